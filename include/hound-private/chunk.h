@@ -0,0 +1,55 @@
+/**
+ * @file      chunk.h
+ * @brief     Pooled, refcounted read buffers, which let records point directly
+ *            into the memory the core read from a driver's fd.
+ * @author    Martin Kelly <mkelly@xevo.com>
+ * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
+ *
+ */
+
+#ifndef HOUND_PRIVATE_CHUNK_H_
+#define HOUND_PRIVATE_CHUNK_H_
+
+#include <hound/hound.h>
+#include <hound-private/refcount.h>
+#include <stdbool.h>
+
+struct chunk_pool;
+
+struct chunk {
+    atomic_refcount_val refcount;
+    struct chunk_pool *pool;
+    struct chunk *next;
+    size_t size;
+    unsigned char data[];
+};
+
+hound_err chunk_pool_alloc(size_t chunk_size, struct chunk_pool **pool);
+
+/*
+ * Drops the owner's reference on the pool. The pool is freed once every chunk
+ * taken from it has been returned.
+ */
+void chunk_pool_release(struct chunk_pool *pool);
+
+/*
+ * Preallocates free chunks until the pool has at least count of them, and lets
+ * it keep that many around from then on.
+ */
+hound_err chunk_pool_fill(struct chunk_pool *pool, size_t count);
+
+/* Returns a chunk with a refcount of 1, or NULL if we ran out of memory. */
+struct chunk *chunk_get(struct chunk_pool *pool);
+
+void chunk_ref(struct chunk *chunk);
+
+/* Drops a reference, returning the chunk to its pool when it reaches 0. */
+void chunk_unref(struct chunk *chunk);
+
+/* Returns true if anyone besides the caller holds a reference. */
+bool chunk_shared(struct chunk *chunk);
+
+/* Returns true if the given pointer lies within the chunk's data. */
+bool chunk_contains(const struct chunk *chunk, const void *p);
+
+#endif /* HOUND_PRIVATE_CHUNK_H_ */
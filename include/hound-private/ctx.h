@@ -24,11 +24,20 @@ hound_err ctx_modify(
 hound_err ctx_free(struct hound_ctx *ctx);
 
 hound_err ctx_start(struct hound_ctx *ctx);
+hound_err ctx_start_async(
+    struct hound_ctx *ctx,
+    size_t workers,
+    size_t max_pending);
 hound_err ctx_stop(struct hound_ctx *ctx);
 
 hound_err ctx_next(struct hound_ctx *ctx, size_t n);
 
-hound_err ctx_read_bytes(struct hound_ctx *ctx, size_t bytes);
+hound_err ctx_read_bytes(
+    struct hound_ctx *ctx,
+    size_t bytes,
+    const hound_data_period *timeout_ns,
+    size_t *records_read,
+    size_t *bytes_read);
 hound_err ctx_read_bytes_nowait(
     struct hound_ctx *ctx,
     size_t bytes,
@@ -40,5 +49,37 @@ hound_err ctx_read_all_nowait(struct hound_ctx *ctx, size_t *read);
 
 hound_err ctx_queue_length(struct hound_ctx *ctx, size_t *count);
 hound_err ctx_max_queue_length(struct hound_ctx *ctx, size_t *count);
+hound_err ctx_queue_bytes(struct hound_ctx *ctx, size_t *bytes);
+hound_err ctx_max_queue_bytes(struct hound_ctx *ctx, size_t *bytes);
+hound_err ctx_get_fd(struct hound_ctx *ctx, size_t watermark, int *fd);
+
+hound_err ctx_set_retention(
+    struct hound_ctx *ctx,
+    size_t max_records,
+    hound_data_period max_age);
+hound_err ctx_query_range(
+    struct hound_ctx *ctx,
+    const struct timespec *start,
+    const struct timespec *end,
+    hound_cb cb,
+    void *cb_ctx,
+    size_t *read);
+
+hound_err ctx_set_join(struct hound_ctx *ctx, const struct hound_join_rq *rq);
+hound_err ctx_join_stats(struct hound_ctx *ctx, struct hound_join_stats *stats);
+hound_err ctx_set_resample(
+    struct hound_ctx *ctx,
+    const struct hound_resample_rq *rq);
+hound_err ctx_resample_stats(
+    struct hound_ctx *ctx,
+    struct hound_resample_stats *stats);
+hound_err ctx_filter_stats(
+    struct hound_ctx *ctx,
+    struct hound_filter_stats *stats);
+
+hound_err ctx_set_spin(
+    struct hound_ctx *ctx,
+    hound_data_period read_spin_ns,
+    hound_data_period io_spin_ns);
 
 #endif /* HOUND_PRIVATE_CTX_H_ */
@@ -0,0 +1,54 @@
+/**
+ * @file      decode.h
+ * @brief     Compiled record decoders header.
+ * @author    Martin Kelly <mkelly@xevo.com>
+ * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
+ *
+ */
+
+#ifndef HOUND_PRIVATE_DECODE_H_
+#define HOUND_PRIVATE_DECODE_H_
+
+#include <hound/hound.h>
+#include <stdbool.h>
+
+/**
+ * Compiles a list of data formats into a decoder, which picks a specialized
+ * extraction loop for each format up-front.
+ */
+hound_err decoder_alloc(
+    size_t fmt_count,
+    const struct hound_data_fmt *fmts,
+    struct hound_decoder **decoder);
+
+void decoder_free(struct hound_decoder *decoder);
+
+hound_err decoder_decode_batch(
+    const struct hound_datadesc *desc,
+    const struct hound_record *records,
+    size_t n,
+    double **columns);
+
+size_t decoder_field_count(const struct hound_decoder *decoder);
+
+/**
+ * Decodes the fields of one record into values, which must have room for every
+ * field. Fields that can't be converted to a double are left alone. Returns
+ * false if the record is too small to hold every field.
+ */
+bool decoder_decode_record(
+    const struct hound_decoder *decoder,
+    const struct hound_record *record,
+    double *values);
+
+/**
+ * Encodes values into the fields of one record, the reverse of
+ * decoder_decode_record. Bools and fields that can't be converted from a double
+ * are left alone. The record must be big enough to hold every field.
+ */
+void decoder_encode_record(
+    const struct hound_decoder *decoder,
+    const double *values,
+    struct hound_record *record);
+
+#endif /* HOUND_PRIVATE_DECODE_H_ */
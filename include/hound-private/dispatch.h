@@ -0,0 +1,48 @@
+/**
+ * @file      dispatch.h
+ * @brief     Asynchronous callback dispatch header.
+ * @author    Martin Kelly <mkelly@xevo.com>
+ * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
+ *
+ */
+
+#ifndef HOUND_PRIVATE_DISPATCH_H_
+#define HOUND_PRIVATE_DISPATCH_H_
+
+#include <hound/hound.h>
+#include <hound-private/queue.h>
+
+struct dispatch;
+
+/**
+ * Starts dispatching records from the given queue to the callback on a pool of
+ * worker threads. Records with the same device ID and data ID always go to the
+ * same worker, so they are delivered in order.
+ *
+ * @param[in] queue the queue to consume
+ * @param[in] workers the number of worker threads
+ * @param[in] max_pending the max number of records waiting for each worker
+ *                        before we stop consuming the queue
+ * @param[in] cb the callback
+ * @param[in] cb_ctx the callback context
+ * @param[out] dispatch filled in with the dispatcher
+ *
+ * @return an error code
+ */
+hound_err dispatch_start(
+    struct queue *queue,
+    size_t workers,
+    size_t max_pending,
+    hound_cb cb,
+    void *cb_ctx,
+    struct dispatch **dispatch);
+
+/**
+ * Interrupts the queue, delivers all records already taken from it, and then
+ * stops and frees the dispatcher. This must not be called from a callback.
+ */
+void dispatch_stop(struct dispatch *dispatch);
+
+void dispatch_set_cb(struct dispatch *dispatch, hound_cb cb, void *cb_ctx);
+
+#endif /* HOUND_PRIVATE_DISPATCH_H_ */
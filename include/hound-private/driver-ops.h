@@ -10,9 +10,10 @@
 #ifndef HOUND_PRIVATE_DRIVER_OPS_H_
 #define HOUND_PRIVATE_DRIVER_OPS_H_
 
+#include <hound-private/chunk.h>
 #include <hound-private/driver.h>
+#include <hound-private/trace.h>
 #include <pthread.h>
-#include <xlib/xvec.h>
 
 /**
  * Gets the active driver.
@@ -33,12 +34,8 @@ void set_active_drv(struct driver *drv);
  */
 void clear_active_drv(void);
 
-struct data {
-    refcount_val refcount;
-    struct hound_data_rq rq;
-};
-
-XVEC_DEFINE(active_data_vec, struct data);
+/* The data requests active on a driver, indexed by data ID. */
+struct active_data;
 
 struct driver {
     pthread_mutex_t state_lock;
@@ -50,11 +47,21 @@ struct driver {
     size_t desc_count;
     struct hound_datadesc *descs;
 
-    active_data_vec active_data;
+    struct active_data *active_data;
 
     int fd;
     struct driver_ops ops;
     void *ctx;
+
+    /*
+     * Where the I/O core reads the driver's fd, protected by op_lock. A
+     * zero-copy driver reads into chunks from read_pool, and read_chunk is the
+     * chunk for the next read; otherwise, it reads into read_buf.
+     */
+    size_t read_size;
+    unsigned char *read_buf;
+    struct chunk_pool *read_pool;
+    struct chunk *read_chunk;
 };
 
 #define TOKENIZE(...) __VA_ARGS__
@@ -68,7 +75,9 @@ struct driver {
         set_active_drv(drv); \
         lock_mutex(&drv->op_lock); \
         XASSERT_NOT_NULL(drv->ops.name); \
+        HOUND_TRACE(drv_op_entry, #name, drv->id); \
         err = drv->ops.name(args); \
+        HOUND_TRACE(drv_op_exit, #name, drv->id, err); \
         unlock_mutex(&drv->op_lock); \
         clear_active_drv(); \
         return err; \
@@ -100,6 +109,14 @@ DEFINE_DRV_OP(setdata,
         size_t rqs_len
     ),
     TOKENIZE(rqs, rqs_len))
+DEFINE_DRV_OP(modifydata,
+    TOKENIZE(
+        const struct hound_data_rq *add,
+        size_t add_len,
+        const struct hound_data_rq *remove,
+        size_t remove_len
+    ),
+    TOKENIZE(add, add_len, remove, remove_len))
 DEFINE_DRV_OP(
     poll,
     TOKENIZE(
@@ -113,8 +130,16 @@ DEFINE_DRV_OP(
     parse,
     TOKENIZE(unsigned char *buf, size_t bytes),
     TOKENIZE(buf, bytes))
+DEFINE_DRV_OP(
+    read_info,
+    TOKENIZE(size_t *size, bool *zero_copy),
+    TOKENIZE(size, zero_copy))
 DEFINE_DRV_OP(start, int *fd, fd)
 DEFINE_DRV_OP(next, hound_data_id id, id)
+DEFINE_DRV_OP(
+    next_batch,
+    TOKENIZE(const hound_data_id *ids, size_t count, size_t n),
+    TOKENIZE(ids, count, n))
 DEFINE_DRV_OP_VOID(stop)
 
 #endif /* HOUND_PRIVATE_DRIVER_OPS_H_ */
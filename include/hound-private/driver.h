@@ -82,6 +82,30 @@ struct driver_ops {
      */
     hound_err (*setdata)(const struct hound_data_rq *rqs, size_t rqs_len);
 
+    /**
+     * Changes the data the driver should generate, given only what changed
+     * since the last call to setdata or modifydata. This is optional; if a
+     * driver implements it, the core calls it instead of setdata whenever the
+     * active data changes while the driver is running, so the driver can leave
+     * unchanged data alone (e.g. not resubscribing to topics it already has).
+     * Before start() is called, the core uses setdata as usual. A data request
+     * (ID and period) is added only if it is not already active and removed
+     * only if it is, and it never appears in both lists. The core may still
+     * call setdata with the full list, such as when recovering from an error.
+     *
+     * @param add a list of data requests to start generating
+     * @param add_len the length of the add list
+     * @param remove a list of data requests to stop generating
+     * @param remove_len the length of the remove list
+     *
+     * @return an error code
+     */
+    hound_err (*modifydata)(
+        const struct hound_data_rq *add,
+        size_t add_len,
+        const struct hound_data_rq *remove,
+        size_t remove_len);
+
     /**
      * Called when the driver's fd is ready to read or write data. A driver must
      * implement either poll or parse, but not both. If it implements poll, then
@@ -122,6 +146,27 @@ struct driver_ops {
      */
     hound_err (*parse)(unsigned char *buf, size_t bytes);
 
+    /**
+     * Describe how the I/O core should read the driver's fd before calling
+     * parse. This is optional; if a driver does not implement it, the core
+     * reads up to a default size and parse must copy any data it keeps. It is
+     * called after start, and again whenever the active data changes while
+     * the driver is running.
+     *
+     * @param size to be filled in with the max number of bytes to read at once.
+     *             This should be a multiple of the driver's unit of data (e.g.
+     *             an IIO scan or a CAN frame), so a read never splits one.
+     * @param zero_copy to be filled in with true if the records the driver
+     *                  produces in parse may point directly into the buffer
+     *                  passed to parse, instead of into memory from drv_alloc.
+     *                  In that case, the buffer stays alive until every record
+     *                  pointing into it is freed, and the core does not free
+     *                  those records' data.
+     *
+     * @return an error code
+     */
+    hound_err (*read_info)(size_t *size, bool *zero_copy);
+
     /**
      * Start the driver producing data.
      *
@@ -141,6 +186,20 @@ struct driver_ops {
      */
     hound_err (*next)(hound_data_id id);
 
+    /**
+     * Ask the driver to generate n values of each of the given IDs. This is
+     * optional; if a driver implements it, the core uses it instead of calling
+     * next() once per value, so the driver can issue all the requests at once
+     * (e.g. in a single syscall).
+     *
+     * @param ids an array of data IDs
+     * @param count the number of IDs in the array
+     * @param n the number of values to generate for each ID
+     *
+     * @return an error code
+     */
+    hound_err (*next_batch)(const hound_data_id *ids, size_t count, size_t n);
+
     /**
      * Stop the driver from producing data and frees resources associated with
      * the driver's open fd.
@@ -220,6 +279,9 @@ bool driver_is_pull_mode(const struct driver *drv);
 bool driver_is_push_mode(const struct driver *drv);
 
 hound_err driver_get_datadescs(struct hound_datadesc **descs, size_t *len);
+
+/* Fills the read pool of every zero-copy driver with count chunks. */
+hound_err driver_fill_pools(size_t count);
 void driver_free_datadescs(struct hound_datadesc *descs);
 
 void driver_register(const char *name, struct driver_ops *ops);
@@ -235,7 +297,11 @@ hound_err driver_init(
 hound_err driver_destroy(const char *path);
 hound_err driver_destroy_all(void);
 
-hound_err driver_next(struct driver *drv, hound_data_id id, size_t n);
+hound_err driver_next(
+    struct driver *drv,
+    const hound_data_id *ids,
+    size_t count,
+    size_t n);
 
 /*
  * Take a reference on this driver, causing the driver to start if it's the
@@ -259,7 +325,9 @@ hound_err driver_unref(
 
 /*
  * Modifies the given driver to use the new request list instead of the old one.
- * Does not change the driver refcount.
+ * Only the requests that differ between the lists are passed on to the driver,
+ * and nothing happens if the lists hold the same requests. Does not change the
+ * driver refcount.
  */
 hound_err driver_modify(
     struct driver *drv,
@@ -272,6 +340,14 @@ hound_err driver_modify(
 
 hound_err driver_get(hound_data_id id, struct driver **drv);
 
+/*
+ * Makes a decoder for the given data that belongs to the caller, so it outlives
+ * the driver. Free it with decoder_free.
+ */
+hound_err driver_alloc_decoder(
+    hound_data_id id,
+    struct hound_decoder **decoder);
+
 bool driver_period_supported(
     struct driver *drv,
     hound_data_id id,
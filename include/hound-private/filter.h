@@ -0,0 +1,53 @@
+/**
+ * @file      filter.h
+ * @brief     Per-request record filters header.
+ * @author    Martin Kelly <mkelly@xevo.com>
+ * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
+ *
+ */
+
+#ifndef HOUND_PRIVATE_FILTER_H_
+#define HOUND_PRIVATE_FILTER_H_
+
+#include <hound/hound.h>
+#include <stdbool.h>
+
+struct filter;
+
+/* Returns true if the request enables any filter. */
+bool filter_rq_enabled(const struct hound_data_rq *rq);
+
+/* Returns true if the request's filter settings are sane. */
+bool filter_rq_valid(const struct hound_data_rq *rq);
+
+/* Orders requests by their filter settings only. */
+int filter_rq_compare(
+    const struct hound_data_rq *a,
+    const struct hound_data_rq *b);
+
+/**
+ * Makes a filter for a request. desc describes the request's data, and may be
+ * NULL if the data has no descriptor, in which case deadbands have no effect.
+ * The filter starts with one reference.
+ */
+hound_err filter_alloc(
+    const struct hound_data_rq *rq,
+    const struct hound_datadesc *desc,
+    struct filter **filter);
+void filter_ref(struct filter *filter);
+void filter_unref(struct filter *filter);
+
+/* Returns true if the filter was made from a request with these settings. */
+bool filter_matches(
+    const struct filter *filter,
+    const struct hound_data_rq *rq);
+
+/**
+ * Decides whether a record passes the filter, and if so, remembers it as the
+ * last record passed. Calls for the same filter must be serialized; the I/O
+ * core does this by calling it only while holding the op lock of the driver
+ * producing the record.
+ */
+bool filter_pass(struct filter *filter, const struct hound_record *record);
+
+#endif /* HOUND_PRIVATE_FILTER_H_ */
@@ -0,0 +1,51 @@
+/**
+ * @file      history.h
+ * @brief     Retained record history header.
+ * @author    Martin Kelly <mkelly@xevo.com>
+ * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
+ *
+ */
+
+#ifndef HOUND_PRIVATE_HISTORY_H_
+#define HOUND_PRIVATE_HISTORY_H_
+
+#include <hound/hound.h>
+
+/* Forward declarations to avoid circular inclusion with queue.h. */
+struct history;
+struct record_info;
+
+hound_err history_alloc(
+    size_t max_len,
+    hound_data_period max_age,
+    struct history **history);
+
+/*
+ * The history is refcounted so that a query can keep running without the
+ * queue lock while the history is being removed from its queue.
+ */
+void history_ref(struct history *history);
+void history_unref(struct history *history);
+
+hound_err history_set_limits(
+    struct history *history,
+    size_t max_len,
+    hound_data_period max_age);
+
+/**
+ * Adds a record to the history, taking a new reference on it. The sequence
+ * number is the one the record has in the live queue.
+ */
+void history_push(
+    struct history *history,
+    struct record_info *rec,
+    hound_seqno seqno);
+
+size_t history_query(
+    struct history *history,
+    const struct timespec *start,
+    const struct timespec *end,
+    hound_cb cb,
+    void *cb_ctx);
+
+#endif /* HOUND_PRIVATE_HISTORY_H_ */
@@ -17,9 +17,22 @@
 /* Forward declaration. */
 struct driver;
 
+/*
+ * A request for the poll thread to spin before sleeping. The owner embeds this
+ * and keeps it alive while it's added; the poll thread uses the largest budget
+ * of all added requests.
+ */
+struct io_spin {
+    hound_data_period ns;
+    struct io_spin *next;
+};
+
 void io_init(void);
 void io_destroy(void);
 
+void io_add_spin(struct io_spin *spin);
+void io_remove_spin(struct io_spin *spin);
+
 hound_err io_add_fd(
     int fd,
     struct driver *drv,
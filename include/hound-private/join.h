@@ -0,0 +1,42 @@
+/**
+ * @file      join.h
+ * @brief     Time-aligned join stage header.
+ * @author    Martin Kelly <mkelly@xevo.com>
+ * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
+ *
+ */
+
+#ifndef HOUND_PRIVATE_JOIN_H_
+#define HOUND_PRIVATE_JOIN_H_
+
+#include <hound/hound.h>
+#include <stdbool.h>
+
+/* Forward declarations to avoid circular inclusion with queue.h. */
+struct join;
+struct record_info;
+
+/**
+ * Called for each combined record the join stage produces. The callee takes
+ * ownership of the record's reference.
+ */
+typedef void (*join_emit_cb)(struct record_info *rec, void *data);
+
+hound_err join_alloc(const struct hound_join_rq *rq, struct join **join);
+void join_destroy(struct join *join);
+
+/**
+ * Feeds a record into the join stage. If the record's data ID is part of the
+ * join, the join stage takes ownership of the record's reference and true is
+ * returned. Otherwise, the record is left alone and false is returned.
+ */
+bool join_push(
+    struct join *join,
+    struct record_info *rec,
+    join_emit_cb emit,
+    void *data);
+
+void join_reset(struct join *join);
+void join_get_stats(const struct join *join, struct hound_join_stats *stats);
+
+#endif /* HOUND_PRIVATE_JOIN_H_ */
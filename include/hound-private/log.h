@@ -10,6 +10,9 @@
 #ifndef HOUND_PRIVATE_LOG_H_
 #define HOUND_PRIVATE_LOG_H_
 
+#include <hound-private/util.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <xlib/xlog.h>
 
 #define hound_log(pri, fmt, ...) xlog(pri, fmt, __VA_ARGS__)
@@ -26,4 +29,58 @@
 #define hound_log_err_nofmt(err, msg) \
     hound_log(XLOG_ERR, msg ", err: %d (%s)", err, hound_strerror(err))
 
+/**
+ * Rate-limiting state for a single logging call site. The hound_log_limited
+ * macros declare one of these per call site, so this should not be used
+ * directly.
+ */
+struct log_site {
+    atomic_uint_fast64_t window_start;
+    atomic_uint_fast32_t count;
+    atomic_uint_fast32_t suppressed;
+};
+
+void log_init(void);
+void log_destroy(void);
+
+/** Receives each message from the rate-limited log path, fully formatted. */
+typedef void (*log_sink)(int pri, const char *msg);
+
+/**
+ * Sends messages from the rate-limited log path to the given sink instead of
+ * the regular log, so that tests can check what gets through. NULL restores
+ * the regular log.
+ */
+PUBLIC_API
+void log_set_sink(log_sink sink);
+
+/**
+ * Logs a message from a hot path. The message is handed to a background
+ * thread rather than written out directly, and each call site may log only a
+ * few messages per second; the rest are counted and reported with the next
+ * message that gets through. If the log ring is full, the message is dropped.
+ */
+PUBLIC_API
+__attribute__((format(printf, 3, 4)))
+void log_ratelimited(struct log_site *site, int pri, const char *fmt, ...);
+
+#define hound_log_limited(pri, fmt, ...) \
+    do { \
+        static struct log_site hound_log_site_; \
+        log_ratelimited(&hound_log_site_, pri, fmt, __VA_ARGS__); \
+    } while (0)
+
+#define hound_log_limited_nofmt(pri, msg) hound_log_limited(pri, "%s", msg)
+
+#define hound_log_err_limited(err, fmt, ...) \
+    hound_log_limited( \
+        XLOG_ERR, \
+        fmt ", err: %d (%s)", \
+        __VA_ARGS__, \
+        err, \
+        hound_strerror(err))
+
+#define hound_log_err_limited_nofmt(err, msg) \
+    hound_log_limited(XLOG_ERR, msg ", err: %d (%s)", err, hound_strerror(err))
+
 #endif /* HOUND_PRIVATE_LOG_H_ */
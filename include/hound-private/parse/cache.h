@@ -0,0 +1,49 @@
+/**
+ * @file      cache.h
+ * @brief     Header for the precompiled config and schema cache.
+ * @author    Martin Kelly <mkelly@xevo.com>
+ * @copyright Copyright (C) 2020 Xevo Inc. All Rights Reserved.
+ */
+
+#ifndef HOUND_PRIVATE_PARSE_CACHE_H_
+#define HOUND_PRIVATE_PARSE_CACHE_H_
+
+#include <hound/hound.h>
+#include <hound-private/parse/config.h>
+#include <sys/stat.h>
+
+struct config_cache;
+
+/**
+ * Loads a precompiled config, if a cache file exists for the given config and
+ * schema base and none of its sources have changed since it was written. On
+ * success, the schemas used by the config are added to the schema cache, and
+ * the returned init list points into the cache, so the cache must stay loaded
+ * until the init list is no longer used.
+ *
+ * @return HOUND_OK on success, or an error if the cache is missing, stale or
+ *         unusable, in which case the caller should parse the config as usual
+ */
+hound_err cache_load_config(
+    const char *config_path,
+    const char *schema_base,
+    struct config_cache **cache,
+    size_t *init_count,
+    struct driver_init **init_list);
+
+void cache_unload_config(struct config_cache *cache);
+
+/**
+ * Writes a precompiled cache file for a config that was just successfully
+ * parsed and registered, including all the schemas that it references.
+ *
+ * @param[in] config_st the status of the config file, as of when it was parsed
+ */
+hound_err cache_store_config(
+    const char *config_path,
+    const struct stat *config_st,
+    const char *schema_base,
+    size_t init_count,
+    const struct driver_init *init_list);
+
+#endif /* HOUND_PRIVATE_PARSE_CACHE_H_ */
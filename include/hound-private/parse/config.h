@@ -11,6 +11,16 @@
 
 #include <hound/hound.h>
 
+struct driver_init {
+    const char *name;
+    const char *path;
+    const char *schema;
+    size_t arg_count;
+    struct hound_init_arg *args;
+};
+
+void destroy_init_list(size_t init_count, struct driver_init *init_list);
+
 hound_err parse_config(const char *config_path, const char *schema_base);
 
 #endif /* HOUND_PRIVATE_PARSE_CONFIG_H_ */
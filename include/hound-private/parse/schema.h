@@ -10,10 +10,23 @@
 #define HOUND_PRIVATE_PARSE_SCHEMA_H_
 
 #include <hound/hound.h>
+#include <hound-private/driver.h>
+#include <sys/stat.h>
 
 void schema_init(void);
 void schema_destroy(void);
 
+/**
+ * Adds a copy of the given parsed schema to the schema cache, so that later
+ * calls to schema_parse for the same unchanged file don't have to parse it
+ * again.
+ */
+hound_err schema_cache_put(
+    const char *path,
+    const struct stat *st,
+    size_t desc_count,
+    const struct schema_desc *descs);
+
 hound_err copy_schema_desc(
     const struct schema_desc *src,
     struct schema_desc *schema);
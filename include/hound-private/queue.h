@@ -16,58 +16,175 @@
 struct queue;
 
 #include <hound/hound.h>
+#include <hound-private/chunk.h>
 #include <hound-private/driver.h>
+#include <hound-private/join.h>
 #include <hound-private/refcount.h>
+#include <hound-private/resample.h>
 
 struct record_info {
     atomic_refcount_val refcount;
     struct hound_record record;
+
+    /*
+     * The pooled read buffer that record.data points into, or NULL if
+     * record.data was allocated separately.
+     */
+    struct chunk *chunk;
 };
 
 void record_ref_dec(struct record_info *info);
 
+/*
+ * A max_bytes of 0 means no byte limit. A record's size counts its payload plus
+ * its header.
+ */
 hound_err queue_alloc(
     struct queue **queue,
-    size_t max_len);
-hound_err queue_resize(struct queue *queue, size_t max_len, bool flush);
+    size_t max_len,
+    size_t max_bytes);
+hound_err queue_resize(
+    struct queue *queue,
+    size_t max_len,
+    size_t max_bytes,
+    bool flush);
+
+/*
+ * Per-data ID overflow policies and lanes, set up from a context's data
+ * requests. Installing a policy is split into an allocation step that can fail
+ * and an install step that can't, so the caller can do the failure-prone
+ * parts of a context change first. The caller must prevent the queue from
+ * being resized between the two steps.
+ */
+struct queue_policy;
+hound_err queue_policy_alloc(
+    struct queue *queue,
+    const struct hound_data_rq_list *rq_list,
+    struct queue_policy **policy);
+void queue_policy_free(struct queue_policy *policy);
+/* Installs a policy, taking ownership of it and freeing the old one. */
+void queue_set_policy(struct queue *queue, struct queue_policy *policy);
 
 void queue_destroy(struct queue *queue);
 
 void queue_interrupt(struct queue *queue);
 
+/* Counts a record of filtered data that the filter passed or dropped. */
+void queue_count_filtered(struct queue *queue, bool passed);
+void queue_filter_stats(struct queue *queue, struct hound_filter_stats *stats);
+
+/*
+ * Sets how long blocking record pops spin waiting for records before they
+ * sleep, or 0 to always sleep right away.
+ */
+void queue_set_spin(struct queue *queue, hound_data_period spin_ns);
+
+/*
+ * Enables or disables HOUND_OVERFLOW_BLOCK. While disabled, it acts like
+ * HOUND_OVERFLOW_DROP_NEWEST, and any blocked producers are released. This
+ * lets the driver I/O paths make progress while a context is changing.
+ */
+void queue_set_blocking(struct queue *queue, bool enable);
+
 void queue_push(
     struct queue *queue,
     struct record_info *rec);
 
+/*
+ * Attaches a join stage to the queue, replacing and destroying any existing one.
+ * The queue takes ownership of the join stage. Pass NULL to remove the join
+ * stage.
+ */
+void queue_set_join(struct queue *queue, struct join *join);
+void queue_join_stats(struct queue *queue, struct hound_join_stats *stats);
+
+/*
+ * Attaches a resampling stage to the queue, replacing and destroying any
+ * existing one. The queue takes ownership of the resampling stage. Records go
+ * through the resampling stage before the join stage. Pass NULL to remove the
+ * resampling stage.
+ */
+void queue_set_resample(struct queue *queue, struct resample *resample);
+void queue_resample_stats(
+    struct queue *queue,
+    struct hound_resample_stats *stats);
+
+/*
+ * Sets how many records (and, if max_age is not 0, how old of records) the queue
+ * retains for range queries. A max_len of 0 turns off retention.
+ */
+hound_err queue_set_retention(
+    struct queue *queue,
+    size_t max_len,
+    hound_data_period max_age);
+hound_err queue_query_range(
+    struct queue *queue,
+    const struct timespec *start,
+    const struct timespec *end,
+    hound_cb cb,
+    void *cb_ctx,
+    size_t *count);
+
 size_t queue_pop_records(
     struct queue *queue,
     struct record_info **buf,
     size_t records,
-    hound_seqno *first_seqno,
+    hound_seqno *seqnos,
     bool *interrupt);
 
+/*
+ * Pops records in order, up to the given number of bytes, blocking until enough
+ * bytes are queued. Returns the number of bytes popped. Stops early, with
+ * HOUND_OK, if the buffer fills up or the next record would go over the byte
+ * count. Stops early with HOUND_CTX_STOPPED if the queue is interrupted, or
+ * with HOUND_TIMEOUT if the deadline (in CLOCK_MONOTONIC) passes first. A NULL
+ * deadline means no timeout.
+ */
+size_t queue_pop_bytes(
+    struct queue *queue,
+    struct record_info **buf,
+    size_t buf_len,
+    size_t bytes,
+    const struct timespec *deadline,
+    hound_seqno *seqnos,
+    size_t *records,
+    hound_err *err);
+
 size_t queue_pop_bytes_nowait(
     struct queue *queue,
     struct record_info **buf,
+    size_t buf_len,
     size_t bytes,
-    hound_seqno *first_seqno,
+    hound_seqno *seqnos,
     size_t *records);
 
 size_t queue_pop_records_nowait(
     struct queue *queue,
     struct record_info **buf,
-    hound_seqno *first_seqno,
+    hound_seqno *seqnos,
     size_t records);
 
 size_t queue_pop_nolock(
     struct queue *queue,
     struct record_info **buf,
-    hound_seqno *first_seqno,
+    hound_seqno *seqnos,
     size_t n);
 
 void queue_drain(struct queue *queue);
 
 size_t queue_len(struct queue *queue);
+/* Includes the space reserved for lanes. */
 size_t queue_max_len(struct queue *queue);
+/* Excludes the space reserved for lanes, as set by queue_alloc/queue_resize. */
+size_t queue_shared_max_len(struct queue *queue);
+size_t queue_bytes(struct queue *queue);
+size_t queue_max_bytes(struct queue *queue);
+
+/*
+ * Returns an eventfd that is readable while the queue holds at least watermark
+ * records, or is full. The fd is created on first use, and the queue owns it.
+ * Calling this again changes the watermark and returns the same fd.
+ */
+hound_err queue_get_fd(struct queue *queue, size_t watermark, int *fd);
 
 #endif /* HOUND_PRIVATE_QUEUE_H_ */
@@ -0,0 +1,46 @@
+/**
+ * @file      resample.h
+ * @brief     Fixed-timeline resampling stage header.
+ * @author    Martin Kelly <mkelly@xevo.com>
+ * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
+ *
+ */
+
+#ifndef HOUND_PRIVATE_RESAMPLE_H_
+#define HOUND_PRIVATE_RESAMPLE_H_
+
+#include <hound/hound.h>
+#include <stdbool.h>
+
+/* Forward declarations to avoid circular inclusion with queue.h. */
+struct resample;
+struct record_info;
+
+/**
+ * Called for each record the resampling stage produces. The callee takes
+ * ownership of the record's reference.
+ */
+typedef void (*resample_emit_cb)(struct record_info *rec, void *data);
+
+hound_err resample_alloc(
+    const struct hound_resample_rq *rq,
+    struct resample **resample);
+void resample_destroy(struct resample *resample);
+
+/**
+ * Feeds a record into the resampling stage. If the record's data ID is being
+ * resampled, the resampling stage takes ownership of the record's reference and
+ * true is returned. Otherwise, the record is left alone and false is returned.
+ */
+bool resample_push(
+    struct resample *resample,
+    struct record_info *rec,
+    resample_emit_cb emit,
+    void *data);
+
+void resample_reset(struct resample *resample);
+void resample_get_stats(
+    const struct resample *resample,
+    struct hound_resample_stats *stats);
+
+#endif /* HOUND_PRIVATE_RESAMPLE_H_ */
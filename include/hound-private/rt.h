@@ -0,0 +1,39 @@
+/**
+ * @file      rt.h
+ * @brief     Real-time settings for hound's threads and memory.
+ * @author    Martin Kelly <mkelly@xevo.com>
+ * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
+ *
+ */
+
+#ifndef HOUND_PRIVATE_RT_H_
+#define HOUND_PRIVATE_RT_H_
+
+#include <hound/hound.h>
+#include <pthread.h>
+
+/*
+ * A thread that follows the real-time settings. The owner embeds this and keeps
+ * it alive while the thread is registered, so registering never allocates.
+ */
+struct rt_thread {
+    pthread_t thread;
+    struct rt_thread *next;
+};
+
+void rt_init(void);
+void rt_destroy(void);
+
+hound_err rt_set(const struct hound_rt_rq *rq, struct hound_rt_status *status);
+
+/*
+ * Registers a running thread, applying the current settings to it. The thread
+ * must be unregistered before it is joined.
+ */
+void rt_add_thread(struct rt_thread *t, pthread_t thread);
+void rt_remove_thread(struct rt_thread *t);
+
+/* The number of chunks a new read pool should be filled with. */
+size_t rt_pool_chunks(void);
+
+#endif /* HOUND_PRIVATE_RT_H_ */
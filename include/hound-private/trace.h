@@ -0,0 +1,44 @@
+/**
+ * @file      trace.h
+ * @brief     Static tracepoints (USDT probes) for the record lifecycle, usable
+ *            from perf, bpftrace, systemtap, etc. Probes are compiled in only
+ *            when the "tracing" meson option is enabled; otherwise, they expand
+ *            to nothing and their arguments are not evaluated.
+ *
+ *            All probes use the "hound" provider:
+ *            - poll_wakeup(fds, ns_since_last_wakeup)
+ *            - drv_op_entry(op_name, dev_id)
+ *            - drv_op_exit(op_name, dev_id, err)
+ *            - record_push(data_id, dev_id, size)
+ *            - queue_push(data_id, dev_id, seqno, size, queue_len)
+ *            - queue_block(data_id, dev_id, queue_len)
+ *            - queue_overflow(data_id, dev_id, seqno, size, policy)
+ *            - queue_pop(data_id, dev_id, seqno, size)
+ *            - callback_entry(data_id, dev_id, seqno, size)
+ *            - callback_exit(data_id, dev_id, seqno, size)
+ * @author    Martin Kelly <mkelly@xevo.com>
+ * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
+ */
+
+#ifndef HOUND_PRIVATE_TRACE_H_
+#define HOUND_PRIVATE_TRACE_H_
+
+#include "config.h"
+
+#ifdef CONFIG_HOUND_TRACE
+#include <sys/sdt.h>
+#define HOUND_TRACE(...) STAP_PROBEV(hound, __VA_ARGS__)
+#else
+#define HOUND_TRACE(...) do { } while (0)
+#endif
+
+/* Traces a callback invocation for the given record. */
+#define HOUND_TRACE_CB(name, rec, seqno) \
+    HOUND_TRACE( \
+        name, \
+        (rec)->data_id, \
+        (rec)->dev_id, \
+        seqno, \
+        (rec)->size)
+
+#endif /* HOUND_PRIVATE_TRACE_H_ */
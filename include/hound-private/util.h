@@ -38,6 +38,12 @@ hound_err norm_path(const char *base, const char *path, size_t len, char *out);
 
 void destroy_rq_list(struct hound_data_rq_list *rq_list);
 
+/* Returns CLOCK_MONOTONIC in nanoseconds. */
+hound_data_period monotonic_ns(void);
+
+/* Tells the CPU we're in a spin loop, so it can save power and yield to SMT. */
+void cpu_relax(void);
+
 /* pthreads helper functions. */
 void init_mutex(pthread_mutex_t *mutex);
 void destroy_mutex(pthread_mutex_t *mutex);
@@ -49,6 +55,20 @@ void init_cond(pthread_cond_t *cond);
 void destroy_cond(pthread_cond_t *cond);
 
 void cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex);
+/*
+ * Fills in a deadline for cond_timedwait, timeout_ns from now. Deadlines too
+ * far out to represent saturate.
+ */
+void get_deadline(hound_data_period timeout_ns, struct timespec *deadline);
+/*
+ * Returns false if the deadline (in CLOCK_MONOTONIC) passed. The condition must
+ * have been set up with init_cond.
+ */
+bool cond_timedwait(
+    pthread_cond_t *cond,
+    pthread_mutex_t *mutex,
+    const struct timespec *deadline);
 void cond_signal(pthread_cond_t *cond);
+void cond_broadcast(pthread_cond_t *cond);
 
 #endif /* HOUND_PRIVATE_UTIL_H_ */
@@ -49,7 +49,11 @@ typedef enum {
     HOUND_DRIVER_ALREADY_PRESENT = -25,
     HOUND_CTX_STOPPED = -26,
     HOUND_NO_DESCS_ENABLED = -27,
-    HOUND_PATH_TOO_LONG = -28
+    HOUND_PATH_TOO_LONG = -28,
+    HOUND_RETENTION_DISABLED = -29,
+    HOUND_CTX_ASYNC = -30,
+    HOUND_TIMEOUT = -31,
+    HOUND_RT_UNAVAILABLE = -32
 } hound_err;
 
 /**
@@ -85,6 +89,9 @@ typedef uint_least32_t hound_record_size;
 /** max number of data IDs requested per context. */
 #define HOUND_MAX_DATA_REQ 1000
 
+/** max block_timeout_ns for HOUND_OVERFLOW_BLOCK (100 ms). */
+#define HOUND_MAX_BLOCK_TIMEOUT_NS ((hound_data_period) 100000000)
+
 struct hound_record {
     /** an ID uniquely describing a datatype. */
     hound_data_id data_id;
@@ -181,6 +188,9 @@ struct hound_data_fmt {
     hound_type type;
 };
 
+/** Opaque pointer to a decoder compiled from a descriptor's data formats. */
+struct hound_decoder;
+
 struct hound_datadesc {
     /** an ID uniquely describing a datatype */
     hound_data_id data_id;
@@ -202,14 +212,106 @@ struct hound_datadesc {
 
     /** an array of data formats */
     struct hound_data_fmt *fmts;
+
+    /** a decoder for records of this data, for use with hound_decode_batch */
+    const struct hound_decoder *decoder;
 };
 
+/**
+ * Policies for what happens when a record arrives and there is no room for it
+ * in the context queue.
+ */
+typedef enum {
+    /** Evict the oldest record to make room for the new one. */
+    HOUND_OVERFLOW_DROP_OLDEST = 0,
+
+    /** Drop the new record, keeping the records already queued. */
+    HOUND_OVERFLOW_DROP_NEWEST = 1,
+
+    /**
+     * Block the producer until a reader makes room, or until the request's
+     * block_timeout_ns expires, in which case the new record is dropped. While
+     * the context is stopped or being modified, this acts like
+     * HOUND_OVERFLOW_DROP_NEWEST.
+     *
+     * Note that all data is delivered by a single I/O thread, so blocking holds
+     * up all data from all drivers to every context, not just this one. It also
+     * holds up anything that needs the I/O thread, such as starting, stopping
+     * or modifying any other context. This is why block_timeout_ns is capped at
+     * HOUND_MAX_BLOCK_TIMEOUT_NS.
+     */
+    HOUND_OVERFLOW_BLOCK = 2
+} hound_overflow_policy;
+
+/**
+ * A request for one data ID. Zero-initialize this (e.g. with memset or a
+ * designated initializer) before filling it in, so that any field you don't
+ * set, including fields added in later versions, gets its default.
+ */
 struct hound_data_rq {
     /** a data ID to be requested */
     hound_data_id id;
 
     /** the period (in nanoseconds) to generate this data */
     hound_data_period period_ns;
+
+    /**
+     * What to do when there is no room in the queue for this data. The default
+     * (0) is HOUND_OVERFLOW_DROP_OLDEST.
+     */
+    hound_overflow_policy overflow;
+
+    /**
+     * For HOUND_OVERFLOW_BLOCK, the max time (in nanoseconds) to block the
+     * producer before dropping a record. Must not exceed
+     * HOUND_MAX_BLOCK_TIMEOUT_NS.
+     */
+    hound_data_period block_timeout_ns;
+
+    /**
+     * If not 0, this data gets its own lane in the context queue, holding up
+     * to this many records. Records in a lane never evict, and are never
+     * evicted by, other data. If 0, the data shares the queue_len records of
+     * the main queue with all other data that has no lane.
+     *
+     * Either way, records are read back in the order they were queued.
+     *
+     * If a data ID is requested more than once in a context, all of its
+     * requests must specify the same overflow, block_timeout_ns, lane_len, and
+     * filter settings (change_only, deadband_abs, deadband_rel and
+     * min_interval_ns).
+     */
+    size_t lane_len;
+
+    /*
+     * Filters, which drop records of this data before they reach the queue, so
+     * that data which rarely changes costs little. A record is queued only if
+     * it passes every filter that is enabled, and each filter compares against
+     * the last record of this data that was queued. The first record always
+     * passes. Filtering is done once per context, so it doesn't matter which
+     * period a record was generated for.
+     */
+
+    /** If true, drop records whose data is identical to the last one queued. */
+    bool change_only;
+
+    /**
+     * Deadbands for the numeric fields of this data, as described by its data
+     * formats. If either is not 0, a record is queued only if one of its
+     * numeric fields differs from the same field of the last record queued by
+     * more than the larger of deadband_abs and deadband_rel times the absolute
+     * value of the last value. NaN always counts as a change. Fields that are
+     * not numeric are ignored, so they alone never let a record through. Both
+     * must be finite and not negative.
+     */
+    double deadband_abs;
+    double deadband_rel;
+
+    /**
+     * If not 0, drop records whose driver timestamp is less than this many
+     * nanoseconds after that of the last record queued.
+     */
+    hound_data_period min_interval_ns;
 };
 
 struct hound_data_rq_list {
@@ -220,13 +322,28 @@ struct hound_data_rq_list {
     struct hound_data_rq *data;
 };
 
+/**
+ * A context request. As with struct hound_data_rq, zero-initialize this before
+ * filling it in.
+ */
 struct hound_rq {
     /**
      * The number of records in the circular buffer hound uses to queue up data
-     * after it's generated and before it's consumed.
+     * after it's generated and before it's consumed. Data requested with a
+     * lane_len has its own space in addition to this.
      */
     size_t queue_len;
 
+    /**
+     * If not 0, the max number of bytes the queue may hold, including lanes.
+     * Each record counts as sizeof(struct hound_record) plus its payload size.
+     * When a new record doesn't fit, its overflow policy applies, just as when
+     * its lane is full, except that records are only evicted from the new
+     * record's own lane; if that can't make enough room, the new record is
+     * dropped. If 0, only queue_len limits the queue.
+     */
+    size_t queue_bytes;
+
     /**
      * A callback function, which will be called by hound_read and friends for
      * each record to be read from the context's queue.
@@ -243,6 +360,177 @@ struct hound_rq {
     struct hound_data_rq_list rq_list;
 };
 
+/**
+ * Policies for choosing which sample of a join member gets combined with a
+ * given anchor sample.
+ */
+typedef enum {
+    /**
+     * Use the member sample whose timestamp is closest to the anchor sample,
+     * waiting for a later member sample if needed to decide.
+     */
+    HOUND_JOIN_NEAREST = 0,
+
+    /**
+     * Use the most recent member sample at or before the anchor sample
+     * (last-value-carried-forward). Combined records are emitted as soon as
+     * the anchor sample arrives.
+     */
+    HOUND_JOIN_LAST_VALUE = 1
+} hound_join_policy;
+
+struct hound_join_rq {
+    /**
+     * The data ID given to combined records. It must not be the ID of any data
+     * provided by a driver, including the joined data IDs.
+     */
+    hound_data_id out_id;
+
+    /** how to pick member samples for each anchor sample. */
+    hound_join_policy policy;
+
+    /**
+     * The max difference (in nanoseconds) between the anchor timestamp and a
+     * member timestamp for the member sample to be used.
+     */
+    hound_data_period tolerance_ns;
+
+    /** the max number of samples buffered per member data ID. */
+    size_t buffer_len;
+
+    /** the number of data IDs in the ids array. */
+    size_t len;
+
+    /**
+     * The data IDs to join. The first ID is the anchor: one combined record is
+     * produced for each anchor sample that has a match for every other ID.
+     */
+    hound_data_id *ids;
+};
+
+struct hound_join_stats {
+    /** the number of combined records emitted into the queue. */
+    uint_least64_t emitted;
+
+    /** the number of anchor samples dropped because a member had no match. */
+    uint_least64_t unmatched_ticks;
+
+    /**
+     * The number of member samples discarded without being part of any
+     * combined record.
+     */
+    uint_least64_t unmatched_samples;
+};
+
+/**
+ * Policies for computing the value of a resampled record at a tick that falls
+ * between two samples.
+ */
+typedef enum {
+    /**
+     * Interpolate each numeric field linearly between the samples before and
+     * after the tick. Fields that aren't numeric, including bools, take the
+     * value of the sample before the tick.
+     */
+    HOUND_RESAMPLE_LINEAR = 0,
+
+    /** Use the sample before the tick as-is (zero-order hold). */
+    HOUND_RESAMPLE_HOLD = 1
+} hound_resample_policy;
+
+struct hound_resample_rq {
+    /**
+     * The spacing (in nanoseconds) of the output timeline. Ticks fall on exact
+     * multiples of the period, counted from the epoch of the record
+     * timestamps.
+     */
+    hound_data_period period_ns;
+
+    /** how to compute values between samples. */
+    hound_resample_policy policy;
+
+    /**
+     * The max time (in nanoseconds) between two samples for the ticks between
+     * them to be filled in. Ticks inside a longer gap are skipped rather than
+     * made up. Must be at least period_ns.
+     */
+    hound_data_period max_gap_ns;
+
+    /** the number of data IDs in the ids array. */
+    size_t len;
+
+    /** the data IDs to resample, each onto its own copy of the timeline. */
+    hound_data_id *ids;
+};
+
+struct hound_resample_stats {
+    /** the number of resampled records emitted. */
+    uint_least64_t emitted;
+
+    /** the number of ticks skipped because they fell inside a gap. */
+    uint_least64_t skipped_ticks;
+
+    /**
+     * The number of samples discarded because they were no newer than the
+     * sample before them.
+     */
+    uint_least64_t late_samples;
+};
+
+struct hound_filter_stats {
+    /** the number of records that passed the filters and were queued. */
+    uint_least64_t passed;
+
+    /** the number of records the filters dropped. */
+    uint_least64_t suppressed;
+};
+
+struct hound_rt_rq {
+    /**
+     * The SCHED_FIFO priority for hound's I/O and callback dispatch threads, or
+     * 0 to run them under the default scheduler.
+     */
+    int priority;
+
+    /**
+     * The number of CPUs in the cpus array, or 0 to let the threads run on any
+     * CPU the process could when hound was loaded.
+     */
+    size_t cpu_count;
+
+    /** the CPUs the threads may run on */
+    const int *cpus;
+
+    /**
+     * If true, lock all of the process's current and future memory into RAM,
+     * and stop malloc from returning freed memory to the kernel, so that hound
+     * doesn't take page faults on memory it reuses. Because this is
+     * process-wide, it affects the application too.
+     */
+    bool lock_memory;
+
+    /**
+     * The number of read chunks to preallocate for each zero-copy driver, so
+     * the I/O thread doesn't have to allocate them while data is flowing.
+     */
+    size_t pool_chunks;
+};
+
+/** Which parts of a struct hound_rt_rq took effect. */
+struct hound_rt_status {
+    /** true if every hound thread got the requested scheduling policy. */
+    bool sched;
+
+    /** true if every hound thread got the requested CPU affinity. */
+    bool affinity;
+
+    /** true if memory is locked as requested. */
+    bool memory;
+
+    /** true if every read pool was filled as requested. */
+    bool pools;
+};
+
 struct hound_init_arg {
     /**
      * The type for this init argument, used to figure out which union element
@@ -282,6 +570,28 @@ hound_err hound_get_datadescs(struct hound_datadesc **descs, size_t *len);
  */
 void hound_free_datadescs(struct hound_datadesc *descs);
 
+/**
+ * Decodes a batch of records into columns of doubles, one column per data
+ * format in the descriptor. Column i receives format i of every record, in
+ * order, converted from the format's type; bools become 0 or 1. This is much
+ * faster than walking the data formats for each record.
+ *
+ * @param[in] desc the descriptor for the records, as returned by
+ *                 hound_get_datadescs
+ * @param[in] records an array of records, all with the descriptor's data ID
+ * @param[in] n the number of records
+ * @param[out] columns an array of desc->fmt_count pointers, each to an array of
+ *                     at least n doubles. A NULL column skips that format.
+ *                     Columns for HOUND_TYPE_BYTES formats must be NULL.
+ *
+ * @return an error code
+ */
+hound_err hound_decode_batch(
+    const struct hound_datadesc *desc,
+    const struct hound_record *records,
+    size_t n,
+    double **columns);
+
 /* Devices. */
 
 /** Opaque pointer to an I/O context. */
@@ -343,6 +653,32 @@ hound_err hound_free_ctx(struct hound_ctx *ctx);
  */
 hound_err hound_start(struct hound_ctx *ctx);
 
+/**
+ * Starts the context and delivers its data asynchronously: rather than waiting
+ * for the caller to read, a pool of worker threads consumes the queue and runs
+ * the context callback as records arrive. Records with the same device ID and
+ * data ID are always delivered in order from the same worker, but records for
+ * different data may be delivered concurrently, so the callback must be
+ * thread-safe.
+ *
+ * While a context is asynchronous, the read functions fail with
+ * HOUND_CTX_ASYNC. hound_query_range still works. Calling hound_stop waits for
+ * all callbacks in flight to finish, so it must not be called from within the
+ * callback.
+ *
+ * @param[in] ctx a context
+ * @param[in] workers the number of worker threads
+ * @param[in] max_pending the max number of records that may wait for each
+ *                        worker. When a worker falls this far behind, records
+ *                        stay in the context queue until it catches up.
+ *
+ * @return an error code
+ */
+hound_err hound_start_async(
+    struct hound_ctx *ctx,
+    size_t workers,
+    size_t max_pending);
+
 /**
  * Stops the generation and queueing of data.
  *
@@ -399,6 +735,55 @@ hound_err hound_read(struct hound_ctx *ctx, size_t records, size_t *read);
  */
 hound_err hound_read_nowait(struct hound_ctx *ctx, size_t records, size_t *read);
 
+/**
+ * Triggers callback invocations to process queued data, blocking until the
+ * records in the queue add up to at least the specified number of bytes. The
+ * callback will take the same form as usual, triggering on a per-record basis,
+ * and the sum of the record sizes triggered will not exceed the specified
+ * number of bytes. Because records can vary in size, fewer bytes than requested
+ * may be read if the next record would go over the limit.
+ *
+ * If the queue fills up (by record count, byte limit, or a full lane) before
+ * enough bytes are queued, the available records are read rather than waiting
+ * for records that would only cause drops. This function does not call
+ * hound_next(), so it is useless for pull-mode data.
+ *
+ * @param[in] ctx a context
+ * @param[in] bytes the max number of bytes to read
+ * @param[out] records_read filled in to indicate how many records were read
+ * @param[out] bytes_read filled in to indicate how many bytes were read
+ *
+ * @return an error code. If the queue has a byte limit smaller than the
+ *         requested number of bytes, HOUND_QUEUE_TOO_SMALL is returned. If
+ *         HOUND_CTX_STOPPED is returned, then the number of bytes read may be
+ *         less than the number requested.
+ */
+hound_err hound_read_bytes(
+    struct hound_ctx *ctx,
+    size_t bytes,
+    size_t *records_read,
+    size_t *bytes_read);
+
+/**
+ * Like hound_read_bytes, but gives up after the specified timeout.
+ *
+ * @param[in] ctx a context
+ * @param[in] bytes the max number of bytes to read
+ * @param[in] timeout_ns the max time to block, in nanoseconds
+ * @param[out] records_read filled in to indicate how many records were read
+ * @param[out] bytes_read filled in to indicate how many bytes were read
+ *
+ * @return an error code. If the timeout expires before enough bytes are
+ *         queued, HOUND_TIMEOUT is returned, and whatever records were queued
+ *         are still read.
+ */
+hound_err hound_read_bytes_timeout(
+    struct hound_ctx *ctx,
+    size_t bytes,
+    hound_data_period timeout_ns,
+    size_t *records_read,
+    size_t *bytes_read);
+
 /**
  * Triggers callback invocations to process queued data. If fewer than n records
  * are available, processes callbacks on what is available instead of blocking
@@ -448,7 +833,7 @@ hound_err hound_read_all_nowait(struct hound_ctx *ctx, size_t *read);
 hound_err hound_queue_length(struct hound_ctx *ctx, size_t *count);
 
 /**
- * Returns the maximum queue length.
+ * Returns the maximum queue length, including the space reserved for lanes.
  *
  * @param[in] ctx a context
  * @param[out] count filled in with the max number of records
@@ -457,9 +842,244 @@ hound_err hound_queue_length(struct hound_ctx *ctx, size_t *count);
  */
 hound_err hound_max_queue_length(struct hound_ctx *ctx, size_t *count);
 
+/**
+ * Returns how many bytes the records currently in the queue take up, counted
+ * the same way as queue_bytes in struct hound_rq.
+ *
+ * @param[in] ctx a context
+ * @param[out] bytes filled in with the current number of queued bytes
+ *
+ * @return an error code
+ */
+hound_err hound_queue_bytes(struct hound_ctx *ctx, size_t *bytes);
+
+/**
+ * Returns the max number of bytes the queue may hold, or 0 if it has no byte
+ * limit.
+ *
+ * @param[in] ctx a context
+ * @param[out] bytes filled in with the max number of bytes
+ *
+ * @return an error code
+ */
+hound_err hound_max_queue_bytes(struct hound_ctx *ctx, size_t *bytes);
+
+/**
+ * Returns a file descriptor that can be used to wait for a context's data in
+ * an application's own event loop (poll, epoll, etc.) instead of blocking a
+ * thread in hound_read. The fd is readable while the context's queue holds at
+ * least watermark records, or while the queue is full, since more records would
+ * only cause drops. Once it's readable, use hound_read_nowait and friends to
+ * process the records; the fd stops being readable when the queue drops back
+ * below the watermark.
+ *
+ * The fd belongs to the context and is closed by hound_free_ctx. Do not read
+ * from, write to, or close it. Calling this again changes the watermark and
+ * returns the same fd.
+ *
+ * @param[in] ctx a context
+ * @param[in] watermark the number of records at which the fd becomes readable
+ * @param[out] fd filled in with the fd
+ *
+ * @return an error code. If the watermark is 0, HOUND_INVALID_VAL is returned,
+ *         and if it's larger than the max queue length, HOUND_QUEUE_TOO_SMALL
+ *         is returned.
+ */
+hound_err hound_get_ctx_fd(struct hound_ctx *ctx, size_t watermark, int *fd);
+
+/**
+ * Sets up record retention for a context. A context with retention enabled
+ * keeps a reference to each of the most recent records added to its queue, even
+ * after they have been read, so they can be fetched again with
+ * hound_query_range. Records are retained until either the record limit is
+ * reached or they are older than max_age_ns relative to the newest retained
+ * record.
+ *
+ * @param[in] ctx a context
+ * @param[in] max_records the max number of records to retain, or 0 to turn off
+ *                        retention and release all retained records
+ * @param[in] max_age_ns the max age of retained records, in nanoseconds, or 0
+ *                       for no age limit
+ *
+ * @return an error code
+ */
+hound_err hound_set_retention(
+    struct hound_ctx *ctx,
+    size_t max_records,
+    hound_data_period max_age_ns);
+
+/**
+ * Triggers callback invocations for all retained records with a timestamp in
+ * the range [start, end], in timestamp order. This does not consume any records
+ * from the context's queue. The callback may be invoked concurrently with
+ * callbacks from hound_read and friends. The sequence number passed to the
+ * callback is the one the record had in the context's queue.
+ *
+ * @param[in] ctx a context with retention enabled
+ * @param[in] start the start of the time range
+ * @param[in] end the end of the time range
+ * @param[in] cb a callback to invoke for each record in the range
+ * @param[in] cb_ctx callback context to pass into each callback invocation
+ * @param[out] read if not NULL, filled in with the number of records found
+ *
+ * @return an error code, or HOUND_RETENTION_DISABLED if the context does not
+ *         retain records
+ */
+hound_err hound_query_range(
+    struct hound_ctx *ctx,
+    const struct timespec *start,
+    const struct timespec *end,
+    hound_cb cb,
+    void *cb_ctx,
+    size_t *read);
+
+/**
+ * Sets up a join stage on a context. Records with the joined data IDs no longer
+ * go directly into the context's queue. Instead, they are aligned on their
+ * driver timestamps and a single combined record with data ID rq->out_id is
+ * queued for each anchor sample.
+ *
+ * The data of a combined record is an array of rq->len struct hound_record, in
+ * the same order as rq->ids, followed by the member payloads. The data pointer
+ * of each member record points into the combined record, so it is valid only
+ * as long as the combined record is.
+ *
+ * The joined data IDs must also be part of the context's request, or else no
+ * records will reach the join stage.
+ *
+ * @param[in] ctx a context
+ * @param[in] rq a join request, or NULL to remove any existing join stage
+ *
+ * @return an error code
+ */
+hound_err hound_set_join(struct hound_ctx *ctx, const struct hound_join_rq *rq);
+
+/**
+ * Gets statistics about the join stage of a context. The statistics are reset
+ * whenever hound_set_join is called. If the context has no join stage, the
+ * statistics are all 0.
+ *
+ * @param[in] ctx a context
+ * @param[out] stats filled in with the join statistics
+ *
+ * @return an error code
+ */
+hound_err hound_get_join_stats(
+    struct hound_ctx *ctx,
+    struct hound_join_stats *stats);
+
+/**
+ * Sets up a resampling stage on a context. Records with the resampled data IDs
+ * no longer go directly into the context's queue. Instead, a record is queued
+ * at every tick of a fixed timeline, timestamped exactly on the tick and
+ * computed from the samples on either side of it. A record is queued for a tick
+ * only once the first sample at or after the tick arrives, so the output lags
+ * the input by up to one sample.
+ *
+ * Resampled records keep their data ID and layout. If the context also has a
+ * join stage, resampled records go into it, so streams resampled onto the same
+ * timeline can be joined on identical timestamps.
+ *
+ * The resampled data IDs must also be part of the context's request, or else
+ * no records will reach the resampling stage.
+ *
+ * @param[in] ctx a context
+ * @param[in] rq a resampling request, or NULL to remove any existing
+ *               resampling stage
+ *
+ * @return an error code
+ */
+hound_err hound_set_resample(
+    struct hound_ctx *ctx,
+    const struct hound_resample_rq *rq);
+
+/**
+ * Gets statistics about the resampling stage of a context. The statistics are
+ * reset whenever hound_set_resample is called. If the context has no
+ * resampling stage, the statistics are all 0.
+ *
+ * @param[in] ctx a context
+ * @param[out] stats filled in with the resampling statistics
+ *
+ * @return an error code
+ */
+hound_err hound_get_resample_stats(
+    struct hound_ctx *ctx,
+    struct hound_resample_stats *stats);
+
+/**
+ * Gets statistics about the filters of a context, as set in its data requests.
+ * Only records of data with a filter enabled are counted. The statistics cover
+ * the whole life of the context.
+ *
+ * @param[in] ctx a context
+ * @param[out] stats filled in with the filter statistics
+ *
+ * @return an error code
+ */
+hound_err hound_get_filter_stats(
+    struct hound_ctx *ctx,
+    struct hound_filter_stats *stats);
+
+/**
+ * Sets how long a context spins waiting for data before going to sleep, which
+ * trades CPU time for lower wakeup latency. By default, nothing spins.
+ *
+ * Blocking reads and async dispatch workers poll the queue for up to
+ * read_spin_ns before they block. While the context is active, the I/O thread
+ * likewise polls drivers without blocking for up to io_spin_ns before it
+ * sleeps; if several contexts ask for this, it uses the largest budget.
+ *
+ * Spinning is adaptive: after a spin finds nothing, the spinner sleeps straight
+ * away on its next waits, and it goes back to spinning once a wait ends sooner
+ * than the spin budget. So an idle context doesn't keep a CPU busy.
+ *
+ * @param[in] ctx a context
+ * @param[in] read_spin_ns how long readers spin, or 0 to not spin. At most 1
+ *                         second.
+ * @param[in] io_spin_ns how long the I/O thread spins, or 0 to not spin. At
+ *                       most 1 second.
+ *
+ * @return an error code
+ */
+hound_err hound_set_spin(
+    struct hound_ctx *ctx,
+    hound_data_period read_spin_ns,
+    hound_data_period io_spin_ns);
+
+/**
+ * Configures real-time operation for hound's own threads and memory. This
+ * applies to the I/O thread and to the threads of any context started with
+ * hound_start_async, including contexts started later. Each call replaces the
+ * settings from the previous one, so a zeroed request turns real-time mode back
+ * off.
+ *
+ * Real-time scheduling and memory locking usually need privileges
+ * (CAP_SYS_NICE and CAP_IPC_LOCK, or suitable rlimits). Whatever can be applied
+ * is applied even if something else fails, and each failure is logged.
+ *
+ * @param[in] rq the real-time settings
+ * @param[out] status if not NULL, filled in with which settings took effect
+ *
+ * @return an error code. If the request was valid but some of it could not be
+ *         applied, HOUND_RT_UNAVAILABLE is returned, and status says which
+ *         parts.
+ */
+hound_err hound_set_rt(
+    const struct hound_rt_rq *rq,
+    struct hound_rt_status *status);
+
 /**
  * Initializes drivers specified in the given config file.
  *
+ * If the hound cache directory exists, a precompiled form of the config and of
+ * the schemas it references is saved there and used on later calls, as long as
+ * none of those files have changed. The cache directory is set at build time,
+ * and it can be overridden by setting the HOUND_CACHE_DIR environment variable
+ * (an empty value turns off caching). The cache directory and the files in it
+ * are used only if they are owned by the effective user and are not writable
+ * by group or others.
+ *
  * @param[in] config the path to a driver config file
  *
  * @return an error code
@@ -0,0 +1,212 @@
+/**
+ * @file      chunk.c
+ * @brief     Pooled, refcounted read buffers. The poll thread reads a driver's
+ *            fd into a chunk, and records parsed out of it can point into the
+ *            chunk instead of copying, each holding a reference. Once the last
+ *            record is freed, the chunk goes back to its pool for reuse.
+ * @author    Martin Kelly <mkelly@xevo.com>
+ * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
+ */
+
+#include <hound/hound.h>
+#include <hound-private/chunk.h>
+#include <hound-private/error.h>
+#include <hound-private/util.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * The max number of free chunks a pool keeps around, unless it was filled with
+ * more. Beyond this, returned chunks are freed.
+ */
+#define MAX_FREE_CHUNKS 16
+
+struct chunk_pool {
+    pthread_mutex_t mutex;
+    size_t chunk_size;
+
+    /* One for the owner, plus one per chunk that's been handed out. */
+    size_t refcount;
+    bool released;
+
+    size_t free_count;
+    size_t max_free;
+    struct chunk *free_list;
+};
+
+hound_err chunk_pool_alloc(size_t chunk_size, struct chunk_pool **out_pool)
+{
+    struct chunk_pool *pool;
+
+    XASSERT_GT(chunk_size, 0);
+    XASSERT_NOT_NULL(out_pool);
+
+    pool = malloc(sizeof(*pool));
+    if (pool == NULL) {
+        return HOUND_OOM;
+    }
+
+    init_mutex(&pool->mutex);
+    pool->chunk_size = chunk_size;
+    pool->refcount = 1;
+    pool->released = false;
+    pool->free_count = 0;
+    pool->max_free = MAX_FREE_CHUNKS;
+    pool->free_list = NULL;
+
+    *out_pool = pool;
+
+    return HOUND_OK;
+}
+
+/* Drops a reference on the pool. Must be called with the pool mutex held. */
+static
+void pool_unref(struct chunk_pool *pool)
+{
+    bool destroy;
+
+    XASSERT_GT(pool->refcount, 0);
+    --pool->refcount;
+    destroy = pool->refcount == 0;
+    unlock_mutex(&pool->mutex);
+
+    if (destroy) {
+        XASSERT_NULL(pool->free_list);
+        destroy_mutex(&pool->mutex);
+        free(pool);
+    }
+}
+
+void chunk_pool_release(struct chunk_pool *pool)
+{
+    struct chunk *chunk;
+    struct chunk *next;
+
+    XASSERT_NOT_NULL(pool);
+
+    lock_mutex(&pool->mutex);
+    XASSERT_FALSE(pool->released);
+    pool->released = true;
+    for (chunk = pool->free_list; chunk != NULL; chunk = next) {
+        next = chunk->next;
+        free(chunk);
+    }
+    pool->free_list = NULL;
+    pool->free_count = 0;
+    pool_unref(pool);
+}
+
+hound_err chunk_pool_fill(struct chunk_pool *pool, size_t count)
+{
+    struct chunk *chunk;
+    hound_err err;
+
+    XASSERT_NOT_NULL(pool);
+
+    lock_mutex(&pool->mutex);
+    pool->max_free = max(count, MAX_FREE_CHUNKS);
+    err = HOUND_OK;
+    while (pool->free_count < count) {
+        chunk = malloc(sizeof(*chunk) + pool->chunk_size);
+        if (chunk == NULL) {
+            err = HOUND_OOM;
+            break;
+        }
+        chunk->pool = pool;
+        chunk->size = pool->chunk_size;
+
+        /* Touch every page now, so the poll thread doesn't fault on them. */
+        memset(chunk->data, 0, chunk->size);
+
+        chunk->next = pool->free_list;
+        pool->free_list = chunk;
+        ++pool->free_count;
+    }
+    unlock_mutex(&pool->mutex);
+
+    return err;
+}
+
+struct chunk *chunk_get(struct chunk_pool *pool)
+{
+    struct chunk *chunk;
+
+    XASSERT_NOT_NULL(pool);
+
+    lock_mutex(&pool->mutex);
+    chunk = pool->free_list;
+    if (chunk != NULL) {
+        pool->free_list = chunk->next;
+        --pool->free_count;
+    }
+    else {
+        chunk = malloc(sizeof(*chunk) + pool->chunk_size);
+        if (chunk == NULL) {
+            unlock_mutex(&pool->mutex);
+            return NULL;
+        }
+        chunk->pool = pool;
+        chunk->size = pool->chunk_size;
+    }
+    ++pool->refcount;
+    unlock_mutex(&pool->mutex);
+
+    atomic_ref_init(&chunk->refcount, 1);
+    chunk->next = NULL;
+
+    return chunk;
+}
+
+void chunk_ref(struct chunk *chunk)
+{
+    XASSERT_NOT_NULL(chunk);
+
+    atomic_ref_inc(&chunk->refcount);
+}
+
+void chunk_unref(struct chunk *chunk)
+{
+    refcount_val count;
+    struct chunk_pool *pool;
+
+    XASSERT_NOT_NULL(chunk);
+
+    count = atomic_ref_dec(&chunk->refcount);
+    if (count != 1) {
+        return;
+    }
+
+    /* That was the last reference, so hand the chunk back to the pool. */
+    pool = chunk->pool;
+    lock_mutex(&pool->mutex);
+    if (!pool->released && pool->free_count < pool->max_free) {
+        chunk->next = pool->free_list;
+        pool->free_list = chunk;
+        ++pool->free_count;
+    }
+    else {
+        /* The pool is full, or its owner released it. */
+        free(chunk);
+    }
+    pool_unref(pool);
+}
+
+bool chunk_shared(struct chunk *chunk)
+{
+    XASSERT_NOT_NULL(chunk);
+
+    return atomic_load(&chunk->refcount) > 1;
+}
+
+bool chunk_contains(const struct chunk *chunk, const void *p)
+{
+    const unsigned char *pos;
+
+    XASSERT_NOT_NULL(chunk);
+
+    pos = p;
+    return pos >= chunk->data && pos < chunk->data + chunk->size;
+}
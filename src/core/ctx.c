@@ -7,11 +7,18 @@
 
 #define _GNU_SOURCE
 #include <hound/hound.h>
+#include <hound-private/dispatch.h>
 #include <hound-private/driver.h>
 #include <hound-private/error.h>
+#include <hound-private/filter.h>
+#include <hound-private/io.h>
+#include <hound-private/join.h>
 #include <hound-private/log.h>
+#include <hound-private/resample.h>
+#include <hound-private/trace.h>
 #include <hound-private/util.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <xlib/xhash.h>
 #include <xlib/xvec.h>
@@ -22,6 +29,9 @@
  */
 #define DEQUEUE_BUF_SIZE (4096 / sizeof(struct hound_record_info *))
 
+/* Ends a chain of requests for the same data ID during validation. */
+#define NO_PREV SIZE_MAX
+
 XVEC_DEFINE(data_rq_vec, struct hound_data_rq);
 XVEC_DEFINE(id_vec, hound_data_id);
 
@@ -30,6 +40,9 @@ XHASH_MAP_INIT_PTR(DRIVER_DATA_MAP, struct driver *, data_rq_vec) /* NOLINT */
 
 /* driver --> list of on-demand data IDs */
 XHASH_MAP_INIT_PTR(ON_DEMAND_MAP, struct driver *, id_vec) /* NOLINT */
+
+/* data ID --> index of the last request for that ID, used for validation */
+XHASH_MAP_INIT_INT(RQ_INDEX_MAP, size_t)
 /*
  * TODO: We shouldn't have to add NOLINT here; it should be entirely contained
  * in the xhash header. Strangely, that does not seem to be working.
@@ -39,14 +52,72 @@ struct hound_ctx {
     pthread_rwlock_t rwlock;
 
     bool active;
-    size_t readers;
-    hound_cb cb;
-    void *cb_ctx;
+
+    /*
+     * Readers register without the lock, so they don't serialize against each
+     * other. Starting async dispatch and registering a reader form a
+     * handshake: each side publishes its own flag, then checks the other's,
+     * so at least one of them backs off.
+     */
+    atomic_size_t readers;
+    atomic_bool async;
+
+    /*
+     * The callback and its context are published under a sequence lock, so
+     * readers can grab a consistent pair without the lock. Writers hold the
+     * write lock, so there is only ever one at a time. The sequence number is
+     * odd while an update is in progress.
+     */
+    atomic_uint cb_seq;
+    _Atomic(hound_cb) cb;
+    _Atomic(void *) cb_ctx;
+
+    struct dispatch *dispatch;
     struct queue *queue;
+
+    /* Registered with the I/O core while we're active, if ns is nonzero. */
+    struct io_spin io_spin;
+
     xhash_t(DRIVER_DATA_MAP) *drv_data_map;
     xhash_t(ON_DEMAND_MAP) *on_demand_data_map;
 };
 
+/**
+ * Publishes a new callback. Must be called with the write lock held, or before
+ * the context is visible to other threads.
+ */
+static
+void store_cb(struct hound_ctx *ctx, hound_cb cb, void *cb_ctx)
+{
+    unsigned int seq;
+
+    seq = atomic_load_explicit(&ctx->cb_seq, memory_order_relaxed);
+    atomic_store_explicit(&ctx->cb_seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&ctx->cb, cb, memory_order_relaxed);
+    atomic_store_explicit(&ctx->cb_ctx, cb_ctx, memory_order_relaxed);
+    atomic_store_explicit(&ctx->cb_seq, seq + 2, memory_order_release);
+}
+
+/**
+ * Grabs the current callback and its context as a consistent pair, without
+ * taking the lock.
+ */
+static
+void load_cb(struct hound_ctx *ctx, hound_cb *cb, void **cb_ctx)
+{
+    unsigned int end;
+    unsigned int start;
+
+    do {
+        start = atomic_load_explicit(&ctx->cb_seq, memory_order_acquire);
+        *cb = atomic_load_explicit(&ctx->cb, memory_order_relaxed);
+        *cb_ctx = atomic_load_explicit(&ctx->cb_ctx, memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+        end = atomic_load_explicit(&ctx->cb_seq, memory_order_relaxed);
+    } while (start != end || start % 2 != 0);
+}
+
 static
 void destroy_drv_data_map(xhash_t(DRIVER_DATA_MAP) *map)
 {
@@ -70,15 +141,25 @@ void destroy_on_demand_map(xhash_t(ON_DEMAND_MAP) *map)
     xh_destroy(ON_DEMAND_MAP, map);
 }
 
+/**
+ * Checks that a request is sane. On success, drvs is set to a newly allocated
+ * array holding the driver for each data request, which the caller must free.
+ */
 static
-hound_err validate_rq(const struct hound_rq *rq)
+hound_err validate_rq(const struct hound_rq *rq, struct driver ***out_drvs)
 {
-    struct hound_data_rq *data_rq;
+    const struct hound_data_rq *data_rq;
     struct driver *drv;
+    struct driver **drvs;
     hound_err err;
     size_t i;
+    xhash_t(RQ_INDEX_MAP) *index_map;
+    xhiter_t iter;
     size_t j;
     const struct hound_data_rq_list *list;
+    const struct hound_data_rq *other;
+    size_t *prev;
+    int ret;
 
     /* Is the request sane? */
     if (rq->queue_len == 0) {
@@ -100,41 +181,128 @@ hound_err validate_rq(const struct hound_rq *rq)
         return HOUND_MISSING_CALLBACK;
     }
 
+    drvs = malloc(list->len * sizeof(*drvs));
+    if (drvs == NULL) {
+        err = HOUND_OOM;
+        goto error_alloc_drvs;
+    }
+
+    prev = malloc(list->len * sizeof(*prev));
+    if (prev == NULL) {
+        err = HOUND_OOM;
+        goto error_alloc_prev;
+    }
+
+    index_map = xh_init(RQ_INDEX_MAP);
+    if (index_map == NULL) {
+        err = HOUND_OOM;
+        goto error_index_map;
+    }
+
     /* Are the data IDs all valid? */
     for (i = 0; i < list->len; ++i) {
         data_rq = &list->data[i];
 
         err = driver_get(data_rq->id, &drv);
         if (err != HOUND_OK) {
-            return err;
+            goto out;
         }
+        drvs[i] = drv;
 
         if (!driver_period_supported(drv, data_rq->id, data_rq->period_ns)) {
-            return HOUND_PERIOD_UNSUPPORTED;
-        }
-
-        for (j = 0; j < i; ++j) {
-            if (data_rq->id == list->data[j].id) {
-                if (data_rq->period_ns == list->data[j].period_ns ||
-                    driver_is_push_mode(drv)) {
-                    /*
-                     * Push-mode drivers can push data at only one rate, so this is
-                     * an error. Pull-mode drivers can handle the same data at
-                     * multiple frequencies without issue, but the exact same ID
-                     * and frequency should still not be requested.
-                     */
-                    return HOUND_DUPLICATE_DATA_REQUESTED;
-                }
+            err = HOUND_PERIOD_UNSUPPORTED;
+            goto out;
+        }
+
+        switch (data_rq->overflow) {
+            case HOUND_OVERFLOW_DROP_OLDEST:
+            case HOUND_OVERFLOW_DROP_NEWEST:
+            case HOUND_OVERFLOW_BLOCK:
+                break;
+            default:
+                err = HOUND_INVALID_VAL;
+                goto out;
+        }
+
+        /* Blocking stalls the I/O thread, so keep it short. */
+        if (data_rq->block_timeout_ns > HOUND_MAX_BLOCK_TIMEOUT_NS) {
+            err = HOUND_INVALID_VAL;
+            goto out;
+        }
+
+        if (!filter_rq_valid(data_rq)) {
+            err = HOUND_INVALID_VAL;
+            goto out;
+        }
+
+        iter = xh_put(RQ_INDEX_MAP, index_map, data_rq->id, &ret);
+        if (ret == -1) {
+            err = HOUND_OOM;
+            goto out;
+        }
+        if (ret != 0) {
+            /* This is the first request for this data ID. */
+            prev[i] = NO_PREV;
+            xh_val(index_map, iter) = i;
+            continue;
+        }
+
+        /* The queue and filter handle each data ID the same way. */
+        other = &list->data[xh_val(index_map, iter)];
+        if (data_rq->overflow != other->overflow ||
+            data_rq->block_timeout_ns != other->block_timeout_ns ||
+            data_rq->lane_len != other->lane_len ||
+            filter_rq_compare(data_rq, other) != 0) {
+            err = HOUND_INVALID_VAL;
+            goto out;
+        }
+
+        /*
+         * Push-mode drivers can push data at only one rate, so this is an
+         * error. Pull-mode drivers can handle the same data at multiple
+         * frequencies without issue, but the exact same ID and frequency should
+         * still not be requested.
+         */
+        if (driver_is_push_mode(drv)) {
+            err = HOUND_DUPLICATE_DATA_REQUESTED;
+            goto out;
+        }
+        for (j = xh_val(index_map, iter); j != NO_PREV; j = prev[j]) {
+            if (data_rq->period_ns == list->data[j].period_ns) {
+                err = HOUND_DUPLICATE_DATA_REQUESTED;
+                goto out;
             }
         }
+
+        prev[i] = xh_val(index_map, iter);
+        xh_val(index_map, iter) = i;
     }
 
-    return HOUND_OK;
+    err = HOUND_OK;
+
+out:
+    xh_destroy(RQ_INDEX_MAP, index_map);
+error_index_map:
+    free(prev);
+error_alloc_prev:
+    if (err == HOUND_OK) {
+        *out_drvs = drvs;
+    }
+    else {
+        free(drvs);
+    }
+error_alloc_drvs:
+    return err;
 }
 
+/**
+ * Groups the data requests by driver, given the driver for each request (as
+ * looked up by validate_rq).
+ */
 static
 hound_err make_driver_data_maps(
     const struct hound_data_rq_list *list,
+    struct driver **drvs,
     xhash_t(DRIVER_DATA_MAP) **out_drv_data_map,
     xhash_t(ON_DEMAND_MAP) **out_on_demand_map)
 {
@@ -169,11 +337,7 @@ hound_err make_driver_data_maps(
      */
     for (i = 0; i < list->len; ++i) {
         data_rq = &list->data[i];
-
-        err = driver_get(data_rq->id, &drv);
-        if (err != HOUND_OK) {
-            goto error_loop;
-        }
+        drv = drvs[i];
 
         iter = xh_put(DRIVER_DATA_MAP, drv_data_map, drv, &ret);
         if (ret == -1) {
@@ -189,6 +353,7 @@ hound_err make_driver_data_maps(
 
         new_rq = xv_pushp(struct hound_data_rq, *rq_vec);
         if (new_rq == NULL) {
+            err = HOUND_OOM;
             goto error_loop;
         }
         *new_rq = *data_rq;
@@ -209,6 +374,7 @@ hound_err make_driver_data_maps(
 
             id = xv_pushp(hound_data_id, *id_list);
             if (id == NULL) {
+                err = HOUND_OOM;
                 goto error_loop;
             }
             *id = data_rq->id;
@@ -231,9 +397,9 @@ hound_err make_driver_data_maps(
     return HOUND_OK;
 
 error_loop:
-    destroy_drv_data_map(drv_data_map);
-error_on_demand_map:
     destroy_on_demand_map(on_demand_map);
+error_on_demand_map:
+    destroy_drv_data_map(drv_data_map);
 error_drv_data_map:
     return err;
 }
@@ -241,12 +407,14 @@ error_drv_data_map:
 hound_err ctx_alloc(const struct hound_rq *rq, struct hound_ctx **ctx_out)
 {
     struct hound_ctx *ctx;
+    struct driver **drvs;
     hound_err err;
+    struct queue_policy *policy;
 
     NULL_CHECK(ctx_out);
     NULL_CHECK(rq);
 
-    err = validate_rq(rq);
+    err = validate_rq(rq, &drvs);
     if (err != HOUND_OK) {
         goto out;
     }
@@ -255,7 +423,7 @@ hound_err ctx_alloc(const struct hound_rq *rq, struct hound_ctx **ctx_out)
     ctx = malloc(sizeof(*ctx));
     if (ctx == NULL) {
         err = HOUND_OOM;
-        goto out;
+        goto error_alloc_ctx;
     }
 
     err = pthread_rwlock_init(&ctx->rwlock, NULL);
@@ -264,33 +432,48 @@ hound_err ctx_alloc(const struct hound_rq *rq, struct hound_ctx **ctx_out)
     }
 
     ctx->active = false;
-    ctx->readers = 0;
-    ctx->cb = rq->cb;
-    ctx->cb_ctx = rq->cb_ctx;
-
-    err = queue_alloc(&ctx->queue, rq->queue_len);
+    atomic_init(&ctx->readers, 0);
+    atomic_init(&ctx->async, false);
+    atomic_init(&ctx->cb_seq, 0);
+    atomic_init(&ctx->cb, rq->cb);
+    atomic_init(&ctx->cb_ctx, rq->cb_ctx);
+    ctx->dispatch = NULL;
+    ctx->io_spin.ns = 0;
+
+    err = queue_alloc(&ctx->queue, rq->queue_len, rq->queue_bytes);
     if (err != HOUND_OK) {
         goto error_queue_alloc;
     }
 
+    err = queue_policy_alloc(ctx->queue, &rq->rq_list, &policy);
+    if (err != HOUND_OK) {
+        goto error_policy_alloc;
+    }
+    queue_set_policy(ctx->queue, policy);
+
     /* Populate our context. */
     err = make_driver_data_maps(
         &rq->rq_list,
+        drvs,
         &ctx->drv_data_map,
         &ctx->on_demand_data_map);
     if (err != HOUND_OK) {
         goto error_make_data_maps;
     }
+    free(drvs);
 
     *ctx_out = ctx;
     return HOUND_OK;
 
 error_make_data_maps:
+error_policy_alloc:
     queue_destroy(ctx->queue);
 error_queue_alloc:
     pthread_rwlock_destroy(&ctx->rwlock);
 error_pthread_init:
     free(ctx);
+error_alloc_ctx:
+    free(drvs);
 out:
     return err;
 }
@@ -376,6 +559,13 @@ hound_err unref_drivers(struct hound_ctx *ctx)
     return err;
 }
 
+/**
+ * Moves the drivers of an active context from its current request map to a new
+ * one. Drivers in both maps are modified in place, and drivers in only one map
+ * are reffed or unreffed. An inactive context holds no driver references, so
+ * there is nothing to do; starting it refs the drivers in the new map.
+ */
+static
 hound_err modify_drivers(
     struct hound_ctx *ctx,
     xhash_t(DRIVER_DATA_MAP) *new_drv_data_map)
@@ -389,6 +579,10 @@ hound_err modify_drivers(
     data_rq_vec *old_rq_vec;
     hound_err tmp;
 
+    if (!ctx->active) {
+        return HOUND_OK;
+    }
+
     /*
      * First go through the new map and modify/ref each driver, depending on
      * whether or not it overlaps with the old map.
@@ -403,7 +597,7 @@ hound_err modify_drivers(
              * This driver is also in the old driver map, so we can just modify
              * it.
              */
-            old_rq_vec = &xh_val(ctx->drv_data_map, new_iter);
+            old_rq_vec = &xh_val(ctx->drv_data_map, old_iter);
             err = driver_modify(
                 drv,
                 ctx->queue,
@@ -413,18 +607,12 @@ hound_err modify_drivers(
                 xv_size(*new_rq_vec));
         }
         else {
-            /*
-             * This driver is not in the old driver map, so we have to ref it if
-             * the context is currently active (if not active, it will get
-             * reffed when the context is started).
-             */
-            if (ctx->active) {
-                err = driver_ref(
-                    drv,
-                    ctx->queue,
-                    xv_data(*new_rq_vec),
-                    xv_size(*new_rq_vec));
-            }
+            /* This driver is not in the old driver map, so we have to ref it. */
+            err = driver_ref(
+                drv,
+                ctx->queue,
+                xv_data(*new_rq_vec),
+                xv_size(*new_rq_vec));
         }
         if (err != HOUND_OK) {
             goto error_new_vec;
@@ -433,11 +621,12 @@ hound_err modify_drivers(
 
     /* Next, go through the old map and unref any drivers not in the new map. */
     xh_iter(ctx->drv_data_map, old_iter,
-        if (xh_exist(new_drv_data_map, old_iter)) {
+        drv = xh_key(ctx->drv_data_map, old_iter);
+        if (xh_get(DRIVER_DATA_MAP, new_drv_data_map, drv) !=
+            xh_end(new_drv_data_map)) {
             continue;
         }
 
-        drv = xh_key(ctx->drv_data_map, old_iter);
         old_rq_vec = &xh_val(ctx->drv_data_map, old_iter);
         err = driver_unref(
             drv,
@@ -445,9 +634,7 @@ hound_err modify_drivers(
             xv_data(*old_rq_vec),
             xv_size(*old_rq_vec));
         if (err != HOUND_OK) {
-            if (err != HOUND_OK) {
-                goto error_unref;
-            }
+            goto error_unref;
         }
     );
 
@@ -458,35 +645,38 @@ error_unref:
         if (iter == old_iter) {
             break;
         }
-        if (xh_exist(new_drv_data_map, iter)) {
+        drv = xh_key(ctx->drv_data_map, iter);
+        if (xh_get(DRIVER_DATA_MAP, new_drv_data_map, drv) !=
+            xh_end(new_drv_data_map)) {
             continue;
         }
 
-        drv = xh_key(ctx->drv_data_map, iter);
         old_rq_vec = &xh_val(ctx->drv_data_map, iter);
-        err = driver_ref(
+        tmp = driver_ref(
             drv,
             ctx->queue,
             xv_data(*old_rq_vec),
             xv_size(*old_rq_vec));
-        if (err != HOUND_OK) {
+        if (tmp != HOUND_OK) {
             hound_log_err(
-                err,
+                tmp,
                 "failed to ref driver %p during cleanup",
                 (void *) drv);
         }
     );
+    /* All the drivers in the new map were handled, so undo them all. */
+    new_iter = xh_end(new_drv_data_map);
 error_new_vec:
     xh_iter(new_drv_data_map, iter,
         if (iter == new_iter) {
             break;
         }
         drv = xh_key(new_drv_data_map, iter);
-        new_rq_vec = &xh_val(new_drv_data_map, new_iter);
+        new_rq_vec = &xh_val(new_drv_data_map, iter);
 
         old_iter = xh_get(DRIVER_DATA_MAP, ctx->drv_data_map, drv);
-        if (old_iter == xh_end(ctx->drv_data_map)) {
-            old_rq_vec = &xh_val(ctx->drv_data_map, new_iter);
+        if (old_iter != xh_end(ctx->drv_data_map)) {
+            old_rq_vec = &xh_val(ctx->drv_data_map, old_iter);
             tmp = driver_modify(
                 drv,
                 ctx->queue,
@@ -494,26 +684,24 @@ error_new_vec:
                 xv_size(*new_rq_vec),
                 xv_data(*old_rq_vec),
                 xv_size(*old_rq_vec));
-                if (tmp != HOUND_OK) {
-                    hound_log_err(
-                        err,
-                        "failed to modify driver %p during cleanup",
-                        (void *) drv);
-                        }
+            if (tmp != HOUND_OK) {
+                hound_log_err(
+                    tmp,
+                    "failed to modify driver %p during cleanup",
+                    (void *) drv);
+            }
         }
         else {
-            if (ctx->active) {
-                tmp = driver_unref(
-                    drv,
-                    ctx->queue,
-                    xv_data(*new_rq_vec),
-                    xv_size(*new_rq_vec));
-                if (tmp != HOUND_OK) {
-                    hound_log_err(
-                        err,
-                        "failed to unref driver %p during cleanup",
-                        (void *) drv);
-                }
+            tmp = driver_unref(
+                drv,
+                ctx->queue,
+                xv_data(*new_rq_vec),
+                xv_size(*new_rq_vec));
+            if (tmp != HOUND_OK) {
+                hound_log_err(
+                    tmp,
+                    "failed to unref driver %p during cleanup",
+                    (void *) drv);
             }
         }
     );
@@ -535,6 +723,10 @@ hound_err ctx_start_nolock(struct hound_ctx *ctx)
         return err;
     }
 
+    if (ctx->io_spin.ns > 0) {
+        io_add_spin(&ctx->io_spin);
+    }
+    queue_set_blocking(ctx->queue, true);
     ctx->active = true;
 
     return HOUND_OK;
@@ -553,33 +745,138 @@ hound_err ctx_start(struct hound_ctx *ctx)
     return err;
 }
 
+/**
+ * Stops a context. Any dispatcher is detached rather than stopped, as stopping
+ * it waits for in-flight callbacks, which may take the context lock. The caller
+ * must pass it to finish_stop after dropping the lock.
+ */
 static
-hound_err ctx_stop_nolock(struct hound_ctx *ctx)
+hound_err ctx_stop_nolock(struct hound_ctx *ctx, struct dispatch **dispatch)
 {
     hound_err err;
 
+    *dispatch = NULL;
+
     /* We must not double-unref the drivers. */
     if (!ctx->active) {
         return HOUND_CTX_NOT_ACTIVE;
     }
 
-    queue_interrupt(ctx->queue);
+    /* Don't let a full queue hold up the drivers while we unref them. */
+    queue_set_blocking(ctx->queue, false);
+    if (ctx->dispatch != NULL) {
+        *dispatch = ctx->dispatch;
+        ctx->dispatch = NULL;
+    }
+    else {
+        queue_interrupt(ctx->queue);
+    }
+    if (ctx->io_spin.ns > 0) {
+        io_remove_spin(&ctx->io_spin);
+    }
     err = unref_drivers(ctx);
     ctx->active = false;
 
     return err;
 }
 
+/*
+ * Stops a dispatcher detached by ctx_stop_nolock. Until the dispatcher is gone,
+ * the async flag stays set, which keeps readers and new dispatchers away from
+ * the queue.
+ */
+static
+void finish_stop(struct hound_ctx *ctx, struct dispatch *dispatch)
+{
+    if (dispatch == NULL) {
+        return;
+    }
+
+    dispatch_stop(dispatch);
+    atomic_store(&ctx->async, false);
+}
+
+hound_err ctx_start_async(
+    struct hound_ctx *ctx,
+    size_t workers,
+    size_t max_pending)
+{
+    struct dispatch *dispatch;
+    hound_err err;
+
+    NULL_CHECK(ctx);
+
+    if (workers == 0 || max_pending == 0) {
+        return HOUND_INVALID_VAL;
+    }
+
+    pthread_rwlock_wrlock(&ctx->rwlock);
+
+    if (ctx->active) {
+        err = HOUND_CTX_ACTIVE;
+        goto out;
+    }
+
+    /*
+     * A dispatcher from an earlier start may still be stopping, in which case
+     * it still owns the queue.
+     */
+    if (atomic_exchange(&ctx->async, true)) {
+        err = HOUND_CTX_ACTIVE;
+        goto out;
+    }
+
+    /*
+     * Readers would compete with the dispatcher for records, so block new
+     * consuming readers, then check that there are none already. See
+     * start_read for the other half of this handshake.
+     */
+    if (atomic_load(&ctx->readers) > 0) {
+        err = HOUND_CTX_ACTIVE;
+        goto error_readers;
+    }
+
+    err = ctx_start_nolock(ctx);
+    if (err != HOUND_OK) {
+        goto error_readers;
+    }
+
+    err = dispatch_start(
+        ctx->queue,
+        workers,
+        max_pending,
+        atomic_load_explicit(&ctx->cb, memory_order_relaxed),
+        atomic_load_explicit(&ctx->cb_ctx, memory_order_relaxed),
+        &ctx->dispatch);
+    if (err != HOUND_OK) {
+        /* There's no dispatcher yet, so there's nothing to finish. */
+        ctx_stop_nolock(ctx, &dispatch);
+        XASSERT_NULL(dispatch);
+        goto error_readers;
+    }
+
+    goto out;
+
+error_readers:
+    atomic_store(&ctx->async, false);
+out:
+    pthread_rwlock_unlock(&ctx->rwlock);
+    return err;
+}
+
 hound_err ctx_stop(struct hound_ctx *ctx)
 {
+    struct dispatch *dispatch;
     hound_err err;
 
     NULL_CHECK(ctx);
 
     pthread_rwlock_wrlock(&ctx->rwlock);
-    err = ctx_stop_nolock(ctx);
+    err = ctx_stop_nolock(ctx, &dispatch);
     pthread_rwlock_unlock(&ctx->rwlock);
 
+    finish_stop(ctx, dispatch);
+
     return err;
 }
 
@@ -589,15 +886,18 @@ hound_err ctx_modify(
     bool flush)
 {
     xhash_t(DRIVER_DATA_MAP) *drv_data_map;
+    struct driver **drvs;
     hound_err err;
     xhash_t(ON_DEMAND_MAP) *on_demand_map;
+    size_t orig_max_bytes;
     size_t orig_max_len;
+    struct queue_policy *policy;
     hound_err tmp;
 
     NULL_CHECK(ctx);
     NULL_CHECK(rq);
 
-    err = validate_rq(rq);
+    err = validate_rq(rq, &drvs);
     if (err != HOUND_OK) {
         return err;
     }
@@ -605,13 +905,26 @@ hound_err ctx_modify(
     /* The request is OK, so let's proceed. */
     pthread_rwlock_wrlock(&ctx->rwlock);
 
-    orig_max_len = queue_max_len(ctx->queue);
-    err = queue_resize(ctx->queue, rq->queue_len, flush);
+    /* Don't let a full queue hold up the drivers while we modify them. */
+    queue_set_blocking(ctx->queue, false);
+
+    orig_max_len = queue_shared_max_len(ctx->queue);
+    orig_max_bytes = queue_max_bytes(ctx->queue);
+    err = queue_resize(ctx->queue, rq->queue_len, rq->queue_bytes, flush);
     if (err != HOUND_OK) {
         goto error_resize;
     }
 
-    err = make_driver_data_maps(&rq->rq_list, &drv_data_map, &on_demand_map);
+    err = queue_policy_alloc(ctx->queue, &rq->rq_list, &policy);
+    if (err != HOUND_OK) {
+        goto error_policy_alloc;
+    }
+
+    err = make_driver_data_maps(
+        &rq->rq_list,
+        drvs,
+        &drv_data_map,
+        &on_demand_map);
     if (err != HOUND_OK) {
         goto error_driver_maps;
     }
@@ -624,10 +937,13 @@ hound_err ctx_modify(
     destroy_drv_data_map(ctx->drv_data_map);
     destroy_on_demand_map(ctx->on_demand_data_map);
 
+    queue_set_policy(ctx->queue, policy);
     ctx->drv_data_map = drv_data_map;
     ctx->on_demand_data_map = on_demand_map;
-    ctx->cb = rq->cb;
-    ctx->cb_ctx = rq->cb_ctx;
+    store_cb(ctx, rq->cb, rq->cb_ctx);
+    if (ctx->dispatch != NULL) {
+        dispatch_set_cb(ctx->dispatch, rq->cb, rq->cb_ctx);
+    }
 
     err = HOUND_OK;
     goto out;
@@ -636,7 +952,9 @@ error_modify_drivers:
     destroy_drv_data_map(drv_data_map);
     destroy_on_demand_map(on_demand_map);
 error_driver_maps:
-    tmp = queue_resize(ctx->queue, orig_max_len, false);
+    queue_policy_free(policy);
+error_policy_alloc:
+    tmp = queue_resize(ctx->queue, orig_max_len, orig_max_bytes, false);
     if (tmp != HOUND_OK) {
         hound_log_err(
             err,
@@ -647,7 +965,9 @@ error_driver_maps:
     }
 error_resize:
 out:
+    queue_set_blocking(ctx->queue, ctx->active);
     pthread_rwlock_unlock(&ctx->rwlock);
+    free(drvs);
     return err;
 }
 
@@ -655,15 +975,16 @@ hound_err ctx_free(struct hound_ctx *ctx)
 {
     bool active;
     hound_err err;
-    size_t readers;
 
     NULL_CHECK(ctx);
 
     pthread_rwlock_rdlock(&ctx->rwlock);
     active = ctx->active;
-    readers = ctx->readers;
     pthread_rwlock_unlock(&ctx->rwlock);
-    if (active || readers > 0) {
+    /* A set async flag means a stop is still waiting on the dispatcher. */
+    if (active ||
+        atomic_load(&ctx->readers) > 0 ||
+        atomic_load(&ctx->async)) {
         return HOUND_CTX_ACTIVE;
     }
 
@@ -682,7 +1003,7 @@ static
 void process_callbacks(
     struct hound_ctx *ctx,
     struct record_info **buf,
-    hound_seqno seqno,
+    const hound_seqno *seqnos,
     size_t n)
 {
     hound_cb cb;
@@ -698,16 +1019,14 @@ void process_callbacks(
      * Grab the callback and its context, since they can be changed via
      * ctx_modify.
      */
-    pthread_rwlock_rdlock(&ctx->rwlock);
-    cb = ctx->cb;
-    cb_ctx = ctx->cb_ctx;
-    pthread_rwlock_unlock(&ctx->rwlock);
+    load_cb(ctx, &cb, &cb_ctx);
 
     for (i = 0; i < n; ++i) {
         rec_info = buf[i];
-        cb(&rec_info->record, seqno, cb_ctx);
+        HOUND_TRACE_CB(callback_entry, &rec_info->record, seqnos[i]);
+        cb(&rec_info->record, seqnos[i], cb_ctx);
+        HOUND_TRACE_CB(callback_exit, &rec_info->record, seqnos[i]);
         record_ref_dec(rec_info);
-        ++seqno;
     }
 }
 
@@ -715,7 +1034,6 @@ hound_err ctx_next(struct hound_ctx *ctx, size_t n)
 {
     struct driver *drv;
     hound_err err;
-    size_t i;
     id_vec *ids;
     xhiter_t iter;
 
@@ -728,15 +1046,14 @@ hound_err ctx_next(struct hound_ctx *ctx, size_t n)
         drv = xh_key(ctx->on_demand_data_map, iter);
         ids = &xh_val(ctx->on_demand_data_map, iter);
 
-        for (i = 0; i < xv_size(*ids); ++i) {
-            err = driver_next(drv, xv_A(*ids, i), n);
-            if (err != HOUND_OK) {
-                hound_log_err(
-                    err,
-                    "ctx %p: driver %p failed next() call",
-                    (void *) ctx,
-                    (void *) drv);
-            }
+        /* Hand each driver all of its IDs at once. */
+        err = driver_next(drv, xv_data(*ids), xv_size(*ids), n);
+        if (err != HOUND_OK) {
+            hound_log_err(
+                err,
+                "ctx %p: driver %p failed next() call",
+                (void *) ctx,
+                (void *) drv);
         }
     );
     pthread_rwlock_unlock(&ctx->rwlock);
@@ -744,8 +1061,17 @@ hound_err ctx_next(struct hound_ctx *ctx, size_t n)
     return err;
 }
 
+/**
+ * Registers a reader of the context's queue.
+ *
+ * @param ctx a context
+ * @param consume true if the reader will pop records from the queue
+ * @param queue filled in with the context's queue
+ *
+ * @return an error code
+ */
 static
-void start_read(struct hound_ctx *ctx, struct queue **queue)
+hound_err start_read(struct hound_ctx *ctx, bool consume, struct queue **queue)
 {
     /*
      * It's safe to hold onto a reference to the queue without the lock because
@@ -753,35 +1079,45 @@ void start_read(struct hound_ctx *ctx, struct queue **queue)
      * context can't be freed while readers > 0. The context may be modified,
      * but that's all done using the queue lock and doesn't change the value of
      * ctx->queue.
+     *
+     * Register first, then check for async dispatch. ctx_start_async does the
+     * opposite, and both use sequentially consistent operations, so either we
+     * see the dispatcher or it sees us.
      */
-    pthread_rwlock_wrlock(&ctx->rwlock);
-    ++ctx->readers;
+    atomic_fetch_add(&ctx->readers, 1);
+    if (consume && atomic_load(&ctx->async)) {
+        /* The dispatcher owns the queue's records. */
+        atomic_fetch_sub(&ctx->readers, 1);
+        return HOUND_CTX_ASYNC;
+    }
     *queue = ctx->queue;
-    pthread_rwlock_unlock(&ctx->rwlock);
+
+    return HOUND_OK;
 }
 
 static
 void stop_read(struct hound_ctx *ctx)
 {
-    pthread_rwlock_wrlock(&ctx->rwlock);
-    --ctx->readers;
-    pthread_rwlock_unlock(&ctx->rwlock);
+    atomic_fetch_sub(&ctx->readers, 1);
 }
 
 hound_err ctx_read(struct hound_ctx *ctx, size_t records, size_t *read)
 {
     struct record_info *buf[DEQUEUE_BUF_SIZE];
     hound_err err;
-    hound_seqno first_seqno;
     bool interrupt;
     size_t pop_count;
     struct queue *queue;
+    hound_seqno seqnos[DEQUEUE_BUF_SIZE];
     size_t target;
     size_t total;
 
     NULL_CHECK(ctx);
 
-    start_read(ctx, &queue);
+    err = start_read(ctx, true, &queue);
+    if (err != HOUND_OK) {
+        return err;
+    }
 
     if (records > queue_max_len(queue)) {
         err = HOUND_QUEUE_TOO_SMALL;
@@ -796,11 +1132,12 @@ hound_err ctx_read(struct hound_ctx *ctx, size_t records, size_t *read)
             queue,
             buf,
             target,
-            &first_seqno,
+            seqnos,
             &interrupt);
-        process_callbacks(ctx, buf, first_seqno, pop_count);
+        process_callbacks(ctx, buf, seqnos, pop_count);
         total += pop_count;
-    } while (total < records && !interrupt);
+        /* Nothing popped means the queue is full yet empty, so give up. */
+    } while (total < records && !interrupt && pop_count > 0);
 
     if (interrupt) {
         err = HOUND_CTX_STOPPED;
@@ -819,53 +1156,98 @@ out:
 }
 
 /*
- * NB: There is no ctx_read_bytes function; this is deliberate. The
- * problem with such a function is that records are not guaranteed to be a fixed
- * size, and until a record is delivered, the driver does not necessarily know
- * how large the record for a given data ID will be. Thus there is no good way
- * to call driver_next for a given number of bytes.
- *
- * That said, it would be possible to implement a blocking queue_pop_bytes
- * function.  You could do something like this:
- *  - add a new property to each context indicating a guess of how many bytes
- *    per sample. initially set this property to something reasonably small but
- *    arbitrary. call this property "guess".
- *  - when doing ctx_read_bytes:
- *      - read target bytes / "guess" number of samples.
- *      - block waiting for that read to finish
- *      - check how many bytes you got. adjust "guess" according to this, erring
- *        on the low side because you don't want to read more bytes than
- *        requested. you would want to figure out a heuristic for how to adjust
- *        "guess" (always take the most recent guess, average the new guess and
- *        the old one, or something else?)
- *      - keep reading until you're done, continually adjusting "guess" based on
- *        how many bytes are in the samples you're getting.
-
- * Considering that the heuristic requered is non-obvious, this is clearly
- * complex, and you risk reading more samples than requested, let's not
- * implement ctx_read_bytes until there is a clear need for it. At that point,
- * perhaps concrete requirements will make it more obvious how it should be
- * implemented.
-*/
+ * Records are not a fixed size, and until a record is delivered, the driver
+ * does not necessarily know how large it will be, so we can't ask the drivers
+ * for a given number of bytes. Instead, the queue tracks how many payload bytes
+ * it holds, and we block until that reaches the number of bytes we still need.
+ */
+hound_err ctx_read_bytes(
+    struct hound_ctx *ctx,
+    size_t bytes,
+    const hound_data_period *timeout_ns,
+    size_t *records_read,
+    size_t *bytes_read)
+{
+    struct record_info *buf[DEQUEUE_BUF_SIZE];
+    size_t count;
+    struct timespec deadline;
+    hound_err err;
+    size_t max_bytes;
+    struct queue *queue;
+    size_t records;
+    hound_seqno seqnos[DEQUEUE_BUF_SIZE];
+    size_t total_bytes;
+    size_t total_records;
+
+    NULL_CHECK(ctx);
+    NULL_CHECK(records_read);
+    NULL_CHECK(bytes_read);
+
+    err = start_read(ctx, true, &queue);
+    if (err != HOUND_OK) {
+        return err;
+    }
+
+    max_bytes = queue_max_bytes(queue);
+    if (max_bytes != 0 && bytes > max_bytes) {
+        err = HOUND_QUEUE_TOO_SMALL;
+        goto out;
+    }
+
+    if (timeout_ns != NULL) {
+        get_deadline(*timeout_ns, &deadline);
+    }
+
+    total_bytes = 0;
+    total_records = 0;
+    do {
+        count = queue_pop_bytes(
+            queue,
+            buf,
+            ARRAYLEN(buf),
+            bytes - total_bytes,
+            timeout_ns != NULL ? &deadline : NULL,
+            seqnos,
+            &records,
+            &err);
+        process_callbacks(ctx, buf, seqnos, records);
+
+        total_records += records;
+        total_bytes += count;
+    } while (err == HOUND_OK &&
+             records == ARRAYLEN(buf) &&
+             total_bytes < bytes);
+
+    *bytes_read = total_bytes;
+    *records_read = total_records;
+
+out:
+    stop_read(ctx);
+    return err;
+}
 
 hound_err ctx_read_nowait(struct hound_ctx *ctx, size_t records, size_t *read)
 {
     struct record_info *buf[DEQUEUE_BUF_SIZE];
     size_t count;
-    hound_seqno first_seqno;
+    hound_err err;
     struct queue *queue;
+    hound_seqno seqnos[DEQUEUE_BUF_SIZE];
     size_t total;
     size_t target;
 
     NULL_CHECK(ctx);
 
-    start_read(ctx, &queue);
+    err = start_read(ctx, true, &queue);
+    if (err != HOUND_OK) {
+        return err;
+    }
 
     total = 0;
     do {
         target = min(records - total, ARRAYLEN(buf));
-        count = queue_pop_records_nowait(queue, buf, &first_seqno, target);
-        process_callbacks(ctx, buf, first_seqno, count);
+        count = queue_pop_records_nowait(queue, buf, seqnos, target);
+        process_callbacks(ctx, buf, seqnos, count);
         total += count;
     } while (count == target && total < records);
     *read = total;
@@ -883,33 +1265,35 @@ hound_err ctx_read_bytes_nowait(
 {
     struct record_info *buf[DEQUEUE_BUF_SIZE];
     size_t count;
-    hound_seqno first_seqno;
+    hound_err err;
     struct queue *queue;
     size_t records;
+    hound_seqno seqnos[DEQUEUE_BUF_SIZE];
     size_t total_bytes;
     size_t total_records;
-    size_t target;
 
     NULL_CHECK(ctx);
 
-    start_read(ctx, &queue);
+    err = start_read(ctx, true, &queue);
+    if (err != HOUND_OK) {
+        return err;
+    }
 
     total_bytes = 0;
     total_records = 0;
     do {
-        target = min(bytes - total_bytes, sizeof(buf));
-
         count = queue_pop_bytes_nowait(
             queue,
             buf,
-            target,
-            &first_seqno,
+            ARRAYLEN(buf),
+            bytes - total_bytes,
+            seqnos,
             &records);
-        process_callbacks(ctx, buf, first_seqno, records);
+        process_callbacks(ctx, buf, seqnos, records);
 
         total_records += records;
         total_bytes += count;
-    } while (count == target && total_bytes < bytes);
+    } while (records == ARRAYLEN(buf) && total_bytes < bytes);
 
     *bytes_read = total_bytes;
     *records_read = total_records;
@@ -945,3 +1329,223 @@ hound_err ctx_max_queue_length(struct hound_ctx *ctx, size_t *count)
 
     return HOUND_OK;
 }
+
+hound_err ctx_queue_bytes(struct hound_ctx *ctx, size_t *bytes)
+{
+    NULL_CHECK(ctx);
+
+    pthread_rwlock_rdlock(&ctx->rwlock);
+    *bytes = queue_bytes(ctx->queue);
+    pthread_rwlock_unlock(&ctx->rwlock);
+
+    return HOUND_OK;
+}
+
+hound_err ctx_max_queue_bytes(struct hound_ctx *ctx, size_t *bytes)
+{
+    NULL_CHECK(ctx);
+
+    pthread_rwlock_rdlock(&ctx->rwlock);
+    *bytes = queue_max_bytes(ctx->queue);
+    pthread_rwlock_unlock(&ctx->rwlock);
+
+    return HOUND_OK;
+}
+
+hound_err ctx_get_fd(struct hound_ctx *ctx, size_t watermark, int *fd)
+{
+    hound_err err;
+
+    NULL_CHECK(ctx);
+    NULL_CHECK(fd);
+
+    if (watermark == 0) {
+        return HOUND_INVALID_VAL;
+    }
+
+    pthread_rwlock_rdlock(&ctx->rwlock);
+    if (watermark > queue_max_len(ctx->queue)) {
+        err = HOUND_QUEUE_TOO_SMALL;
+    }
+    else {
+        err = queue_get_fd(ctx->queue, watermark, fd);
+    }
+    pthread_rwlock_unlock(&ctx->rwlock);
+
+    return err;
+}
+
+hound_err ctx_filter_stats(
+    struct hound_ctx *ctx,
+    struct hound_filter_stats *stats)
+{
+    NULL_CHECK(ctx);
+    NULL_CHECK(stats);
+
+    pthread_rwlock_rdlock(&ctx->rwlock);
+    queue_filter_stats(ctx->queue, stats);
+    pthread_rwlock_unlock(&ctx->rwlock);
+
+    return HOUND_OK;
+}
+
+hound_err ctx_set_spin(
+    struct hound_ctx *ctx,
+    hound_data_period read_spin_ns,
+    hound_data_period io_spin_ns)
+{
+    NULL_CHECK(ctx);
+
+    /* Spinning for longer than this can't be what anyone wants. */
+    if (read_spin_ns > NSEC_PER_SEC || io_spin_ns > NSEC_PER_SEC) {
+        return HOUND_INVALID_VAL;
+    }
+
+    pthread_rwlock_wrlock(&ctx->rwlock);
+    queue_set_spin(ctx->queue, read_spin_ns);
+    if (ctx->active && ctx->io_spin.ns > 0) {
+        io_remove_spin(&ctx->io_spin);
+    }
+    ctx->io_spin.ns = io_spin_ns;
+    if (ctx->active && ctx->io_spin.ns > 0) {
+        io_add_spin(&ctx->io_spin);
+    }
+    pthread_rwlock_unlock(&ctx->rwlock);
+
+    return HOUND_OK;
+}
+
+hound_err ctx_set_join(struct hound_ctx *ctx, const struct hound_join_rq *rq)
+{
+    hound_err err;
+    struct join *join;
+
+    NULL_CHECK(ctx);
+
+    if (rq != NULL) {
+        err = join_alloc(rq, &join);
+        if (err != HOUND_OK) {
+            return err;
+        }
+    }
+    else {
+        join = NULL;
+    }
+
+    pthread_rwlock_rdlock(&ctx->rwlock);
+    queue_set_join(ctx->queue, join);
+    pthread_rwlock_unlock(&ctx->rwlock);
+
+    return HOUND_OK;
+}
+
+hound_err ctx_join_stats(struct hound_ctx *ctx, struct hound_join_stats *stats)
+{
+    NULL_CHECK(ctx);
+    NULL_CHECK(stats);
+
+    pthread_rwlock_rdlock(&ctx->rwlock);
+    queue_join_stats(ctx->queue, stats);
+    pthread_rwlock_unlock(&ctx->rwlock);
+
+    return HOUND_OK;
+}
+
+hound_err ctx_set_resample(
+    struct hound_ctx *ctx,
+    const struct hound_resample_rq *rq)
+{
+    hound_err err;
+    struct resample *resample;
+
+    NULL_CHECK(ctx);
+
+    if (rq != NULL) {
+        err = resample_alloc(rq, &resample);
+        if (err != HOUND_OK) {
+            return err;
+        }
+    }
+    else {
+        resample = NULL;
+    }
+
+    pthread_rwlock_rdlock(&ctx->rwlock);
+    queue_set_resample(ctx->queue, resample);
+    pthread_rwlock_unlock(&ctx->rwlock);
+
+    return HOUND_OK;
+}
+
+hound_err ctx_resample_stats(
+    struct hound_ctx *ctx,
+    struct hound_resample_stats *stats)
+{
+    NULL_CHECK(ctx);
+    NULL_CHECK(stats);
+
+    pthread_rwlock_rdlock(&ctx->rwlock);
+    queue_resample_stats(ctx->queue, stats);
+    pthread_rwlock_unlock(&ctx->rwlock);
+
+    return HOUND_OK;
+}
+
+hound_err ctx_set_retention(
+    struct hound_ctx *ctx,
+    size_t max_records,
+    hound_data_period max_age)
+{
+    hound_err err;
+
+    NULL_CHECK(ctx);
+
+    pthread_rwlock_rdlock(&ctx->rwlock);
+    err = queue_set_retention(ctx->queue, max_records, max_age);
+    pthread_rwlock_unlock(&ctx->rwlock);
+
+    return err;
+}
+
+hound_err ctx_query_range(
+    struct hound_ctx *ctx,
+    const struct timespec *start,
+    const struct timespec *end,
+    hound_cb cb,
+    void *cb_ctx,
+    size_t *read)
+{
+    size_t count;
+    hound_err err;
+    struct queue *queue;
+
+    NULL_CHECK(ctx);
+    NULL_CHECK(start);
+    NULL_CHECK(end);
+
+    if (cb == NULL) {
+        return HOUND_MISSING_CALLBACK;
+    }
+
+    if (start->tv_sec > end->tv_sec ||
+        (start->tv_sec == end->tv_sec && start->tv_nsec > end->tv_nsec)) {
+        return HOUND_INVALID_VAL;
+    }
+
+    /* Queries don't consume records, so they work in async mode too. */
+    err = start_read(ctx, false, &queue);
+    if (err != HOUND_OK) {
+        return err;
+    }
+    err = queue_query_range(queue, start, end, cb, cb_ctx, &count);
+    stop_read(ctx);
+    if (err != HOUND_OK) {
+        return err;
+    }
+
+    if (read != NULL) {
+        *read = count;
+    }
+
+    return HOUND_OK;
+}
@@ -0,0 +1,348 @@
+/**
+ * @file      decode.c
+ * @brief     Compiled record decoders. Each data descriptor gets a decoder when
+ *            its driver is initialized, which maps every data format to an
+ *            extraction loop specialized for its type. Decoding a batch then
+ *            runs one tight loop per format, writing each field into its own
+ *            column of doubles, rather than interpreting the formats for every
+ *            field of every record.
+ * @author    Martin Kelly <mkelly@xevo.com>
+ * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
+ */
+
+#include <hound/hound.h>
+#include <hound-private/decode.h>
+#include <hound-private/error.h>
+#include <hound-private/util.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef void (*decode_func)(
+    const struct hound_record *records,
+    size_t n,
+    size_t offset,
+    double *out);
+
+typedef void (*encode_func)(double val, unsigned char *out);
+
+struct decode_field {
+    /* NULL for formats that can't be converted to a double. */
+    decode_func func;
+
+    /* NULL for formats that can't be converted from a double. */
+    encode_func encode;
+    size_t offset;
+};
+
+struct hound_decoder {
+    /* The smallest record size that contains all fixed-size fields. */
+    size_t min_size;
+    size_t field_count;
+    struct decode_field fields[];
+};
+
+/*
+ * Record data has no alignment guarantees, so we memcpy each field out rather
+ * than casting a pointer to it.
+ */
+#define DEFINE_DECODE_FUNC(name, type) \
+    static \
+    void decode_##name( \
+        const struct hound_record *records, \
+        size_t n, \
+        size_t offset, \
+        double *out) \
+    { \
+        size_t i; \
+        type val; \
+        \
+        for (i = 0; i < n; ++i) { \
+            memcpy(&val, records[i].data + offset, sizeof(val)); \
+            out[i] = val; \
+        } \
+    }
+
+DEFINE_DECODE_FUNC(double, double)
+DEFINE_DECODE_FUNC(float, float)
+DEFINE_DECODE_FUNC(int8, int8_t)
+DEFINE_DECODE_FUNC(uint8, uint8_t)
+DEFINE_DECODE_FUNC(int16, int16_t)
+DEFINE_DECODE_FUNC(uint16, uint16_t)
+DEFINE_DECODE_FUNC(int32, int32_t)
+DEFINE_DECODE_FUNC(uint32, uint32_t)
+DEFINE_DECODE_FUNC(int64, int64_t)
+DEFINE_DECODE_FUNC(uint64, uint64_t)
+
+/*
+ * Integers are rounded to the nearest value and clamped to the range of their
+ * type. NaN has no sensible integer value, so it leaves the field alone.
+ */
+#define DEFINE_ENCODE_INT_FUNC(name, type, lo, hi) \
+    static \
+    void encode_##name(double val, unsigned char *out) \
+    { \
+        type i; \
+        \
+        if (val != val) { \
+            return; \
+        } \
+        \
+        if (val <= (double) (lo)) { \
+            i = (lo); \
+        } \
+        else if (val >= (double) (hi)) { \
+            i = (hi); \
+        } \
+        else if (val >= 0) { \
+            i = (type) (val + 0.5); \
+        } \
+        else { \
+            i = (type) (val - 0.5); \
+        } \
+        memcpy(out, &i, sizeof(i)); \
+    }
+
+DEFINE_ENCODE_INT_FUNC(int8, int8_t, INT8_MIN, INT8_MAX)
+DEFINE_ENCODE_INT_FUNC(uint8, uint8_t, 0, UINT8_MAX)
+DEFINE_ENCODE_INT_FUNC(int16, int16_t, INT16_MIN, INT16_MAX)
+DEFINE_ENCODE_INT_FUNC(uint16, uint16_t, 0, UINT16_MAX)
+DEFINE_ENCODE_INT_FUNC(int32, int32_t, INT32_MIN, INT32_MAX)
+DEFINE_ENCODE_INT_FUNC(uint32, uint32_t, 0, UINT32_MAX)
+DEFINE_ENCODE_INT_FUNC(int64, int64_t, INT64_MIN, INT64_MAX)
+DEFINE_ENCODE_INT_FUNC(uint64, uint64_t, 0, UINT64_MAX)
+
+static
+void encode_double(double val, unsigned char *out)
+{
+    memcpy(out, &val, sizeof(val));
+}
+
+static
+void encode_float(double val, unsigned char *out)
+{
+    float f;
+
+    f = val;
+    memcpy(out, &f, sizeof(f));
+}
+
+static
+void decode_bool(
+    const struct hound_record *records,
+    size_t n,
+    size_t offset,
+    double *out)
+{
+    size_t i;
+
+    for (i = 0; i < n; ++i) {
+        out[i] = records[i].data[offset] != 0;
+    }
+}
+
+static
+decode_func get_decode_func(hound_type type)
+{
+    switch (type) {
+        case HOUND_TYPE_BOOL:
+            return decode_bool;
+        case HOUND_TYPE_FLOAT:
+            return decode_float;
+        case HOUND_TYPE_DOUBLE:
+            return decode_double;
+        case HOUND_TYPE_INT8:
+            return decode_int8;
+        case HOUND_TYPE_UINT8:
+            return decode_uint8;
+        case HOUND_TYPE_INT16:
+            return decode_int16;
+        case HOUND_TYPE_UINT16:
+            return decode_uint16;
+        case HOUND_TYPE_INT32:
+            return decode_int32;
+        case HOUND_TYPE_UINT32:
+            return decode_uint32;
+        case HOUND_TYPE_INT64:
+            return decode_int64;
+        case HOUND_TYPE_UINT64:
+            return decode_uint64;
+        case HOUND_TYPE_BYTES:
+            return NULL;
+    }
+
+    XASSERT_ERROR;
+}
+
+static
+encode_func get_encode_func(hound_type type)
+{
+    switch (type) {
+        case HOUND_TYPE_FLOAT:
+            return encode_float;
+        case HOUND_TYPE_DOUBLE:
+            return encode_double;
+        case HOUND_TYPE_INT8:
+            return encode_int8;
+        case HOUND_TYPE_UINT8:
+            return encode_uint8;
+        case HOUND_TYPE_INT16:
+            return encode_int16;
+        case HOUND_TYPE_UINT16:
+            return encode_uint16;
+        case HOUND_TYPE_INT32:
+            return encode_int32;
+        case HOUND_TYPE_UINT32:
+            return encode_uint32;
+        case HOUND_TYPE_INT64:
+            return encode_int64;
+        case HOUND_TYPE_UINT64:
+            return encode_uint64;
+        case HOUND_TYPE_BOOL:
+        case HOUND_TYPE_BYTES:
+            return NULL;
+    }
+
+    XASSERT_ERROR;
+}
+
+hound_err decoder_alloc(
+    size_t fmt_count,
+    const struct hound_data_fmt *fmts,
+    struct hound_decoder **out_decoder)
+{
+    struct hound_decoder *decoder;
+    const struct hound_data_fmt *fmt;
+    struct decode_field *field;
+    size_t i;
+
+    XASSERT_NOT_NULL(fmts);
+    XASSERT_NOT_NULL(out_decoder);
+
+    decoder = malloc(sizeof(*decoder) + fmt_count*sizeof(*decoder->fields));
+    if (decoder == NULL) {
+        return HOUND_OOM;
+    }
+
+    decoder->min_size = 0;
+    decoder->field_count = fmt_count;
+    for (i = 0; i < fmt_count; ++i) {
+        fmt = &fmts[i];
+        field = &decoder->fields[i];
+        field->offset = fmt->offset;
+        field->func = get_decode_func(fmt->type);
+        field->encode = get_encode_func(fmt->type);
+        decoder->min_size = max(decoder->min_size, fmt->offset + fmt->size);
+    }
+
+    *out_decoder = decoder;
+
+    return HOUND_OK;
+}
+
+void decoder_free(struct hound_decoder *decoder)
+{
+    free(decoder);
+}
+
+hound_err decoder_decode_batch(
+    const struct hound_datadesc *desc,
+    const struct hound_record *records,
+    size_t n,
+    double **columns)
+{
+    const struct hound_decoder *decoder;
+    const struct decode_field *field;
+    size_t i;
+
+    NULL_CHECK(desc);
+    NULL_CHECK(records);
+    NULL_CHECK(columns);
+
+    decoder = desc->decoder;
+    if (decoder == NULL) {
+        return HOUND_INVALID_VAL;
+    }
+
+    /* Validate everything up-front, so the decode loops need no checks. */
+    for (i = 0; i < decoder->field_count; ++i) {
+        if (columns[i] != NULL && decoder->fields[i].func == NULL) {
+            return HOUND_INVALID_VAL;
+        }
+    }
+    for (i = 0; i < n; ++i) {
+        if (records[i].data_id != desc->data_id ||
+            records[i].size < decoder->min_size) {
+            return HOUND_INVALID_VAL;
+        }
+        if (records[i].data == NULL && records[i].size > 0) {
+            return HOUND_NULL_VAL;
+        }
+    }
+
+    for (i = 0; i < decoder->field_count; ++i) {
+        if (columns[i] == NULL) {
+            continue;
+        }
+        field = &decoder->fields[i];
+        field->func(records, n, field->offset, columns[i]);
+    }
+
+    return HOUND_OK;
+}
+
+size_t decoder_field_count(const struct hound_decoder *decoder)
+{
+    XASSERT_NOT_NULL(decoder);
+
+    return decoder->field_count;
+}
+
+bool decoder_decode_record(
+    const struct hound_decoder *decoder,
+    const struct hound_record *record,
+    double *values)
+{
+    const struct decode_field *field;
+    size_t i;
+
+    XASSERT_NOT_NULL(decoder);
+    XASSERT_NOT_NULL(record);
+    XASSERT_NOT_NULL(values);
+
+    if (record->size < decoder->min_size ||
+        (record->data == NULL && record->size > 0)) {
+        return false;
+    }
+
+    for (i = 0; i < decoder->field_count; ++i) {
+        field = &decoder->fields[i];
+        if (field->func != NULL) {
+            field->func(record, 1, field->offset, &values[i]);
+        }
+    }
+
+    return true;
+}
+
+void decoder_encode_record(
+    const struct hound_decoder *decoder,
+    const double *values,
+    struct hound_record *record)
+{
+    const struct decode_field *field;
+    size_t i;
+
+    XASSERT_NOT_NULL(decoder);
+    XASSERT_NOT_NULL(values);
+    XASSERT_NOT_NULL(record);
+    XASSERT_GTE(record->size, decoder->min_size);
+
+    for (i = 0; i < decoder->field_count; ++i) {
+        field = &decoder->fields[i];
+        if (field->encode != NULL) {
+            field->encode(values[i], record->data + field->offset);
+        }
+    }
+}
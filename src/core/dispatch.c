@@ -0,0 +1,368 @@
+/**
+ * @file      dispatch.c
+ * @brief     Asynchronous callback dispatch. A pump thread consumes a context's
+ *            queue and hands each record to one of a pool of worker threads,
+ *            which run the user callback. Records are sharded across workers
+ *            by device ID and data ID, so records for the same data are
+ *            delivered in order, while different data can be delivered in
+ *            parallel. Each worker has a bounded FIFO; when it fills up, the
+ *            pump stops consuming the queue, so a slow consumer makes the queue
+ *            back up (and eventually overflow) just like a slow reader would.
+ * @author    Martin Kelly <mkelly@xevo.com>
+ * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
+ */
+
+#include <hound/hound.h>
+#include <hound-private/dispatch.h>
+#include <hound-private/error.h>
+#include <hound-private/queue.h>
+#include <hound-private/rt.h>
+#include <hound-private/trace.h>
+#include <hound-private/util.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+/* The max number of records the pump takes from the queue at once. */
+#define PUMP_BUF_SIZE 64
+
+/* The max number of records a worker takes from its FIFO at once. */
+#define WORKER_BATCH_SIZE 64
+
+struct pending {
+    struct record_info *rec;
+    hound_seqno seqno;
+};
+
+struct worker {
+    struct dispatch *dispatch;
+    pthread_t thread;
+    struct rt_thread rt;
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    bool stop;
+    size_t front;
+    size_t len;
+    struct pending *fifo;
+};
+
+struct dispatch {
+    struct queue *queue;
+    pthread_t pump;
+    struct rt_thread pump_rt;
+    atomic_bool stop;
+
+    pthread_mutex_t cb_lock;
+    hound_cb cb;
+    void *cb_ctx;
+
+    size_t max_pending;
+    size_t worker_count;
+    struct worker *workers;
+};
+
+static
+void get_cb(struct dispatch *dispatch, hound_cb *cb, void **cb_ctx)
+{
+    /* The callback can be changed via ctx_modify. */
+    lock_mutex(&dispatch->cb_lock);
+    *cb = dispatch->cb;
+    *cb_ctx = dispatch->cb_ctx;
+    unlock_mutex(&dispatch->cb_lock);
+}
+
+static
+void *worker_thread(void *data)
+{
+    struct pending batch[WORKER_BATCH_SIZE];
+    hound_cb cb;
+    void *cb_ctx;
+    size_t count;
+    size_t i;
+    struct worker *worker;
+
+    worker = data;
+
+    lock_mutex(&worker->mutex);
+    while (true) {
+        while (worker->len == 0 && !worker->stop) {
+            cond_wait(&worker->not_empty, &worker->mutex);
+        }
+        if (worker->len == 0) {
+            /* We were stopped and have nothing left to deliver. */
+            break;
+        }
+
+        count = min(worker->len, ARRAYLEN(batch));
+        for (i = 0; i < count; ++i) {
+            batch[i] = worker->fifo[
+                (worker->front + i) % worker->dispatch->max_pending];
+        }
+        worker->front = (worker->front + count) % worker->dispatch->max_pending;
+        worker->len -= count;
+        cond_signal(&worker->not_full);
+        unlock_mutex(&worker->mutex);
+
+        get_cb(worker->dispatch, &cb, &cb_ctx);
+        for (i = 0; i < count; ++i) {
+            HOUND_TRACE_CB(
+                callback_entry,
+                &batch[i].rec->record,
+                batch[i].seqno);
+            cb(&batch[i].rec->record, batch[i].seqno, cb_ctx);
+            HOUND_TRACE_CB(
+                callback_exit,
+                &batch[i].rec->record,
+                batch[i].seqno);
+            record_ref_dec(batch[i].rec);
+        }
+
+        lock_mutex(&worker->mutex);
+    }
+    unlock_mutex(&worker->mutex);
+
+    return NULL;
+}
+
+static
+struct worker *get_worker(
+    struct dispatch *dispatch,
+    const struct hound_record *record)
+{
+    uint_fast32_t hash;
+
+    /* Shard by (dev_id, data_id) so each data stream stays in order. */
+    hash = (uint_fast32_t) record->data_id * 2654435761u;
+    hash ^= record->dev_id;
+
+    return &dispatch->workers[hash % dispatch->worker_count];
+}
+
+static
+void dispatch_record(
+    struct dispatch *dispatch,
+    struct record_info *rec,
+    hound_seqno seqno)
+{
+    size_t back;
+    struct worker *worker;
+
+    worker = get_worker(dispatch, &rec->record);
+
+    lock_mutex(&worker->mutex);
+    while (worker->len == dispatch->max_pending) {
+        /* Backpressure: wait for the worker to catch up. */
+        cond_wait(&worker->not_full, &worker->mutex);
+    }
+    back = (worker->front + worker->len) % dispatch->max_pending;
+    worker->fifo[back].rec = rec;
+    worker->fifo[back].seqno = seqno;
+    ++worker->len;
+    cond_signal(&worker->not_empty);
+    unlock_mutex(&worker->mutex);
+}
+
+static
+void *pump_thread(void *data)
+{
+    struct record_info *buf[PUMP_BUF_SIZE];
+    size_t count;
+    struct dispatch *dispatch;
+    size_t i;
+    bool interrupt;
+    hound_seqno seqnos[PUMP_BUF_SIZE];
+
+    dispatch = data;
+    while (true) {
+        /* Block until at least one record is ready, then grab what we can. */
+        count = queue_pop_records(
+            dispatch->queue,
+            buf,
+            1,
+            seqnos,
+            &interrupt);
+        for (i = 0; i < count; ++i) {
+            dispatch_record(dispatch, buf[i], seqnos[i]);
+        }
+        if (interrupt) {
+            if (atomic_load(&dispatch->stop)) {
+                break;
+            }
+            continue;
+        }
+
+        count = queue_pop_records_nowait(
+            dispatch->queue,
+            buf,
+            seqnos,
+            ARRAYLEN(buf));
+        for (i = 0; i < count; ++i) {
+            dispatch_record(dispatch, buf[i], seqnos[i]);
+        }
+    }
+
+    return NULL;
+}
+
+static
+void stop_workers(struct dispatch *dispatch, size_t count)
+{
+    size_t i;
+    int ret;
+    struct worker *worker;
+
+    for (i = 0; i < count; ++i) {
+        worker = &dispatch->workers[i];
+        lock_mutex(&worker->mutex);
+        worker->stop = true;
+        cond_signal(&worker->not_empty);
+        unlock_mutex(&worker->mutex);
+    }
+
+    for (i = 0; i < count; ++i) {
+        worker = &dispatch->workers[i];
+        rt_remove_thread(&worker->rt);
+        ret = pthread_join(worker->thread, NULL);
+        XASSERT_EQ(ret, 0);
+    }
+}
+
+static
+void destroy_workers(struct dispatch *dispatch, size_t count)
+{
+    size_t i;
+    struct worker *worker;
+
+    for (i = 0; i < count; ++i) {
+        worker = &dispatch->workers[i];
+        XASSERT_EQ(worker->len, 0);
+        destroy_cond(&worker->not_full);
+        destroy_cond(&worker->not_empty);
+        destroy_mutex(&worker->mutex);
+        free(worker->fifo);
+    }
+    free(dispatch->workers);
+}
+
+hound_err dispatch_start(
+    struct queue *queue,
+    size_t workers,
+    size_t max_pending,
+    hound_cb cb,
+    void *cb_ctx,
+    struct dispatch **out_dispatch)
+{
+    struct dispatch *dispatch;
+    hound_err err;
+    size_t i;
+    int ret;
+    size_t started;
+    struct worker *worker;
+
+    XASSERT_NOT_NULL(queue);
+    XASSERT_GT(workers, 0);
+    XASSERT_GT(max_pending, 0);
+    XASSERT_NOT_NULL(cb);
+    XASSERT_NOT_NULL(out_dispatch);
+
+    dispatch = malloc(sizeof(*dispatch));
+    if (dispatch == NULL) {
+        err = HOUND_OOM;
+        goto error_alloc_dispatch;
+    }
+
+    dispatch->queue = queue;
+    atomic_init(&dispatch->stop, false);
+    init_mutex(&dispatch->cb_lock);
+    dispatch->cb = cb;
+    dispatch->cb_ctx = cb_ctx;
+    dispatch->max_pending = max_pending;
+    dispatch->worker_count = workers;
+
+    dispatch->workers = malloc(workers * sizeof(*dispatch->workers));
+    if (dispatch->workers == NULL) {
+        err = HOUND_OOM;
+        goto error_alloc_workers;
+    }
+
+    for (i = 0; i < workers; ++i) {
+        worker = &dispatch->workers[i];
+        worker->fifo = malloc(max_pending * sizeof(*worker->fifo));
+        if (worker->fifo == NULL) {
+            err = HOUND_OOM;
+            goto error_alloc_fifo;
+        }
+        worker->dispatch = dispatch;
+        init_mutex(&worker->mutex);
+        init_cond(&worker->not_empty);
+        init_cond(&worker->not_full);
+        worker->stop = false;
+        worker->front = 0;
+        worker->len = 0;
+    }
+
+    for (started = 0; started < workers; ++started) {
+        worker = &dispatch->workers[started];
+        ret = pthread_create(&worker->thread, NULL, worker_thread, worker);
+        if (ret != 0) {
+            err = HOUND_OOM;
+            goto error_create_workers;
+        }
+        rt_add_thread(&worker->rt, worker->thread);
+    }
+
+    ret = pthread_create(&dispatch->pump, NULL, pump_thread, dispatch);
+    if (ret != 0) {
+        err = HOUND_OOM;
+        goto error_create_pump;
+    }
+    rt_add_thread(&dispatch->pump_rt, dispatch->pump);
+
+    *out_dispatch = dispatch;
+
+    return HOUND_OK;
+
+error_create_pump:
+error_create_workers:
+    stop_workers(dispatch, started);
+    destroy_workers(dispatch, workers);
+    goto error_alloc_workers;
+error_alloc_fifo:
+    destroy_workers(dispatch, i);
+error_alloc_workers:
+    destroy_mutex(&dispatch->cb_lock);
+    free(dispatch);
+error_alloc_dispatch:
+    return err;
+}
+
+void dispatch_stop(struct dispatch *dispatch)
+{
+    int ret;
+
+    XASSERT_NOT_NULL(dispatch);
+
+    /* Stop the pump first, so the workers can drain whatever it gave them. */
+    atomic_store(&dispatch->stop, true);
+    queue_interrupt(dispatch->queue);
+    rt_remove_thread(&dispatch->pump_rt);
+    ret = pthread_join(dispatch->pump, NULL);
+    XASSERT_EQ(ret, 0);
+
+    stop_workers(dispatch, dispatch->worker_count);
+    destroy_workers(dispatch, dispatch->worker_count);
+    destroy_mutex(&dispatch->cb_lock);
+    free(dispatch);
+}
+
+void dispatch_set_cb(struct dispatch *dispatch, hound_cb cb, void *cb_ctx)
+{
+    XASSERT_NOT_NULL(dispatch);
+
+    lock_mutex(&dispatch->cb_lock);
+    dispatch->cb = cb;
+    dispatch->cb_ctx = cb_ctx;
+    unlock_mutex(&dispatch->cb_lock);
+}
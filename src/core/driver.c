@@ -7,14 +7,18 @@
 
 #define _POSIX_C_SOURCE 200809L
 #include <hound/hound.h>
+#include <hound-private/decode.h>
 #include <hound-private/driver.h>
 #include <hound-private/driver-ops.h>
 #include <hound-private/error.h>
+#include <hound-private/filter.h>
 #include <hound-private/io.h>
 #include <hound-private/log.h>
 #include <hound-private/parse/schema.h>
+#include <hound-private/rt.h>
 #include <hound-private/util.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
@@ -25,6 +29,9 @@
 
 #define FD_INVALID (-1)
 
+/* How much to read at once for drivers that don't tell us. */
+#define DEFAULT_READ_SIZE (100*1024)
+
 /* driver name --> driver ops */
 XHASH_MAP_INIT_STR(OPS_MAP, const struct driver_ops *)
 static xhash_t(OPS_MAP) *s_ops_map = NULL;
@@ -33,12 +40,41 @@ static xhash_t(OPS_MAP) *s_ops_map = NULL;
 XHASH_MAP_INIT_STR(DEVICE_MAP, struct driver *)
 static xhash_t(DEVICE_MAP) *s_device_map = NULL;
 
-/* data ID --> driver */
-XHASH_MAP_INIT_INT64(DATA_MAP, struct driver *)
+/* data ID --> the driver that owns it, and the descriptor for it */
+struct data_owner {
+    struct driver *drv;
+    const struct hound_datadesc *desc;
+};
+XHASH_MAP_INIT_INT64(DATA_MAP, struct data_owner)
 static xhash_t(DATA_MAP) *s_data_map;
 
+/* device paths of drivers that are in the middle of initializing */
+XHASH_SET_INIT_STR(PENDING_SET)
+static xhash_t(PENDING_SET) *s_pending_set = NULL;
+
 XVEC_DEFINE(data_rq_vec, struct hound_data_rq);
 
+/* A data request active on a driver, shared by all the contexts using it. */
+struct data {
+    refcount_val refcount;
+    struct hound_data_rq rq;
+};
+
+XVEC_DEFINE(data_vec, struct data);
+
+/*
+ * data ID --> the active requests for that ID, one per period. Most IDs are
+ * active at only one or two periods, so these lists are short.
+ */
+XHASH_MAP_INIT_INT(ACTIVE_DATA_MAP, data_vec)
+
+struct active_data {
+    xhash_t(ACTIVE_DATA_MAP) *map;
+
+    /* The number of active requests across all data IDs. */
+    size_t count;
+};
+
 /* Forward declaration. */
 hound_err driver_destroy_nolock(const char *path);
 
@@ -52,6 +88,8 @@ void driver_init_statics(void)
     XASSERT_NOT_NULL(s_device_map);
     s_ops_map = xh_init(OPS_MAP);
     XASSERT_NOT_NULL(s_ops_map);
+    s_pending_set = xh_init(PENDING_SET);
+    XASSERT_NOT_NULL(s_pending_set);
 }
 
 void driver_destroy_statics(void)
@@ -64,6 +102,7 @@ void driver_destroy_statics(void)
     );
     xh_destroy(DEVICE_MAP, s_device_map);
     xh_destroy(DATA_MAP, s_data_map);
+    xh_destroy(PENDING_SET, s_pending_set);
 }
 
 PUBLIC_API
@@ -123,6 +162,29 @@ hound_err driver_get_dev_name(hound_dev_id id, const char **name)
     return err;
 }
 
+hound_err driver_fill_pools(size_t count)
+{
+    struct driver *drv;
+    hound_err err;
+    hound_err err2;
+
+    err = HOUND_OK;
+    pthread_rwlock_rdlock(&s_driver_rwlock);
+    xh_foreach_value(s_device_map, drv,
+        lock_mutex(&drv->op_lock);
+        if (drv->read_pool != NULL) {
+            err2 = chunk_pool_fill(drv->read_pool, count);
+            if (err2 != HOUND_OK) {
+                err = err2;
+            }
+        }
+        unlock_mutex(&drv->op_lock);
+    );
+    pthread_rwlock_unlock(&s_driver_rwlock);
+
+    return err;
+}
+
 hound_err driver_get_datadescs(struct hound_datadesc **descs, size_t *len)
 {
     struct driver *drv;
@@ -183,16 +245,12 @@ void driver_free_datadescs(struct hound_datadesc *descs)
     free(descs);
 }
 
-static hound_dev_id s_next_dev_id = 0;
+/* Drivers initialize in parallel, so this is atomic. */
+static _Atomic hound_dev_id s_next_dev_id = 0;
 static
 hound_dev_id next_dev_id(void)
 {
-    hound_dev_id id;
-
-    /* Must be called with the driver lock held. */
-    id = s_next_dev_id;
-    ++s_next_dev_id;
-    return id;
+    return atomic_fetch_add(&s_next_dev_id, 1);
 }
 
 size_t get_type_size(hound_type type)
@@ -251,6 +309,7 @@ void copy_desc(
     datadesc->avail_periods = drv_desc->avail_periods;
     datadesc->fmt_count = schema_desc->fmt_count;
     datadesc->fmts = schema_desc->fmts;
+    datadesc->decoder = NULL;
     drv_desc->avail_periods = NULL;
     schema_desc->name = NULL;
     schema_desc->fmt_count = 0;
@@ -273,6 +332,155 @@ bool driver_is_push_mode(const struct driver *drv)
     return drv->ops.poll == drv_default_push;
 }
 
+static
+void drv_destroy_desc(struct hound_datadesc *desc)
+{
+    drv_free((void *) desc->name);
+    drv_free((void *) desc->avail_periods);
+    destroy_desc_fmts(desc->fmt_count, desc->fmts);
+    decoder_free((struct hound_decoder *) desc->decoder);
+}
+
+/**
+ * Claims a device path for a driver that is being initialized, so that no one
+ * else initializes a driver at the same path in the meantime. This must be
+ * called with the driver lock held for writing.
+ */
+static
+hound_err claim_path(const char *path)
+{
+    xhiter_t iter;
+    int ret;
+
+    iter = xh_get(DEVICE_MAP, s_device_map, path);
+    if (iter != xh_end(s_device_map)) {
+        return HOUND_DRIVER_ALREADY_PRESENT;
+    }
+
+    iter = xh_get(PENDING_SET, s_pending_set, path);
+    if (iter != xh_end(s_pending_set)) {
+        return HOUND_DRIVER_ALREADY_PRESENT;
+    }
+
+    xh_put(PENDING_SET, s_pending_set, path, &ret);
+    if (ret == -1) {
+        return HOUND_OOM;
+    }
+
+    return HOUND_OK;
+}
+
+/**
+ * Releases a path claimed with claim_path. This must be called with the driver
+ * lock held for writing.
+ */
+static
+void release_path(const char *path)
+{
+    xhiter_t iter;
+
+    iter = xh_get(PENDING_SET, s_pending_set, path);
+    XASSERT_NEQ(iter, xh_end(s_pending_set));
+    xh_del(PENDING_SET, s_pending_set, iter);
+}
+
+/**
+ * Adds a fully initialized driver to all the maps, making it visible to
+ * everyone else. This must be called with the driver lock held for writing.
+ */
+static
+hound_err commit_driver(const char *path, struct driver *drv)
+{
+    char *drv_path;
+    hound_err err;
+    size_t i;
+    xhiter_t iter;
+    int ret;
+
+    /*
+     * Verify that multiple drivers don't claim the same data ID. We can check
+     * this only now, as other drivers may have been committed while we were
+     * initializing.
+     */
+    for (i = 0; i < drv->desc_count; ++i) {
+        iter = xh_get(DATA_MAP, s_data_map, drv->descs[i].data_id);
+        if (iter != xh_end(s_data_map)) {
+            return HOUND_CONFLICTING_DRIVERS;
+        }
+    }
+
+    drv_path = strdup(path);
+    if (drv_path == NULL) {
+        err = HOUND_OOM;
+        goto error_alloc_drv_path;
+    }
+
+    iter = xh_put(DEVICE_MAP, s_device_map, drv_path, &ret);
+    if (ret == -1) {
+        err = HOUND_OOM;
+        goto error_device_map_put;
+    }
+    xh_val(s_device_map, iter) = drv;
+
+    for (i = 0; i < drv->desc_count; ++i ) {
+        iter = xh_put(DATA_MAP, s_data_map, drv->descs[i].data_id, &ret);
+        if (ret == -1) {
+            err = HOUND_OOM;
+            goto error_data_map_put;
+        }
+        xh_val(s_data_map, iter).drv = drv;
+        xh_val(s_data_map, iter).desc = &drv->descs[i];
+    }
+
+    return HOUND_OK;
+
+error_data_map_put:
+    for (--i; i < drv->desc_count; --i) {
+        iter = xh_get(DATA_MAP, s_data_map, drv->descs[i].data_id);
+        XASSERT_NEQ(iter, xh_end(s_data_map));
+        xh_del(DATA_MAP, s_data_map, iter);
+    }
+    iter = xh_get(DEVICE_MAP, s_device_map, path);
+    XASSERT_NEQ(iter, xh_end(s_device_map));
+    xh_del(DEVICE_MAP, s_device_map, iter);
+error_device_map_put:
+    free(drv_path);
+error_alloc_drv_path:
+    return err;
+}
+
+static
+struct active_data *active_data_alloc(void)
+{
+    struct active_data *active;
+
+    active = malloc(sizeof(*active));
+    if (active == NULL) {
+        return NULL;
+    }
+
+    active->map = xh_init(ACTIVE_DATA_MAP);
+    if (active->map == NULL) {
+        free(active);
+        return NULL;
+    }
+    active->count = 0;
+
+    return active;
+}
+
+static
+void active_data_destroy(struct active_data *active)
+{
+    xhiter_t iter;
+
+    xh_iter(active->map, iter,
+        xv_destroy(xh_val(active->map, iter));
+    );
+    xh_destroy(ACTIVE_DATA_MAP, active->map);
+    free(active);
+}
+
 PUBLIC_API
 hound_err driver_init(
     const char *name,
@@ -282,13 +490,14 @@ hound_err driver_init(
     size_t arg_count,
     const struct hound_init_arg *args)
 {
+    struct hound_decoder *decoder;
     size_t desc_count;
     struct driver *drv;
     struct drv_datadesc *drv_desc;
     struct drv_datadesc *drv_descs;
-    char *drv_path;
     size_t enabled_count;
     hound_err err;
+    hound_err err2;
     struct hound_data_fmt *fmt;
     size_t i;
     size_t j;
@@ -296,7 +505,6 @@ hound_err driver_init(
     size_t next_index;
     size_t offset;
     const struct driver_ops *ops;
-    int ret;
     struct schema_desc *schema_desc;
     struct schema_desc *schema_descs;
     size_t size;
@@ -321,19 +529,25 @@ hound_err driver_init(
         return HOUND_INVALID_STRING;
     }
 
+    /*
+     * Driver ops can be slow (e.g. connecting to a server or reading many
+     * sysfs files), so we don't hold the driver lock while calling them. This
+     * lets multiple drivers initialize in parallel. Instead, we claim the path
+     * up front so no one else can initialize the same device, and take the
+     * lock again only to commit the driver into the maps at the end.
+     */
     pthread_rwlock_wrlock(&s_driver_rwlock);
-
-    iter = xh_get(DEVICE_MAP, s_device_map, path);
-    if (iter != xh_end(s_device_map)) {
-        err = HOUND_DRIVER_ALREADY_PRESENT;
-        goto out;
+    err = claim_path(path);
+    pthread_rwlock_unlock(&s_driver_rwlock);
+    if (err != HOUND_OK) {
+        return err;
     }
 
     /* Allocate. */
     drv = malloc(sizeof(*drv));
     if (drv == NULL) {
         err = HOUND_OOM;
-        goto out;
+        goto error_alloc_drv;
     }
 
     /* Initialize driver fields. */
@@ -341,10 +555,19 @@ hound_err driver_init(
     init_mutex(&drv->op_lock);
     drv->refcount = 0;
     drv->fd = FD_INVALID;
-    xv_init(drv->active_data);
     drv->ops = *ops;
     drv->id = next_dev_id();
     drv->ctx = NULL;
+    drv->read_size = 0;
+    drv->read_buf = NULL;
+    drv->read_pool = NULL;
+    drv->read_chunk = NULL;
+
+    drv->active_data = active_data_alloc();
+    if (drv->active_data == NULL) {
+        err = HOUND_OOM;
+        goto error_active_data_alloc;
+    }
 
     /* Init. */
     err = drv_op_init(drv, path, arg_count, args);
@@ -427,24 +650,13 @@ hound_err driver_init(
 
     /*
      * Count the number of enabled descriptors so we can allocate a data
-     * descriptor array. While we're looping through the descriptors, validate
-     * that the driver gave us sane data.
+     * descriptor array.
      */
     enabled_count = 0;
     for (i = 0; i < desc_count; ++i) {
-        drv_desc = &drv_descs[i];
-        if (!drv_desc->enabled) {
-            continue;
-        }
-        ++enabled_count;
-
-        /* Verify that multiple drivers don't claim the same data ID. */
-        iter = xh_get(DATA_MAP, s_data_map, drv_desc->schema_desc->data_id);
-        if (iter != xh_end(s_data_map)) {
-            err = HOUND_CONFLICTING_DRIVERS;
-            goto error_drv_datadesc;
+        if (drv_descs[i].enabled) {
+            ++enabled_count;
         }
-
     }
     if (enabled_count == 0) {
         err = HOUND_NO_DESCS_ENABLED;
@@ -475,42 +687,41 @@ hound_err driver_init(
     free(drv_descs);
     free(schema_descs);
 
+    /* Compile a decoder for each descriptor's data formats. */
+    for (i = 0; i < drv->desc_count; ++i) {
+        err = decoder_alloc(
+            drv->descs[i].fmt_count,
+            drv->descs[i].fmts,
+            &decoder);
+        if (err != HOUND_OK) {
+            goto error_decoder_alloc;
+        }
+        drv->descs[i].decoder = decoder;
+    }
+
     /*
      * Finally, commit the driver into all the maps.
      */
-    drv_path = strdup(path);
-    if (drv_path == NULL) {
-        err = HOUND_OOM;
-        goto error_alloc_drv_path;
-    }
-
-    iter = xh_put(DEVICE_MAP, s_device_map, drv_path, &ret);
-    if (ret == -1) {
-        err = HOUND_OOM;
-        goto error_device_map_put;
+    pthread_rwlock_wrlock(&s_driver_rwlock);
+    err = commit_driver(path, drv);
+    if (err == HOUND_OK) {
+        release_path(path);
     }
-    xh_val(s_device_map, iter) = drv;
-
-    for (i = 0; i < drv->desc_count; ++i ) {
-        iter = xh_put(DATA_MAP, s_data_map, drv->descs[i].data_id, &ret);
-        if (ret == -1) {
-            err = HOUND_OOM;
-            goto error_data_map_put;
-        }
-        xh_val(s_data_map, iter) = drv;
+    pthread_rwlock_unlock(&s_driver_rwlock);
+    if (err != HOUND_OK) {
+        goto error_commit;
     }
 
-    err = HOUND_OK;
-    goto out;
+    return HOUND_OK;
 
-error_data_map_put:
-    iter = xh_get(DEVICE_MAP, s_device_map, path);
-    XASSERT_NEQ(iter, xh_end(s_device_map));
-    xh_del(DEVICE_MAP, s_device_map, iter);
-error_device_map_put:
-    free(drv_path);
-error_alloc_drv_path:
+error_commit:
+error_decoder_alloc:
+    for (i = 0; i < drv->desc_count; ++i) {
+        drv_destroy_desc(&drv->descs[i]);
+    }
     free(drv->descs);
+    /* The temporary descriptors are already gone, so just destroy the driver. */
+    goto error_schema_parse;
 error_drv_datadesc:
     for (i = 0; i < desc_count; ++i) {
         destroy_drv_desc(&drv_descs[i]);
@@ -523,31 +734,30 @@ error_alloc_drv_descs:
     free(schema_descs);
 error_schema_parse:
 error_device_name:
-    err = drv_op_destroy(drv);
-    if (err != HOUND_OK) {
-        hound_log_err(err, "driver %p failed to destroy", (void *) drv);
+    err2 = drv_op_destroy(drv);
+    if (err2 != HOUND_OK) {
+        hound_log_err(err2, "driver %p failed to destroy", (void *) drv);
     }
 error_init:
+    active_data_destroy(drv->active_data);
+error_active_data_alloc:
+    destroy_mutex(&drv->state_lock);
+    destroy_mutex(&drv->op_lock);
     free(drv);
-out:
+error_alloc_drv:
+    pthread_rwlock_wrlock(&s_driver_rwlock);
+    release_path(path);
     pthread_rwlock_unlock(&s_driver_rwlock);
     return err;
 }
 
-static
-void drv_destroy_desc(struct hound_datadesc *desc)
-{
-    drv_free((void *) desc->name);
-    drv_free((void *) desc->avail_periods);
-    destroy_desc_fmts(desc->fmt_count, desc->fmts);
-}
-
 static
 hound_err driver_remove_from_maps(const char *path, struct driver **out_drv)
 {
     struct driver *drv;
     const char *drv_path;
     struct driver *drv_iter;
+    size_t i;
     xhiter_t iter;
 
     NULL_CHECK(path);
@@ -573,11 +783,11 @@ hound_err driver_remove_from_maps(const char *path, struct driver **out_drv)
     );
 
     /* Remove the driver from the data map for each datatype it manages. */
-    xh_foreach_value_iter(s_data_map, drv_iter, iter,
-        if (drv_iter == drv) {
-            xh_del(DATA_MAP, s_data_map, iter);
-        }
-    );
+    for (i = 0; i < drv->desc_count; ++i) {
+        iter = xh_get(DATA_MAP, s_data_map, drv->descs[i].data_id);
+        XASSERT_NEQ(iter, xh_end(s_data_map));
+        xh_del(DATA_MAP, s_data_map, iter);
+    }
 
     free((char *) drv_path);
 
@@ -586,6 +796,27 @@ hound_err driver_remove_from_maps(const char *path, struct driver **out_drv)
     return HOUND_OK;
 }
 
+/**
+ * Frees the buffers the I/O core reads the driver's fd into. The caller must
+ * hold the driver's op_lock, or the driver's fd must not be polled.
+ */
+static
+void free_read_buf(struct driver *drv)
+{
+    if (drv->read_chunk != NULL) {
+        chunk_unref(drv->read_chunk);
+        drv->read_chunk = NULL;
+    }
+    if (drv->read_pool != NULL) {
+        /* Chunks still held by records are freed along with those records. */
+        chunk_pool_release(drv->read_pool);
+        drv->read_pool = NULL;
+    }
+    free(drv->read_buf);
+    drv->read_buf = NULL;
+    drv->read_size = 0;
+}
+
 static
 void driver_destroy_obj(struct driver *drv)
 {
@@ -604,9 +835,10 @@ void driver_destroy_obj(struct driver *drv)
     }
     free(drv->descs);
 
+    free_read_buf(drv);
     destroy_mutex(&drv->state_lock);
     destroy_mutex(&drv->op_lock);
-    xv_destroy(drv->active_data);
+    active_data_destroy(drv->active_data);
     free(drv);
 }
 
@@ -664,186 +896,327 @@ hound_err driver_destroy_all(void)
     return err;
 }
 
-static
-size_t get_active_data_index(
-    const struct driver *drv,
-    const struct hound_data_rq *drv_data,
-    bool *found)
-{
-    const struct data *data;
-    size_t i;
-
-    for (i = 0; i < xv_size(drv->active_data); ++i) {
-        data = &xv_A(drv->active_data, i);
-        if (data->rq.id == drv_data->id &&
-            data->rq.period_ns == drv_data->period_ns) {
-            *found = true;
-            return i;
-        }
-    }
-
-    *found = false;
-    return SIZE_MAX;
-}
-
 static
 struct data *get_active_data(
     const struct driver *drv,
     const struct hound_data_rq *drv_data)
 {
-    struct data *active_data;
-    bool found;
-    size_t index;
+    struct data *data;
+    size_t i;
+    xhiter_t iter;
+    data_vec *list;
 
-    index = get_active_data_index(drv, drv_data, &found);
-    if (found) {
-        active_data = &xv_A(drv->active_data, index);
+    iter = xh_get(ACTIVE_DATA_MAP, drv->active_data->map, drv_data->id);
+    if (iter == xh_end(drv->active_data->map)) {
+        return NULL;
     }
-    else {
-        active_data = NULL;
+
+    list = &xh_val(drv->active_data->map, iter);
+    for (i = 0; i < xv_size(*list); ++i) {
+        data = &xv_A(*list, i);
+        if (data->rq.period_ns == drv_data->period_ns) {
+            return data;
+        }
     }
 
-    return active_data;
+    return NULL;
 }
 
 static
 hound_err push_drv_data(struct driver *drv, const struct hound_data_rq *rq)
 {
     struct data *data;
+    xhiter_t iter;
+    data_vec *list;
+    int ret;
+
+    iter = xh_put(ACTIVE_DATA_MAP, drv->active_data->map, rq->id, &ret);
+    if (ret == -1) {
+        goto error;
+    }
+    list = &xh_val(drv->active_data->map, iter);
+    if (ret != 0) {
+        /* This is the first active request for this data ID. */
+        xv_init(*list);
+    }
 
-    data = xv_pushp(struct data, drv->active_data);
+    data = xv_pushp(struct data, *list);
     if (data == NULL) {
-        /* We are out of memory, so the entire active_data list is invalid! */
-        hound_log_err(
-            HOUND_OOM,
-            "Failed to push drv data onto active data list",
-            rq->id);
-        return HOUND_OOM;
+        if (xv_size(*list) == 0) {
+            xv_destroy(*list);
+            xh_del(ACTIVE_DATA_MAP, drv->active_data->map, iter);
+        }
+        goto error;
     }
     data->refcount = 1;
     data->rq = *rq;
+    ++drv->active_data->count;
 
     return HOUND_OK;
+
+error:
+    hound_log_err(
+        HOUND_OOM,
+        "Failed to push drv data for ID 0x%x onto active data list",
+        rq->id);
+    return HOUND_OOM;
 }
 
 
-hound_err driver_next(struct driver *drv, hound_data_id id, size_t n)
+hound_err driver_next(
+    struct driver *drv,
+    const hound_data_id *ids,
+    size_t count,
+    size_t n)
 {
     hound_err err;
+    hound_err first_err;
     size_t i;
+    size_t j;
 
     XASSERT_NOT_NULL(drv);
+    XASSERT_NOT_NULL(ids);
 
     lock_mutex(&drv->state_lock);
-    for (i = 0; i < n; ++i) {
-        err = drv_op_next(drv, id);
-        if (err != HOUND_OK) {
-            goto out;
-        }
+    if (drv->ops.next_batch != NULL) {
+        err = drv_op_next_batch(drv, ids, count, n);
+        goto out;
     }
-    unlock_mutex(&drv->state_lock);
-    err = HOUND_OK;
+
+    /*
+     * Drivers without batch support may block in next() until the poll loop
+     * catches up, so let the poll loop take the op lock between values.
+     *
+     * One ID failing shouldn't starve the others, so give up only on that ID
+     * and report the first error at the end.
+     */
+    first_err = HOUND_OK;
+    for (i = 0; i < count; ++i) {
+        for (j = 0; j < n; ++j) {
+            err = drv_op_next(drv, ids[i]);
+            if (err != HOUND_OK) {
+                if (first_err == HOUND_OK) {
+                    first_err = err;
+                }
+                break;
+            }
+        }
+    }
+    err = first_err;
 
 out:
+    unlock_mutex(&drv->state_lock);
     return err;
 }
 
+/**
+ * Drops a reference on each request in the active data. If removed is not NULL,
+ * the requests that are no longer active are appended to it. This fails only if
+ * there's no room to grow removed, in which case nothing is changed.
+ */
 static
-hound_err ref_data_list(
+hound_err unref_data_list(
     struct driver *drv,
     const struct hound_data_rq *rqs,
     size_t rqs_len,
-    bool *out_changed)
+    data_rq_vec *removed)
 {
-    bool changed;
     struct data *data;
-    hound_err err;
     size_t i;
+    size_t j;
+    xhiter_t iter;
+    data_vec *list;
     const struct hound_data_rq *rq;
 
-    changed = false;
+    /* Make room up-front, so recording what we remove can't fail midway. */
+    if (removed != NULL && rqs_len > 0) {
+        xv_resize(struct hound_data_rq, *removed, xv_size(*removed) + rqs_len);
+        if (xv_data(*removed) == NULL) {
+            return HOUND_OOM;
+        }
+    }
+
     for (i = 0; i < rqs_len; ++i) {
         rq = &rqs[i];
-        data = get_active_data(drv, rq);
-        if (data != NULL) {
-            ++data->refcount;
-        }
-        else {
-            err = push_drv_data(drv, rq);
-            if (err != HOUND_OK) {
-                /* We have run out of memory! */
-                goto out;
+        iter = xh_get(ACTIVE_DATA_MAP, drv->active_data->map, rq->id);
+        /* We previously added this data, so it should be found. */
+        XASSERT_NEQ(iter, xh_end(drv->active_data->map));
+        list = &xh_val(drv->active_data->map, iter);
+        for (j = 0; j < xv_size(*list); ++j) {
+            if (xv_A(*list, j).rq.period_ns == rq->period_ns) {
+                break;
             }
-            changed = true;
         }
-    }
-
-    err = HOUND_OK;
+        XASSERT_LT(j, xv_size(*list));
 
-out:
-    if (out_changed != NULL) {
-        *out_changed = changed;
+        data = &xv_A(*list, j);
+        --data->refcount;
+        if (data->refcount == 0) {
+            if (removed != NULL) {
+                xv_push(struct hound_data_rq, *removed, data->rq);
+            }
+            xv_quickdel(*list, j);
+            --drv->active_data->count;
+            if (xv_size(*list) == 0) {
+                xv_destroy(*list);
+                xh_del(ACTIVE_DATA_MAP, drv->active_data->map, iter);
+            }
+        }
     }
 
-    return err;
+    return HOUND_OK;
 }
 
+/**
+ * Takes a reference on each request in the active data. If added is not NULL,
+ * the requests that were not already active are appended to it. On error, the
+ * active data is unchanged, but added may have been partly filled in.
+ */
 static
-bool unref_data_list(
+hound_err ref_data_list(
     struct driver *drv,
     const struct hound_data_rq *rqs,
-    size_t rqs_len)
+    size_t rqs_len,
+    data_rq_vec *added)
 {
-    bool changed;
     struct data *data;
-    bool found;
+    hound_err err;
     size_t i;
-    size_t index;
     const struct hound_data_rq *rq;
 
-    changed = false;
+    /* Make room up-front, so recording what we add can't fail midway. */
+    if (added != NULL && rqs_len > 0) {
+        xv_resize(struct hound_data_rq, *added, xv_size(*added) + rqs_len);
+        if (xv_data(*added) == NULL) {
+            return HOUND_OOM;
+        }
+    }
+
     for (i = 0; i < rqs_len; ++i) {
         rq = &rqs[i];
-        index = get_active_data_index(drv, rq, &found);
-        /* We previously added this data, so it should be found. */
-        XASSERT(found);
-        data = &xv_A(drv->active_data, index);
-        --data->refcount;
-        if (data->refcount == 0) {
-            xv_quickdel(drv->active_data, index);
-            changed = true;
+        data = get_active_data(drv, rq);
+        if (data != NULL) {
+            ++data->refcount;
+            continue;
+        }
+
+        err = push_drv_data(drv, rq);
+        if (err != HOUND_OK) {
+            /* We have run out of memory, so undo what we did so far. */
+            (void) unref_data_list(drv, rqs, i, NULL);
+            return err;
+        }
+        if (added != NULL) {
+            xv_push(struct hound_data_rq, *added, *rq);
         }
     }
 
-    return changed;
+    return HOUND_OK;
 }
 
 static
 hound_err make_active_data_vec(
-    const active_data_vec *active_data,
+    const struct active_data *active,
     data_rq_vec *rq_vec)
 {
     size_t i;
+    xhiter_t iter;
+    const data_vec *list;
     struct hound_data_rq *rq;
 
     /* Preallocate space for the request vector. */
-    xv_resize(struct hound_data_rq, *rq_vec, xv_size(*active_data));
+    xv_resize(struct hound_data_rq, *rq_vec, active->count);
     if (xv_data(*rq_vec) == NULL) {
         return HOUND_OOM;
     }
 
-    for (i = 0; i < xv_size(*active_data); ++i) {
-        rq = xv_pushp(struct hound_data_rq, *rq_vec);
-        /*
-         * This shouldn't fail because we already preallocated space for the
-         * pushes.
-         */
-        XASSERT_NOT_NULL(rq);
+    xh_iter(active->map, iter,
+        list = &xh_val(active->map, iter);
+        for (i = 0; i < xv_size(*list); ++i) {
+            rq = xv_pushp(struct hound_data_rq, *rq_vec);
+            /*
+             * This shouldn't fail because we already preallocated space for
+             * the pushes.
+             */
+            XASSERT_NOT_NULL(rq);
+
+            *rq = xv_A(*list, i).rq;
+        }
+    );
+
+    return HOUND_OK;
+}
+
+/**
+ * Asks the driver how its fd should be read, and sets up the buffers to match.
+ * This is a no-op if nothing changed since the last call.
+ */
+static
+hound_err update_read_buf(struct driver *drv)
+{
+    unsigned char *buf;
+    hound_err err;
+    struct chunk_pool *pool;
+    size_t size;
+    bool zero_copy;
 
-        *rq = xv_A(*active_data, i).rq;
+    if (drv->ops.parse == NULL) {
+        /* The driver reads its own fd. */
+        return HOUND_OK;
     }
 
-    return HOUND_OK;
+    if (drv->ops.read_info != NULL) {
+        err = drv_op_read_info(drv, &size, &zero_copy);
+        if (err != HOUND_OK) {
+            return err;
+        }
+        if (size == 0) {
+            return HOUND_DRIVER_FAIL;
+        }
+    }
+    else {
+        size = DEFAULT_READ_SIZE;
+        zero_copy = false;
+    }
+
+    lock_mutex(&drv->op_lock);
+    if (size == drv->read_size && zero_copy == (drv->read_pool != NULL)) {
+        err = HOUND_OK;
+        goto out;
+    }
+
+    buf = NULL;
+    pool = NULL;
+    if (zero_copy) {
+        err = chunk_pool_alloc(size, &pool);
+        if (err != HOUND_OK) {
+            goto out;
+        }
+
+        /* Filling is only an optimization, so failing to do it is OK. */
+        err = chunk_pool_fill(pool, rt_pool_chunks());
+        if (err != HOUND_OK) {
+            hound_log_err_nofmt(err, "Failed to fill a read pool");
+        }
+    }
+    else {
+        buf = malloc(size);
+        if (buf == NULL) {
+            err = HOUND_OOM;
+            goto out;
+        }
+    }
+
+    free_read_buf(drv);
+    drv->read_size = size;
+    drv->read_buf = buf;
+    drv->read_pool = pool;
+
+    err = HOUND_OK;
+
+out:
+    unlock_mutex(&drv->op_lock);
+    return err;
 }
 
 static
@@ -853,24 +1226,64 @@ hound_err set_driver_data(struct driver *drv)
     data_rq_vec rq_vec;
 
     xv_init(rq_vec);
-    err = make_active_data_vec(&drv->active_data, &rq_vec);
+    err = make_active_data_vec(drv->active_data, &rq_vec);
     if (err != HOUND_OK) {
         return err;
     }
 
     err = drv_op_setdata(drv, xv_data(rq_vec), xv_size(rq_vec));
     xv_destroy(rq_vec);
+    if (err != HOUND_OK) {
+        return err;
+    }
+
+    if (drv->refcount > 0) {
+        /* The driver is running, and new data may change how it's read. */
+        err = update_read_buf(drv);
+    }
 
     return err;
 }
 
+/**
+ * Tells the driver that its active data changed. A running driver that
+ * supports it gets only the changes; otherwise, the driver gets the full list
+ * of active data.
+ */
+static
+hound_err update_driver_data(
+    struct driver *drv,
+    const struct hound_data_rq *add,
+    size_t add_len,
+    const struct hound_data_rq *remove,
+    size_t remove_len)
+{
+    hound_err err;
+
+    if (add_len == 0 && remove_len == 0) {
+        return HOUND_OK;
+    }
+
+    if (drv->ops.modifydata == NULL || drv->refcount == 0) {
+        return set_driver_data(drv);
+    }
+
+    err = drv_op_modifydata(drv, add, add_len, remove, remove_len);
+    if (err != HOUND_OK) {
+        return err;
+    }
+
+    /* New data may change how the driver is read. */
+    return update_read_buf(drv);
+}
+
 hound_err driver_ref(
     struct driver *drv,
     struct queue *queue,
     const struct hound_data_rq *rqs,
     size_t rqs_len)
 {
-    bool changed;
+    data_rq_vec added;
     hound_err err;
     hound_err tmp;
 
@@ -878,20 +1291,19 @@ hound_err driver_ref(
     XASSERT_NOT_NULL(queue);
     XASSERT_NOT_NULL(rqs);
 
+    xv_init(added);
     lock_mutex(&drv->state_lock);
 
     /* Update the active data list. */
-    err = ref_data_list(drv, rqs, rqs_len, &changed);
+    err = ref_data_list(drv, rqs, rqs_len, &added);
     if (err != HOUND_OK) {
         goto out;
     }
 
-    if (changed) {
-        /* Tell the driver to change what data it generates. */
-        err = set_driver_data(drv);
-        if (err != HOUND_OK) {
-            goto error_driver_setdata;
-        }
+    /* Tell the driver to change what data it generates. */
+    err = update_driver_data(drv, xv_data(added), xv_size(added), NULL, 0);
+    if (err != HOUND_OK) {
+        goto error_driver_setdata;
     }
 
     /* Start the driver if needed, and tell the I/O layer what we need. */
@@ -902,12 +1314,13 @@ hound_err driver_ref(
             goto error_driver_start;
         }
 
+        err = update_read_buf(drv);
+        if (err != HOUND_OK) {
+            goto error_read_buf;
+        }
+
         err = io_add_fd(drv->fd, drv, rqs, rqs_len, queue);
         if (err != HOUND_OK) {
-            tmp = drv_op_stop(drv);
-            if (tmp != HOUND_OK) {
-                hound_log_err(tmp, "driver %p failed to stop", (void *) drv);
-            }
             goto error_io_add_fd;
         }
     }
@@ -925,13 +1338,19 @@ hound_err driver_ref(
     err = HOUND_OK;
     goto out;
 
-error_io_add_queue:
 error_io_add_fd:
+    free_read_buf(drv);
+error_read_buf:
+    tmp = drv_op_stop(drv);
+    if (tmp != HOUND_OK) {
+        hound_log_err(tmp, "driver %p failed to stop", (void *) drv);
+    }
+error_io_add_queue:
 error_driver_start:
     --drv->refcount;
 error_driver_setdata:
-    (void) unref_data_list(drv, rqs, rqs_len);
-    if (changed) {
+    (void) unref_data_list(drv, rqs, rqs_len, NULL);
+    if (xv_size(added) > 0) {
         tmp = set_driver_data(drv);
         if (tmp != HOUND_OK) {
             hound_log_err(
@@ -942,6 +1361,7 @@ error_driver_setdata:
     }
 out:
     unlock_mutex(&drv->state_lock);
+    xv_destroy(added);
     return err;
 }
 
@@ -951,18 +1371,22 @@ hound_err driver_unref(
     const struct hound_data_rq *rqs,
     size_t rqs_len)
 {
-    bool changed;
     hound_err err;
     hound_err err2;
+    data_rq_vec removed;
 
     XASSERT_NOT_NULL(drv);
     XASSERT_NOT_NULL(queue);
     XASSERT_NOT_NULL(rqs);
 
+    xv_init(removed);
     lock_mutex(&drv->state_lock);
 
     /* Update the active data list. */
-    changed = unref_data_list(drv, rqs, rqs_len);
+    err = unref_data_list(drv, rqs, rqs_len, &removed);
+    if (err != HOUND_OK) {
+        goto out;
+    }
 
     /* Stop the driver if needed. */
     --drv->refcount;
@@ -982,6 +1406,7 @@ hound_err driver_unref(
             goto error_driver_op;
         }
         drv->fd = FD_INVALID;
+        free_read_buf(drv);
     }
     else {
         /*
@@ -990,13 +1415,16 @@ hound_err driver_unref(
          */
         io_remove_queue(drv->fd, rqs, rqs_len, queue);
 
-        if (changed) {
-            err = set_driver_data(drv);
-            if (err != HOUND_OK) {
-                err2 = io_add_queue(drv->fd, rqs, rqs_len, queue);
-                hound_log_err(err2, "driver %p failed to queue", (void *) drv);
-                goto error_driver_op;
-            }
+        err = update_driver_data(
+            drv,
+            NULL,
+            0,
+            xv_data(removed),
+            xv_size(removed));
+        if (err != HOUND_OK) {
+            err2 = io_add_queue(drv->fd, rqs, rqs_len, queue);
+            hound_log_err(err2, "driver %p failed to queue", (void *) drv);
+            goto error_driver_op;
         }
     }
 
@@ -1011,6 +1439,7 @@ error_driver_op:
     }
 out:
     unlock_mutex(&drv->state_lock);
+    xv_destroy(removed);
     return err;
 }
 
@@ -1026,7 +1455,7 @@ hound_err driver_get(hound_data_id data_id, struct driver **drv)
         err = HOUND_DATA_ID_DOES_NOT_EXIST;
         goto out;
     }
-    *drv = xh_val(s_data_map, iter);
+    *drv = xh_val(s_data_map, iter).drv;
 
     err = HOUND_OK;
 
@@ -1035,6 +1464,139 @@ out:
     return err;
 }
 
+hound_err driver_alloc_decoder(
+    hound_data_id data_id,
+    struct hound_decoder **decoder)
+{
+    const struct hound_datadesc *desc;
+    hound_err err;
+    xhiter_t iter;
+
+    XASSERT_NOT_NULL(decoder);
+
+    pthread_rwlock_rdlock(&s_driver_rwlock);
+
+    iter = xh_get(DATA_MAP, s_data_map, data_id);
+    if (iter == xh_end(s_data_map)) {
+        err = HOUND_DATA_ID_DOES_NOT_EXIST;
+        goto out;
+    }
+    desc = xh_val(s_data_map, iter).desc;
+
+    err = decoder_alloc(desc->fmt_count, desc->fmts, decoder);
+
+out:
+    pthread_rwlock_unlock(&s_driver_rwlock);
+    return err;
+}
+
+static
+int compare_rqs(const void *a, const void *b)
+{
+    const struct hound_data_rq *x;
+    const struct hound_data_rq *y;
+
+    x = a;
+    y = b;
+    if (x->id != y->id) {
+        return x->id < y->id ? -1 : 1;
+    }
+    if (x->period_ns != y->period_ns) {
+        return x->period_ns < y->period_ns ? -1 : 1;
+    }
+    return filter_rq_compare(x, y);
+}
+
+/**
+ * Finds the requests that are only in the new list (added) and only in the old
+ * list (removed), comparing by data ID, period and filter settings. A request
+ * whose filter changed shows up in both lists, which leaves the driver alone
+ * but gets the I/O core to rebuild its queue entries. Each list must not have
+ * the same data ID and period twice.
+ */
+static
+hound_err diff_rqs(
+    const struct hound_data_rq *old_rqs,
+    size_t old_rqs_len,
+    const struct hound_data_rq *new_rqs,
+    size_t new_rqs_len,
+    data_rq_vec *added,
+    data_rq_vec *removed)
+{
+    int cmp;
+    hound_err err;
+    size_t i;
+    size_t j;
+    struct hound_data_rq *sorted_new;
+    struct hound_data_rq *sorted_old;
+
+    sorted_old = malloc(old_rqs_len * sizeof(*sorted_old));
+    if (sorted_old == NULL) {
+        err = HOUND_OOM;
+        goto error_sorted_old;
+    }
+
+    sorted_new = malloc(new_rqs_len * sizeof(*sorted_new));
+    if (sorted_new == NULL) {
+        err = HOUND_OOM;
+        goto error_sorted_new;
+    }
+
+    xv_resize(struct hound_data_rq, *added, new_rqs_len);
+    if (xv_data(*added) == NULL) {
+        err = HOUND_OOM;
+        goto out;
+    }
+
+    xv_resize(struct hound_data_rq, *removed, old_rqs_len);
+    if (xv_data(*removed) == NULL) {
+        err = HOUND_OOM;
+        goto out;
+    }
+
+    memcpy(sorted_old, old_rqs, old_rqs_len * sizeof(*sorted_old));
+    qsort(sorted_old, old_rqs_len, sizeof(*sorted_old), compare_rqs);
+    memcpy(sorted_new, new_rqs, new_rqs_len * sizeof(*sorted_new));
+    qsort(sorted_new, new_rqs_len, sizeof(*sorted_new), compare_rqs);
+
+    /* Walk both sorted lists together, like a merge. */
+    i = 0;
+    j = 0;
+    while (i < old_rqs_len || j < new_rqs_len) {
+        if (i == old_rqs_len) {
+            cmp = 1;
+        }
+        else if (j == new_rqs_len) {
+            cmp = -1;
+        }
+        else {
+            cmp = compare_rqs(&sorted_old[i], &sorted_new[j]);
+        }
+
+        if (cmp < 0) {
+            xv_push(struct hound_data_rq, *removed, sorted_old[i]);
+            ++i;
+        }
+        else if (cmp > 0) {
+            xv_push(struct hound_data_rq, *added, sorted_new[j]);
+            ++j;
+        }
+        else {
+            ++i;
+            ++j;
+        }
+    }
+
+    err = HOUND_OK;
+
+out:
+    free(sorted_new);
+error_sorted_new:
+    free(sorted_old);
+error_sorted_old:
+    return err;
+}
+
 hound_err driver_modify(
     struct driver *drv,
     struct queue *queue,
@@ -1043,8 +1605,12 @@ hound_err driver_modify(
     const struct hound_data_rq *new_rqs,
     size_t new_rqs_len)
 {
-    bool changed;
+    data_rq_vec activated;
+    data_rq_vec added;
+    data_rq_vec deactivated;
     hound_err err;
+    data_rq_vec removed;
+    bool resync;
     hound_err tmp;
 
     XASSERT_NOT_NULL(drv);
@@ -1054,59 +1620,98 @@ hound_err driver_modify(
     XASSERT_NOT_NULL(new_rqs);
     XASSERT_GT(new_rqs_len, 0);
 
+    xv_init(activated);
+    xv_init(added);
+    xv_init(deactivated);
+    xv_init(removed);
+    resync = false;
+
+    /*
+     * Work out what actually changed, so that requests in both lists are left
+     * alone (and if nothing changed, so is the driver).
+     */
+    err = diff_rqs(
+        old_rqs,
+        old_rqs_len,
+        new_rqs,
+        new_rqs_len,
+        &added,
+        &removed);
+    if (err != HOUND_OK) {
+        goto out_nolock;
+    }
+    if (xv_size(added) == 0 && xv_size(removed) == 0) {
+        goto out_nolock;
+    }
+
     lock_mutex(&drv->state_lock);
 
-    err = ref_data_list(drv, new_rqs, new_rqs_len, &changed);
+    err = ref_data_list(drv, xv_data(added), xv_size(added), &activated);
     if (err != HOUND_OK) {
         goto out;
     }
 
-    changed |= unref_data_list(drv, old_rqs, old_rqs_len);
+    err = unref_data_list(
+        drv,
+        xv_data(removed),
+        xv_size(removed),
+        &deactivated);
     if (err != HOUND_OK) {
         goto error_unref;
     }
 
-    if (changed) {
-        if (drv->refcount > 0) {
-            /* Tell the I/O layer to expect different data. */
-            err = io_modify_queue(
-                drv->fd,
-                old_rqs,
-                old_rqs_len,
-                new_rqs,
-                new_rqs_len,
-                queue);
-            if (err != HOUND_OK) {
-                goto error_modify_queue;
-            }
-        }
-
-        /* Tell the driver to generate different data. */
-        err = set_driver_data(drv);
+    if (drv->refcount > 0) {
+        /*
+         * Tell the I/O layer to expect different data. It gets the full lists,
+         * as a data ID can stay in the queue at one period while being removed
+         * at another.
+         */
+        err = io_modify_queue(
+            drv->fd,
+            old_rqs,
+            old_rqs_len,
+            new_rqs,
+            new_rqs_len,
+            queue);
         if (err != HOUND_OK) {
-            goto error_setdata;
+            goto error_modify_queue;
         }
     }
 
+    /* Tell the driver to generate different data. */
+    err = update_driver_data(
+        drv,
+        xv_data(activated),
+        xv_size(activated),
+        xv_data(deactivated),
+        xv_size(deactivated));
+    if (err != HOUND_OK) {
+        /* The driver may have made some of the changes, so resync it. */
+        resync = true;
+        goto error_setdata;
+    }
+
     err = HOUND_OK;
     goto out;
 
 error_setdata:
-    tmp = io_modify_queue(
-        drv->fd,
-        new_rqs,
-        new_rqs_len,
-        old_rqs,
-        old_rqs_len,
-        queue);
-    if (tmp != HOUND_OK) {
-        hound_log_err(
-            tmp,
-            "failed to restore queue for driver %p during cleanup",
-            (void *) drv);
+    if (drv->refcount > 0) {
+        tmp = io_modify_queue(
+            drv->fd,
+            new_rqs,
+            new_rqs_len,
+            old_rqs,
+            old_rqs_len,
+            queue);
+        if (tmp != HOUND_OK) {
+            hound_log_err(
+                tmp,
+                "failed to restore queue for driver %p during cleanup",
+                (void *) drv);
+        }
     }
 error_modify_queue:
-    tmp = ref_data_list(drv, old_rqs, old_rqs_len, NULL);
+    tmp = ref_data_list(drv, xv_data(removed), xv_size(removed), NULL);
     if (tmp != HOUND_OK) {
         hound_log_err(
             tmp,
@@ -1114,9 +1719,23 @@ error_modify_queue:
             (void *) drv);
     }
 error_unref:
-    (void) unref_data_list(drv, new_rqs, new_rqs_len);
+    (void) unref_data_list(drv, xv_data(added), xv_size(added), NULL);
+    if (resync) {
+        tmp = set_driver_data(drv);
+        if (tmp != HOUND_OK) {
+            hound_log_err(
+                tmp,
+                "failed to restore active data for driver %p during cleanup",
+                (void *) drv);
+        }
+    }
 out:
     unlock_mutex(&drv->state_lock);
+out_nolock:
+    xv_destroy(removed);
+    xv_destroy(deactivated);
+    xv_destroy(added);
+    xv_destroy(activated);
     return err;
 }
 
@@ -1128,22 +1747,18 @@ bool driver_period_supported(
     const struct hound_datadesc *desc;
     bool found;
     size_t i;
-    size_t j;
+    xhiter_t iter;
 
     XASSERT_NOT_NULL(drv);
 
     pthread_rwlock_rdlock(&s_driver_rwlock);
 
-    for (i = 0; i < drv->desc_count; ++i) {
-        desc = &drv->descs[i];
-        if (desc->data_id == id) {
-            break;
-        }
-    }
-    if (i == drv->desc_count) {
+    iter = xh_get(DATA_MAP, s_data_map, id);
+    if (iter == xh_end(s_data_map) || xh_val(s_data_map, iter).drv != drv) {
         found = false;
         goto out;
     }
+    desc = xh_val(s_data_map, iter).desc;
 
     /* A driver specifying no periods means any period is permissable. */
     if (desc->period_count == 0) {
@@ -1152,8 +1767,8 @@ bool driver_period_supported(
     }
 
     found = false;
-    for (j = 0; j < desc->period_count; ++j) {
-        if (desc->avail_periods[j] == period) {
+    for (i = 0; i < desc->period_count; ++i) {
+        if (desc->avail_periods[i] == period) {
             found = true;
             goto out;
         }
@@ -9,13 +9,17 @@
 #include <hound-private/io.h>
 #include <hound-private/log.h>
 #include <hound-private/parse/schema.h>
+#include <hound-private/rt.h>
 
 #define CORE_PRIO (HOUND_DRIVER_REGISTER_PRIO-1)
 
 __attribute__((constructor(CORE_PRIO)))
 static void lib_init(void)
 {
+    log_init();
+    rt_init();
     io_init();
+    schema_init();
     driver_init_statics();
 }
 
@@ -24,4 +28,7 @@ static void lib_destroy(void)
 {
     io_destroy();
     driver_destroy_statics();
+    schema_destroy();
+    rt_destroy();
+    log_destroy();
 }
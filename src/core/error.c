@@ -78,6 +78,14 @@ const char *error_strerror(hound_err err)
             return "driver didn't enabled any data descriptors";
         case HOUND_PATH_TOO_LONG:
             return "path is longer than PATH_MAX";
+        case HOUND_RETENTION_DISABLED:
+            return "context does not retain records";
+        case HOUND_CTX_ASYNC:
+            return "context is dispatching callbacks asynchronously";
+        case HOUND_TIMEOUT:
+            return "timed out before the read finished";
+        case HOUND_RT_UNAVAILABLE:
+            return "some real-time settings could not be applied";
     }
 
     /*
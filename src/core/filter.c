@@ -0,0 +1,292 @@
+/**
+ * @file      filter.c
+ * @brief     Per-request record filters. The I/O core runs each record through
+ *            the filter of every queue that wants it before queueing it, so
+ *            records that no queue wants are never allocated or queued. A
+ *            filter remembers the last record it passed, and is shared by the
+ *            I/O snapshots that refer to it, so its state survives changes to
+ *            other requests on the same driver.
+ * @author    Martin Kelly <mkelly@xevo.com>
+ * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
+ */
+
+#include <hound/hound.h>
+#include <hound-private/decode.h>
+#include <hound-private/error.h>
+#include <hound-private/filter.h>
+#include <hound-private/refcount.h>
+#include <hound-private/util.h>
+#include <float.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct filter {
+    atomic_refcount_val refcount;
+
+    /* The request the filter was made from, for its settings. */
+    struct hound_data_rq rq;
+
+    /* NULL if deadbands are disabled or the data can't be decoded. */
+    const struct hound_decoder *decoder;
+    size_t field_count;
+
+    /* The last record passed. */
+    bool have_last;
+    hound_data_period last_ns;
+    bool have_data;
+    size_t last_size;
+    size_t data_cap;
+    unsigned char *last_data;
+    bool have_values;
+    double *last_values;
+
+    /* Space to decode the current record into. */
+    double *values;
+};
+
+bool filter_rq_enabled(const struct hound_data_rq *rq)
+{
+    XASSERT_NOT_NULL(rq);
+
+    return rq->change_only ||
+        rq->deadband_abs != 0 ||
+        rq->deadband_rel != 0 ||
+        rq->min_interval_ns != 0;
+}
+
+bool filter_rq_valid(const struct hound_data_rq *rq)
+{
+    XASSERT_NOT_NULL(rq);
+
+    /* Written so that NaN fails too. */
+    return rq->deadband_abs >= 0 && rq->deadband_abs <= DBL_MAX &&
+        rq->deadband_rel >= 0 && rq->deadband_rel <= DBL_MAX;
+}
+
+int filter_rq_compare(
+    const struct hound_data_rq *a,
+    const struct hound_data_rq *b)
+{
+    XASSERT_NOT_NULL(a);
+    XASSERT_NOT_NULL(b);
+
+    if (a->change_only != b->change_only) {
+        return a->change_only < b->change_only ? -1 : 1;
+    }
+    if (a->deadband_abs != b->deadband_abs) {
+        return a->deadband_abs < b->deadband_abs ? -1 : 1;
+    }
+    if (a->deadband_rel != b->deadband_rel) {
+        return a->deadband_rel < b->deadband_rel ? -1 : 1;
+    }
+    if (a->min_interval_ns != b->min_interval_ns) {
+        return a->min_interval_ns < b->min_interval_ns ? -1 : 1;
+    }
+    return 0;
+}
+
+hound_err filter_alloc(
+    const struct hound_data_rq *rq,
+    const struct hound_datadesc *desc,
+    struct filter **out_filter)
+{
+    hound_err err;
+    struct filter *filter;
+
+    XASSERT_NOT_NULL(rq);
+    XASSERT_NOT_NULL(out_filter);
+
+    filter = malloc(sizeof(*filter));
+    if (filter == NULL) {
+        err = HOUND_OOM;
+        goto error_alloc_filter;
+    }
+
+    atomic_ref_init(&filter->refcount, 1);
+    filter->rq = *rq;
+    filter->have_last = false;
+    filter->have_data = false;
+    filter->last_size = 0;
+    filter->data_cap = 0;
+    filter->last_data = NULL;
+    filter->have_values = false;
+
+    if ((rq->deadband_abs != 0 || rq->deadband_rel != 0) &&
+        desc != NULL &&
+        desc->decoder != NULL) {
+        filter->decoder = desc->decoder;
+        filter->field_count = decoder_field_count(filter->decoder);
+    }
+    else {
+        filter->decoder = NULL;
+        filter->field_count = 0;
+    }
+
+    /*
+     * Fields that aren't numeric are never decoded, so zeroing them here keeps
+     * them from ever looking changed.
+     */
+    filter->last_values = calloc(
+        filter->field_count,
+        sizeof(*filter->last_values));
+    if (filter->last_values == NULL && filter->field_count > 0) {
+        err = HOUND_OOM;
+        goto error_alloc_last_values;
+    }
+
+    filter->values = calloc(filter->field_count, sizeof(*filter->values));
+    if (filter->values == NULL && filter->field_count > 0) {
+        err = HOUND_OOM;
+        goto error_alloc_values;
+    }
+
+    *out_filter = filter;
+
+    return HOUND_OK;
+
+error_alloc_values:
+    free(filter->last_values);
+error_alloc_last_values:
+    free(filter);
+error_alloc_filter:
+    return err;
+}
+
+void filter_ref(struct filter *filter)
+{
+    XASSERT_NOT_NULL(filter);
+
+    atomic_ref_inc(&filter->refcount);
+}
+
+void filter_unref(struct filter *filter)
+{
+    XASSERT_NOT_NULL(filter);
+
+    if (atomic_ref_dec(&filter->refcount) > 1) {
+        return;
+    }
+
+    free(filter->values);
+    free(filter->last_values);
+    free(filter->last_data);
+    free(filter);
+}
+
+bool filter_matches(
+    const struct filter *filter,
+    const struct hound_data_rq *rq)
+{
+    XASSERT_NOT_NULL(filter);
+
+    return filter_rq_compare(&filter->rq, rq) == 0;
+}
+
+static
+bool values_moved(const struct filter *filter)
+{
+    double band;
+    double diff;
+    size_t i;
+    double last;
+
+    for (i = 0; i < filter->field_count; ++i) {
+        last = filter->last_values[i];
+        diff = filter->values[i] - last;
+        if (diff < 0) {
+            diff = -diff;
+        }
+        if (last < 0) {
+            last = -last;
+        }
+        band = filter->rq.deadband_rel * last;
+        if (filter->rq.deadband_abs > band) {
+            band = filter->rq.deadband_abs;
+        }
+
+        /* Written so that NaN counts as a change. */
+        if (!(diff <= band)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static
+void save_data(struct filter *filter, const struct hound_record *record)
+{
+    unsigned char *data;
+
+    if (record->size > filter->data_cap) {
+        data = realloc(filter->last_data, record->size);
+        if (data == NULL) {
+            /* Without the data, let the next record through unconditionally. */
+            filter->have_data = false;
+            return;
+        }
+        filter->last_data = data;
+        filter->data_cap = record->size;
+    }
+
+    if (record->size > 0) {
+        memcpy(filter->last_data, record->data, record->size);
+    }
+    filter->last_size = record->size;
+    filter->have_data = true;
+}
+
+bool filter_pass(struct filter *filter, const struct hound_record *record)
+{
+    bool decoded;
+    double *tmp;
+    hound_data_period ts;
+
+    XASSERT_NOT_NULL(filter);
+    XASSERT_NOT_NULL(record);
+
+    ts = NSEC_PER_SEC*record->timestamp.tv_sec + record->timestamp.tv_nsec;
+
+    /* A timestamp going backwards doesn't count as being too soon. */
+    if (filter->rq.min_interval_ns != 0 &&
+        filter->have_last &&
+        ts >= filter->last_ns &&
+        ts - filter->last_ns < filter->rq.min_interval_ns) {
+        return false;
+    }
+
+    if (filter->rq.change_only &&
+        filter->have_data &&
+        record->size == filter->last_size &&
+        (record->size == 0 ||
+         memcmp(record->data, filter->last_data, record->size) == 0)) {
+        return false;
+    }
+
+    decoded = false;
+    if (filter->decoder != NULL) {
+        /* Data we can't decode always counts as a change. */
+        decoded = decoder_decode_record(
+            filter->decoder,
+            record,
+            filter->values);
+        if (decoded && filter->have_values && !values_moved(filter)) {
+            return false;
+        }
+    }
+
+    /* The record passes, so it's the new baseline. */
+    filter->have_last = true;
+    filter->last_ns = ts;
+    if (filter->rq.change_only) {
+        save_data(filter, record);
+    }
+    if (decoded) {
+        tmp = filter->last_values;
+        filter->last_values = filter->values;
+        filter->values = tmp;
+    }
+    filter->have_values = decoded;
+
+    return true;
+}
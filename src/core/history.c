@@ -0,0 +1,349 @@
+/**
+ * @file      history.c
+ * @brief     Retained record history. The history keeps references to the most
+ *            recent records pushed into a queue, in a circular buffer ordered
+ *            by (timestamp, sequence number), so that time ranges can be found
+ *            with a binary search. Queries do not consume records, and they
+ *            run independently of the live queue.
+ * @author    Martin Kelly <mkelly@xevo.com>
+ * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
+ */
+
+#include <hound-private/error.h>
+#include <hound-private/history.h>
+#include <hound-private/queue.h>
+#include <hound-private/refcount.h>
+#include <hound-private/trace.h>
+#include <hound-private/util.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+/*
+ * The number of records to grab under the lock per batch of callbacks during a
+ * query. Callbacks are run without the lock held, so producers are never
+ * blocked on a slow query callback.
+ */
+#define QUERY_BATCH_SIZE 64
+
+struct history_entry {
+    struct record_info *rec;
+    hound_data_period ts;
+    hound_seqno seqno;
+};
+
+/*
+ * Entries are kept sorted from oldest to newest. front is the oldest entry, and
+ * the back is calculated implicitly as front + len with wraparound.
+ */
+struct history {
+    atomic_refcount_val refcount;
+    pthread_mutex_t mutex;
+    size_t max_len;
+    hound_data_period max_age;
+    size_t front;
+    size_t len;
+    struct history_entry *entries;
+};
+
+static
+hound_data_period get_ts(const struct timespec *ts)
+{
+    return NSEC_PER_SEC*ts->tv_sec + ts->tv_nsec;
+}
+
+hound_err history_alloc(
+    size_t max_len,
+    hound_data_period max_age,
+    struct history **out_history)
+{
+    hound_err err;
+    struct history *history;
+
+    XASSERT_NOT_NULL(out_history);
+    XASSERT_GT(max_len, 0);
+
+    history = malloc(sizeof(*history));
+    if (history == NULL) {
+        return HOUND_OOM;
+    }
+
+    history->entries = malloc(max_len * sizeof(*history->entries));
+    if (history->entries == NULL) {
+        err = HOUND_OOM;
+        goto error_alloc_entries;
+    }
+
+    atomic_ref_init(&history->refcount, 1);
+    init_mutex(&history->mutex);
+    history->max_len = max_len;
+    history->max_age = max_age;
+    history->front = 0;
+    history->len = 0;
+
+    *out_history = history;
+
+    return HOUND_OK;
+
+error_alloc_entries:
+    free(history);
+    return err;
+}
+
+static
+struct history_entry *get_entry(const struct history *history, size_t index)
+{
+    return &history->entries[(history->front + index) % history->max_len];
+}
+
+static
+void pop_front(struct history *history)
+{
+    XASSERT_GT(history->len, 0);
+
+    record_ref_dec(get_entry(history, 0)->rec);
+    history->front = (history->front + 1) % history->max_len;
+    --history->len;
+}
+
+static
+void history_destroy(struct history *history)
+{
+    while (history->len > 0) {
+        pop_front(history);
+    }
+    destroy_mutex(&history->mutex);
+    free(history->entries);
+    free(history);
+}
+
+void history_ref(struct history *history)
+{
+    XASSERT_NOT_NULL(history);
+
+    atomic_ref_inc(&history->refcount);
+}
+
+void history_unref(struct history *history)
+{
+    refcount_val count;
+
+    XASSERT_NOT_NULL(history);
+
+    count = atomic_ref_dec(&history->refcount);
+    if (count == 1) {
+        /* The refcount has now reached 0. */
+        history_destroy(history);
+    }
+}
+
+hound_err history_set_limits(
+    struct history *history,
+    size_t max_len,
+    hound_data_period max_age)
+{
+    struct history_entry *entries;
+    size_t i;
+
+    XASSERT_NOT_NULL(history);
+    XASSERT_GT(max_len, 0);
+
+    lock_mutex(&history->mutex);
+
+    /* Drop the oldest entries that won't fit. */
+    while (history->len > max_len) {
+        pop_front(history);
+    }
+
+    if (max_len != history->max_len) {
+        entries = malloc(max_len * sizeof(*entries));
+        if (entries == NULL) {
+            unlock_mutex(&history->mutex);
+            return HOUND_OOM;
+        }
+
+        /* Straighten out the circular buffer while we copy it. */
+        for (i = 0; i < history->len; ++i) {
+            entries[i] = *get_entry(history, i);
+        }
+        free(history->entries);
+        history->entries = entries;
+        history->front = 0;
+        history->max_len = max_len;
+    }
+    history->max_age = max_age;
+
+    unlock_mutex(&history->mutex);
+
+    return HOUND_OK;
+}
+
+/**
+ * Finds the first entry ordered after the given timestamp and sequence number.
+ * Entries are sorted by timestamp and then by sequence number.
+ *
+ * @param history a history
+ * @param ts a timestamp
+ * @param seqno a sequence number
+ * @param inclusive if true, an entry with the same timestamp as ts is considered
+ *                  to be after it regardless of its sequence number
+ *
+ * @return the index of the first such entry, or history->len if there is none
+ */
+static
+size_t find_after(
+    const struct history *history,
+    hound_data_period ts,
+    hound_seqno seqno,
+    bool inclusive)
+{
+    const struct history_entry *entry;
+    size_t high;
+    size_t low;
+    size_t mid;
+
+    low = 0;
+    high = history->len;
+    while (low < high) {
+        mid = low + (high - low) / 2;
+        entry = get_entry(history, mid);
+        if (entry->ts > ts ||
+            (entry->ts == ts && (inclusive || entry->seqno > seqno))) {
+            high = mid;
+        }
+        else {
+            low = mid + 1;
+        }
+    }
+
+    return low;
+}
+
+void history_push(
+    struct history *history,
+    struct record_info *rec,
+    hound_seqno seqno)
+{
+    size_t i;
+    size_t index;
+    const struct history_entry *newest;
+    hound_data_period ts;
+
+    XASSERT_NOT_NULL(history);
+    XASSERT_NOT_NULL(rec);
+
+    ts = get_ts(&rec->record.timestamp);
+
+    lock_mutex(&history->mutex);
+
+    /*
+     * Records usually arrive in timestamp order, but drivers don't share a
+     * clock, so a record may be a bit older than the newest ones. Keep the
+     * history sorted by inserting it after the newest entry that is not newer
+     * than it. Its sequence number is always the largest so far, so ties are
+     * ordered by sequence number as well.
+     */
+    index = history->len;
+    while (index > 0 && get_entry(history, index-1)->ts > ts) {
+        --index;
+    }
+
+    if (history->len == history->max_len) {
+        if (index == 0) {
+            /* The record is older than everything we keep, so drop it. */
+            goto out;
+        }
+        pop_front(history);
+        --index;
+    }
+
+    for (i = history->len; i > index; --i) {
+        *get_entry(history, i) = *get_entry(history, i-1);
+    }
+    ++history->len;
+
+    atomic_ref_inc(&rec->refcount);
+    get_entry(history, index)->rec = rec;
+    get_entry(history, index)->ts = ts;
+    get_entry(history, index)->seqno = seqno;
+
+    /* Expire records that are too old relative to the newest one. */
+    if (history->max_age > 0) {
+        newest = get_entry(history, history->len-1);
+        while (newest->ts - get_entry(history, 0)->ts > history->max_age) {
+            pop_front(history);
+        }
+    }
+
+out:
+    unlock_mutex(&history->mutex);
+}
+
+size_t history_query(
+    struct history *history,
+    const struct timespec *start,
+    const struct timespec *end,
+    hound_cb cb,
+    void *cb_ctx)
+{
+    struct history_entry batch[QUERY_BATCH_SIZE];
+    size_t count;
+    hound_data_period end_ts;
+    size_t i;
+    size_t index;
+    bool inclusive;
+    hound_seqno seqno;
+    size_t total;
+    hound_data_period ts;
+
+    XASSERT_NOT_NULL(history);
+    XASSERT_NOT_NULL(start);
+    XASSERT_NOT_NULL(end);
+    XASSERT_NOT_NULL(cb);
+
+    ts = get_ts(start);
+    end_ts = get_ts(end);
+    seqno = 0;
+    inclusive = true;
+    total = 0;
+    do {
+        /*
+         * Find where we left off. Entries may have been added or expired since
+         * the last batch, so search for the last entry we handled rather than
+         * remembering its index.
+         */
+        lock_mutex(&history->mutex);
+        index = find_after(history, ts, seqno, inclusive);
+        for (count = 0;
+             count < ARRAYLEN(batch) && index < history->len;
+             ++count, ++index) {
+            batch[count] = *get_entry(history, index);
+            if (batch[count].ts > end_ts) {
+                break;
+            }
+            atomic_ref_inc(&batch[count].rec->refcount);
+        }
+        unlock_mutex(&history->mutex);
+
+        for (i = 0; i < count; ++i) {
+            HOUND_TRACE_CB(
+                callback_entry,
+                &batch[i].rec->record,
+                batch[i].seqno);
+            cb(&batch[i].rec->record, batch[i].seqno, cb_ctx);
+            HOUND_TRACE_CB(
+                callback_exit,
+                &batch[i].rec->record,
+                batch[i].seqno);
+            record_ref_dec(batch[i].rec);
+        }
+        total += count;
+
+        if (count > 0) {
+            ts = batch[count-1].ts;
+            seqno = batch[count-1].seqno;
+            inclusive = false;
+        }
+    } while (count == ARRAYLEN(batch));
+
+    return total;
+}
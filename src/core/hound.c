@@ -7,11 +7,13 @@
 
 #include <hound/hound.h>
 #include <hound-private/ctx.h>
+#include <hound-private/decode.h>
 #include <hound-private/error.h>
 #include <hound-private/driver.h>
 #include <hound-private/log.h>
 #include <hound-private/parse/config.h>
 #include <hound-private/parse/schema.h>
+#include <hound-private/rt.h>
 #include <hound-private/util.h>
 
 PUBLIC_API
@@ -32,6 +34,16 @@ void hound_free_datadescs(struct hound_datadesc *descs)
     driver_free_datadescs(descs);
 }
 
+PUBLIC_API
+hound_err hound_decode_batch(
+    const struct hound_datadesc *desc,
+    const struct hound_record *records,
+    size_t n,
+    double **columns)
+{
+    return decoder_decode_batch(desc, records, n, columns);
+}
+
 PUBLIC_API
 hound_err hound_alloc_ctx(const struct hound_rq *rq, struct hound_ctx **ctx)
 {
@@ -59,6 +71,15 @@ hound_err hound_start(struct hound_ctx *ctx)
     return ctx_start(ctx);
 }
 
+PUBLIC_API
+hound_err hound_start_async(
+    struct hound_ctx *ctx,
+    size_t workers,
+    size_t max_pending)
+{
+    return ctx_start_async(ctx, workers, max_pending);
+}
+
 PUBLIC_API
 hound_err hound_stop(struct hound_ctx *ctx)
 {
@@ -86,6 +107,27 @@ hound_err hound_read_nowait(
     return ctx_read_nowait(ctx, records, read);
 }
 
+PUBLIC_API
+hound_err hound_read_bytes(
+    struct hound_ctx *ctx,
+    size_t bytes,
+    size_t *records_read,
+    size_t *bytes_read)
+{
+    return ctx_read_bytes(ctx, bytes, NULL, records_read, bytes_read);
+}
+
+PUBLIC_API
+hound_err hound_read_bytes_timeout(
+    struct hound_ctx *ctx,
+    size_t bytes,
+    hound_data_period timeout_ns,
+    size_t *records_read,
+    size_t *bytes_read)
+{
+    return ctx_read_bytes(ctx, bytes, &timeout_ns, records_read, bytes_read);
+}
+
 PUBLIC_API
 hound_err hound_read_bytes_nowait(
     struct hound_ctx *ctx,
@@ -114,6 +156,100 @@ hound_err hound_max_queue_length(struct hound_ctx *ctx, size_t *count)
     return ctx_max_queue_length(ctx, count);
 }
 
+PUBLIC_API
+hound_err hound_get_ctx_fd(struct hound_ctx *ctx, size_t watermark, int *fd)
+{
+    return ctx_get_fd(ctx, watermark, fd);
+}
+
+PUBLIC_API
+hound_err hound_queue_bytes(struct hound_ctx *ctx, size_t *bytes)
+{
+    return ctx_queue_bytes(ctx, bytes);
+}
+
+PUBLIC_API
+hound_err hound_max_queue_bytes(struct hound_ctx *ctx, size_t *bytes)
+{
+    return ctx_max_queue_bytes(ctx, bytes);
+}
+
+PUBLIC_API
+hound_err hound_set_retention(
+    struct hound_ctx *ctx,
+    size_t max_records,
+    hound_data_period max_age_ns)
+{
+    return ctx_set_retention(ctx, max_records, max_age_ns);
+}
+
+PUBLIC_API
+hound_err hound_query_range(
+    struct hound_ctx *ctx,
+    const struct timespec *start,
+    const struct timespec *end,
+    hound_cb cb,
+    void *cb_ctx,
+    size_t *read)
+{
+    return ctx_query_range(ctx, start, end, cb, cb_ctx, read);
+}
+
+PUBLIC_API
+hound_err hound_set_join(struct hound_ctx *ctx, const struct hound_join_rq *rq)
+{
+    return ctx_set_join(ctx, rq);
+}
+
+PUBLIC_API
+hound_err hound_get_join_stats(
+    struct hound_ctx *ctx,
+    struct hound_join_stats *stats)
+{
+    return ctx_join_stats(ctx, stats);
+}
+
+PUBLIC_API
+hound_err hound_set_resample(
+    struct hound_ctx *ctx,
+    const struct hound_resample_rq *rq)
+{
+    return ctx_set_resample(ctx, rq);
+}
+
+PUBLIC_API
+hound_err hound_get_resample_stats(
+    struct hound_ctx *ctx,
+    struct hound_resample_stats *stats)
+{
+    return ctx_resample_stats(ctx, stats);
+}
+
+PUBLIC_API
+hound_err hound_get_filter_stats(
+    struct hound_ctx *ctx,
+    struct hound_filter_stats *stats)
+{
+    return ctx_filter_stats(ctx, stats);
+}
+
+PUBLIC_API
+hound_err hound_set_spin(
+    struct hound_ctx *ctx,
+    hound_data_period read_spin_ns,
+    hound_data_period io_spin_ns)
+{
+    return ctx_set_spin(ctx, read_spin_ns, io_spin_ns);
+}
+
+PUBLIC_API
+hound_err hound_set_rt(
+    const struct hound_rt_rq *rq,
+    struct hound_rt_status *status)
+{
+    return rt_set(rq, status);
+}
+
 PUBLIC_API
 hound_err hound_init_config(const char *config, const char *schema_base)
 {
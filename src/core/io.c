@@ -1,190 +1,335 @@
 /**
  * @file      io.c
- * @brief     Hound I/O subsystem.
+ * @brief     Hound I/O subsystem. A single poll thread reads from all driver
+ *            fds and pushes the resulting records into user queues.
+ *
+ *            The table of fds and the queues attached to them is published as
+ *            an immutable snapshot. A change builds a new snapshot, swaps it in
+ *            atomically and wakes the poll thread, which adopts it at the top
+ *            of its next loop, so polling never stops for a change. The old
+ *            snapshot is freed once the poll thread has moved on from it and
+ *            any other threads pushing records have left their epoch.
+ *
+ *            Each queue entry may have a filter, which sees a record before it
+ *            is allocated and queued, so a record that no queue wants costs
+ *            nothing beyond the filter checks.
+ *
+ *            If any running context asks for it, the poll thread polls
+ *            without blocking for a while before it sleeps in poll, which
+ *            cuts wakeup latency for drivers with a high data rate.
  * @author    Martin Kelly <mkelly@xevo.com>
  * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
  */
 
 #define _GNU_SOURCE
 #include <errno.h>
+#include <hound-private/chunk.h>
 #include <hound-private/driver.h>
 #include <hound-private/driver-ops.h>
 #include <hound-private/error.h>
+#include <hound-private/filter.h>
 #include <hound-private/log.h>
 #include <hound-private/queue.h>
 #include <hound-private/refcount.h>
+#include <hound-private/rt.h>
+#include <hound-private/trace.h>
 #include <hound-private/util.h>
 #include <fcntl.h>
 #include <poll.h>
 #include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <xlib/xhash.h>
 #include <xlib/xvec.h>
 
-#define PAUSE_FD_INDEX 0
+#define WAKE_FD_INDEX 0
 #define DATA_FD_START 1
 
 #define READ_END 0
 #define WRITE_END 1
 
-#define POLL_BUF_SIZE (100*1024)
 #define POLL_DEFAULT_EVENTS (POLLIN|POLLOUT|POLLPRI|POLLERR|POLLHUP)
 
-struct pull_timeout_info {
-    hound_data_id id;
-    hound_data_period current_timeout;
-    hound_data_period max_timeout;
-};
+/* Marks a pull period that didn't exist in the entry being replaced. */
+#define NO_PREV SIZE_MAX
 
-struct pull_info {
-    hound_data_period last_pull;
-    xvec_t(struct pull_timeout_info) timeout_info;
-};
+/* A set of data IDs. */
+XHASH_SET_INIT_INT(ID_SET)
 
-/** Map from fd to pull-mode timeout information for the fd. */
-XHASH_MAP_INIT_INT(PULL_MAP, struct pull_info)
-xhash_t(PULL_MAP) *s_pull_map = NULL;
+/* data ID --> filter */
+XHASH_MAP_INIT_INT(FILTER_MAP, struct filter *)
+
+XVEC_DEFINE(period_vec, hound_data_period);
+
+/* data ID --> list of pull periods */
+XHASH_MAP_INIT_INT(PERIOD_MAP, period_vec)
 
 struct queue_entry {
     hound_data_id id;
     struct queue *queue;
+
+    /* NULL if the data isn't filtered. Each entry holds a reference. */
+    struct filter *filter;
+};
+
+struct pull_period {
+    hound_data_id id;
+    hound_data_period period;
+
+    /* The index of the same period in the entry this one replaced, if any. */
+    size_t prev;
 };
 
 /**
  * Provides the relevant information that the I/O system need to know about a
- * given fd (besides the fd value itself). This is stored separately from the
- * struct pollfd structures because poll requires that the array of struct
- * pollfd's passed in be contiguous in memory.
+ * given fd (besides the fd value itself). The first part never changes after
+ * the entry is published; changing an fd replaces its entry. The second part
+ * belongs to the poll thread, which sets it up when it first sees the entry.
  */
-struct fdctx {
+struct fd_entry {
+    int fd;
     struct driver *drv;
+    size_t queue_count;
+    struct queue_entry *queues;
+    size_t period_count;
+    struct pull_period *periods;
+
+    bool adopted;
+    short events;
     bool timeout_enabled;
     hound_data_period timeout_ns;
-    xvec_t(struct queue_entry) queues;
+    hound_data_period last_pull;
+    hound_data_period *timeouts;
 };
 
-static struct {
-    pthread_rwlock_t lock;
-    xvec_t(struct fdctx) ctx;
-    xvec_t(struct pollfd) fds;
-} s_ios;
+struct snapshot {
+    uint_fast64_t gen;
+    size_t count;
+    struct fd_entry **entries;
+
+    /*
+     * The wake pipe followed by the fd of each entry. This is filled in by the
+     * poll thread, and it is stored separately from the entries because poll
+     * requires that the array of struct pollfd's passed in be contiguous in
+     * memory.
+     */
+    struct pollfd *fds;
+};
+
+/* Writers are serialized, and always replace the whole snapshot. */
+static pthread_mutex_t s_write_mutex = PTHREAD_MUTEX_INITIALIZER;
+static _Atomic(struct snapshot *) s_snapshot;
+
+/* The generation of the last snapshot the poll thread adopted. */
+static pthread_mutex_t s_adopt_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_adopt_cond = PTHREAD_COND_INITIALIZER;
+static uint_fast64_t s_adopted_gen;
+
+/*
+ * Threads other than the poll thread can push records too (for instance, from
+ * a driver's next callback). They register in the current epoch while they use
+ * a snapshot, and a writer flips the epoch and waits for the old one to empty.
+ */
+static atomic_uint_fast64_t s_epoch;
+static atomic_size_t s_epoch_readers[2];
 
 /* Polling. */
 static pthread_t s_poll_thread;
-static int s_self_pipe[2];
-static pthread_mutex_t s_poll_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t s_poll_cond = PTHREAD_COND_INITIALIZER;
-static bool s_poll_active_target = false;
-static bool s_poll_active_current = false;
+static struct rt_thread s_poll_rt;
+static bool s_poll_running = false;
+static atomic_bool s_poll_stop;
+static int s_wake_pipe[2];
+
+/* Contexts asking the poll thread to spin, and the largest budget any wants. */
+static pthread_mutex_t s_spin_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct io_spin *s_spins;
+static atomic_uint_fast64_t s_spin_ns;
 
-static unsigned char s_read_buf[POLL_BUF_SIZE];
+/* Set on the poll thread while it is servicing an fd. */
+static _Thread_local struct fd_entry *s_poll_entry;
+
+/* Set on the poll thread while a zero-copy driver parses a chunk. */
+static _Thread_local struct chunk *s_parse_chunk;
 
 static
-size_t get_fd_index(int fd)
+uint_fast64_t enter_epoch(void)
 {
-    size_t index;
-    const struct pollfd *pfd;
+    uint_fast64_t epoch;
 
-    for (index = DATA_FD_START; index < xv_size(s_ios.fds); ++index) {
-        pfd = &xv_A(s_ios.fds, index);
-        if (pfd->fd == fd) {
-            break;
+    while (true) {
+        epoch = atomic_load(&s_epoch);
+        atomic_fetch_add(&s_epoch_readers[epoch % 2], 1);
+        if (atomic_load(&s_epoch) == epoch) {
+            return epoch;
         }
+
+        /* A writer flipped the epoch under us, so try again. */
+        atomic_fetch_sub(&s_epoch_readers[epoch % 2], 1);
     }
-    XASSERT_NEQ(index, xv_size(s_ios.fds));
+}
 
-    return index;
+static
+void exit_epoch(uint_fast64_t epoch)
+{
+    atomic_fetch_sub(&s_epoch_readers[epoch % 2], 1);
 }
 
 static
-size_t get_fdctx_index(size_t fd_index)
+void wait_for_epoch(void)
 {
+    uint_fast64_t epoch;
+
     /*
-     * We have to subtract one to get the ctx corresponding to an fd index
-     * because the first index is taken up by the special self-pipe that we use
-     * to stop the poll loop.
+     * Anyone who entered the old epoch might have seen the old snapshot, and
+     * anyone who enters the new one will see the new snapshot, so once the old
+     * epoch is empty, nobody outside the poll thread can be using the old
+     * snapshot. Readers hold an epoch only while pushing records, so spinning
+     * is fine.
      */
-    XASSERT_GT(fd_index, 0);
-    return fd_index - 1;
+    epoch = atomic_fetch_add(&s_epoch, 1);
+    while (atomic_load(&s_epoch_readers[epoch % 2]) > 0) {
+        sched_yield();
+    }
 }
 
 static
-struct fdctx *get_fdctx(int fd)
+struct fd_entry *find_entry(const struct snapshot *snapshot, int fd)
 {
-    size_t fdctx_index;
+    size_t i;
 
-    fdctx_index = get_fdctx_index(get_fd_index(fd));
+    for (i = 0; i < snapshot->count; ++i) {
+        if (snapshot->entries[i]->fd == fd) {
+            return snapshot->entries[i];
+        }
+    }
 
-    return &xv_A(s_ios.ctx, fdctx_index);
+    return NULL;
 }
 
+/**
+ * Wraps a record for queueing. The record info holds one reference, which the
+ * caller must drop when done pushing.
+ */
 static
-struct fdctx *get_fdctx_from_fd_index(size_t fd_index)
+struct record_info *make_rec_info(
+    struct driver *drv,
+    struct hound_record *record)
 {
-    size_t fdctx_index;
+    struct record_info *rec_info;
 
-    fdctx_index = get_fdctx_index(fd_index);
+    rec_info = drv_alloc(sizeof(*rec_info));
+    if (rec_info == NULL) {
+        hound_log_err_limited_nofmt(
+                HOUND_OOM,
+                "Failed to allocate a rec_info; can't add record to user queue");
+        return NULL;
+    }
+    record->dev_id = drv->id;
+    rec_info->record = *record;
+    if (s_parse_chunk != NULL &&
+        chunk_contains(s_parse_chunk, record->data)) {
+        /* The record points into the buffer we read, so keep it alive. */
+        chunk_ref(s_parse_chunk);
+        rec_info->chunk = s_parse_chunk;
+    }
+    else {
+        rec_info->chunk = NULL;
+    }
+    HOUND_TRACE(record_push, record->data_id, record->dev_id, record->size);
 
-    return &xv_A(s_ios.ctx, fdctx_index);
+    /*
+     * Hold our own reference while pushing, as a reader of one queue can
+     * consume and release the record before we push it to the next queue.
+     */
+    atomic_ref_init(&rec_info->refcount, 1);
+
+    return rec_info;
 }
 
-void io_push_records(struct hound_record *records, size_t count)
+static
+void push_to_queues(
+    const struct fd_entry *entry,
+    struct driver *drv,
+    struct hound_record *records,
+    size_t count)
 {
     const struct hound_record *end;
-    struct driver *drv;
-    struct queue_entry *entry;
-    struct fdctx *fdctx;
+    const struct queue_entry *qentry;
     size_t i;
+    bool passed;
     struct hound_record *record;
     struct record_info *rec_info;
-    bool pushed;
-
-    pthread_rwlock_rdlock(&s_ios.lock);
-
-    drv = get_active_drv();
-    XASSERT_NOT_NULL(drv);
-
-    fdctx = get_fdctx(drv->fd);
-    XASSERT_NOT_NULL(fdctx);
 
     /* Add to all user queues. */
     end = records + count;
     for (record = records; record < end; ++record) {
-        rec_info = drv_alloc(sizeof(*rec_info));
-        if (rec_info == NULL) {
-            hound_log_err_nofmt(
-                    HOUND_OOM,
-                    "Failed to allocate a rec_info; can't add record to user queue");
-            continue;
-        }
-        record->dev_id = drv->id;
-        rec_info->record = *record;
-        atomic_ref_init(&rec_info->refcount, 0);
-
-        pushed = false;
-        for (i = 0; i < xv_size(fdctx->queues); ++i) {
-            entry = &xv_A(fdctx->queues, i);
-            if (record->data_id == entry->id) {
-                atomic_ref_inc(&rec_info->refcount);
-//                fprintf(stderr, "pushing %p into %lu\n", (void *) rec_info, i);
-                queue_push(entry->queue, rec_info);
-                pushed = true;
+        /* Don't allocate anything until some queue wants the record. */
+        rec_info = NULL;
+        for (i = 0; i < entry->queue_count; ++i) {
+            qentry = &entry->queues[i];
+            if (record->data_id != qentry->id) {
+                continue;
+            }
+
+            if (qentry->filter != NULL) {
+                passed = filter_pass(qentry->filter, record);
+                queue_count_filtered(qentry->queue, passed);
+                if (!passed) {
+                    continue;
+                }
+            }
+
+            if (rec_info == NULL) {
+                rec_info = make_rec_info(drv, record);
+                if (rec_info == NULL) {
+                    break;
+                }
             }
+            atomic_ref_inc(&rec_info->refcount);
+            queue_push(qentry->queue, rec_info);
+        }
+
+        if (rec_info != NULL) {
+            record_ref_dec(rec_info);
         }
-        if (!pushed) {
+        else if (s_parse_chunk == NULL ||
+                 !chunk_contains(s_parse_chunk, record->data)) {
             /*
-             * This is unlikely, but if there's no queue associated with this
-             * data, make sure we don't leak the record info. This should happen
-             * only if a driver pushes data from outside the poll loop and its
-             * context is being modified at the same time.
+             * Nobody took the record, either because the filters dropped it or
+             * because no queue wants its data. The latter should happen only if
+             * a driver pushes data from outside the poll loop while its context
+             * is being modified. Either way, we own its data.
              */
-            drv_free(rec_info);
+            drv_free(record->data);
         }
     }
+}
+
+void io_push_records(struct hound_record *records, size_t count)
+{
+    struct driver *drv;
+    struct fd_entry *entry;
+    uint_fast64_t epoch;
+
+    drv = get_active_drv();
+    XASSERT_NOT_NULL(drv);
 
-    pthread_rwlock_unlock(&s_ios.lock);
+    if (s_poll_entry != NULL) {
+        /* We're on the poll thread, which holds onto its snapshot. */
+        XASSERT_EQ(s_poll_entry->drv, drv);
+        push_to_queues(s_poll_entry, drv, records, count);
+        return;
+    }
+
+    epoch = enter_epoch();
+    entry = find_entry(atomic_load(&s_snapshot), drv->fd);
+    XASSERT_NOT_NULL(entry);
+    push_to_queues(entry, drv, records, count);
+    exit_epoch(epoch);
 }
 
 static
@@ -202,14 +347,36 @@ hound_data_period get_time_ns(void)
 }
 
 static
-hound_err make_records(struct driver *drv, unsigned char *buf, size_t size)
+hound_err make_records(struct driver *drv)
 {
+    unsigned char *buf;
     ssize_t bytes_read;
     hound_err err;
     int fd;
 
+    /*
+     * We're inside a driver ops callback, so we hold the driver's op_lock,
+     * which protects its read buffers.
+     */
+    if (drv->read_pool != NULL) {
+        if (drv->read_chunk == NULL) {
+            drv->read_chunk = chunk_get(drv->read_pool);
+            if (drv->read_chunk == NULL) {
+                hound_log_err_limited_nofmt(
+                    HOUND_OOM,
+                    "Failed to allocate a chunk");
+                return HOUND_OOM;
+            }
+        }
+        buf = drv->read_chunk->data;
+    }
+    else {
+        buf = drv->read_buf;
+    }
+    XASSERT_NOT_NULL(buf);
+
     fd = drv_fd();
-    bytes_read = read(fd, buf, size);
+    bytes_read = read(fd, buf, drv->read_size);
     if (bytes_read <= 0) {
         if (bytes_read == 0 || errno == EAGAIN || errno == EWOULDBLOCK) {
             /* No more data to read, so we're done. */
@@ -221,7 +388,7 @@ hound_err make_records(struct driver *drv, unsigned char *buf, size_t size)
             return HOUND_INTR;
         }
         else if (errno == EIO) {
-            hound_log_err(errno, "read returned EIO on fd %d", fd);
+            hound_log_err_limited(errno, "read returned EIO on fd %d", fd);
             return HOUND_IO_ERROR;
         }
         else {
@@ -236,12 +403,27 @@ hound_err make_records(struct driver *drv, unsigned char *buf, size_t size)
      * inside a driver ops callback, so re-taking the mutex will cause a
      * deadlock!
      */
+    HOUND_TRACE(drv_op_entry, "parse", drv->id);
+    s_parse_chunk = drv->read_chunk;
     err = drv->ops.parse(buf, bytes_read);
+    s_parse_chunk = NULL;
+    HOUND_TRACE(drv_op_exit, "parse", drv->id, err);
+
+    /*
+     * If any records still point into the chunk, hand it over to them, and
+     * read into a fresh chunk next time. Otherwise, we can reuse it.
+     */
+    if (drv->read_chunk != NULL && chunk_shared(drv->read_chunk)) {
+        chunk_unref(drv->read_chunk);
+        drv->read_chunk = NULL;
+    }
+
     if (err != HOUND_OK) {
-        hound_log_err(
+        hound_log_err_limited(
                 err,
-                "Driver failed to parse records (size = %zu, drv = 0x%p)",
-                bytes_read, drv);
+                "Driver failed to parse records (size = %zu, drv = %p)",
+                (size_t) bytes_read,
+                (void *) drv);
         return err;
     }
 
@@ -256,62 +438,64 @@ hound_err io_default_pull(
     hound_data_period *timeout)
 {
     struct driver *drv;
+    struct fd_entry *entry;
     hound_err err;
     size_t i;
-    struct pull_info *info;
-    xhiter_t iter;
     hound_data_period lateness;
     hound_data_period min_timeout;
-    struct pull_timeout_info *timeout_info;
+    const struct pull_period *period;
+    hound_data_period *current_timeout;
     hound_data_period time_since_last_poll;
 
     drv = get_active_drv();
 
-    iter = xh_get(PULL_MAP, s_pull_map, drv_fd());
-    XASSERT_NEQ(iter, xh_end(s_pull_map));
-    info = &xh_val(s_pull_map, iter);
+    /* Pull-mode drivers call this only from within the poll loop. */
+    entry = s_poll_entry;
+    XASSERT_NOT_NULL(entry);
 
     /* Adjust our timeout data and trigger a pull if a timeout expired. */
-    time_since_last_poll = poll_time - info->last_pull;
+    time_since_last_poll = poll_time - entry->last_pull;
     min_timeout = UINT64_MAX;
-    for (i = 0; i < xv_size(info->timeout_info); ++i) {
-        timeout_info = &xv_A(info->timeout_info, i);
+    for (i = 0; i < entry->period_count; ++i) {
+        period = &entry->periods[i];
+        current_timeout = &entry->timeouts[i];
 
-        if (time_since_last_poll >= timeout_info->current_timeout) {
+        if (time_since_last_poll >= *current_timeout) {
             /* Driver is ready to pull data. */
-            lateness = time_since_last_poll - timeout_info->current_timeout;
+            lateness = time_since_last_poll - *current_timeout;
             /*
              * NOTE: We don't use drv_ops_next here, which would set the active
              * driver and take the driver ops mutex. This is because we are already
              * inside a driver ops callback, so re-taking the mutex will cause a
              * deadlock!
              */
-            err = drv->ops.next(timeout_info->id);
+            HOUND_TRACE(drv_op_entry, "next", drv->id);
+            err = drv->ops.next(period->id);
+            HOUND_TRACE(drv_op_exit, "next", drv->id, err);
             if (err != HOUND_OK) {
-                hound_log_err(
+                hound_log_err_limited(
                         err,
                         "driver %p failed to pull data",
                         (void *) drv);
             }
-            if (lateness >= timeout_info->max_timeout) {
+            if (lateness >= period->period) {
                 /* We were so late that the driver is ready again. */
-                timeout_info->current_timeout = 0;
+                *current_timeout = 0;
             }
             else {
-                timeout_info->current_timeout =
-                    timeout_info->max_timeout - lateness;
+                *current_timeout = period->period - lateness;
             }
         }
         else {
-            timeout_info->current_timeout -= time_since_last_poll;
+            *current_timeout -= time_since_last_poll;
         }
 
         /* Find the next lowest timeout. */
-        min_timeout = min(min_timeout, timeout_info->current_timeout);
+        min_timeout = min(min_timeout, *current_timeout);
     }
 
     if (events & POLLIN) {
-        err = make_records(drv, s_read_buf, ARRAYLEN(s_read_buf));
+        err = make_records(drv);
     }
     else {
         err = HOUND_OK;
@@ -321,7 +505,7 @@ hound_err io_default_pull(
     *next_events = POLLIN;
     *timeout_enabled = true;
     *timeout = min_timeout;
-    info->last_pull = poll_time;
+    entry->last_pull = poll_time;
 
     return err;
 }
@@ -340,27 +524,27 @@ hound_err io_default_push(
         return HOUND_OK;
     }
 
-    return make_records(get_active_drv(), s_read_buf, ARRAYLEN(s_read_buf));
+    return make_records(get_active_drv());
 }
 
 static
 hound_err io_read(
-    struct fdctx *ctx,
+    struct fd_entry *entry,
     hound_data_period poll_time,
     short events,
     short *next_events)
 {
     hound_err err;
 
-    ctx->timeout_enabled = false;
-    ctx->timeout_ns = UINT64_MAX;
+    entry->timeout_enabled = false;
+    entry->timeout_ns = UINT64_MAX;
     err = drv_op_poll(
-        ctx->drv,
+        entry->drv,
         events,
         next_events,
         poll_time,
-        &ctx->timeout_enabled,
-        &ctx->timeout_ns);
+        &entry->timeout_enabled,
+        &entry->timeout_ns);
     if (err != HOUND_OK) {
         return err;
     }
@@ -368,61 +552,214 @@ hound_err io_read(
     return HOUND_OK;
 }
 
+static
+void populate_timespec(hound_data_period ts, struct timespec *spec)
+{
+    spec->tv_sec = ts / NSEC_PER_SEC;
+    spec->tv_nsec = ts % NSEC_PER_SEC;
+}
+
+static
+void set_fd_timeout(struct fd_entry *entry)
+{
+    size_t i;
+    hound_data_period min_timeout;
+
+    if (entry->period_count == 0) {
+        /* No timing entries; nothing to do here. */
+        entry->timeout_enabled = false;
+        entry->timeout_ns = UINT64_MAX;
+        return;
+    }
+
+    min_timeout = UINT64_MAX;
+    for (i = 0; i < entry->period_count; ++i) {
+        min_timeout = min(min_timeout, entry->timeouts[i]);
+    }
+    entry->timeout_enabled = true;
+    entry->timeout_ns = min_timeout;
+}
+
 /**
- * Wait until it's safe for the event loop to continue.
+ * Sets up the poll thread's state for a new entry, carrying it over from the
+ * entry it replaces, if any.
  */
 static
-void io_wait_for_ready(void) {
-    lock_mutex(&s_poll_mutex);
-    while (!s_poll_active_target) {
-        s_poll_active_current = false;
-        cond_signal(&s_poll_cond);
-        cond_wait(&s_poll_cond, &s_poll_mutex);
+void adopt_entry(struct fd_entry *entry, const struct snapshot *prev)
+{
+    size_t i;
+    const struct fd_entry *old;
+    const struct pull_period *period;
+
+    if (prev != NULL) {
+        old = find_entry(prev, entry->fd);
+    }
+    else {
+        old = NULL;
+    }
+
+    if (old != NULL) {
+        entry->events = old->events;
+        entry->timeout_enabled = old->timeout_enabled;
+        entry->timeout_ns = old->timeout_ns;
+        entry->last_pull = old->last_pull;
     }
-    s_poll_active_current = true;
-    unlock_mutex(&s_poll_mutex);
+    else {
+        entry->events = POLL_DEFAULT_EVENTS;
+        entry->timeout_enabled = false;
+        entry->timeout_ns = UINT64_MAX;
+        entry->last_pull = 0;
+    }
+
+    for (i = 0; i < entry->period_count; ++i) {
+        period = &entry->periods[i];
+        if (old != NULL && period->prev != NO_PREV) {
+            entry->timeouts[i] = old->timeouts[period->prev];
+        }
+        else {
+            entry->timeouts[i] = period->period;
+        }
+    }
+
+    /*
+     * For pull-mode drivers, adjust the new fd timeout, as timing entries may
+     * have been added or deleted.
+     */
+    if (driver_is_pull_mode(entry->drv)) {
+        set_fd_timeout(entry);
+    }
+
+    entry->adopted = true;
 }
 
 static
-void populate_timespec(hound_data_period ts, struct timespec *spec)
+void adopt_snapshot(struct snapshot *snapshot, const struct snapshot *prev)
 {
-    spec->tv_sec = ts / NSEC_PER_SEC;
-    spec->tv_nsec = ts % NSEC_PER_SEC;
+    struct fd_entry *entry;
+    size_t i;
+    struct pollfd *pfd;
+
+    pfd = &snapshot->fds[WAKE_FD_INDEX];
+    pfd->fd = s_wake_pipe[READ_END];
+    pfd->events = POLLIN;
+
+    for (i = 0; i < snapshot->count; ++i) {
+        entry = snapshot->entries[i];
+        if (!entry->adopted) {
+            adopt_entry(entry, prev);
+        }
+        pfd = &snapshot->fds[DATA_FD_START + i];
+        pfd->fd = entry->fd;
+        pfd->events = entry->events;
+    }
+
+    /* Tell the writer we're done with the previous snapshot. */
+    lock_mutex(&s_adopt_mutex);
+    s_adopted_gen = snapshot->gen;
+    pthread_cond_broadcast(&s_adopt_cond);
+    unlock_mutex(&s_adopt_mutex);
 }
 
 static
-bool need_to_pause(void)
+void drain_wake_pipe(void)
 {
-    char buf;
+    char buf[64];
     ssize_t bytes;
-    struct pollfd *pfd;
-    bool result;
 
-    pthread_rwlock_rdlock(&s_ios.lock);
+    do {
+        bytes = read(s_wake_pipe[READ_END], buf, sizeof(buf));
+    } while (bytes > 0);
+    XASSERT(bytes == 0 || errno == EAGAIN || errno == EWOULDBLOCK);
+}
 
-    pfd = &xv_A(s_ios.fds, PAUSE_FD_INDEX);
-    if (!(pfd->revents & POLLIN)) {
-        result = false;
-        goto out;
+/**
+ * Waits for I/O on the snapshot's fds. If spinning is enabled, this first polls
+ * without blocking until something is ready or the spin budget runs out. After
+ * a spin comes up empty, the poll thread goes straight to sleep until a sleep
+ * turns out shorter than the spin budget, so an idle poll thread doesn't keep
+ * burning CPU.
+ *
+ * @param snapshot the current snapshot
+ * @param timeout_ns the poll timeout, or NULL for none. If we spin, this is
+ *                   reduced by the time spent spinning.
+ * @param spin_idle the poll thread's idle flag
+ *
+ * @return the result of the last ppoll
+ */
+static
+int wait_for_io(
+    struct snapshot *snapshot,
+    hound_data_period *timeout_ns,
+    bool *spin_idle)
+{
+    hound_data_period budget;
+    hound_data_period elapsed;
+    int fds;
+    size_t nfds;
+    hound_data_period spin_ns;
+    hound_data_period start;
+    struct timespec *timeout;
+    struct timespec timeout_spec;
+    static const struct timespec zero_timeout = { 0, 0 };
+
+    nfds = DATA_FD_START + snapshot->count;
+    spin_ns = atomic_load_explicit(&s_spin_ns, memory_order_relaxed);
+    if (spin_ns > 0 && !*spin_idle) {
+        /* Don't spin past a driver timeout. */
+        budget = spin_ns;
+        if (timeout_ns != NULL) {
+            budget = min(budget, *timeout_ns);
+        }
+
+        start = monotonic_ns();
+        do {
+            fds = ppoll(snapshot->fds, nfds, &zero_timeout, NULL);
+            if (fds != 0) {
+                return fds;
+            }
+            cpu_relax();
+            elapsed = monotonic_ns() - start;
+        } while (elapsed < budget);
+
+        if (timeout_ns != NULL) {
+            if (elapsed >= *timeout_ns) {
+                /* A driver timeout is due, so there's no need to sleep. */
+                return 0;
+            }
+            *timeout_ns -= elapsed;
+        }
+        *spin_idle = true;
     }
 
-    /* Read the self-pipe so it can be used again. */
-    do {
-        bytes = read(pfd->fd, &buf, sizeof(buf));
-        XASSERT_NEQ(bytes, -1);
-    } while (bytes != sizeof(buf));
+    if (timeout_ns != NULL) {
+        populate_timespec(*timeout_ns, &timeout_spec);
+        timeout = &timeout_spec;
+    }
+    else {
+        timeout = NULL;
+    }
 
-    result = true;
+    /*
+     * Wait for I/O. We use ppoll for a more precise timeout, not because we
+     * need to care about signals.
+     */
+    if (spin_ns == 0) {
+        return ppoll(snapshot->fds, nfds, timeout, NULL);
+    }
 
-out:
-    pthread_rwlock_unlock(&s_ios.lock);
-    return result;
+    start = monotonic_ns();
+    fds = ppoll(snapshot->fds, nfds, timeout, NULL);
+    if (fds > 0 && monotonic_ns() - start < spin_ns) {
+        *spin_idle = false;
+    }
+
+    return fds;
 }
 
 static
 void *io_poll(UNUSED void *data)
 {
-    struct fdctx *ctx;
+    struct fd_entry *entry;
     hound_err err;
     bool fd_timeout;
     size_t i;
@@ -430,46 +767,54 @@ void *io_poll(UNUSED void *data)
     bool have_timeout;
     uint_fast64_t last_poll_ns;
     hound_data_period min_timeout;
+    struct snapshot *next;
     hound_data_period now;
     struct pollfd *pfd;
-    struct timespec *timeout;
-    struct timespec timeout_spec;
+    struct snapshot *snapshot;
+    bool spin_idle;
     hound_data_period time_since_last_poll;
 
     last_poll_ns = get_time_ns();
 
+    snapshot = NULL;
+    spin_idle = false;
     while (true) {
-        io_wait_for_ready();
+        /* Pick up any changes. */
+        next = atomic_load(&s_snapshot);
+        if (next != snapshot) {
+            adopt_snapshot(next, snapshot);
+            snapshot = next;
+        }
+
+        if (atomic_load(&s_poll_stop)) {
+            break;
+        }
 
         /* Find the timeout we need for the poll (if any). */
         have_timeout = false;
         min_timeout = UINT64_MAX;
-        for (i = 0; i < xv_size(s_ios.ctx); ++i) {
-            ctx = &xv_A(s_ios.ctx, i);
-            if (!ctx->timeout_enabled) {
+        for (i = 0; i < snapshot->count; ++i) {
+            entry = snapshot->entries[i];
+            if (!entry->timeout_enabled) {
                 continue;
             }
             have_timeout = true;
-            min_timeout = min(min_timeout, ctx->timeout_ns);
-        }
-        if (have_timeout) {
-            populate_timespec(min_timeout, &timeout_spec);
-            timeout = &timeout_spec;
-        }
-        else {
-            timeout = NULL;
+            min_timeout = min(min_timeout, entry->timeout_ns);
         }
-
-        /*
-         * Wait for I/O. We use ppoll for a more precise timeout, not because we
-         * need to care about signals.
-         */
-        fds = ppoll(xv_data(s_ios.fds), xv_size(s_ios.fds), timeout, NULL);
+        fds = wait_for_io(
+            snapshot,
+            have_timeout ? &min_timeout : NULL,
+            &spin_idle);
         now = get_time_ns();
         time_since_last_poll = now - last_poll_ns;
         last_poll_ns = now;
-        if (fds > 0 && need_to_pause()) {
-            continue;
+        HOUND_TRACE(poll_wakeup, fds, time_since_last_poll);
+        if (fds > 0 && (snapshot->fds[WAKE_FD_INDEX].revents & POLLIN)) {
+            /*
+             * A writer published a new snapshot. Finish this round with the
+             * current one, and we'll pick it up at the top of the loop.
+             */
+            drain_wake_pipe();
         }
         else if (fds == -1) {
             /* Error. */
@@ -478,10 +823,10 @@ void *io_poll(UNUSED void *data)
                 continue;
             }
             else if (errno == ENOMEM) {
-                hound_log_err_nofmt(errno, "poll failed with ENOMEM");
+                hound_log_err_limited_nofmt(errno, "poll failed with ENOMEM");
             }
             else if (errno == EIO) {
-                hound_log_err_nofmt(errno, "poll failed with EIO");
+                hound_log_err_limited_nofmt(errno, "poll failed with EIO");
             }
             else {
                 /* Other error codes are likely program bugs. */
@@ -490,18 +835,18 @@ void *io_poll(UNUSED void *data)
         }
 
         /* Read all fds that have data, and adjust timeouts. */
-        pthread_rwlock_rdlock(&s_ios.lock);
-        for (i = DATA_FD_START; i < xv_size(s_ios.fds); ++i) {
-            ctx = get_fdctx_from_fd_index(i);
-            pfd = &xv_A(s_ios.fds, i);
-
-            if (ctx->timeout_enabled) {
-                if (time_since_last_poll >= ctx->timeout_ns) {
-                    ctx->timeout_enabled = false;
+        for (i = 0; i < snapshot->count; ++i) {
+            entry = snapshot->entries[i];
+            pfd = &snapshot->fds[DATA_FD_START + i];
+
+            if (entry->timeout_enabled) {
+                if (time_since_last_poll >= entry->timeout_ns) {
+                    entry->timeout_enabled = false;
                     fd_timeout = true;
                 }
                 else {
-                    ctx->timeout_ns -= time_since_last_poll;
+                    entry->timeout_ns -= time_since_last_poll;
+                    fd_timeout = false;
                 }
             }
             else {
@@ -512,143 +857,496 @@ void *io_poll(UNUSED void *data)
                 continue;
             }
 
-            err = io_read(ctx, now, pfd->revents, &pfd->events);
+            s_poll_entry = entry;
+            err = io_read(entry, now, pfd->revents, &pfd->events);
+            s_poll_entry = NULL;
+            entry->events = pfd->events;
             if (err == HOUND_INTR) {
-                /* Someone wants to pause polling; finish reading later. */
+                /* We got a signal; finish reading later. */
                 break;
             }
             if (err != HOUND_OK) {
-                hound_log_err(err, "Failed to grab record from fd %d", pfd->fd);
+                hound_log_err_limited(
+                    err,
+                    "Failed to grab record from fd %d",
+                    pfd->fd);
                 continue;
             }
         }
-        pthread_rwlock_unlock(&s_ios.lock);
     }
 
     return NULL;
 }
 
 static
-void pause_poll(void)
+void wake_poll(void)
 {
     ssize_t bytes;
     static const char payload = 1;
 
-    /*
-     * Wait until the poll has actually canceled. io_wait_for_ready will signal
-     * on the condition variable when it is run.
-     */
-    lock_mutex(&s_poll_mutex);
-    s_poll_active_target = false;
-    while (s_poll_active_current) {
-        do {
-            bytes = write(s_self_pipe[WRITE_END], &payload, sizeof(payload));
-            XASSERT_NEQ(bytes, -1);
-        } while (bytes != sizeof(payload));
-        cond_signal(&s_poll_cond);
-        cond_wait(&s_poll_cond, &s_poll_mutex);
+    bytes = write(s_wake_pipe[WRITE_END], &payload, sizeof(payload));
+    /* A full pipe means the poll thread is already going to wake up. */
+    XASSERT(
+        bytes == sizeof(payload) || errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+static
+void free_entry(struct fd_entry *entry)
+{
+    size_t i;
+
+    for (i = 0; i < entry->queue_count; ++i) {
+        if (entry->queues[i].filter != NULL) {
+            filter_unref(entry->queues[i].filter);
+        }
     }
-    unlock_mutex(&s_poll_mutex);
+    free(entry->timeouts);
+    free(entry->periods);
+    free(entry->queues);
+    free(entry);
 }
 
 static
-void resume_poll(void)
+void free_snapshot(struct snapshot *snapshot)
 {
-    lock_mutex(&s_poll_mutex);
-    s_poll_active_target = true;
-    cond_signal(&s_poll_cond);
-    unlock_mutex(&s_poll_mutex);
+    free(snapshot->fds);
+    free(snapshot->entries);
+    free(snapshot);
 }
 
 static
-hound_err io_start_poll(void)
+bool has_entry(const struct snapshot *snapshot, const struct fd_entry *entry)
 {
-    hound_err err;
+    size_t i;
 
-    err = pthread_create(&s_poll_thread, NULL, io_poll, NULL);
-    if (err != 0) {
-        return err;
+    for (i = 0; i < snapshot->count; ++i) {
+        if (snapshot->entries[i] == entry) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static
+struct snapshot *alloc_snapshot(size_t count)
+{
+    struct snapshot *snapshot;
+
+    snapshot = malloc(sizeof(*snapshot));
+    if (snapshot == NULL) {
+        goto error_alloc_snapshot;
+    }
+
+    snapshot->entries = malloc(count * sizeof(*snapshot->entries));
+    if (snapshot->entries == NULL && count > 0) {
+        goto error_alloc_entries;
+    }
+
+    snapshot->fds = malloc((DATA_FD_START + count) * sizeof(*snapshot->fds));
+    if (snapshot->fds == NULL) {
+        goto error_alloc_fds;
+    }
+
+    snapshot->count = count;
+
+    return snapshot;
+
+error_alloc_fds:
+    free(snapshot->entries);
+error_alloc_entries:
+    free(snapshot);
+error_alloc_snapshot:
+    return NULL;
+}
+
+/**
+ * Publishes a new snapshot, waits until nothing can still be using the old one,
+ * and then frees whatever the new snapshot doesn't share with it. Must be
+ * called with the write mutex held.
+ */
+static
+void publish(struct snapshot *snapshot)
+{
+    size_t i;
+    struct snapshot *prev;
+
+    prev = atomic_load(&s_snapshot);
+    snapshot->gen = prev->gen + 1;
+    atomic_store(&s_snapshot, snapshot);
+
+    /* Wait for the poll thread to switch over... */
+    if (s_poll_running) {
+        lock_mutex(&s_adopt_mutex);
+        wake_poll();
+        while (s_adopted_gen < snapshot->gen) {
+            cond_wait(&s_adopt_cond, &s_adopt_mutex);
+        }
+        unlock_mutex(&s_adopt_mutex);
+    }
+
+    /* ...and for anyone else pushing records. */
+    wait_for_epoch();
+
+    for (i = 0; i < prev->count; ++i) {
+        if (!has_entry(snapshot, prev->entries[i])) {
+            free_entry(prev->entries[i]);
+        }
+    }
+    free_snapshot(prev);
+}
+
+/**
+ * Publishes a copy of the current snapshot with the entry for the given fd
+ * replaced. If entry is NULL, the fd is removed, and if the fd isn't in the
+ * current snapshot, the entry is added. Must be called with the write mutex
+ * held.
+ */
+static
+hound_err replace_entry(int fd, struct fd_entry *entry)
+{
+    size_t count;
+    size_t i;
+    size_t j;
+    struct snapshot *prev;
+    struct snapshot *snapshot;
+
+    prev = atomic_load(&s_snapshot);
+    for (i = 0; i < prev->count; ++i) {
+        if (prev->entries[i]->fd == fd) {
+            break;
+        }
+    }
+
+    count = prev->count;
+    if (i == prev->count) {
+        XASSERT_NOT_NULL(entry);
+        ++count;
     }
+    else if (entry == NULL) {
+        --count;
+    }
+
+    snapshot = alloc_snapshot(count);
+    if (snapshot == NULL) {
+        return HOUND_OOM;
+    }
+
+    count = 0;
+    for (j = 0; j < prev->count; ++j) {
+        if (j != i) {
+            snapshot->entries[count] = prev->entries[j];
+            ++count;
+        }
+        else if (entry != NULL) {
+            snapshot->entries[count] = entry;
+            ++count;
+        }
+    }
+    if (i == prev->count) {
+        snapshot->entries[count] = entry;
+        ++count;
+    }
+    XASSERT_EQ(count, snapshot->count);
+
+    publish(snapshot);
 
     return HOUND_OK;
 }
 
 static
-void io_stop_poll(void)
+void destroy_period_map(xhash_t(PERIOD_MAP) *map)
+{
+    xhiter_t iter;
+
+    xh_iter(map, iter,
+        xv_destroy(xh_val(map, iter));
+    );
+    xh_destroy(PERIOD_MAP, map);
+}
+
+/**
+ * Indexes the requests being removed from an fd: the data IDs, and for each
+ * data ID, the pull periods to drop.
+ */
+static
+hound_err make_remove_index(
+    const struct hound_data_rq *rqs,
+    size_t len,
+    bool pull_mode,
+    xhash_t(ID_SET) **out_ids,
+    xhash_t(PERIOD_MAP) **out_periods)
 {
     hound_err err;
-    void *ret;
+    size_t i;
+    xhash_t(ID_SET) *ids;
+    xhiter_t iter;
+    hound_data_period *period;
+    xhash_t(PERIOD_MAP) *periods;
+    period_vec *list;
+    int ret;
+    const struct hound_data_rq *rq;
+
+    ids = xh_init(ID_SET);
+    if (ids == NULL) {
+        err = HOUND_OOM;
+        goto error_ids;
+    }
+
+    periods = xh_init(PERIOD_MAP);
+    if (periods == NULL) {
+        err = HOUND_OOM;
+        goto error_periods;
+    }
+
+    for (i = 0; i < len; ++i) {
+        rq = &rqs[i];
+        xh_put(ID_SET, ids, rq->id, &ret);
+        if (ret == -1) {
+            err = HOUND_OOM;
+            goto error_loop;
+        }
+
+        if (!pull_mode || rq->period_ns == 0) {
+            continue;
+        }
+        iter = xh_put(PERIOD_MAP, periods, rq->id, &ret);
+        if (ret == -1) {
+            err = HOUND_OOM;
+            goto error_loop;
+        }
+        list = &xh_val(periods, iter);
+        if (ret != 0) {
+            xv_init(*list);
+        }
+        period = xv_pushp(hound_data_period, *list);
+        if (period == NULL) {
+            err = HOUND_OOM;
+            goto error_loop;
+        }
+        *period = rq->period_ns;
+    }
 
-    /* First let the event loop gracefully exit. */
-    pause_poll();
+    *out_ids = ids;
+    *out_periods = periods;
 
-    /* Now shoot it in the head. */
-    err = pthread_cancel(s_poll_thread);
-    XASSERT_EQ(err, 0);
+    return HOUND_OK;
 
-    /* Wait until the thread is finally dead. */
-    err = pthread_join(s_poll_thread, &ret);
-    XASSERT_EQ(err, 0);
-    XASSERT_EQ(ret, PTHREAD_CANCELED);
+error_loop:
+    destroy_period_map(periods);
+error_periods:
+    xh_destroy(ID_SET, ids);
+error_ids:
+    return err;
 }
 
+/**
+ * Returns true and drops the period from the list if the given data ID and pull
+ * period is one being removed.
+ */
 static
-void set_fd_timeout(int fd, struct fdctx *ctx)
+bool take_removed_period(
+    xhash_t(PERIOD_MAP) *periods,
+    hound_data_id id,
+    hound_data_period period)
 {
     size_t i;
-    struct pull_info *info;
     xhiter_t iter;
-    hound_data_period min_timeout;
-    struct pull_timeout_info *timeout_info;
+    period_vec *list;
 
-    /*
-     * This function should be called only for pull-mode drivers, so we should
-     * always find our fd in the pull-mode map.
-     */
-    iter = xh_get(PULL_MAP, s_pull_map, fd);
-    XASSERT_NEQ(iter, xh_end(s_pull_map));
-    info = &xh_val(s_pull_map, iter);
+    iter = xh_get(PERIOD_MAP, periods, id);
+    if (iter == xh_end(periods)) {
+        return false;
+    }
 
-    if (xv_size(info->timeout_info) == 0) {
-        /* No timing entries; nothing to do here. */
-        ctx->timeout_enabled = false;
-        ctx->timeout_ns = UINT64_MAX;
-        return;
+    list = &xh_val(periods, iter);
+    for (i = 0; i < xv_size(*list); ++i) {
+        if (xv_A(*list, i) == period) {
+            xv_quickdel(*list, i);
+            return true;
+        }
     }
 
-    min_timeout = UINT64_MAX;
-    for (i = 0; i < xv_size(info->timeout_info); ++i) {
-        timeout_info = &xv_A(info->timeout_info, i);
-        min_timeout = min(min_timeout, timeout_info->current_timeout);
+    return false;
+}
+
+static
+const struct hound_datadesc *find_desc(
+    const struct driver *drv,
+    hound_data_id id)
+{
+    size_t i;
+
+    for (i = 0; i < drv->desc_count; ++i) {
+        if (drv->descs[i].data_id == id) {
+            return &drv->descs[i];
+        }
     }
-    ctx->timeout_enabled = true;
-    ctx->timeout_ns = min_timeout;
+
+    return NULL;
 }
 
+/**
+ * Gets the filter for a new queue entry. A modify removes and re-adds every
+ * request of the context on this fd, so if the removed entry for the same data
+ * had the same settings, keep using its filter, along with what it remembers.
+ */
 static
-hound_err add_queue_nolock(
+hound_err get_filter(
+    struct driver *drv,
+    const struct hound_data_rq *rq,
+    xhash_t(FILTER_MAP) *removed_filters,
+    struct filter **out_filter)
+{
+    struct filter *filter;
+    xhiter_t iter;
+
+    if (!filter_rq_enabled(rq)) {
+        *out_filter = NULL;
+        return HOUND_OK;
+    }
+
+    iter = xh_get(FILTER_MAP, removed_filters, rq->id);
+    if (iter != xh_end(removed_filters)) {
+        filter = xh_val(removed_filters, iter);
+        if (filter_matches(filter, rq)) {
+            filter_ref(filter);
+            *out_filter = filter;
+            return HOUND_OK;
+        }
+    }
+
+    return filter_alloc(rq, find_desc(drv, rq->id), out_filter);
+}
+
+/**
+ * Makes a new entry for an fd, starting from the entry it replaces (if any),
+ * minus the queue entries in remove_rqs, plus the queue entries in add_rqs.
+ */
+static
+hound_err make_entry(
     int fd,
-    const struct hound_data_rq *rqs,
-    size_t rqs_len,
-    struct queue *queue)
+    struct driver *drv,
+    const struct fd_entry *old,
+    const struct hound_data_rq *remove_rqs,
+    size_t remove_len,
+    const struct hound_data_rq *add_rqs,
+    size_t add_len,
+    struct queue *queue,
+    struct fd_entry **out_entry)
 {
-    struct fdctx *ctx;
-    struct queue_entry *entry;
+    xhash_t(ID_SET) *added_ids;
+    struct fd_entry *entry;
     hound_err err;
+    struct filter *filter;
     size_t i;
-    struct pull_info *info;
     xhiter_t iter;
-    size_t j;
-    size_t queue_count;
+    size_t max_periods;
+    size_t max_queues;
+    const struct pull_period *pull;
+    const struct queue_entry *qentry;
+    bool pull_mode;
+    xhash_t(FILTER_MAP) *removed_filters;
+    xhash_t(ID_SET) *removed_ids;
+    xhash_t(PERIOD_MAP) *removed_periods;
+    int ret;
     const struct hound_data_rq *rq;
-    struct pull_timeout_info *timeout_info;
 
-    ctx = get_fdctx(fd);
-    XASSERT_NOT_NULL(ctx);
+    entry = malloc(sizeof(*entry));
+    if (entry == NULL) {
+        err = HOUND_OOM;
+        goto error_alloc_entry;
+    }
+
+    max_queues = add_len;
+    max_periods = add_len;
+    if (old != NULL) {
+        max_queues += old->queue_count;
+        max_periods += old->period_count;
+    }
+
+    entry->queues = malloc(max_queues * sizeof(*entry->queues));
+    if (entry->queues == NULL && max_queues > 0) {
+        err = HOUND_OOM;
+        goto error_alloc_queues;
+    }
+
+    entry->periods = malloc(max_periods * sizeof(*entry->periods));
+    if (entry->periods == NULL && max_periods > 0) {
+        err = HOUND_OOM;
+        goto error_alloc_periods;
+    }
+
+    entry->timeouts = malloc(max_periods * sizeof(*entry->timeouts));
+    if (entry->timeouts == NULL && max_periods > 0) {
+        err = HOUND_OOM;
+        goto error_alloc_timeouts;
+    }
+
+    entry->fd = fd;
+    entry->drv = drv;
+    entry->adopted = false;
+    entry->queue_count = 0;
+    entry->period_count = 0;
+    pull_mode = driver_is_pull_mode(drv);
+
+    /*
+     * A context can request hundreds of data IDs, so index the requests rather
+     * than scanning them for each queue entry and period.
+     */
+    err = make_remove_index(
+        remove_rqs,
+        remove_len,
+        pull_mode,
+        &removed_ids,
+        &removed_periods);
+    if (err != HOUND_OK) {
+        goto error_remove_index;
+    }
 
-    err = HOUND_OK;
-    queue_count = 0;
-    for (i = 0; i < rqs_len; ++i) {
+    added_ids = xh_init(ID_SET);
+    if (added_ids == NULL) {
+        err = HOUND_OOM;
+        goto error_added_ids;
+    }
+
+    removed_filters = xh_init(FILTER_MAP);
+    if (removed_filters == NULL) {
+        err = HOUND_OOM;
+        goto error_removed_filters;
+    }
+
+    if (old != NULL) {
+        /* Keep all queue entries that aren't being removed. */
+        for (i = 0; i < old->queue_count; ++i) {
+            qentry = &old->queues[i];
+            if (qentry->queue == queue &&
+                xh_get(ID_SET, removed_ids, qentry->id) !=
+                    xh_end(removed_ids)) {
+                if (qentry->filter != NULL) {
+                    iter = xh_put(
+                        FILTER_MAP,
+                        removed_filters,
+                        qentry->id,
+                        &ret);
+                    if (ret == -1) {
+                        err = HOUND_OOM;
+                        goto error_loop;
+                    }
+                    xh_val(removed_filters, iter) = qentry->filter;
+                }
+                continue;
+            }
+            entry->queues[entry->queue_count] = *qentry;
+            if (qentry->filter != NULL) {
+                filter_ref(qentry->filter);
+            }
+            ++entry->queue_count;
+        }
+
+    }
+
+    for (i = 0; i < add_len; ++i) {
         /*
          * Add exactly one queue entry per data ID in this request. If we add
          * more than one queue entry, then the same record will get delivered
@@ -657,25 +1355,25 @@ hound_err add_queue_nolock(
          * data ID, but the same data ID in *a single user context* should
          * result in just one queue entry.
          */
-        rq = &rqs[i];
-        for (j = 0; j < i; ++j) {
-            if (rq->id == rqs[j].id) {
-                /* We already added a queue entry, so don't add another. */
-                break;
-            }
+        rq = &add_rqs[i];
+        xh_put(ID_SET, added_ids, rq->id, &ret);
+        if (ret == -1) {
+            err = HOUND_OOM;
+            goto error_loop;
         }
-        if (j == i) {
+        if (ret != 0) {
             /* We haven't yet added a queue entry for this data ID. */
-            entry = xv_pushp(struct queue_entry, ctx->queues);
-            if (entry == NULL) {
-                return HOUND_OOM;
+            err = get_filter(drv, rq, removed_filters, &filter);
+            if (err != HOUND_OK) {
+                goto error_loop;
             }
-            entry->id = rq->id;
-            entry->queue = queue;
-            ++queue_count;
+            entry->queues[entry->queue_count].id = rq->id;
+            entry->queues[entry->queue_count].queue = queue;
+            entry->queues[entry->queue_count].filter = filter;
+            ++entry->queue_count;
         }
 
-        if (driver_is_pull_mode(ctx->drv) && rq->period_ns > 0) {
+        if (pull_mode && rq->period_ns > 0) {
             /*
              * Push-mode doesn't need timeout data, as the driver manages the
              * data timing.
@@ -684,94 +1382,126 @@ hound_err add_queue_nolock(
              * meaning neither push nor pull (no data flows until requested with
              * hound_next(). Therefore, if the period is 0, we should not add
              * timing data for this request.
+             *
+             * If the same period is also being removed, the request is being
+             * kept across a modify, so keep its old timing entry instead, and
+             * its data keeps flowing on schedule.
              */
-            iter = xh_get(PULL_MAP, s_pull_map, fd);
-            XASSERT_NEQ(iter, xh_end(s_pull_map));
-            info = &xh_val(s_pull_map, iter);
-            timeout_info = xv_pushp(struct pull_timeout_info, info->timeout_info);
-            if (timeout_info == NULL) {
-                for (j = 0; j < queue_count; ++j) {
-                    (void) xv_pop(ctx->queues);
-                }
-                return HOUND_OOM;
+            if (take_removed_period(removed_periods, rq->id, rq->period_ns)) {
+                continue;
             }
-
-            timeout_info->id = entry->id;
-            timeout_info->current_timeout = rq->period_ns;
-            timeout_info->max_timeout = rq->period_ns;
+            entry->periods[entry->period_count].id = rq->id;
+            entry->periods[entry->period_count].period = rq->period_ns;
+            entry->periods[entry->period_count].prev = NO_PREV;
+            ++entry->period_count;
         }
     }
 
-    /*
-     * For pull-mode drivers, adjust the new fd timeout, as some timing entries
-     * have been deleted.
-     */
-    if (driver_is_pull_mode(ctx->drv)) {
-        set_fd_timeout(fd, ctx);
+    if (old != NULL) {
+        /* Keep all periods, less one pull-mode timing entry per request. */
+        for (i = 0; i < old->period_count; ++i) {
+            pull = &old->periods[i];
+            if (take_removed_period(removed_periods, pull->id, pull->period)) {
+                continue;
+            }
+            entry->periods[entry->period_count] = *pull;
+            entry->periods[entry->period_count].prev = i;
+            ++entry->period_count;
+        }
     }
 
+    xh_destroy(FILTER_MAP, removed_filters);
+    xh_destroy(ID_SET, added_ids);
+    destroy_period_map(removed_periods);
+    xh_destroy(ID_SET, removed_ids);
+
+    *out_entry = entry;
+
+    return HOUND_OK;
+
+error_loop:
+    for (i = 0; i < entry->queue_count; ++i) {
+        if (entry->queues[i].filter != NULL) {
+            filter_unref(entry->queues[i].filter);
+        }
+    }
+    xh_destroy(FILTER_MAP, removed_filters);
+error_removed_filters:
+    xh_destroy(ID_SET, added_ids);
+error_added_ids:
+    destroy_period_map(removed_periods);
+    xh_destroy(ID_SET, removed_ids);
+error_remove_index:
+    free(entry->timeouts);
+error_alloc_timeouts:
+    free(entry->periods);
+error_alloc_periods:
+    free(entry->queues);
+error_alloc_queues:
+    free(entry);
+error_alloc_entry:
     return err;
 }
 
+/**
+ * Replaces the entry for an existing fd. Must be called with the write mutex
+ * held.
+ */
 static
-void remove_queue_nolock(
+hound_err change_queues(
     int fd,
-    const struct hound_data_rq *rqs,
-    size_t rqs_len,
+    const struct hound_data_rq *remove_rqs,
+    size_t remove_len,
+    const struct hound_data_rq *add_rqs,
+    size_t add_len,
     struct queue *queue)
 {
-    struct fdctx *ctx;
-    struct queue_entry *entry;
-    size_t i;
-    struct pull_info *info;
-    xhiter_t iter;
-    size_t j;
-    const struct hound_data_rq *rq;
-    struct pull_timeout_info *timeout_info;
-
-    ctx = get_fdctx(fd);
-    XASSERT_NOT_NULL(ctx);
-
-    iter = xh_get(PULL_MAP, s_pull_map, fd);
-    if (iter != xh_end(s_pull_map)) {
-        info = &xh_val(s_pull_map, iter);
+    struct fd_entry *entry;
+    hound_err err;
+    const struct fd_entry *old;
+
+    old = find_entry(atomic_load(&s_snapshot), fd);
+    XASSERT_NOT_NULL(old);
+
+    err = make_entry(
+        fd,
+        old->drv,
+        old,
+        remove_rqs,
+        remove_len,
+        add_rqs,
+        add_len,
+        queue,
+        &entry);
+    if (err != HOUND_OK) {
+        return err;
     }
-    else {
-        info = NULL;
+
+    err = replace_entry(fd, entry);
+    if (err != HOUND_OK) {
+        free_entry(entry);
+        return err;
     }
 
-    /* Remove all matching queue entries. */
-    for (i = 0; i < rqs_len; ++i) {
-        rq = &rqs[i];
-        for (j = 0; j < xv_size(ctx->queues); ++j) {
-            entry = &xv_A(ctx->queues, j);
-            if (rq->id != entry->id || queue != entry->queue) {
-                continue;
-            }
-            /* Remove the queue. */
-            xv_quickdel(ctx->queues, j);
-        }
+    return HOUND_OK;
+}
 
-        if (driver_is_pull_mode(ctx->drv) && rq->period_ns > 0) {
-            /* Remove pull-mode timing info, if any. */
-            for (j = 0; j < xv_size(info->timeout_info); ++j) {
-                timeout_info = &xv_A(info->timeout_info, j);
-                if (timeout_info->id == rq->id &&
-                    timeout_info->max_timeout == rq->period_ns) {
-                    xv_quickdel(info->timeout_info, j);
-                    break;
-                }
-            }
-        }
-    }
+/**
+ * Removing things from the I/O system can't fail, as the callers have already
+ * committed to tearing things down. So if we can't allocate a new snapshot,
+ * keep trying.
+ */
+static
+void retry_oom(hound_err err, int fd)
+{
+    struct timespec ts;
 
-    /*
-     * For pull-mode drivers, adjust the new fd timeout, as some timing entries
-     * have been deleted.
-     */
-    if (driver_is_pull_mode(ctx->drv)) {
-        set_fd_timeout(fd, ctx);
-    }
+    XASSERT_EQ(err, HOUND_OOM);
+    hound_log_err(err, "failed to remove fd %d from I/O; retrying", fd);
+
+    ts.tv_sec = 0;
+    ts.tv_nsec = NSEC_PER_MSEC;
+    nanosleep(&ts, NULL);
 }
 
 hound_err io_add_fd(
@@ -781,13 +1511,9 @@ hound_err io_add_fd(
     size_t rqs_len,
     struct queue *queue)
 {
-    struct fdctx *ctx;
+    struct fd_entry *entry;
     hound_err err;
     int flags;
-    struct pull_info *info;
-    xhiter_t iter;
-    struct pollfd *pfd;
-    int ret;
 
     XASSERT_NOT_NULL(drv);
     XASSERT_NEQ(fd, 0);
@@ -798,92 +1524,33 @@ hound_err io_add_fd(
     err = fcntl(fd, F_SETFL, flags | O_NONBLOCK);
     XASSERT_NEQ(err, -1);
 
-    pause_poll();
-    pthread_rwlock_wrlock(&s_ios.lock);
-
-    pfd = xv_pushp(struct pollfd, s_ios.fds);
-    if (pfd == NULL) {
-        err = HOUND_OOM;
-        goto error_fds_push;
-    }
-    pfd->fd = fd;
-    pfd->events = POLL_DEFAULT_EVENTS;
-
-    ctx = xv_pushp(struct fdctx, s_ios.ctx);
-    if (ctx == NULL) {
-        err = HOUND_OOM;
-        goto error_ctx_push;
-    }
-    ctx->drv = drv;
-    ctx->timeout_enabled = false;
-    ctx->timeout_ns = UINT64_MAX;
-    xv_init(ctx->queues);
-
-    if (driver_is_pull_mode(drv)) {
-        iter = xh_put(PULL_MAP, s_pull_map, fd, &ret);
-        if (ret == -1) {
-            err = HOUND_OOM;
-            goto error_pull_mode_indices_push;
-        }
-        info = &xh_val(s_pull_map, iter);
+    lock_mutex(&s_write_mutex);
 
-        info->last_pull = 0;
-        xv_init(info->timeout_info);
+    err = make_entry(fd, drv, NULL, NULL, 0, rqs, rqs_len, queue, &entry);
+    if (err != HOUND_OK) {
+        goto out;
     }
 
-    err = add_queue_nolock(fd, rqs, rqs_len, queue);
+    err = replace_entry(fd, entry);
     if (err != HOUND_OK) {
-        remove_queue_nolock(fd, rqs, rqs_len, queue);
+        free_entry(entry);
     }
 
-    err = HOUND_OK;
-    goto out;
-
-error_pull_mode_indices_push:
-    (void) xv_pop(s_ios.ctx);
-error_ctx_push:
-    (void) xv_pop(s_ios.fds);
-error_fds_push:
 out:
-    pthread_rwlock_unlock(&s_ios.lock);
-    resume_poll();
+    unlock_mutex(&s_write_mutex);
     return err;
 }
 
 void io_remove_fd(int fd)
 {
-    struct fdctx *ctx;
-    size_t ctx_index;
-    size_t fd_index;
-    struct pull_info *info;
-    xhiter_t iter;
-
-    pause_poll();
-    pthread_rwlock_wrlock(&s_ios.lock);
-
-    fd_index = get_fd_index(fd);
-    ctx_index = get_fdctx_index(fd_index);
-    ctx = get_fdctx_from_fd_index(fd_index);
-    XASSERT_NOT_NULL(ctx);
+    hound_err err;
 
-    if (driver_is_pull_mode(ctx->drv)) {
-        /* If we have a pointer to this index in the pull mode map, remove it. */
-        iter = xh_get(PULL_MAP, s_pull_map, fd);
-        if (iter != xh_end(s_pull_map)) {
-            info = &xh_val(s_pull_map, iter);
-            xv_destroy(info->timeout_info);
-            xh_del(PULL_MAP, s_pull_map, iter);
-        }
+    lock_mutex(&s_write_mutex);
+    XASSERT_NOT_NULL(find_entry(atomic_load(&s_snapshot), fd));
+    while ((err = replace_entry(fd, NULL)) != HOUND_OK) {
+        retry_oom(err, fd);
     }
-
-    /* Remove fd and ctx. */
-    xv_quickdel(s_ios.fds, fd_index);
-    xv_quickdel(s_ios.ctx, ctx_index);
-
-    xv_destroy(ctx->queues);
-
-    pthread_rwlock_unlock(&s_ios.lock);
-    resume_poll();
+    unlock_mutex(&s_write_mutex);
 }
 
 hound_err io_modify_queue(
@@ -896,17 +1563,16 @@ hound_err io_modify_queue(
 {
     hound_err err;
 
-    pause_poll();
-    pthread_rwlock_wrlock(&s_ios.lock);
-    remove_queue_nolock(fd, old_rqs, old_rqs_len, queue);
-    err = add_queue_nolock(fd, new_rqs, new_rqs_len, queue);
-    if (err != HOUND_OK) {
-        goto out;
-    }
+    lock_mutex(&s_write_mutex);
+    err = change_queues(
+        fd,
+        old_rqs,
+        old_rqs_len,
+        new_rqs,
+        new_rqs_len,
+        queue);
+    unlock_mutex(&s_write_mutex);
 
-out:
-    pthread_rwlock_unlock(&s_ios.lock);
-    resume_poll();
     return err;
 }
 
@@ -918,11 +1584,9 @@ hound_err io_add_queue(
 {
     hound_err err;
 
-    pause_poll();
-    pthread_rwlock_wrlock(&s_ios.lock);
-    err = add_queue_nolock(fd, rqs, rqs_len, queue);
-    pthread_rwlock_unlock(&s_ios.lock);
-    resume_poll();
+    lock_mutex(&s_write_mutex);
+    err = change_queues(fd, NULL, 0, rqs, rqs_len, queue);
+    unlock_mutex(&s_write_mutex);
 
     return err;
 }
@@ -933,63 +1597,122 @@ void io_remove_queue(
     size_t rqs_len,
     struct queue *queue)
 {
-    pause_poll();
-    pthread_rwlock_wrlock(&s_ios.lock);
-    remove_queue_nolock(fd, rqs, rqs_len, queue);
-    pthread_rwlock_unlock(&s_ios.lock);
-    resume_poll();
+    hound_err err;
+
+    lock_mutex(&s_write_mutex);
+    while (true) {
+        err = change_queues(fd, rqs, rqs_len, NULL, 0, queue);
+        if (err == HOUND_OK) {
+            break;
+        }
+        retry_oom(err, fd);
+    }
+    unlock_mutex(&s_write_mutex);
+}
+
+/* Recomputes the spin budget. Must be called with s_spin_mutex held. */
+static
+void update_spin(void)
+{
+    hound_data_period spin_ns;
+    const struct io_spin *spin;
+
+    spin_ns = 0;
+    for (spin = s_spins; spin != NULL; spin = spin->next) {
+        spin_ns = max(spin_ns, spin->ns);
+    }
+    atomic_store(&s_spin_ns, spin_ns);
+}
+
+void io_add_spin(struct io_spin *spin)
+{
+    XASSERT_NOT_NULL(spin);
+
+    lock_mutex(&s_spin_mutex);
+    spin->next = s_spins;
+    s_spins = spin;
+    update_spin();
+    unlock_mutex(&s_spin_mutex);
+}
+
+void io_remove_spin(struct io_spin *spin)
+{
+    struct io_spin **p;
+
+    XASSERT_NOT_NULL(spin);
+
+    lock_mutex(&s_spin_mutex);
+    for (p = &s_spins; *p != spin; p = &(*p)->next) {
+        XASSERT_NOT_NULL(*p);
+    }
+    *p = spin->next;
+    update_spin();
+    unlock_mutex(&s_spin_mutex);
 }
 
 void io_init(void)
 {
     hound_err err;
-    struct pollfd *pfd;
     int ret;
-
-    pthread_rwlock_init(&s_ios.lock, NULL);
-    xv_init(s_ios.ctx);
-    xv_init(s_ios.fds);
-
-    s_pull_map = xh_init(PULL_MAP);
-    if (s_pull_map == NULL) {
-        hound_log_nofmt(XLOG_ERR, "Failed to initialize pull-mode timing map");
+    struct snapshot *snapshot;
+
+    atomic_init(&s_epoch, 0);
+    atomic_init(&s_epoch_readers[0], 0);
+    atomic_init(&s_epoch_readers[1], 0);
+    atomic_init(&s_poll_stop, false);
+    s_spins = NULL;
+    atomic_init(&s_spin_ns, 0);
+
+    snapshot = alloc_snapshot(0);
+    if (snapshot == NULL) {
+        hound_log_nofmt(XLOG_ERR, "Failed to allocate the I/O snapshot");
         return;
     }
+    snapshot->gen = 0;
+    atomic_init(&s_snapshot, snapshot);
 
     /*
-     * Create our self-pipe, which we use to interrupt the poll loop when
-     * needed. Mark it non-blocking so it can't block a read() during the poll
-     * loop. It really never should block, but this is a defensive precaution.
+     * Create our self-pipe, which we use to wake up the poll loop when needed.
+     * Mark it non-blocking so it can't block a read() during the poll loop or
+     * a write() when the poll loop is slow to wake up.
      */
-    ret = pipe2(s_self_pipe, O_NONBLOCK);
+    ret = pipe2(s_wake_pipe, O_NONBLOCK);
     if (ret != 0) {
         hound_log_nofmt(XLOG_ERR, "Failed to create self pipe");
         return;
     }
 
-    pfd = xv_pushp(struct pollfd, s_ios.fds);
-    if (pfd == NULL) {
-        hound_log_nofmt(XLOG_ERR, "Failed to setup pfd for self pipe");
-        return;
-    }
-    XASSERT_EQ((void *) pfd, &xv_A(s_ios.fds, PAUSE_FD_INDEX));
-    pfd->fd = s_self_pipe[READ_END];
-    pfd->events = POLLIN;
-
-    err = io_start_poll();
-    if (err != HOUND_OK) {
-        hound_log_err_nofmt(err, "Failed io_start_poll");
+    err = pthread_create(&s_poll_thread, NULL, io_poll, NULL);
+    if (err != 0) {
+        hound_log_err_nofmt(err, "Failed to start the poll thread");
         return;
     }
+    rt_add_thread(&s_poll_rt, s_poll_thread);
+    s_poll_running = true;
 }
 
 void io_destroy(void)
 {
-    io_stop_poll();
-    xv_destroy(s_ios.ctx);
-    xv_destroy(s_ios.fds);
-    pthread_rwlock_destroy(&s_ios.lock);
-    xh_destroy(PULL_MAP, s_pull_map);
-    close(s_self_pipe[READ_END]);
-    close(s_self_pipe[WRITE_END]);
+    size_t i;
+    int ret;
+    struct snapshot *snapshot;
+
+    if (s_poll_running) {
+        rt_remove_thread(&s_poll_rt);
+        atomic_store(&s_poll_stop, true);
+        wake_poll();
+        ret = pthread_join(s_poll_thread, NULL);
+        XASSERT_EQ(ret, 0);
+        s_poll_running = false;
+    }
+
+    snapshot = atomic_load(&s_snapshot);
+    if (snapshot != NULL) {
+        for (i = 0; i < snapshot->count; ++i) {
+            free_entry(snapshot->entries[i]);
+        }
+        free_snapshot(snapshot);
+    }
+    close(s_wake_pipe[READ_END]);
+    close(s_wake_pipe[WRITE_END]);
 }
@@ -0,0 +1,519 @@
+/**
+ * @file      join.c
+ * @brief     Time-aligned join stage. The join stage buffers the samples of a
+ *            set of data IDs and combines each sample of the first (anchor) ID
+ *            with the best-matching samples of the other IDs, producing a
+ *            single record per anchor sample. It is owned by a queue and always
+ *            runs with the queue lock held.
+ * @author    Martin Kelly <mkelly@xevo.com>
+ * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
+ */
+
+#include <hound-private/driver.h>
+#include <hound-private/error.h>
+#include <hound-private/join.h>
+#include <hound-private/log.h>
+#include <hound-private/queue.h>
+#include <hound-private/util.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ANCHOR_INDEX 0
+
+struct join_sample {
+    struct record_info *rec;
+    hound_data_period ts;
+    bool used;
+};
+
+/*
+ * A circular buffer of samples for one data ID, in arrival order. Push to back,
+ * pop from front.
+ */
+struct join_member {
+    hound_data_id id;
+    size_t front;
+    size_t len;
+    struct join_sample *samples;
+};
+
+struct join {
+    hound_data_id out_id;
+    hound_join_policy policy;
+    hound_data_period tolerance;
+    size_t buffer_len;
+    size_t member_count;
+    struct join_member *members;
+    struct join_sample **matches;
+    hound_data_period last_anchor_ts;
+    struct hound_join_stats stats;
+};
+
+static
+hound_data_period get_ts(const struct record_info *rec)
+{
+    return NSEC_PER_SEC*rec->record.timestamp.tv_sec +
+        rec->record.timestamp.tv_nsec;
+}
+
+hound_err join_alloc(const struct hound_join_rq *rq, struct join **out_join)
+{
+    struct driver *drv;
+    hound_err err;
+    size_t i;
+    struct join *join;
+    size_t j;
+    struct join_member *member;
+
+    NULL_CHECK(rq);
+    NULL_CHECK(out_join);
+    NULL_CHECK(rq->ids);
+
+    if (rq->len < 2 || rq->buffer_len == 0) {
+        return HOUND_INVALID_VAL;
+    }
+
+    if (rq->policy != HOUND_JOIN_NEAREST &&
+        rq->policy != HOUND_JOIN_LAST_VALUE) {
+        return HOUND_INVALID_VAL;
+    }
+
+    /*
+     * Combined records have their own layout, so giving them the ID of real
+     * data (including a member's) would mislead anything keyed on that ID.
+     */
+    err = driver_get(rq->out_id, &drv);
+    if (err == HOUND_OK) {
+        return HOUND_INVALID_VAL;
+    }
+
+    for (i = 0; i < rq->len; ++i) {
+        err = driver_get(rq->ids[i], &drv);
+        if (err != HOUND_OK) {
+            return err;
+        }
+
+        for (j = 0; j < i; ++j) {
+            if (rq->ids[i] == rq->ids[j]) {
+                return HOUND_DUPLICATE_DATA_REQUESTED;
+            }
+        }
+    }
+
+    join = malloc(sizeof(*join));
+    if (join == NULL) {
+        err = HOUND_OOM;
+        goto error_alloc_join;
+    }
+
+    join->members = malloc(rq->len * sizeof(*join->members));
+    if (join->members == NULL) {
+        err = HOUND_OOM;
+        goto error_alloc_members;
+    }
+
+    join->matches = malloc(rq->len * sizeof(*join->matches));
+    if (join->matches == NULL) {
+        err = HOUND_OOM;
+        goto error_alloc_matches;
+    }
+
+    for (i = 0; i < rq->len; ++i) {
+        member = &join->members[i];
+        member->samples = malloc(rq->buffer_len * sizeof(*member->samples));
+        if (member->samples == NULL) {
+            err = HOUND_OOM;
+            goto error_alloc_samples;
+        }
+        member->id = rq->ids[i];
+        member->front = 0;
+        member->len = 0;
+    }
+
+    join->out_id = rq->out_id;
+    join->policy = rq->policy;
+    join->tolerance = rq->tolerance_ns;
+    join->buffer_len = rq->buffer_len;
+    join->member_count = rq->len;
+    join->last_anchor_ts = 0;
+    memset(&join->stats, 0, sizeof(join->stats));
+
+    *out_join = join;
+
+    return HOUND_OK;
+
+error_alloc_samples:
+    for (j = 0; j < i; ++j) {
+        free(join->members[j].samples);
+    }
+    free(join->matches);
+error_alloc_matches:
+    free(join->members);
+error_alloc_members:
+    free(join);
+error_alloc_join:
+    return err;
+}
+
+static
+struct join_sample *get_sample(
+    const struct join *join,
+    const struct join_member *member,
+    size_t index)
+{
+    return &member->samples[(member->front + index) % join->buffer_len];
+}
+
+static
+void pop_sample(struct join *join, struct join_member *member)
+{
+    struct join_sample *sample;
+
+    XASSERT_GT(member->len, 0);
+
+    sample = get_sample(join, member, 0);
+    if (!sample->used) {
+        ++join->stats.unmatched_samples;
+    }
+    record_ref_dec(sample->rec);
+
+    member->front = (member->front + 1) % join->buffer_len;
+    --member->len;
+}
+
+static
+void push_sample(
+    struct join *join,
+    struct join_member *member,
+    struct record_info *rec)
+{
+    struct join_sample *sample;
+
+    XASSERT_LT(member->len, join->buffer_len);
+
+    sample = get_sample(join, member, member->len);
+    sample->rec = rec;
+    sample->ts = get_ts(rec);
+    sample->used = false;
+    ++member->len;
+}
+
+static
+void clear_member(struct join *join, struct join_member *member)
+{
+    size_t i;
+
+    for (i = 0; i < member->len; ++i) {
+        record_ref_dec(get_sample(join, member, i)->rec);
+    }
+    member->front = 0;
+    member->len = 0;
+}
+
+void join_reset(struct join *join)
+{
+    size_t i;
+
+    XASSERT_NOT_NULL(join);
+
+    for (i = 0; i < join->member_count; ++i) {
+        clear_member(join, &join->members[i]);
+    }
+    join->last_anchor_ts = 0;
+}
+
+void join_destroy(struct join *join)
+{
+    size_t i;
+
+    XASSERT_NOT_NULL(join);
+
+    join_reset(join);
+    for (i = 0; i < join->member_count; ++i) {
+        free(join->members[i].samples);
+    }
+    free(join->matches);
+    free(join->members);
+    free(join);
+}
+
+/**
+ * Finds the sample of a member to combine with an anchor sample taken at time
+ * ts.
+ *
+ * @param join a join
+ * @param member a non-anchor member of the join
+ * @param ts the anchor timestamp
+ * @param force if true, decide using only the samples we already have
+ * @param match filled in with the matching sample, or NULL if no sample is
+ *              within tolerance
+ *
+ * @return false if a better sample may still arrive, so no decision can be
+ *         made yet, and true otherwise
+ */
+static
+bool find_match(
+    const struct join *join,
+    const struct join_member *member,
+    hound_data_period ts,
+    bool force,
+    struct join_sample **match)
+{
+    size_t i;
+    struct join_sample *next;
+    struct join_sample *prev;
+    struct join_sample *sample;
+
+    /* Find the samples just before (or at) and just after the anchor. */
+    next = NULL;
+    prev = NULL;
+    for (i = member->len; i > 0; --i) {
+        sample = get_sample(join, member, i-1);
+        if (sample->ts <= ts) {
+            prev = sample;
+            break;
+        }
+        next = sample;
+    }
+
+    if (prev != NULL && ts - prev->ts > join->tolerance) {
+        prev = NULL;
+    }
+
+    if (join->policy == HOUND_JOIN_LAST_VALUE) {
+        *match = prev;
+        return true;
+    }
+
+    /*
+     * Member timestamps increase over time, so until we have seen a member
+     * sample after the anchor, a closer one may still arrive.
+     */
+    if (next == NULL && !force && (prev == NULL || prev->ts != ts)) {
+        return false;
+    }
+
+    if (next != NULL && next->ts - ts > join->tolerance) {
+        next = NULL;
+    }
+
+    if (prev == NULL) {
+        *match = next;
+    }
+    else if (next == NULL) {
+        *match = prev;
+    }
+    else if (ts - prev->ts <= next->ts - ts) {
+        *match = prev;
+    }
+    else {
+        *match = next;
+    }
+
+    return true;
+}
+
+static
+void emit_record(
+    struct join *join,
+    join_emit_cb emit,
+    void *data)
+{
+    const struct join_sample *anchor;
+    size_t i;
+    unsigned char *payload;
+    struct record_info *rec;
+    struct hound_record *records;
+    struct join_sample *sample;
+    size_t size;
+
+    anchor = join->matches[ANCHOR_INDEX];
+
+    size = join->member_count * sizeof(*records);
+    for (i = 0; i < join->member_count; ++i) {
+        size += join->matches[i]->rec->record.size;
+    }
+
+    rec = drv_alloc(sizeof(*rec));
+    if (rec == NULL) {
+        hound_log_err_limited_nofmt(
+            HOUND_OOM,
+            "Failed to allocate a joined record");
+        return;
+    }
+
+    rec->record.data = drv_alloc(size);
+    if (rec->record.data == NULL) {
+        hound_log_err_limited_nofmt(
+            HOUND_OOM,
+            "Failed to allocate joined record data");
+        drv_free(rec);
+        return;
+    }
+
+    /*
+     * Lay out the member records first, followed by their payloads, and point
+     * each member record at its own payload.
+     */
+    records = (struct hound_record *) rec->record.data;
+    payload = rec->record.data + join->member_count * sizeof(*records);
+    for (i = 0; i < join->member_count; ++i) {
+        sample = join->matches[i];
+        records[i] = sample->rec->record;
+        records[i].data = payload;
+        memcpy(payload, sample->rec->record.data, sample->rec->record.size);
+        payload += sample->rec->record.size;
+        sample->used = true;
+    }
+
+    rec->record.data_id = join->out_id;
+    rec->record.dev_id = anchor->rec->record.dev_id;
+    rec->record.timestamp = anchor->rec->record.timestamp;
+    rec->record.size = size;
+    rec->chunk = NULL;
+    atomic_ref_init(&rec->refcount, 1);
+
+    ++join->stats.emitted;
+    emit(rec, data);
+}
+
+static
+void resolve_anchors(
+    struct join *join,
+    bool force,
+    join_emit_cb emit,
+    void *data)
+{
+    struct join_sample *anchor;
+    struct join_member *anchors;
+    size_t i;
+    bool matched;
+
+    /* Resolve anchors in order, stopping at the first undecidable one. */
+    anchors = &join->members[ANCHOR_INDEX];
+    while (anchors->len > 0) {
+        anchor = get_sample(join, anchors, 0);
+
+        matched = true;
+        for (i = ANCHOR_INDEX+1; i < join->member_count; ++i) {
+            if (!find_match(
+                join,
+                &join->members[i],
+                anchor->ts,
+                force,
+                &join->matches[i])) {
+                return;
+            }
+            if (join->matches[i] == NULL) {
+                matched = false;
+            }
+        }
+
+        if (matched) {
+            join->matches[ANCHOR_INDEX] = anchor;
+            emit_record(join, emit, data);
+        }
+        else {
+            /* This is counted as an unmatched tick, not a sample. */
+            ++join->stats.unmatched_ticks;
+            anchor->used = true;
+        }
+
+        join->last_anchor_ts = anchor->ts;
+        pop_sample(join, anchors);
+
+        /* Only the oldest anchor is ever forced. */
+        force = false;
+    }
+}
+
+static
+void prune(struct join *join)
+{
+    const struct join_member *anchors;
+    size_t i;
+    struct join_member *member;
+    const struct join_sample *sample;
+    hound_data_period ts;
+
+    /*
+     * No future anchor will be older than the oldest pending anchor (or the last
+     * resolved one if none are pending), so any member sample that is followed
+     * by another sample at or before that time, or is out of tolerance for it,
+     * can never be matched again.
+     */
+    anchors = &join->members[ANCHOR_INDEX];
+    if (anchors->len > 0) {
+        ts = get_sample(join, anchors, 0)->ts;
+    }
+    else {
+        ts = join->last_anchor_ts;
+    }
+
+    for (i = ANCHOR_INDEX+1; i < join->member_count; ++i) {
+        member = &join->members[i];
+        while (member->len > 0) {
+            sample = get_sample(join, member, 0);
+            if (member->len > 1 && get_sample(join, member, 1)->ts <= ts) {
+                pop_sample(join, member);
+            }
+            else if (sample->ts < ts && ts - sample->ts > join->tolerance) {
+                pop_sample(join, member);
+            }
+            else {
+                break;
+            }
+        }
+    }
+}
+
+bool join_push(
+    struct join *join,
+    struct record_info *rec,
+    join_emit_cb emit,
+    void *data)
+{
+    size_t i;
+    struct join_member *member;
+
+    XASSERT_NOT_NULL(join);
+    XASSERT_NOT_NULL(rec);
+    XASSERT_NOT_NULL(emit);
+
+    for (i = 0; i < join->member_count; ++i) {
+        if (join->members[i].id == rec->record.data_id) {
+            break;
+        }
+    }
+    if (i == join->member_count) {
+        return false;
+    }
+    member = &join->members[i];
+
+    if (member->len == join->buffer_len) {
+        if (i == ANCHOR_INDEX) {
+            /*
+             * Too many anchors are waiting on a match, so decide the oldest one
+             * with the samples we have.
+             */
+            resolve_anchors(join, true, emit, data);
+        }
+        else {
+            pop_sample(join, member);
+        }
+    }
+
+    push_sample(join, member, rec);
+    resolve_anchors(join, false, emit, data);
+    prune(join);
+
+    return true;
+}
+
+void join_get_stats(const struct join *join, struct hound_join_stats *stats)
+{
+    XASSERT_NOT_NULL(join);
+    XASSERT_NOT_NULL(stats);
+
+    *stats = join->stats;
+}
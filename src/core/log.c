@@ -0,0 +1,363 @@
+/**
+ * @file      log.c
+ * @brief     Rate-limited, asynchronous logging for hot paths. Messages are
+ *            formatted into a fixed-size, lock-free ring and written out by a
+ *            background thread, so a log storm in the I/O thread costs a few
+ *            atomic operations per message rather than a blocking write. Each
+ *            call site also has its own rate limit, and reports how many
+ *            messages it suppressed once it is allowed to log again.
+ * @author    Martin Kelly <mkelly@xevo.com>
+ * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
+ */
+
+#define _GNU_SOURCE
+#include <hound/hound.h>
+#include <hound-private/log.h>
+#include <hound-private/util.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FD_INVALID (-1)
+
+/* Must be a power of 2, so positions can wrap around with a mask. */
+#define LOG_RING_SIZE 256
+#define LOG_MSG_MAX 256
+
+/* Each call site may log this many messages per interval. */
+#define LOG_RATE_BURST 10
+#define LOG_RATE_INTERVAL_NS NSEC_PER_SEC
+
+/*
+ * A slot in the ring. The sequence number says who owns the slot: it equals the
+ * producer position when the slot is free to write, and the position + 1 once
+ * the message is ready to drain.
+ */
+struct log_entry {
+    atomic_size_t seq;
+    int pri;
+    uint_fast32_t suppressed;
+    char msg[LOG_MSG_MAX];
+};
+
+static struct log_entry s_ring[LOG_RING_SIZE];
+
+/* The next position to write, shared by all producers. */
+static atomic_size_t s_head;
+
+/* The next position to drain, owned by the drain thread. */
+static size_t s_tail;
+
+/* Messages lost because the ring was full. */
+static atomic_size_t s_dropped;
+
+static atomic_bool s_running;
+
+/* Producers between checking s_running and finishing with the ring. */
+static atomic_size_t s_producers;
+
+static atomic_bool s_stop;
+static atomic_bool s_wake_pending;
+static int s_wake_fd = FD_INVALID;
+static pthread_t s_drain_thread;
+static _Atomic(log_sink) s_sink;
+
+static
+hound_data_period get_coarse_time_ns(void)
+{
+    struct timespec ts;
+
+    /*
+     * Rate limits have a granularity of seconds, so the coarse clock is
+     * plenty, and it's the cheapest one to read.
+     */
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+
+    return NSEC_PER_SEC*ts.tv_sec + ts.tv_nsec;
+}
+
+static
+void emit(int pri, uint_fast32_t suppressed, const char *msg)
+{
+    char buf[LOG_MSG_MAX + 64];
+    log_sink sink;
+
+    if (suppressed > 0) {
+        snprintf(
+            buf,
+            sizeof(buf),
+            "%s (suppressed %" PRIuFAST32 " similar messages)",
+            msg,
+            suppressed);
+        msg = buf;
+    }
+
+    sink = atomic_load(&s_sink);
+    if (sink != NULL) {
+        sink(pri, msg);
+    }
+    else {
+        hound_log(pri, "%s", msg);
+    }
+}
+
+/**
+ * Decides whether a call site may log right now. This is approximate when
+ * several threads cross into a new interval at once, which is fine for rate
+ * limiting.
+ */
+static
+bool site_admit(struct log_site *site, uint_fast32_t *suppressed)
+{
+    uint_fast64_t now;
+    uint_fast64_t start;
+
+    now = get_coarse_time_ns();
+    start = atomic_load_explicit(&site->window_start, memory_order_relaxed);
+    if (now - start >= LOG_RATE_INTERVAL_NS &&
+        atomic_compare_exchange_strong(&site->window_start, &start, now)) {
+        /* We opened a new interval, so report what the last one suppressed. */
+        *suppressed = atomic_exchange(&site->suppressed, 0);
+        atomic_store(&site->count, 1);
+        return true;
+    }
+
+    *suppressed = 0;
+    if (atomic_fetch_add(&site->count, 1) < LOG_RATE_BURST) {
+        return true;
+    }
+    atomic_fetch_add(&site->suppressed, 1);
+
+    return false;
+}
+
+static
+void wake_drain(void)
+{
+    uint64_t val;
+    ssize_t written;
+
+    /* Only the first message since the last drain needs to wake the thread. */
+    if (atomic_exchange(&s_wake_pending, true)) {
+        return;
+    }
+
+    /*
+     * An eventfd write fails only if the counter would overflow, and the
+     * thread resets the counter each time it wakes up, so this can't fail.
+     */
+    val = 1;
+    written = write(s_wake_fd, &val, sizeof(val));
+    XASSERT_EQ(written, sizeof(val));
+}
+
+static
+void enqueue(int pri, uint_fast32_t suppressed, const char *fmt, va_list args)
+{
+    struct log_entry *entry;
+    intptr_t diff;
+    char msg[LOG_MSG_MAX];
+    size_t pos;
+    size_t seq;
+
+    /*
+     * Count ourselves in before checking s_running, so that log_destroy either
+     * sees us or we see it, and it waits for us before closing the eventfd.
+     */
+    atomic_fetch_add(&s_producers, 1);
+    if (!atomic_load(&s_running)) {
+        atomic_fetch_sub(&s_producers, 1);
+
+        /* Before init or after destroy, there's no thread to hand off to. */
+        vsnprintf(msg, sizeof(msg), fmt, args);
+        emit(pri, suppressed, msg);
+        return;
+    }
+
+    /* Claim a slot. */
+    pos = atomic_load_explicit(&s_head, memory_order_relaxed);
+    while (true) {
+        entry = &s_ring[pos & (LOG_RING_SIZE-1)];
+        seq = atomic_load_explicit(&entry->seq, memory_order_acquire);
+        diff = (intptr_t) seq - (intptr_t) pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(
+                    &s_head,
+                    &pos,
+                    pos + 1,
+                    memory_order_relaxed,
+                    memory_order_relaxed)) {
+                break;
+            }
+        }
+        else if (diff < 0) {
+            /* The ring is full, so drop the message rather than wait. */
+            atomic_fetch_add_explicit(&s_dropped, 1, memory_order_relaxed);
+            atomic_fetch_sub(&s_producers, 1);
+            return;
+        }
+        else {
+            /* Another producer took this slot; try the next one. */
+            pos = atomic_load_explicit(&s_head, memory_order_relaxed);
+        }
+    }
+
+    entry->pri = pri;
+    entry->suppressed = suppressed;
+    vsnprintf(entry->msg, sizeof(entry->msg), fmt, args);
+    atomic_store_explicit(&entry->seq, pos + 1, memory_order_release);
+
+    wake_drain();
+    atomic_fetch_sub(&s_producers, 1);
+}
+
+static
+void drain(void)
+{
+    size_t dropped;
+    struct log_entry *entry;
+    char msg[LOG_MSG_MAX];
+
+    while (true) {
+        entry = &s_ring[s_tail & (LOG_RING_SIZE-1)];
+        if (atomic_load_explicit(&entry->seq, memory_order_acquire) !=
+            s_tail + 1) {
+            break;
+        }
+        emit(entry->pri, entry->suppressed, entry->msg);
+        atomic_store_explicit(
+            &entry->seq,
+            s_tail + LOG_RING_SIZE,
+            memory_order_release);
+        ++s_tail;
+    }
+
+    dropped = atomic_exchange(&s_dropped, 0);
+    if (dropped > 0) {
+        snprintf(
+            msg,
+            sizeof(msg),
+            "log ring full; dropped %zu messages",
+            dropped);
+        emit(XLOG_WARNING, 0, msg);
+    }
+}
+
+static
+void *drain_thread(UNUSED void *data)
+{
+    ssize_t bytes;
+    uint64_t val;
+
+    while (!atomic_load(&s_stop)) {
+        bytes = read(s_wake_fd, &val, sizeof(val));
+        if (bytes < 0) {
+            XASSERT_EQ(errno, EINTR);
+            continue;
+        }
+
+        /*
+         * Clear the flag before draining, so anything published after we
+         * look at the ring wakes us up again.
+         */
+        atomic_store(&s_wake_pending, false);
+        drain();
+    }
+
+    return NULL;
+}
+
+void log_ratelimited(struct log_site *site, int pri, const char *fmt, ...)
+{
+    va_list args;
+    uint_fast32_t suppressed;
+
+    XASSERT_NOT_NULL(site);
+    XASSERT_NOT_NULL(fmt);
+
+    if (!site_admit(site, &suppressed)) {
+        return;
+    }
+
+    va_start(args, fmt);
+    enqueue(pri, suppressed, fmt, args);
+    va_end(args);
+}
+
+void log_init(void)
+{
+    int err;
+    size_t i;
+
+    for (i = 0; i < LOG_RING_SIZE; ++i) {
+        atomic_init(&s_ring[i].seq, i);
+    }
+    atomic_init(&s_head, 0);
+    s_tail = 0;
+    atomic_init(&s_dropped, 0);
+    atomic_init(&s_stop, false);
+    atomic_init(&s_wake_pending, false);
+    atomic_init(&s_running, false);
+    atomic_init(&s_producers, 0);
+
+    s_wake_fd = eventfd(0, EFD_CLOEXEC);
+    if (s_wake_fd == FD_INVALID) {
+        hound_log_err_nofmt(errno, "Failed to create log eventfd");
+        return;
+    }
+
+    err = pthread_create(&s_drain_thread, NULL, drain_thread, NULL);
+    if (err != 0) {
+        hound_log_err_nofmt(err, "Failed to start the log thread");
+        close(s_wake_fd);
+        s_wake_fd = FD_INVALID;
+        return;
+    }
+    atomic_store(&s_running, true);
+}
+
+void log_set_sink(log_sink sink)
+{
+    atomic_store(&s_sink, sink);
+}
+
+void log_destroy(void)
+{
+    int ret;
+    uint64_t val;
+    ssize_t written;
+
+    if (!atomic_load(&s_running)) {
+        return;
+    }
+
+    /*
+     * New messages get logged directly from here on. Wait out producers that
+     * got in before that, so their messages make it into the final drain and
+     * their wakeups don't hit a closed eventfd.
+     */
+    atomic_store(&s_running, false);
+    while (atomic_load(&s_producers) > 0) {
+        cpu_relax();
+    }
+    atomic_store(&s_stop, true);
+    val = 1;
+    written = write(s_wake_fd, &val, sizeof(val));
+    XASSERT_EQ(written, sizeof(val));
+    ret = pthread_join(s_drain_thread, NULL);
+    XASSERT_EQ(ret, 0);
+
+    /* Flush anything published while the thread was exiting. */
+    drain();
+
+    close(s_wake_fd);
+    s_wake_fd = FD_INVALID;
+}
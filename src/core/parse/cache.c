@@ -0,0 +1,958 @@
+/**
+ * @file      cache.c
+ * @brief     Precompiled config and schema cache. Parsing YAML with libyaml is
+ *            slow relative to the rest of startup, so after a config is parsed,
+ *            we write out a compact binary form of it and of all the schemas
+ *            it uses. On the next startup, if none of the source files have
+ *            changed, we mmap the binary form and use it directly instead of
+ *            parsing YAML.
+ *
+ *            The cache file consists of a fixed header followed by a payload:
+ *            - the source files (path, device, inode, size, mtime), config
+ *              first
+ *            - the driver init list
+ *            - the parsed schemas, each referring to its source file
+ *
+ *            Integers are stored in native byte order and strings are stored
+ *            with a length prefix and a null terminator, so that they can be
+ *            used in place. The cache is machine-local, so this is fine, but
+ *            the header records enough to reject a file written by an
+ *            incompatible build.
+ * @author    Martin Kelly <mkelly@xevo.com>
+ * @copyright Copyright (C) 2020 Xevo Inc. All Rights Reserved.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <hound/hound.h>
+#include <hound-private/driver.h>
+#include <hound-private/log.h>
+#include <hound-private/parse/cache.h>
+#include <hound-private/parse/config.h>
+#include <hound-private/parse/schema.h>
+#include <hound-private/util.h>
+#include <inttypes.h>
+#include <linux/limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <xlib/xassert.h>
+
+#include "config.h"
+
+#define CACHE_MAGIC "HNDC"
+#define CACHE_VERSION 1
+
+/* Setting this environment variable overrides the cache directory. */
+#define CACHE_DIR_ENV "HOUND_CACHE_DIR"
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+struct cache_header {
+    char magic[4];
+    uint32_t version;
+
+    /* Guards against reading a cache written by a build with a different ABI. */
+    uint32_t arg_size;
+
+    uint32_t source_count;
+    uint32_t driver_count;
+    uint32_t schema_count;
+
+    /* The length of the entire file, including the header. */
+    uint64_t len;
+
+    /* A hash of the payload following the header. */
+    uint64_t hash;
+};
+
+struct config_cache {
+    void *addr;
+    size_t len;
+};
+
+struct cache_source {
+    char path[PATH_MAX];
+    struct stat st;
+};
+
+struct cache_schema {
+    uint32_t source_index;
+    size_t desc_count;
+    struct schema_desc *descs;
+};
+
+struct buf {
+    unsigned char *data;
+    size_t len;
+    size_t cap;
+    bool oom;
+};
+
+struct cursor {
+    const unsigned char *pos;
+    const unsigned char *end;
+};
+
+static
+uint64_t fnv1a(uint64_t hash, const void *data, size_t len)
+{
+    const unsigned char *bytes;
+    size_t i;
+
+    bytes = data;
+    for (i = 0; i < len; ++i) {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+
+    return hash;
+}
+
+/*
+ * The cache decides which drivers get loaded and with which arguments, and its
+ * hash only catches accidents. So only trust files and directories that nobody
+ * but us could have written.
+ */
+static
+bool is_trusted(const struct stat *st)
+{
+    return st->st_uid == geteuid() && (st->st_mode & (S_IWGRP | S_IWOTH)) == 0;
+}
+
+/**
+ * Gets the cache directory.
+ *
+ * @return the cache directory, or NULL if caching is turned off
+ */
+static
+const char *get_cache_dir(void)
+{
+    const char *dir;
+    int ret;
+    struct stat st;
+
+    dir = getenv(CACHE_DIR_ENV);
+    if (dir == NULL) {
+        dir = CONFIG_HOUND_CACHEDIR;
+    }
+    else if (dir[0] == '\0') {
+        /* An empty cache directory turns off caching. */
+        return NULL;
+    }
+
+    /*
+     * We never create the cache directory ourselves, so that a library doesn't
+     * leave files in unexpected places. If it doesn't exist, caching is off.
+     */
+    ret = stat(dir, &st);
+    if (ret != 0 || !S_ISDIR(st.st_mode)) {
+        return NULL;
+    }
+
+    if (!is_trusted(&st)) {
+        hound_log(
+            XLOG_WARNING,
+            "not using config cache directory %s, as others can write to it",
+            dir);
+        return NULL;
+    }
+
+    return dir;
+}
+
+static
+hound_err get_cache_path(
+    const char *config_path,
+    const char *schema_base,
+    size_t len,
+    char *out)
+{
+    int count;
+    const char *dir;
+    uint64_t hash;
+
+    dir = get_cache_dir();
+    if (dir == NULL) {
+        return HOUND_IO_ERROR;
+    }
+
+    /* The schema base changes how schemas are found, so it's part of the key. */
+    hash = fnv1a(FNV_OFFSET_BASIS, config_path, strlen(config_path) + 1);
+    hash = fnv1a(hash, schema_base, strlen(schema_base) + 1);
+
+    count = snprintf(out, len, "%s/config-%016" PRIx64 ".bin", dir, hash);
+    if (count < 0 || (size_t) count >= len) {
+        return HOUND_PATH_TOO_LONG;
+    }
+
+    return HOUND_OK;
+}
+
+/*
+ * Writing.
+ */
+
+static
+void buf_append(struct buf *buf, const void *data, size_t len)
+{
+    size_t cap;
+    unsigned char *new_data;
+
+    if (buf->oom) {
+        return;
+    }
+
+    if (buf->len + len > buf->cap) {
+        cap = max(2*buf->cap, buf->len + len);
+        new_data = realloc(buf->data, cap);
+        if (new_data == NULL) {
+            buf->oom = true;
+            return;
+        }
+        buf->data = new_data;
+        buf->cap = cap;
+    }
+
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+}
+
+static
+void buf_u32(struct buf *buf, uint32_t val)
+{
+    buf_append(buf, &val, sizeof(val));
+}
+
+static
+void buf_u64(struct buf *buf, uint64_t val)
+{
+    buf_append(buf, &val, sizeof(val));
+}
+
+static
+void buf_str(struct buf *buf, const char *str)
+{
+    size_t len;
+
+    len = strlen(str);
+    buf_u32(buf, len);
+    buf_append(buf, str, len + 1);
+}
+
+static
+void buf_source(struct buf *buf, const struct cache_source *source)
+{
+    buf_u64(buf, source->st.st_dev);
+    buf_u64(buf, source->st.st_ino);
+    buf_u64(buf, source->st.st_size);
+    buf_u64(buf, source->st.st_mtim.tv_sec);
+    buf_u64(buf, source->st.st_mtim.tv_nsec);
+    buf_str(buf, source->path);
+}
+
+static
+void buf_driver(struct buf *buf, const struct driver_init *init)
+{
+    const struct hound_init_arg *arg;
+    size_t i;
+
+    buf_str(buf, init->name);
+    buf_str(buf, init->path);
+    buf_str(buf, init->schema);
+    buf_u32(buf, init->arg_count);
+    for (i = 0; i < init->arg_count; ++i) {
+        arg = &init->args[i];
+        buf_u32(buf, arg->type);
+        if (arg->type == HOUND_TYPE_BYTES) {
+            /* Bytes args come from YAML scalars, so they are strings. */
+            buf_str(buf, (const char *) arg->data.as_bytes);
+        }
+        else {
+            buf_append(buf, &arg->data, sizeof(arg->data));
+        }
+    }
+}
+
+static
+void buf_schema(struct buf *buf, const struct cache_schema *schema)
+{
+    const struct schema_desc *desc;
+    const struct hound_data_fmt *fmt;
+    size_t i;
+    size_t j;
+
+    buf_u32(buf, schema->source_index);
+    buf_u32(buf, schema->desc_count);
+    for (i = 0; i < schema->desc_count; ++i) {
+        desc = &schema->descs[i];
+        buf_u32(buf, desc->data_id);
+        buf_str(buf, desc->name);
+        buf_u32(buf, desc->fmt_count);
+        for (j = 0; j < desc->fmt_count; ++j) {
+            fmt = &desc->fmts[j];
+            buf_str(buf, fmt->name);
+            buf_u32(buf, fmt->unit);
+            buf_u32(buf, fmt->type);
+            buf_u64(buf, fmt->size);
+        }
+    }
+}
+
+static
+void destroy_cache_schemas(size_t count, struct cache_schema *schemas)
+{
+    size_t i;
+    size_t j;
+
+    for (i = 0; i < count; ++i) {
+        for (j = 0; j < schemas[i].desc_count; ++j) {
+            destroy_schema_desc(&schemas[i].descs[j]);
+        }
+        free(schemas[i].descs);
+    }
+    free(schemas);
+}
+
+/**
+ * Collects the schemas referenced by the init list, parsing each distinct
+ * schema file once. Since the drivers were just registered, the schemas come
+ * from the schema cache rather than from YAML.
+ */
+static
+hound_err collect_schemas(
+    const char *schema_base,
+    size_t init_count,
+    const struct driver_init *init_list,
+    size_t *out_source_count,
+    struct cache_source *sources,
+    size_t *out_schema_count,
+    struct cache_schema *schemas)
+{
+    hound_err err;
+    size_t i;
+    size_t j;
+    char path[PATH_MAX];
+    int ret;
+    struct cache_schema *schema;
+    size_t schema_count;
+    size_t source_count;
+
+    /* The config itself is always the first source. */
+    source_count = 1;
+    schema_count = 0;
+    err = HOUND_OK;
+    for (i = 0; i < init_count; ++i) {
+        err = norm_path(schema_base, init_list[i].schema, ARRAYLEN(path), path);
+        if (err != HOUND_OK) {
+            break;
+        }
+
+        for (j = 1; j < source_count; ++j) {
+            if (strcmp(sources[j].path, path) == 0) {
+                break;
+            }
+        }
+        if (j < source_count) {
+            continue;
+        }
+
+        /*
+         * Stat before parsing, so that if the schema changes in between, the
+         * cache will look stale rather than silently holding old data.
+         */
+        strcpy(sources[source_count].path, path);
+        ret = stat(path, &sources[source_count].st);
+        if (ret != 0) {
+            err = HOUND_IO_ERROR;
+            break;
+        }
+
+        schema = &schemas[schema_count];
+        err = schema_parse(
+            schema_base,
+            init_list[i].schema,
+            &schema->desc_count,
+            &schema->descs);
+        if (err != HOUND_OK) {
+            break;
+        }
+        schema->source_index = source_count;
+
+        ++source_count;
+        ++schema_count;
+    }
+
+    *out_source_count = source_count;
+    *out_schema_count = schema_count;
+
+    return err;
+}
+
+static
+hound_err write_file(const char *path, const void *data, size_t len)
+{
+    const unsigned char *bytes;
+    int fd;
+    hound_err err;
+    size_t offset;
+    int ret;
+    ssize_t written;
+    char tmp_path[PATH_MAX];
+
+    ret = snprintf(tmp_path, ARRAYLEN(tmp_path), "%s.XXXXXX", path);
+    if (ret < 0 || (size_t) ret >= ARRAYLEN(tmp_path)) {
+        return HOUND_PATH_TOO_LONG;
+    }
+
+    fd = mkstemp(tmp_path);
+    if (fd == -1) {
+        return HOUND_IO_ERROR;
+    }
+
+    bytes = data;
+    offset = 0;
+    while (offset < len) {
+        written = write(fd, bytes + offset, len - offset);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            err = HOUND_IO_ERROR;
+            goto error_write;
+        }
+        offset += written;
+    }
+
+    ret = close(fd);
+    if (ret != 0) {
+        err = HOUND_IO_ERROR;
+        goto error_close;
+    }
+
+    /*
+     * Rename into place, so that readers see either the old cache file or the
+     * complete new one, but never a partial file.
+     */
+    ret = rename(tmp_path, path);
+    if (ret != 0) {
+        err = HOUND_IO_ERROR;
+        goto error_close;
+    }
+
+    return HOUND_OK;
+
+error_write:
+    close(fd);
+error_close:
+    unlink(tmp_path);
+    return err;
+}
+
+hound_err cache_store_config(
+    const char *config_path,
+    const struct stat *config_st,
+    const char *schema_base,
+    size_t init_count,
+    const struct driver_init *init_list)
+{
+    struct buf buf;
+    hound_err err;
+    struct cache_header header;
+    size_t i;
+    char path[PATH_MAX];
+    size_t schema_count;
+    struct cache_schema *schemas;
+    size_t source_count;
+    struct cache_source *sources;
+
+    XASSERT_NOT_NULL(config_path);
+    XASSERT_NOT_NULL(config_st);
+    XASSERT_NOT_NULL(schema_base);
+
+    if (get_cache_dir() == NULL) {
+        /* Caching is turned off. */
+        return HOUND_OK;
+    }
+
+    if (strnlen(config_path, PATH_MAX) == PATH_MAX) {
+        return HOUND_PATH_TOO_LONG;
+    }
+
+    err = get_cache_path(config_path, schema_base, ARRAYLEN(path), path);
+    if (err != HOUND_OK) {
+        goto out;
+    }
+
+    sources = malloc((init_count + 1) * sizeof(*sources));
+    if (sources == NULL) {
+        err = HOUND_OOM;
+        goto out;
+    }
+
+    schemas = calloc(init_count + 1, sizeof(*schemas));
+    if (schemas == NULL) {
+        err = HOUND_OOM;
+        goto out_free_sources;
+    }
+
+    strcpy(sources[0].path, config_path);
+    sources[0].st = *config_st;
+
+    err = collect_schemas(
+        schema_base,
+        init_count,
+        init_list,
+        &source_count,
+        sources,
+        &schema_count,
+        schemas);
+    if (err != HOUND_OK) {
+        goto out_free_schemas;
+    }
+
+    buf.data = NULL;
+    buf.len = 0;
+    buf.cap = 0;
+    buf.oom = false;
+
+    /* Reserve space for the header, which we fill in at the end. */
+    memset(&header, 0, sizeof(header));
+    buf_append(&buf, &header, sizeof(header));
+    for (i = 0; i < source_count; ++i) {
+        buf_source(&buf, &sources[i]);
+    }
+    for (i = 0; i < init_count; ++i) {
+        buf_driver(&buf, &init_list[i]);
+    }
+    for (i = 0; i < schema_count; ++i) {
+        buf_schema(&buf, &schemas[i]);
+    }
+    if (buf.oom) {
+        err = HOUND_OOM;
+        goto out_free_buf;
+    }
+
+    memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+    header.version = CACHE_VERSION;
+    header.arg_size = sizeof(struct hound_init_arg);
+    header.source_count = source_count;
+    header.driver_count = init_count;
+    header.schema_count = schema_count;
+    header.len = buf.len;
+    header.hash = fnv1a(
+        FNV_OFFSET_BASIS,
+        buf.data + sizeof(header),
+        buf.len - sizeof(header));
+    memcpy(buf.data, &header, sizeof(header));
+
+    err = write_file(path, buf.data, buf.len);
+
+out_free_buf:
+    free(buf.data);
+out_free_schemas:
+    destroy_cache_schemas(schema_count, schemas);
+out_free_sources:
+    free(sources);
+out:
+    return err;
+}
+
+/*
+ * Reading.
+ */
+
+static
+bool read_bytes(struct cursor *cursor, void *out, size_t len)
+{
+    if ((size_t) (cursor->end - cursor->pos) < len) {
+        return false;
+    }
+
+    memcpy(out, cursor->pos, len);
+    cursor->pos += len;
+
+    return true;
+}
+
+static
+bool read_u32(struct cursor *cursor, uint32_t *out)
+{
+    return read_bytes(cursor, out, sizeof(*out));
+}
+
+static
+bool read_u64(struct cursor *cursor, uint64_t *out)
+{
+    return read_bytes(cursor, out, sizeof(*out));
+}
+
+static
+bool read_str(struct cursor *cursor, const char **out)
+{
+    uint32_t len;
+
+    if (!read_u32(cursor, &len)) {
+        return false;
+    }
+
+    if ((size_t) (cursor->end - cursor->pos) <= len ||
+        cursor->pos[len] != '\0') {
+        return false;
+    }
+
+    *out = (const char *) cursor->pos;
+    cursor->pos += len + 1;
+
+    return true;
+}
+
+/**
+ * Reads a source entry and checks it against the current state of the file.
+ *
+ * @return true if the source file is unchanged, false otherwise
+ */
+static
+bool read_source(struct cursor *cursor, const char **path, struct stat *st)
+{
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t mtime_nsec;
+    uint64_t mtime_sec;
+    int ret;
+    uint64_t size;
+
+    if (!read_u64(cursor, &dev) ||
+        !read_u64(cursor, &ino) ||
+        !read_u64(cursor, &size) ||
+        !read_u64(cursor, &mtime_sec) ||
+        !read_u64(cursor, &mtime_nsec) ||
+        !read_str(cursor, path)) {
+        return false;
+    }
+
+    ret = stat(*path, st);
+    if (ret != 0) {
+        return false;
+    }
+
+    return st->st_dev == (dev_t) dev &&
+           st->st_ino == (ino_t) ino &&
+           st->st_size == (off_t) size &&
+           st->st_mtim.tv_sec == (time_t) mtime_sec &&
+           st->st_mtim.tv_nsec == (long) mtime_nsec;
+}
+
+static
+bool read_driver(struct cursor *cursor, struct driver_init *init)
+{
+    struct hound_init_arg *arg;
+    uint32_t arg_count;
+    const char *bytes;
+    size_t i;
+    uint32_t type;
+
+    init->arg_count = 0;
+    init->args = NULL;
+    if (!read_str(cursor, &init->name) ||
+        !read_str(cursor, &init->path) ||
+        !read_str(cursor, &init->schema) ||
+        !read_u32(cursor, &arg_count)) {
+        return false;
+    }
+
+    if (arg_count == 0) {
+        return true;
+    }
+
+    init->args = malloc(arg_count * sizeof(*init->args));
+    if (init->args == NULL) {
+        return false;
+    }
+
+    for (i = 0; i < arg_count; ++i) {
+        arg = &init->args[i];
+        if (!read_u32(cursor, &type)) {
+            return false;
+        }
+        arg->type = type;
+        if (arg->type == HOUND_TYPE_BYTES) {
+            if (!read_str(cursor, &bytes)) {
+                return false;
+            }
+            arg->data.as_bytes = (const unsigned char *) bytes;
+        }
+        else if (!read_bytes(cursor, &arg->data, sizeof(arg->data))) {
+            return false;
+        }
+        ++init->arg_count;
+    }
+
+    return true;
+}
+
+/**
+ * Reads a schema and adds it to the schema cache. The descriptors read here
+ * point into the cache file, but the schema cache makes its own copy.
+ */
+static
+bool read_schema(
+    struct cursor *cursor,
+    size_t source_count,
+    const char **source_paths,
+    const struct stat *source_sts)
+{
+    struct schema_desc *desc;
+    uint32_t desc_count;
+    struct schema_desc *descs;
+    hound_err err;
+    struct hound_data_fmt *fmt;
+    uint32_t fmt_count;
+    size_t i;
+    size_t j;
+    bool ok;
+    uint64_t size;
+    uint32_t source_index;
+    uint32_t val;
+
+    if (!read_u32(cursor, &source_index) ||
+        source_index == 0 ||
+        source_index >= source_count ||
+        !read_u32(cursor, &desc_count)) {
+        return false;
+    }
+
+    descs = calloc(desc_count, sizeof(*descs));
+    if (descs == NULL) {
+        return false;
+    }
+
+    ok = false;
+    for (i = 0; i < desc_count; ++i) {
+        desc = &descs[i];
+        if (!read_u32(cursor, &val) ||
+            !read_str(cursor, &desc->name) ||
+            !read_u32(cursor, &fmt_count) ||
+            fmt_count == 0) {
+            goto out;
+        }
+        desc->data_id = val;
+
+        desc->fmts = malloc(fmt_count * sizeof(*desc->fmts));
+        if (desc->fmts == NULL) {
+            goto out;
+        }
+        desc->fmt_count = fmt_count;
+
+        for (j = 0; j < fmt_count; ++j) {
+            fmt = &desc->fmts[j];
+            if (!read_str(cursor, &fmt->name) ||
+                !read_u32(cursor, &val)) {
+                goto out;
+            }
+            fmt->unit = val;
+            if (!read_u32(cursor, &val) || !read_u64(cursor, &size)) {
+                goto out;
+            }
+            fmt->type = val;
+            fmt->offset = 0;
+            fmt->size = size;
+        }
+    }
+
+    err = schema_cache_put(
+        source_paths[source_index],
+        &source_sts[source_index],
+        desc_count,
+        descs);
+    ok = (err == HOUND_OK);
+
+out:
+    for (i = 0; i < desc_count; ++i) {
+        free(descs[i].fmts);
+    }
+    free(descs);
+    return ok;
+}
+
+static
+bool read_payload(
+    struct cursor *cursor,
+    const struct cache_header *header,
+    struct driver_init *init_list)
+{
+    size_t i;
+    bool ok;
+    const char **source_paths;
+    struct stat *source_sts;
+
+    source_paths = malloc(header->source_count * sizeof(*source_paths));
+    if (source_paths == NULL) {
+        return false;
+    }
+
+    source_sts = malloc(header->source_count * sizeof(*source_sts));
+    if (source_sts == NULL) {
+        free(source_paths);
+        return false;
+    }
+
+    ok = false;
+    for (i = 0; i < header->source_count; ++i) {
+        if (!read_source(cursor, &source_paths[i], &source_sts[i])) {
+            goto out;
+        }
+    }
+
+    for (i = 0; i < header->driver_count; ++i) {
+        if (!read_driver(cursor, &init_list[i])) {
+            goto out;
+        }
+    }
+
+    for (i = 0; i < header->schema_count; ++i) {
+        if (!read_schema(
+                cursor,
+                header->source_count,
+                source_paths,
+                source_sts)) {
+            goto out;
+        }
+    }
+
+    ok = (cursor->pos == cursor->end);
+
+out:
+    free(source_sts);
+    free(source_paths);
+    return ok;
+}
+
+hound_err cache_load_config(
+    const char *config_path,
+    const char *schema_base,
+    struct config_cache **out_cache,
+    size_t *out_init_count,
+    struct driver_init **out_init_list)
+{
+    void *addr;
+    struct config_cache *cache;
+    struct cursor cursor;
+    hound_err err;
+    int fd;
+    struct cache_header header;
+    struct driver_init *init_list;
+    char path[PATH_MAX];
+    int ret;
+    struct stat st;
+
+    XASSERT_NOT_NULL(config_path);
+    XASSERT_NOT_NULL(schema_base);
+    XASSERT_NOT_NULL(out_cache);
+    XASSERT_NOT_NULL(out_init_count);
+    XASSERT_NOT_NULL(out_init_list);
+
+    err = get_cache_path(config_path, schema_base, ARRAYLEN(path), path);
+    if (err != HOUND_OK) {
+        goto error_path;
+    }
+
+    fd = open(path, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    if (fd == -1) {
+        err = HOUND_IO_ERROR;
+        goto error_open;
+    }
+
+    ret = fstat(fd, &st);
+    if (ret != 0 || (size_t) st.st_size < sizeof(header)) {
+        close(fd);
+        err = HOUND_IO_ERROR;
+        goto error_open;
+    }
+
+    if (!S_ISREG(st.st_mode) || !is_trusted(&st)) {
+        hound_log(
+            XLOG_WARNING,
+            "ignoring config cache %s, as others can write to it",
+            path);
+        close(fd);
+        err = HOUND_IO_ERROR;
+        goto error_open;
+    }
+
+    addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        err = HOUND_IO_ERROR;
+        goto error_open;
+    }
+
+    memcpy(&header, addr, sizeof(header));
+    if (memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != CACHE_VERSION ||
+        header.arg_size != sizeof(struct hound_init_arg) ||
+        header.len != (uint64_t) st.st_size ||
+        header.source_count == 0 ||
+        header.hash != fnv1a(
+            FNV_OFFSET_BASIS,
+            (const unsigned char *) addr + sizeof(header),
+            header.len - sizeof(header))) {
+        hound_log(XLOG_WARNING, "ignoring invalid config cache %s", path);
+        err = HOUND_IO_ERROR;
+        goto error_header;
+    }
+
+    cache = malloc(sizeof(*cache));
+    if (cache == NULL) {
+        err = HOUND_OOM;
+        goto error_alloc_cache;
+    }
+    cache->addr = addr;
+    cache->len = header.len;
+
+    /* Zero this so that a partially-read init list can be safely freed. */
+    init_list = calloc(header.driver_count, sizeof(*init_list));
+    if (init_list == NULL) {
+        err = HOUND_OOM;
+        goto error_alloc_init_list;
+    }
+
+    cursor.pos = (const unsigned char *) addr + sizeof(header);
+    cursor.end = (const unsigned char *) addr + header.len;
+    if (!read_payload(&cursor, &header, init_list)) {
+        /* Most likely, one of the sources changed. */
+        err = HOUND_IO_ERROR;
+        goto error_read_payload;
+    }
+
+    *out_cache = cache;
+    *out_init_count = header.driver_count;
+    *out_init_list = init_list;
+
+    return HOUND_OK;
+
+error_read_payload:
+    destroy_init_list(header.driver_count, init_list);
+error_alloc_init_list:
+    free(cache);
+error_alloc_cache:
+error_header:
+    munmap(addr, st.st_size);
+error_open:
+error_path:
+    return err;
+}
+
+void cache_unload_config(struct config_cache *cache)
+{
+    XASSERT_NOT_NULL(cache);
+
+    munmap(cache->addr, cache->len);
+    free(cache);
+}
@@ -12,23 +12,20 @@
 #include <inttypes.h>
 #include <hound/hound.h>
 #include <hound-private/log.h>
+#include <hound-private/parse/cache.h>
 #include <hound-private/parse/common.h>
+#include <hound-private/parse/config.h>
 #include <hound-private/util.h>
 #include <linux/limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <xlib/xassert.h>
 #include <yaml.h>
 
 #include "config.h"
 
-struct driver_init {
-    const char *name;
-    const char *path;
-    const char *schema;
-    size_t arg_count;
-    struct hound_init_arg *args;
-};
-
 #define CHECK_ERRNO \
     do { \
         if (errno != 0) { \
@@ -314,6 +311,54 @@ int parse_doc(
     return err;
 }
 
+/*
+ * The max number of threads used to initialize drivers. Driver init is mostly
+ * waiting on I/O (servers, sysfs, devices), so this doesn't need to track the
+ * number of CPUs.
+ */
+#define MAX_INIT_THREADS 8
+
+struct init_work {
+    size_t init_count;
+    struct driver_init *init_list;
+    const char *schema_base;
+    atomic_size_t next;
+    hound_err *errs;
+};
+
+static
+void *init_worker(void *data)
+{
+    size_t i;
+    struct driver_init *init;
+    struct init_work *work;
+
+    work = data;
+    while (true) {
+        i = atomic_fetch_add(&work->next, 1);
+        if (i >= work->init_count) {
+            break;
+        }
+
+        init = &work->init_list[i];
+        work->errs[i] = hound_init_driver(
+            init->name,
+            init->path,
+            work->schema_base,
+            init->schema,
+            init->arg_count,
+            init->args);
+    }
+
+    return NULL;
+}
+
+/**
+ * Initializes all drivers in the init list in parallel, so that startup takes
+ * as long as the slowest driver rather than the sum of all of them. If any
+ * driver fails, all the drivers that succeeded are destroyed again, and the
+ * error of the first failing driver in config order is returned.
+ */
 static
 hound_err register_drivers(
     size_t init_count,
@@ -322,37 +367,74 @@ hound_err register_drivers(
 {
     hound_err err;
     hound_err err2;
+    hound_err *errs;
     size_t i;
     struct driver_init *init;
+    int ret;
+    size_t thread_count;
+    pthread_t threads[MAX_INIT_THREADS-1];
+    struct init_work work;
+
+    errs = malloc(init_count * sizeof(*errs));
+    if (errs == NULL) {
+        return HOUND_OOM;
+    }
 
+    work.init_count = init_count;
+    work.init_list = init_list;
+    work.schema_base = schema_base;
+    atomic_init(&work.next, 0);
+    work.errs = errs;
+
+    /*
+     * The calling thread also does work, so we need one fewer extra thread
+     * than there are drivers. If we can't create a thread, we just use fewer.
+     */
+    thread_count = 0;
+    for (i = 0; i+1 < init_count && i < ARRAYLEN(threads); ++i) {
+        ret = pthread_create(&threads[i], NULL, init_worker, &work);
+        if (ret != 0) {
+            break;
+        }
+        ++thread_count;
+    }
+    init_worker(&work);
+    for (i = 0; i < thread_count; ++i) {
+        ret = pthread_join(threads[i], NULL);
+        XASSERT_EQ(ret, 0);
+    }
+
+    err = HOUND_OK;
     for (i = 0; i < init_count; ++i) {
-        init = &init_list[i];
-        err = hound_init_driver(
-            init->name,
-            init->path,
-            schema_base,
-            init->schema,
-            init->arg_count,
-            init->args);
-        if (err != HOUND_OK) {
-            for (--i; i < init_count; --i) {
-                err2 = hound_destroy_driver(init->path);
-                if (err2 != HOUND_OK) {
-                    hound_log_err(
-                        err2,
-                        "failed to unregister driver %s at path %s",
-                        init->name,
-                        init->path);
-                }
-            }
+        if (errs[i] != HOUND_OK) {
+            err = errs[i];
             break;
         }
     }
 
+    if (err != HOUND_OK) {
+        /* Roll back so that we initialize either all drivers or none. */
+        for (i = 0; i < init_count; ++i) {
+            if (errs[i] != HOUND_OK) {
+                continue;
+            }
+            init = &init_list[i];
+            err2 = hound_destroy_driver(init->path);
+            if (err2 != HOUND_OK) {
+                hound_log_err(
+                    err2,
+                    "failed to unregister driver %s at path %s",
+                    init->name,
+                    init->path);
+            }
+        }
+    }
+
+    free(errs);
+
     return err;
 }
 
-static
 void destroy_init_list(size_t init_count, struct driver_init *init_list)
 {
     size_t i;
@@ -365,15 +447,26 @@ void destroy_init_list(size_t init_count, struct driver_init *init_list)
 }
 
 static
-hound_err register_config(FILE *file, const char *schema_base)
+hound_err register_config(
+    FILE *file,
+    const char *config_path,
+    const char *schema_base)
 {
     yaml_document_t doc;
     hound_err err;
+    hound_err err2;
     size_t init_count;
     struct driver_init *init_list;
     yaml_node_t *node;
     yaml_parser_t parser;
     int ret;
+    struct stat st;
+
+    /* Stat before parsing so a concurrent edit makes the cache look stale. */
+    ret = fstat(fileno(file), &st);
+    if (ret != 0) {
+        return HOUND_IO_ERROR;
+    }
 
     ret = yaml_parser_initialize(&parser);
     if (ret == 0) {
@@ -400,6 +493,17 @@ hound_err register_config(FILE *file, const char *schema_base)
         goto out;
     }
 
+    /* The cache is only an optimization, so failing to write it is OK. */
+    err2 = cache_store_config(
+        config_path,
+        &st,
+        schema_base,
+        init_count,
+        init_list);
+    if (err2 != HOUND_OK) {
+        hound_log_err(err2, "failed to write cache for config %s", config_path);
+    }
+
 out:
     destroy_init_list(init_count, init_list);
     yaml_document_delete(&doc);
@@ -409,8 +513,11 @@ out:
 
 hound_err parse_config(const char *config_path, const char *schema_base)
 {
+    struct config_cache *cache;
     hound_err err;
     FILE *f;
+    size_t init_count;
+    struct driver_init *init_list;
     char path[PATH_MAX];
 
     err = norm_path(CONFIG_HOUND_CONFDIR, config_path, ARRAYLEN(path), path);
@@ -418,13 +525,22 @@ hound_err parse_config(const char *config_path, const char *schema_base)
         return HOUND_PATH_TOO_LONG;
     }
 
+    /* Skip YAML parsing entirely if we have an up-to-date precompiled config. */
+    err = cache_load_config(path, schema_base, &cache, &init_count, &init_list);
+    if (err == HOUND_OK) {
+        err = register_drivers(init_count, init_list, schema_base);
+        destroy_init_list(init_count, init_list);
+        cache_unload_config(cache);
+        return err;
+    }
+
     f = fopen(path, "r");
     if (f == NULL) {
         err = HOUND_IO_ERROR;
         goto error_fopen;
     }
 
-    err = register_config(f, schema_base);
+    err = register_config(f, path, schema_base);
     fclose(f);
     if (err != HOUND_OK) {
         goto error_parse;
@@ -11,17 +11,39 @@
 #include <hound-private/driver.h>
 #include <hound-private/error.h>
 #include <hound-private/driver.h>
+#include <hound-private/log.h>
 #include <hound-private/parse/common.h>
 #include <hound-private/parse/schema.h>
 #include <hound-private/util.h>
 #include <linux/limits.h>
 #include <pthread.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <xlib/xhash.h>
 #include <xlib/xvec.h>
 #include <yaml.h>
 
 #define MAX_FMT_ENTRIES 100
 
+/*
+ * Parsed schemas, cached so that drivers sharing a schema file (such as several
+ * MQTT brokers) parse it only once. An entry is used only while the file's
+ * inode, size and modification time still match what was parsed.
+ */
+struct schema_cache_entry {
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    size_t desc_count;
+    struct schema_desc *descs;
+};
+
+/* normalized schema path --> cache entry */
+XHASH_MAP_INIT_STR(SCHEMA_MAP, struct schema_cache_entry *)
+static xhash_t(SCHEMA_MAP) *s_schema_map = NULL;
+static pthread_mutex_t s_schema_lock = PTHREAD_MUTEX_INITIALIZER;
+
 void destroy_desc_fmts(size_t count, struct hound_data_fmt *fmts)
 {
     size_t i;
@@ -121,6 +143,191 @@ error_name:
     return err;
 }
 
+static
+void destroy_schema_descs(size_t count, struct schema_desc *descs)
+{
+    size_t i;
+
+    for (i = 0; i < count; ++i) {
+        destroy_schema_desc(&descs[i]);
+    }
+    free(descs);
+}
+
+static
+hound_err copy_schema_descs(
+    size_t count,
+    const struct schema_desc *src,
+    struct schema_desc **out_descs)
+{
+    struct schema_desc *descs;
+    hound_err err;
+    size_t i;
+
+    descs = malloc(count * sizeof(*descs));
+    if (descs == NULL) {
+        return HOUND_OOM;
+    }
+
+    for (i = 0; i < count; ++i) {
+        err = copy_schema_desc(&src[i], &descs[i]);
+        if (err != HOUND_OK) {
+            destroy_schema_descs(i, descs);
+            return err;
+        }
+    }
+
+    *out_descs = descs;
+
+    return HOUND_OK;
+}
+
+static
+void destroy_cache_entry(struct schema_cache_entry *entry)
+{
+    destroy_schema_descs(entry->desc_count, entry->descs);
+    free(entry);
+}
+
+static
+bool cache_entry_fresh(
+    const struct schema_cache_entry *entry,
+    const struct stat *st)
+{
+    return entry->dev == st->st_dev &&
+           entry->ino == st->st_ino &&
+           entry->size == st->st_size &&
+           entry->mtime.tv_sec == st->st_mtim.tv_sec &&
+           entry->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+void schema_init(void)
+{
+    s_schema_map = xh_init(SCHEMA_MAP);
+    XASSERT_NOT_NULL(s_schema_map);
+}
+
+void schema_destroy(void)
+{
+    xhiter_t iter;
+
+    xh_iter(s_schema_map, iter,
+        free((char *) xh_key(s_schema_map, iter));
+        destroy_cache_entry(xh_val(s_schema_map, iter));
+    );
+    xh_destroy(SCHEMA_MAP, s_schema_map);
+}
+
+hound_err schema_cache_put(
+    const char *path,
+    const struct stat *st,
+    size_t desc_count,
+    const struct schema_desc *descs)
+{
+    struct schema_cache_entry *entry;
+    hound_err err;
+    xhiter_t iter;
+    const char *key;
+    int ret;
+
+    XASSERT_NOT_NULL(path);
+    XASSERT_NOT_NULL(st);
+    XASSERT_NOT_NULL(descs);
+
+    entry = malloc(sizeof(*entry));
+    if (entry == NULL) {
+        err = HOUND_OOM;
+        goto error_alloc_entry;
+    }
+
+    err = copy_schema_descs(desc_count, descs, &entry->descs);
+    if (err != HOUND_OK) {
+        goto error_copy_descs;
+    }
+    entry->desc_count = desc_count;
+    entry->dev = st->st_dev;
+    entry->ino = st->st_ino;
+    entry->size = st->st_size;
+    entry->mtime = st->st_mtim;
+
+    lock_mutex(&s_schema_lock);
+    iter = xh_get(SCHEMA_MAP, s_schema_map, path);
+    if (iter != xh_end(s_schema_map)) {
+        /* Replace a stale entry, keeping its key. */
+        destroy_cache_entry(xh_val(s_schema_map, iter));
+        xh_val(s_schema_map, iter) = entry;
+        unlock_mutex(&s_schema_lock);
+        return HOUND_OK;
+    }
+
+    key = strdup(path);
+    if (key == NULL) {
+        err = HOUND_OOM;
+        goto error_strdup;
+    }
+
+    iter = xh_put(SCHEMA_MAP, s_schema_map, key, &ret);
+    if (ret == -1) {
+        err = HOUND_OOM;
+        goto error_put;
+    }
+    xh_val(s_schema_map, iter) = entry;
+    unlock_mutex(&s_schema_lock);
+
+    return HOUND_OK;
+
+error_put:
+    free((char *) key);
+error_strdup:
+    unlock_mutex(&s_schema_lock);
+    destroy_schema_descs(entry->desc_count, entry->descs);
+error_copy_descs:
+    free(entry);
+error_alloc_entry:
+    return err;
+}
+
+/**
+ * Looks up a parsed schema in the cache, returning a copy that the caller may
+ * modify and must free.
+ *
+ * @return HOUND_OK on a cache hit, HOUND_OOM if a copy could not be made, or
+ *         HOUND_IO_ERROR if there is no fresh cache entry
+ */
+static
+hound_err schema_cache_get(
+    const char *path,
+    const struct stat *st,
+    size_t *out_desc_count,
+    struct schema_desc **out_descs)
+{
+    struct schema_cache_entry *entry;
+    hound_err err;
+    xhiter_t iter;
+
+    lock_mutex(&s_schema_lock);
+    iter = xh_get(SCHEMA_MAP, s_schema_map, path);
+    if (iter == xh_end(s_schema_map)) {
+        err = HOUND_IO_ERROR;
+        goto out;
+    }
+
+    entry = xh_val(s_schema_map, iter);
+    if (!cache_entry_fresh(entry, st)) {
+        err = HOUND_IO_ERROR;
+        goto out;
+    }
+
+    err = copy_schema_descs(entry->desc_count, entry->descs, out_descs);
+    if (err == HOUND_OK) {
+        *out_desc_count = entry->desc_count;
+    }
+
+out:
+    unlock_mutex(&s_schema_lock);
+    return err;
+}
+
 static
 uint32_t parse_num(const char *s)
 {
@@ -327,6 +534,7 @@ hound_err parse_doc(
     return HOUND_OK;
 }
 
+static
 hound_err parse(
     FILE *file,
     size_t *out_desc_count,
@@ -410,10 +618,13 @@ hound_err schema_parse(
     struct schema_desc **out_descs)
 {
     hound_err err;
+    hound_err err2;
     FILE *f;
     size_t desc_count;
     struct schema_desc *descs;
     char path[PATH_MAX];
+    int ret;
+    struct stat st;
 
     XASSERT_NOT_NULL(schema);
 
@@ -428,13 +639,30 @@ hound_err schema_parse(
         goto out;
     }
 
-    err = parse(f, &desc_count, &descs);
-    fclose(f);
+    ret = fstat(fileno(f), &st);
+    if (ret != 0) {
+        err = HOUND_IO_ERROR;
+        goto out_fclose;
+    }
+
+    err = schema_cache_get(path, &st, &desc_count, &descs);
+    if (err == HOUND_IO_ERROR) {
+        err = parse(f, &desc_count, &descs);
+        if (err == HOUND_OK) {
+            /* The cache is only an optimization, so failing to fill it is OK. */
+            err2 = schema_cache_put(path, &st, desc_count, descs);
+            if (err2 != HOUND_OK) {
+                hound_log_err(err2, "failed to cache schema %s", path);
+            }
+        }
+    }
     if (err == HOUND_OK) {
         *out_desc_count = desc_count;
         *out_descs = descs;
     }
 
+out_fclose:
+    fclose(f);
 out:
     return err;
 }
@@ -5,36 +5,138 @@
  *            thread-safe and blocks during the pop operation if the queue is
  *            empty. Thus it is intended for use in a producer-consumer
  *            scenario.
+ *
+ *            The queue can also have a max size in bytes, counting each
+ *            record's payload plus its header. Exceeding it is handled with the
+ *            same overflow policies as exceeding the max length.
+ *
+ *            For callers that wait in their own event loop rather than
+ *            blocking in a pop, the queue can also drive an eventfd that is
+ *            readable while the queue is at or above a watermark. We write to
+ *            it only when the queue crosses the watermark, not per record.
+ *
+ *            Data IDs can also be given their own lanes, which are separate
+ *            circular buffers with their own max lengths, and their own
+ *            overflow policies. Every record gets a sequence number when it is
+ *            pushed, and pops merge the lanes by sequence number, so records
+ *            still come out in the order they were pushed.
+ *
+ *            Blocking pops can spin for a while before sleeping, which cuts
+ *            wakeup latency when records arrive at a high rate. Spinning
+ *            watches an atomic copy of the queue length, so spinners don't
+ *            contend with producers for the queue lock.
  * @author    Martin Kelly <mkelly@xevo.com>
  * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
  */
 
+#include <hound-private/chunk.h>
 #include <hound-private/error.h>
+#include <hound-private/history.h>
+#include <hound-private/join.h>
+#include <hound-private/log.h>
 #include <hound-private/queue.h>
+#include <hound-private/resample.h>
+#include <hound-private/trace.h>
 #include <hound-private/util.h>
+#include <errno.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <xlib/xhash.h>
+
+/* Data with no policy, or with a policy but no lane, uses the shared lane. */
+#define SHARED_LANE SIZE_MAX
+
+/* How many times a spinner checks the queue between clock reads. */
+#define SPIN_CHECK_INTERVAL 64
+
+struct slot {
+    struct record_info *rec;
+    hound_seqno seqno;
+};
 
 /*
  * Push to back, pop from front. Back is calculated implicitly as front + len
  * with wraparound.
  */
+struct lane {
+    size_t max_len;
+    size_t len;
+    size_t bytes;
+    size_t front;
+    struct slot *data;
+};
+
+struct id_policy {
+    hound_overflow_policy overflow;
+    hound_data_period timeout_ns;
+    size_t lane;
+};
+
+XHASH_MAP_INIT_INT(POLICY_MAP, struct id_policy)
+
+/*
+ * The map holds only data IDs with non-default settings, so the common case of
+ * no policies costs nothing more than an empty map lookup.
+ */
+struct queue_policy {
+    xhash_t(POLICY_MAP) *map;
+    size_t lane_count;
+    struct lane *lanes;
+
+    /* Space to hold every queued record while the policy is installed. */
+    size_t scratch_len;
+    struct slot *scratch;
+};
+
 struct queue {
     pthread_mutex_t mutex;
     pthread_cond_t ready_cond;
+    pthread_cond_t space_cond;
+    bool blocking;
+    size_t blocked;
     bool interrupt;
-    size_t max_len;
     size_t len;
-    size_t front;
-    hound_seqno front_seqno;
-    struct record_info **data;
+
+    /*
+     * For spinning readers: a copy of len that can be read without the lock,
+     * the spin budget, and whether the last spin came up empty.
+     */
+    atomic_size_t ready_len;
+    atomic_uint_fast64_t spin_ns;
+    atomic_bool spin_idle;
+
+    /* Counted by the I/O core without the lock, as it filters records. */
+    atomic_uint_least64_t filter_passed;
+    atomic_uint_least64_t filter_suppressed;
+
+    size_t bytes;
+    size_t max_bytes;
+    bool bytes_full;
+    size_t payload;
+    int event_fd;
+    size_t watermark;
+    bool event_ready;
+    hound_seqno next_seqno;
+    struct lane shared;
+    struct queue_policy *policy;
+    struct resample *resample;
+    struct join *join;
+    struct history *history;
 };
 
 static
 void free_record_info(struct record_info *info)
 {
-    drv_free(info->record.data);
+    if (info->chunk != NULL) {
+        chunk_unref(info->chunk);
+    }
+    else {
+        drv_free(info->record.data);
+    }
     drv_free(info);
 }
 
@@ -52,9 +154,16 @@ void record_ref_dec(struct record_info *info)
     }
 }
 
+static
+size_t record_bytes(const struct record_info *rec)
+{
+    return sizeof(rec->record) + rec->record.size;
+}
+
 hound_err queue_alloc(
     struct queue **out_queue,
-    size_t max_len)
+    size_t max_len,
+    size_t max_bytes)
 {
     hound_err err;
     struct queue *queue;
@@ -66,19 +175,40 @@ hound_err queue_alloc(
         return HOUND_OOM;
     }
 
-    queue->data = malloc(max_len * sizeof(*queue->data));
-    if (queue->data == NULL) {
+    queue->shared.data = malloc(max_len * sizeof(*queue->shared.data));
+    if (queue->shared.data == NULL) {
         err = HOUND_OOM;
         goto error_alloc_data;
     }
 
     init_mutex(&queue->mutex);
     init_cond(&queue->ready_cond);
+    init_cond(&queue->space_cond);
+    queue->blocking = true;
+    queue->blocked = 0;
     queue->interrupt = false;
-    queue->max_len = max_len;
     queue->len = 0;
-    queue->front = 0;
-    queue->front_seqno = 0;
+    atomic_init(&queue->ready_len, 0);
+    atomic_init(&queue->spin_ns, 0);
+    atomic_init(&queue->spin_idle, false);
+    atomic_init(&queue->filter_passed, 0);
+    atomic_init(&queue->filter_suppressed, 0);
+    queue->bytes = 0;
+    queue->max_bytes = max_bytes;
+    queue->bytes_full = false;
+    queue->payload = 0;
+    queue->event_fd = -1;
+    queue->watermark = 0;
+    queue->event_ready = false;
+    queue->next_seqno = 0;
+    queue->shared.max_len = max_len;
+    queue->shared.len = 0;
+    queue->shared.bytes = 0;
+    queue->shared.front = 0;
+    queue->policy = NULL;
+    queue->resample = NULL;
+    queue->join = NULL;
+    queue->history = NULL;
 
     *out_queue = queue;
 
@@ -90,48 +220,255 @@ error_alloc_data:
 }
 
 static
-void drain_until(struct queue *queue, size_t new_len)
+struct slot lane_pop(struct queue *queue, struct lane *lane)
+{
+    size_t bytes;
+    struct slot slot;
+
+    XASSERT_GT(lane->len, 0);
+
+    slot = lane->data[lane->front];
+    lane->front = (lane->front + 1) % lane->max_len;
+    --lane->len;
+    --queue->len;
+    atomic_store_explicit(&queue->ready_len, queue->len, memory_order_release);
+
+    bytes = record_bytes(slot.rec);
+    lane->bytes -= bytes;
+    queue->bytes -= bytes;
+    queue->payload -= slot.rec->record.size;
+
+    return slot;
+}
+
+static
+void lane_push(struct queue *queue, struct lane *lane, struct slot slot)
+{
+    size_t bytes;
+
+    XASSERT_LT(lane->len, lane->max_len);
+
+    lane->data[(lane->front + lane->len) % lane->max_len] = slot;
+    ++lane->len;
+    ++queue->len;
+    atomic_store_explicit(&queue->ready_len, queue->len, memory_order_release);
+
+    bytes = record_bytes(slot.rec);
+    lane->bytes += bytes;
+    queue->bytes += bytes;
+    queue->payload += slot.rec->record.size;
+}
+
+static
+const struct id_policy *get_policy(struct queue *queue, hound_data_id id)
+{
+    xhiter_t iter;
+    xhash_t(POLICY_MAP) *map;
+
+    if (queue->policy == NULL) {
+        return NULL;
+    }
+
+    map = queue->policy->map;
+    if (xh_size(map) == 0) {
+        return NULL;
+    }
+
+    iter = xh_get(POLICY_MAP, map, id);
+    if (iter == xh_end(map)) {
+        return NULL;
+    }
+
+    return &xh_val(map, iter);
+}
+
+static
+struct lane *get_lane(struct queue *queue, const struct id_policy *policy)
+{
+    if (policy == NULL || policy->lane == SHARED_LANE) {
+        return &queue->shared;
+    }
+
+    return &queue->policy->lanes[policy->lane];
+}
+
+/**
+ * Returns the lane holding the oldest record in the queue, or NULL if the
+ * queue is empty.
+ */
+static
+struct lane *next_lane(struct queue *queue)
+{
+    struct lane *best;
+    size_t i;
+    struct lane *lane;
+
+    if (queue->shared.len > 0) {
+        best = &queue->shared;
+    }
+    else {
+        best = NULL;
+    }
+
+    if (queue->policy == NULL) {
+        return best;
+    }
+
+    for (i = 0; i < queue->policy->lane_count; ++i) {
+        lane = &queue->policy->lanes[i];
+        if (lane->len == 0) {
+            continue;
+        }
+        if (best == NULL ||
+            lane->data[lane->front].seqno < best->data[best->front].seqno) {
+            best = lane;
+        }
+    }
+
+    return best;
+}
+
+static
+void wake_producers(struct queue *queue)
+{
+    if (queue->blocked > 0) {
+        cond_broadcast(&queue->space_cond);
+    }
+}
+
+static
+void drain_until(struct queue *queue, struct lane *lane, size_t new_len)
+{
+    struct slot slot;
+
+    while (lane->len > new_len) {
+        slot = lane_pop(queue, lane);
+        record_ref_dec(slot.rec);
+    }
+}
+
+/**
+ * Drops the oldest records in the queue, regardless of lane, until it fits
+ * within its byte limit.
+ */
+static
+void trim_bytes(struct queue *queue)
+{
+    struct slot slot;
+
+    if (queue->max_bytes == 0) {
+        return;
+    }
+
+    while (queue->bytes > queue->max_bytes) {
+        slot = lane_pop(queue, next_lane(queue));
+        record_ref_dec(slot.rec);
+    }
+}
+
+/**
+ * Returns true if more records for some data will only cause drops or block
+ * producers until a reader makes room.
+ */
+static
+bool is_full(struct queue *queue)
 {
-    size_t drain_count;
     size_t i;
+    struct lane *lane;
+
+    /* An empty queue can't be short of bytes, whatever the last push saw. */
+    if (queue->bytes_full && queue->len > 0) {
+        return true;
+    }
+
+    if (queue->shared.len == queue->shared.max_len) {
+        return true;
+    }
+
+    if (queue->policy != NULL) {
+        for (i = 0; i < queue->policy->lane_count; ++i) {
+            lane = &queue->policy->lanes[i];
+            if (lane->len == lane->max_len) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Makes the eventfd readable if the queue just reached the watermark (or
+ * filled up before reaching it), and clears it if the queue just dropped below
+ * the watermark. Must be called after anything that changes the queue.
+ */
+static
+void update_event(struct queue *queue)
+{
+    ssize_t bytes;
+    bool ready;
+    uint64_t val;
 
-    if (new_len >= queue->len) {
+    if (queue->event_fd == -1) {
         return;
     }
 
-    drain_count = queue->len - new_len;
-    for (i = 0; i < drain_count; i++) {
-        record_ref_dec(queue->data[queue->front]);
-        queue->front = (queue->front + 1) % queue->max_len;
+    ready = queue->len > 0 &&
+            (queue->len >= queue->watermark || is_full(queue));
+    if (ready == queue->event_ready) {
+        return;
     }
 
-    queue->front_seqno += drain_count;
-    queue->len = new_len;
+    if (ready) {
+        val = 1;
+        bytes = write(queue->event_fd, &val, sizeof(val));
+        XASSERT_EQ(bytes, sizeof(val));
+    }
+    else {
+        /* The user isn't supposed to read the fd, but tolerate it. */
+        bytes = read(queue->event_fd, &val, sizeof(val));
+        XASSERT(bytes == sizeof(val) || errno == EAGAIN);
+    }
+    queue->event_ready = ready;
 }
 
 static
 void drain_nolock(struct queue *queue)
 {
-    drain_until(queue, 0);
+    size_t i;
+
+    drain_until(queue, &queue->shared, 0);
+    if (queue->policy != NULL) {
+        for (i = 0; i < queue->policy->lane_count; ++i) {
+            drain_until(queue, &queue->policy->lanes[i], 0);
+        }
+    }
+    XASSERT_EQ(queue->len, 0);
+
+    wake_producers(queue);
+    update_event(queue);
 }
 
 static
-bool is_contiguous(struct queue *queue)
+bool is_contiguous(const struct lane *lane)
 {
-    return (queue->front + queue->len) <= queue->max_len;
+    return (lane->front + lane->len) <= lane->max_len;
 }
 
 static
-void contract_queue(struct queue *queue, size_t new_max_len)
+void contract_lane(
+    struct queue *queue,
+    struct lane *lane,
+    size_t new_max_len)
 {
     size_t back;
     size_t count;
     size_t start;
 
-    XASSERT_LT(new_max_len, queue->max_len);
+    XASSERT_LT(new_max_len, lane->max_len);
 
     /* Trim the queue to match the new size. */
-    drain_until(queue, new_max_len);
+    drain_until(queue, lane, new_max_len);
 
     /*
      * Calculate how many records will "fall off the end" after contraction, and
@@ -143,7 +480,7 @@ void contract_queue(struct queue *queue, size_t new_max_len)
      * little, bit we have ASCII art depicting the queue before and after
      * truncation. The legend for the art is as follows:
      *
-     * |     indicates the start and end of queue->data
+     * |     indicates the start and end of lane->data
      * _     indicates empty space in the queue
      * -     indicates where we are truncating the queue
      * 1,2,3 indicate the queue items
@@ -151,10 +488,10 @@ void contract_queue(struct queue *queue, size_t new_max_len)
      * b     indicates the back position of the queue
      * -->   indicates how the queue will change after truncation
      */
-    back = (queue->front + queue->len) % queue->max_len;
-    if (is_contiguous(queue)) {
+    back = (lane->front + lane->len) % lane->max_len;
+    if (is_contiguous(lane)) {
         /* Queue data is contiguous. */
-        if (queue->front >= new_max_len) {
+        if (lane->front >= new_max_len) {
             /*
              * The entirety of the queue data needs to be moved, so front also
              * moves to the start of the array.
@@ -165,9 +502,9 @@ void contract_queue(struct queue *queue, size_t new_max_len)
              *  f  b
              * |123__|
              */
-            start = queue->front;
-            count = back - queue->front;
-            queue->front = 0;
+            start = lane->front;
+            count = back - lane->front;
+            lane->front = 0;
         }
         else if (back > new_max_len) {
             /*
@@ -201,7 +538,7 @@ void contract_queue(struct queue *queue, size_t new_max_len)
     }
     else {
         /* Queue data wraps around. */
-        if (queue->front >= new_max_len) {
+        if (lane->front >= new_max_len) {
             /*
              * The new queue will completely remove the records at the end of
              * the array. Move these records to the start, making the array
@@ -214,9 +551,9 @@ void contract_queue(struct queue *queue, size_t new_max_len)
              * |123__|
              *
              */
-            start = queue->front;
-            count = queue->max_len - queue->front;
-            queue->front = 0;
+            start = lane->front;
+            count = lane->max_len - lane->front;
+            lane->front = 0;
         }
         else {
             /*
@@ -232,7 +569,7 @@ void contract_queue(struct queue *queue, size_t new_max_len)
              *
              */
             start = new_max_len;
-            count = queue->len - new_max_len;
+            count = lane->len - new_max_len;
         }
 
         /*
@@ -241,9 +578,9 @@ void contract_queue(struct queue *queue, size_t new_max_len)
          * the array.
          */
         memmove(
-            queue->data + count,
-            queue->data,
-            back * sizeof(*queue->data));
+            lane->data + count,
+            lane->data,
+            back * sizeof(*lane->data));
     }
 
     /*
@@ -251,20 +588,20 @@ void contract_queue(struct queue *queue, size_t new_max_len)
      * we will naturally wrap around to them when we contract the queue.
      */
     memcpy(
-        queue->data,
-        queue->data + start,
-        count * sizeof(*queue->data));
+        lane->data,
+        lane->data + start,
+        count * sizeof(*lane->data));
 }
 
 static
-void expand_queue(struct queue *queue, size_t new_max_len)
+void expand_lane(struct lane *lane, size_t new_max_len)
 {
     size_t back;
     size_t diff;
 
-    XASSERT_GT(new_max_len, queue->len);
+    XASSERT_GT(new_max_len, lane->len);
 
-    if (is_contiguous(queue)) {
+    if (is_contiguous(lane)) {
         /*
          * See above for ASCI art legend.
          *
@@ -282,8 +619,8 @@ void expand_queue(struct queue *queue, size_t new_max_len)
      * The queue is not contiguous, so move the data that previously wrapped
      * around from the start of the array to the new array end.
      */
-    back = (queue->front + queue->len) % queue->max_len;
-    diff = new_max_len - queue->max_len;
+    back = (lane->front + lane->len) % lane->max_len;
+    diff = new_max_len - lane->max_len;
     if (back <= diff) {
         /*
          * We can fit all the data from the start of the array at the end of the
@@ -298,9 +635,9 @@ void expand_queue(struct queue *queue, size_t new_max_len)
          * |____123|
          */
         memcpy(
-            queue->data + queue->len,
-            queue->data,
-            back * sizeof(*queue->data));
+            lane->data + lane->len,
+            lane->data,
+            back * sizeof(*lane->data));
     }
     else {
         /*
@@ -317,53 +654,80 @@ void expand_queue(struct queue *queue, size_t new_max_len)
          * |3____12|
          */
         memcpy(
-            queue->data + queue->len,
-            queue->data,
-            diff * sizeof(*queue->data));
+            lane->data + lane->len,
+            lane->data,
+            diff * sizeof(*lane->data));
         memmove(
-            queue->data,
-            queue->data + diff,
-            (back - diff) * sizeof(*queue->data));
+            lane->data,
+            lane->data + diff,
+            (back - diff) * sizeof(*lane->data));
     }
 }
 
-hound_err queue_resize(struct queue *queue, size_t max_len, bool flush)
+hound_err queue_resize(
+    struct queue *queue,
+    size_t max_len,
+    size_t max_bytes,
+    bool flush)
 {
-    struct record_info **data;
+    struct slot *data;
     hound_err err;
+    size_t i;
+    struct lane *lane;
 
     XASSERT_NOT_NULL(queue);
 
+    lane = &queue->shared;
+
     lock_mutex(&queue->mutex);
 
     if (flush) {
         drain_nolock(queue);
+        if (queue->resample != NULL) {
+            resample_reset(queue->resample);
+        }
+        if (queue->join != NULL) {
+            join_reset(queue->join);
+        }
         /*
          * Reset the front pointer to make sure it's in bounds of the new
          * queue length.
          */
-        queue->front = 0;
+        lane->front = 0;
+        if (queue->policy != NULL) {
+            for (i = 0; i < queue->policy->lane_count; ++i) {
+                queue->policy->lanes[i].front = 0;
+            }
+        }
     }
-    else if (max_len < queue->max_len) {
-        contract_queue(queue, max_len);
+    else if (max_len < lane->max_len) {
+        contract_lane(queue, lane, max_len);
     }
 
-    if (max_len != queue->max_len) {
+    if (max_len != lane->max_len) {
         data = realloc(
-            queue->data,
+            lane->data,
             max_len * sizeof(*data));
         if (data == NULL) {
             err = HOUND_OOM;
             goto out;
         }
-        queue->data = data;
+        lane->data = data;
 
-        if (max_len > queue->max_len) {
-            expand_queue(queue, max_len);
+        if (max_len > lane->max_len) {
+            expand_lane(lane, max_len);
+            wake_producers(queue);
         }
     }
 
-    queue->max_len = max_len;
+    lane->max_len = max_len;
+
+    queue->max_bytes = max_bytes;
+    queue->bytes_full = false;
+    trim_bytes(queue);
+    wake_producers(queue);
+    update_event(queue);
+
     err = HOUND_OK;
 
 out:
@@ -371,97 +735,311 @@ out:
     return err;
 }
 
+static
+void free_policy(struct queue_policy *policy)
+{
+    size_t i;
+
+    for (i = 0; i < policy->lane_count; ++i) {
+        XASSERT_EQ(policy->lanes[i].len, 0);
+        free(policy->lanes[i].data);
+    }
+    free(policy->lanes);
+    free(policy->scratch);
+    xh_destroy(POLICY_MAP, policy->map);
+    free(policy);
+}
+
+void queue_policy_free(struct queue_policy *policy)
+{
+    XASSERT_NOT_NULL(policy);
+
+    free_policy(policy);
+}
+
+hound_err queue_policy_alloc(
+    struct queue *queue,
+    const struct hound_data_rq_list *rq_list,
+    struct queue_policy **out_policy)
+{
+    const struct hound_data_rq *data_rq;
+    hound_err err;
+    size_t i;
+    xhiter_t iter;
+    struct lane *lane;
+    size_t lane_count;
+    struct queue_policy *policy;
+    int ret;
+    struct id_policy *val;
+
+    XASSERT_NOT_NULL(queue);
+    XASSERT_NOT_NULL(rq_list);
+    XASSERT_NOT_NULL(out_policy);
+
+    policy = malloc(sizeof(*policy));
+    if (policy == NULL) {
+        err = HOUND_OOM;
+        goto error_alloc_policy;
+    }
+
+    policy->map = xh_init(POLICY_MAP);
+    if (policy->map == NULL) {
+        err = HOUND_OOM;
+        goto error_alloc_map;
+    }
+    policy->lane_count = 0;
+    policy->lanes = NULL;
+    policy->scratch_len = 0;
+    policy->scratch = NULL;
+
+    /*
+     * Data IDs requested more than once have the same settings in each request
+     * (validated by the caller), so we just take the first one we see.
+     */
+    lane_count = 0;
+    for (i = 0; i < rq_list->len; ++i) {
+        data_rq = &rq_list->data[i];
+        if (data_rq->overflow == HOUND_OVERFLOW_DROP_OLDEST &&
+            data_rq->lane_len == 0) {
+            continue;
+        }
+
+        iter = xh_put(POLICY_MAP, policy->map, data_rq->id, &ret);
+        if (ret == -1) {
+            err = HOUND_OOM;
+            goto error_put;
+        }
+        if (ret == 0) {
+            /* Already present. */
+            continue;
+        }
+
+        val = &xh_val(policy->map, iter);
+        val->overflow = data_rq->overflow;
+        val->timeout_ns = data_rq->block_timeout_ns;
+        if (data_rq->lane_len > 0) {
+            val->lane = lane_count;
+            ++lane_count;
+        }
+        else {
+            val->lane = SHARED_LANE;
+        }
+    }
+
+    policy->lanes = malloc(lane_count * sizeof(*policy->lanes));
+    if (policy->lanes == NULL && lane_count > 0) {
+        err = HOUND_OOM;
+        goto error_alloc_lanes;
+    }
+
+    for (i = 0; i < rq_list->len; ++i) {
+        data_rq = &rq_list->data[i];
+        iter = xh_get(POLICY_MAP, policy->map, data_rq->id);
+        if (iter == xh_end(policy->map)) {
+            continue;
+        }
+        val = &xh_val(policy->map, iter);
+        if (val->lane == SHARED_LANE || val->lane < policy->lane_count) {
+            /* No lane, or we already allocated it. */
+            continue;
+        }
+
+        XASSERT_EQ(val->lane, policy->lane_count);
+        lane = &policy->lanes[val->lane];
+        lane->data = malloc(data_rq->lane_len * sizeof(*lane->data));
+        if (lane->data == NULL) {
+            err = HOUND_OOM;
+            goto error_alloc_lane_data;
+        }
+        lane->max_len = data_rq->lane_len;
+        lane->len = 0;
+        lane->bytes = 0;
+        lane->front = 0;
+        ++policy->lane_count;
+    }
+
+    /*
+     * The caller holds the context lock, so the queue can't be resized before
+     * the policy is installed, and it can't hold more than its max length.
+     */
+    policy->scratch_len = queue_max_len(queue);
+    policy->scratch = malloc(policy->scratch_len * sizeof(*policy->scratch));
+    if (policy->scratch == NULL) {
+        err = HOUND_OOM;
+        goto error_alloc_scratch;
+    }
+
+    *out_policy = policy;
+
+    return HOUND_OK;
+
+error_alloc_scratch:
+error_alloc_lane_data:
+error_alloc_lanes:
+error_put:
+    /* free_policy cleans up only the lanes we finished allocating. */
+    free_policy(policy);
+    goto error_alloc_policy;
+error_alloc_map:
+    free(policy);
+error_alloc_policy:
+    return err;
+}
+
+void queue_set_policy(struct queue *queue, struct queue_policy *policy)
+{
+    size_t count;
+    size_t i;
+    struct lane *lane;
+    struct queue_policy *old;
+    const struct id_policy *policy_val;
+    struct slot *scratch;
+
+    XASSERT_NOT_NULL(queue);
+    XASSERT_NOT_NULL(policy);
+
+    lock_mutex(&queue->mutex);
+
+    /* Take everything out in push order... */
+    scratch = policy->scratch;
+    count = 0;
+    while (true) {
+        lane = next_lane(queue);
+        if (lane == NULL) {
+            break;
+        }
+        XASSERT_LT(count, policy->scratch_len);
+        scratch[count] = lane_pop(queue, lane);
+        ++count;
+    }
+
+    old = queue->policy;
+    queue->policy = policy;
+
+    /*
+     * ...and put it back in the new lanes. This keeps each lane sorted by
+     * sequence number. If a new lane is too small, its oldest records are
+     * dropped, just like when shrinking the queue.
+     */
+    for (i = 0; i < count; ++i) {
+        policy_val = get_policy(queue, scratch[i].rec->record.data_id);
+        lane = get_lane(queue, policy_val);
+        if (lane->len == lane->max_len) {
+            record_ref_dec(lane_pop(queue, lane).rec);
+        }
+        lane_push(queue, lane, scratch[i]);
+    }
+
+    wake_producers(queue);
+    update_event(queue);
+
+    unlock_mutex(&queue->mutex);
+
+    policy->scratch = NULL;
+    policy->scratch_len = 0;
+    free(scratch);
+    if (old != NULL) {
+        free_policy(old);
+    }
+}
+
 void queue_destroy(struct queue *queue)
 {
     XASSERT_NOT_NULL(queue);
 
     queue_drain(queue);
+    if (queue->resample != NULL) {
+        resample_destroy(queue->resample);
+    }
+    if (queue->join != NULL) {
+        join_destroy(queue->join);
+    }
+    if (queue->history != NULL) {
+        history_unref(queue->history);
+    }
+    if (queue->policy != NULL) {
+        free_policy(queue->policy);
+    }
     destroy_mutex(&queue->mutex);
+    destroy_cond(&queue->space_cond);
     destroy_cond(&queue->ready_cond);
-    free(queue->data);
+    if (queue->event_fd != -1) {
+        close(queue->event_fd);
+    }
+    free(queue->shared.data);
     free(queue);
 }
 
-void queue_interrupt(struct queue *queue)
+void queue_set_blocking(struct queue *queue, bool enable)
 {
+    XASSERT_NOT_NULL(queue);
+
     lock_mutex(&queue->mutex);
-    queue->interrupt = true;
-    cond_signal(&queue->ready_cond);
+    queue->blocking = enable;
+    if (!enable) {
+        wake_producers(queue);
+    }
     unlock_mutex(&queue->mutex);
 }
 
-static
-void pop_helper(
-    struct queue *queue,
-    struct record_info **buf,
-    hound_seqno *first_seqno,
-    size_t records)
+void queue_interrupt(struct queue *queue)
 {
-    size_t right_records;
-
-    XASSERT_LTE(records, queue->max_len);
-
-    right_records = queue->max_len - queue->front;
-    if (records < right_records) {
-        /* All records we need are between [front, back]. */
-        memcpy(buf, queue->data + queue->front, records * sizeof(*buf));
-        queue->front += records;
-    }
-    else {
-        /*
-         * Records wrap around, so we need records from both [front, end] and
-         * [start, back].
-         *
-         * Note that if records == right_records, then the second memcpy will be
-         * a no-op and the front pointer will be correctly wrapped.
-         */
-        memcpy(buf, queue->data + queue->front, right_records * sizeof(*buf));
-        memcpy(
-            buf + right_records,
-            queue->data,
-            (records - right_records) * sizeof(*buf));
-        queue->front = records - right_records;
-    }
-    queue->len -= records;
-    *first_seqno = queue->front_seqno;
-    queue->front_seqno += records;
+    lock_mutex(&queue->mutex);
+    queue->interrupt = true;
+    cond_signal(&queue->ready_cond);
+    unlock_mutex(&queue->mutex);
 }
 
+/**
+ * Pops records in order as long as their total size stays within the given
+ * number of bytes and they fit in the buffer.
+ */
 static
 size_t pop_bytes(
     struct queue *queue,
     struct record_info **buf,
+    size_t buf_len,
     size_t bytes,
-    hound_seqno *first_seqno,
+    hound_seqno *seqnos,
     size_t *out_records)
 {
-    size_t i;
-    size_t remainder;
+    struct lane *lane;
     size_t records;
+    size_t remainder;
     size_t size;
+    struct slot slot;
 
     records = 0;
     remainder = bytes;
-    i = queue->front;
-    while (true) {
-        if (records == queue->len) {
+    while (records < buf_len) {
+        lane = next_lane(queue);
+        if (lane == NULL) {
             break;
         }
 
-        size = queue->data[i]->record.size;
+        size = lane->data[lane->front].rec->record.size;
         if (remainder < size) {
             break;
         }
         remainder -= size;
 
+        slot = lane_pop(queue, lane);
+        HOUND_TRACE(
+            queue_pop,
+            slot.rec->record.data_id,
+            slot.rec->record.dev_id,
+            slot.seqno,
+            slot.rec->record.size);
+        buf[records] = slot.rec;
+        seqnos[records] = slot.seqno;
         ++records;
-        ++i;
-        if (i == queue->max_len) {
-            i = 0;
-        }
     }
 
-    pop_helper(queue, buf, first_seqno, records);
+    if (records > 0) {
+        queue->bytes_full = false;
+        wake_producers(queue);
+        update_event(queue);
+    }
     *out_records = records;
 
     return bytes - remainder;
@@ -471,52 +1049,496 @@ static
 size_t pop_records(
     struct queue *queue,
     struct record_info **buf,
-    hound_seqno *first_seqno,
+    hound_seqno *seqnos,
     size_t records)
 {
+    size_t i;
+    struct slot slot;
     size_t target;
 
     /* Clamp the number of items to pop at the queue length. */
     target = min(records, queue->len);
-    pop_helper(queue, buf, first_seqno, target);
+    for (i = 0; i < target; ++i) {
+        slot = lane_pop(queue, next_lane(queue));
+        HOUND_TRACE(
+            queue_pop,
+            slot.rec->record.data_id,
+            slot.rec->record.dev_id,
+            slot.seqno,
+            slot.rec->record.size);
+        buf[i] = slot.rec;
+        seqnos[i] = slot.seqno;
+    }
+
+    if (target > 0) {
+        queue->bytes_full = false;
+        wake_producers(queue);
+        update_event(queue);
+    }
 
     return target;
 }
 
+/* Drops the oldest record in the given lane to make room. */
+static
+void evict(struct queue *queue, struct lane *lane)
+{
+    struct slot slot;
+
+    slot = lane_pop(queue, lane);
+    HOUND_TRACE(
+        queue_overflow,
+        slot.rec->record.data_id,
+        slot.rec->record.dev_id,
+        slot.seqno,
+        slot.rec->record.size,
+        HOUND_OVERFLOW_DROP_OLDEST);
+    record_ref_dec(slot.rec);
+}
+
+/**
+ * Returns true if a record of the given size fits in the queue's byte limit,
+ * and sets *can_evict to whether it would fit after dropping every record in
+ * the given lane.
+ */
+static
+bool fits_bytes(
+    const struct queue *queue,
+    const struct lane *lane,
+    size_t bytes,
+    bool *can_evict)
+{
+    if (queue->max_bytes == 0) {
+        *can_evict = true;
+        return true;
+    }
+
+    *can_evict = queue->bytes - lane->bytes + bytes <= queue->max_bytes;
+
+    return queue->bytes + bytes <= queue->max_bytes;
+}
+
+/**
+ * Pushes a record into the queue, returning the record if it was dropped
+ * instead, in which case the caller must drop its reference. Returns NULL if
+ * the record was queued. Records evicted to make room for it are freed here.
+ *
+ * Records evicted for lack of space are always taken from the same lane as the
+ * new record, so data with its own lane never evicts other data. If evicting
+ * the whole lane wouldn't make enough room under the byte limit, the new record
+ * is dropped instead.
+ *
+ * If may_block is false, HOUND_OVERFLOW_BLOCK acts like
+ * HOUND_OVERFLOW_DROP_NEWEST.
+ */
+static
+struct record_info *push_nolock(
+    struct queue *queue,
+    struct record_info *rec,
+    bool may_block)
+{
+    size_t bytes;
+    bool can_evict;
+    struct timespec deadline;
+    bool fits;
+    bool have_deadline;
+    struct lane *lane;
+    hound_overflow_policy overflow;
+    const struct id_policy *policy;
+    struct slot slot;
+    bool timed_out;
+
+    bytes = record_bytes(rec);
+    have_deadline = false;
+    timed_out = false;
+    while (true) {
+        /*
+         * Look up the policy each time around, since it may be replaced while
+         * we wait.
+         */
+        policy = get_policy(queue, rec->record.data_id);
+        lane = get_lane(queue, policy);
+        fits = fits_bytes(queue, lane, bytes, &can_evict);
+        if (lane->len < lane->max_len && fits) {
+            break;
+        }
+
+        /*
+         * Let readers waiting for more records know they won't come. A record
+         * bigger than the whole byte limit never fits, so it says nothing about
+         * how full the queue is.
+         */
+        if (!fits && bytes <= queue->max_bytes) {
+            queue->bytes_full = true;
+            cond_signal(&queue->ready_cond);
+        }
+
+        if (policy == NULL) {
+            overflow = HOUND_OVERFLOW_DROP_OLDEST;
+        }
+        else {
+            overflow = policy->overflow;
+        }
+
+        if (overflow == HOUND_OVERFLOW_BLOCK) {
+            if (!may_block ||
+                !queue->blocking ||
+                timed_out ||
+                (queue->max_bytes != 0 && bytes > queue->max_bytes)) {
+                /* We can't wait, or waiting wouldn't help. */
+                overflow = HOUND_OVERFLOW_DROP_NEWEST;
+            }
+            else {
+                if (!have_deadline) {
+                    get_deadline(policy->timeout_ns, &deadline);
+                    have_deadline = true;
+                }
+                /* Let an event loop know it needs to make room. */
+                update_event(queue);
+                HOUND_TRACE(
+                    queue_block,
+                    rec->record.data_id,
+                    rec->record.dev_id,
+                    queue->len);
+                ++queue->blocked;
+                timed_out = !cond_timedwait(
+                    &queue->space_cond,
+                    &queue->mutex,
+                    &deadline);
+                --queue->blocked;
+                continue;
+            }
+        }
+
+        if (overflow == HOUND_OVERFLOW_DROP_OLDEST && !can_evict) {
+            overflow = HOUND_OVERFLOW_DROP_NEWEST;
+        }
+
+        if (overflow == HOUND_OVERFLOW_DROP_NEWEST) {
+            /*
+             * Burn a sequence number anyway, so readers can see that a record
+             * was dropped.
+             */
+            HOUND_TRACE(
+                queue_overflow,
+                rec->record.data_id,
+                rec->record.dev_id,
+                queue->next_seqno,
+                rec->record.size,
+                overflow);
+            ++queue->next_seqno;
+            return rec;
+        }
+
+        /* Drop the oldest records in the lane until we have room. */
+        XASSERT_EQ(overflow, HOUND_OVERFLOW_DROP_OLDEST);
+        if (lane->len == lane->max_len) {
+            evict(queue, lane);
+        }
+        while (!fits_bytes(queue, lane, bytes, &can_evict)) {
+            evict(queue, lane);
+        }
+        break;
+    }
+
+    slot.rec = rec;
+    slot.seqno = queue->next_seqno;
+    ++queue->next_seqno;
+    lane_push(queue, lane, slot);
+    HOUND_TRACE(
+        queue_push,
+        rec->record.data_id,
+        rec->record.dev_id,
+        slot.seqno,
+        rec->record.size,
+        queue->len);
+
+    if (queue->history != NULL) {
+        history_push(queue->history, rec, slot.seqno);
+    }
+
+    cond_signal(&queue->ready_cond);
+
+    return NULL;
+}
+
+static
+void push_joined(struct record_info *rec, void *data)
+{
+    struct record_info *dropped;
+    struct queue *queue;
+
+    /*
+     * We're called from within the join stage, so we must not drop the queue
+     * lock by blocking.
+     */
+    queue = data;
+    dropped = push_nolock(queue, rec, false);
+    if (dropped != NULL) {
+        record_ref_dec(dropped);
+    }
+}
+
+static
+void push_resampled(struct record_info *rec, void *data)
+{
+    struct queue *queue;
+
+    /* Resampled records go through the join stage like any other record. */
+    queue = data;
+    if (queue->join != NULL &&
+        join_push(queue->join, rec, push_joined, queue)) {
+        return;
+    }
+    push_joined(rec, queue);
+}
 
 void queue_push(struct queue *queue, struct record_info *rec)
 {
-    size_t back;
-    struct record_info *tmp;
+    struct record_info *dropped;
 
     XASSERT_NOT_NULL(queue);
     XASSERT_NOT_NULL(rec);
 
     lock_mutex(&queue->mutex);
-    back = (queue->front + queue->len) % queue->max_len;
-    if (queue->len < queue->max_len) {
-        ++queue->len;
-        tmp = NULL;
+    if (queue->resample != NULL &&
+        resample_push(queue->resample, rec, push_resampled, queue)) {
+        /* The resampling stage now owns the record. */
+        dropped = NULL;
+    }
+    else if (queue->join != NULL &&
+             join_push(queue->join, rec, push_joined, queue)) {
+        /* The join stage now owns the record. */
+        dropped = NULL;
     }
     else {
-        /*
-         * Overflow. Increment front so we remove the oldest entry, preserving
-         * our max queue length.
-         */
-        XASSERT_EQ(queue->len, queue->max_len);
-        XASSERT_EQ(queue->front, back);
-        tmp = queue->data[queue->front];
-        queue->front = (queue->front + 1) % queue->max_len;
-        ++queue->front_seqno;
+        dropped = push_nolock(queue, rec, true);
     }
+    update_event(queue);
+    unlock_mutex(&queue->mutex);
 
-    queue->data[back] = rec;
+    if (dropped != NULL) {
+        record_ref_dec(dropped);
+    }
+}
 
-    cond_signal(&queue->ready_cond);
+void queue_set_join(struct queue *queue, struct join *join)
+{
+    struct join *old;
+
+    XASSERT_NOT_NULL(queue);
+
+    lock_mutex(&queue->mutex);
+    old = queue->join;
+    queue->join = join;
     unlock_mutex(&queue->mutex);
 
-    if (tmp != NULL) {
-        record_ref_dec(tmp);
+    if (old != NULL) {
+        join_destroy(old);
+    }
+}
+
+void queue_set_resample(struct queue *queue, struct resample *resample)
+{
+    struct resample *old;
+
+    XASSERT_NOT_NULL(queue);
+
+    lock_mutex(&queue->mutex);
+    old = queue->resample;
+    queue->resample = resample;
+    unlock_mutex(&queue->mutex);
+
+    if (old != NULL) {
+        resample_destroy(old);
+    }
+}
+
+void queue_resample_stats(
+    struct queue *queue,
+    struct hound_resample_stats *stats)
+{
+    XASSERT_NOT_NULL(queue);
+    XASSERT_NOT_NULL(stats);
+
+    lock_mutex(&queue->mutex);
+    if (queue->resample != NULL) {
+        resample_get_stats(queue->resample, stats);
+    }
+    else {
+        memset(stats, 0, sizeof(*stats));
+    }
+    unlock_mutex(&queue->mutex);
+}
+
+void queue_join_stats(struct queue *queue, struct hound_join_stats *stats)
+{
+    XASSERT_NOT_NULL(queue);
+    XASSERT_NOT_NULL(stats);
+
+    lock_mutex(&queue->mutex);
+    if (queue->join != NULL) {
+        join_get_stats(queue->join, stats);
+    }
+    else {
+        memset(stats, 0, sizeof(*stats));
+    }
+    unlock_mutex(&queue->mutex);
+}
+
+hound_err queue_set_retention(
+    struct queue *queue,
+    size_t max_len,
+    hound_data_period max_age)
+{
+    hound_err err;
+    struct history *history;
+
+    XASSERT_NOT_NULL(queue);
+
+    lock_mutex(&queue->mutex);
+    if (max_len == 0) {
+        /* Turn off retention. */
+        history = queue->history;
+        queue->history = NULL;
+        err = HOUND_OK;
+    }
+    else if (queue->history == NULL) {
+        err = history_alloc(max_len, max_age, &queue->history);
+        history = NULL;
+    }
+    else {
+        err = history_set_limits(queue->history, max_len, max_age);
+        history = NULL;
+    }
+    unlock_mutex(&queue->mutex);
+
+    if (history != NULL) {
+        history_unref(history);
+    }
+
+    return err;
+}
+
+hound_err queue_query_range(
+    struct queue *queue,
+    const struct timespec *start,
+    const struct timespec *end,
+    hound_cb cb,
+    void *cb_ctx,
+    size_t *count)
+{
+    struct history *history;
+
+    XASSERT_NOT_NULL(queue);
+
+    lock_mutex(&queue->mutex);
+    history = queue->history;
+    if (history != NULL) {
+        history_ref(history);
+    }
+    unlock_mutex(&queue->mutex);
+
+    if (history == NULL) {
+        return HOUND_RETENTION_DISABLED;
+    }
+
+    /* Run the query without the queue lock so we don't block producers. */
+    *count = history_query(history, start, end, cb, cb_ctx);
+    history_unref(history);
+
+    return HOUND_OK;
+}
+
+void queue_count_filtered(struct queue *queue, bool passed)
+{
+    XASSERT_NOT_NULL(queue);
+
+    if (passed) {
+        atomic_fetch_add_explicit(
+            &queue->filter_passed,
+            1,
+            memory_order_relaxed);
+    }
+    else {
+        atomic_fetch_add_explicit(
+            &queue->filter_suppressed,
+            1,
+            memory_order_relaxed);
+    }
+}
+
+void queue_filter_stats(struct queue *queue, struct hound_filter_stats *stats)
+{
+    XASSERT_NOT_NULL(queue);
+    XASSERT_NOT_NULL(stats);
+
+    stats->passed = atomic_load(&queue->filter_passed);
+    stats->suppressed = atomic_load(&queue->filter_suppressed);
+}
+
+void queue_set_spin(struct queue *queue, hound_data_period spin_ns)
+{
+    XASSERT_NOT_NULL(queue);
+
+    atomic_store(&queue->spin_ns, spin_ns);
+    atomic_store(&queue->spin_idle, false);
+}
+
+/**
+ * Spins until the queue holds at least the given number of records, or until
+ * the spin budget runs out. After a spin comes up empty, readers go straight to
+ * sleep until a sleep turns out shorter than the spin budget, so a context
+ * whose data is slow doesn't keep burning CPU.
+ */
+static
+void spin_for_records(struct queue *queue, size_t records)
+{
+    hound_data_period deadline;
+    size_t i;
+    hound_data_period spin_ns;
+
+    spin_ns = atomic_load_explicit(&queue->spin_ns, memory_order_relaxed);
+    if (spin_ns == 0 ||
+        atomic_load_explicit(&queue->spin_idle, memory_order_relaxed)) {
+        return;
+    }
+
+    deadline = monotonic_ns() + spin_ns;
+    do {
+        for (i = 0; i < SPIN_CHECK_INTERVAL; ++i) {
+            if (atomic_load_explicit(
+                    &queue->ready_len,
+                    memory_order_acquire) >= records) {
+                return;
+            }
+            cpu_relax();
+        }
+    } while (monotonic_ns() < deadline);
+
+    atomic_store_explicit(&queue->spin_idle, true, memory_order_relaxed);
+}
+
+/*
+ * Waits for records, and turns spinning back on if they came sooner than the
+ * spin budget. Must be called with the queue lock held.
+ */
+static
+void wait_for_records(struct queue *queue)
+{
+    hound_data_period spin_ns;
+    hound_data_period start;
+
+    spin_ns = atomic_load_explicit(&queue->spin_ns, memory_order_relaxed);
+    if (spin_ns == 0) {
+        cond_wait(&queue->ready_cond, &queue->mutex);
+        return;
+    }
+
+    start = monotonic_ns();
+    cond_wait(&queue->ready_cond, &queue->mutex);
+    if (monotonic_ns() - start < spin_ns) {
+        atomic_store_explicit(&queue->spin_idle, false, memory_order_relaxed);
     }
 }
 
@@ -524,26 +1546,34 @@ size_t queue_pop_records(
     struct queue *queue,
     struct record_info **buf,
     size_t records,
-    hound_seqno *first_seqno,
+    hound_seqno *seqnos,
     bool *interrupt)
 {
     size_t count;
-    hound_seqno *seqno;
-    hound_seqno tmp;
+    size_t popped;
 
     XASSERT_NOT_NULL(queue);
     XASSERT_NOT_NULL(buf);
+    XASSERT_NOT_NULL(seqnos);
 
     count = 0;
     *interrupt = false;
+    spin_for_records(queue, records);
     lock_mutex(&queue->mutex);
     do {
         /* TODO: Possible optimization: wake up only when n records/bytes are
          * ready, rather than when 1 is ready. Probably would need to use a heap
          * structure for this, to always wait for the smallest next wakeup
          * target. */
-        while (queue->len < records && !queue->interrupt) {
-            cond_wait(&queue->ready_cond, &queue->mutex);
+        /*
+         * If a lane or the byte limit fills up, more records will only cause
+         * drops, so take what we have rather than waiting for records that may
+         * never come.
+         */
+        while (queue->len < records - count &&
+               !queue->interrupt &&
+               !is_full(queue)) {
+            wait_for_records(queue);
         }
         if (queue->interrupt) {
             *interrupt = true;
@@ -551,19 +1581,20 @@ size_t queue_pop_records(
             break;
         }
 
+        popped = pop_records(
+            queue,
+            buf + count,
+            seqnos + count,
+            records - count);
+        count += popped;
+
         /*
-         * We want to return the first sequence number for the entire buffer, so
-         * if we call pop_records more than once, just throw away the later
-         * values.
+         * If the queue is full but gave us nothing, waiting wouldn't change
+         * that, so return rather than spin with the lock held.
          */
-        if (count == 0) {
-            seqno = first_seqno;
-        }
-        else {
-            seqno = &tmp;
+        if (popped == 0 && is_full(queue)) {
+            break;
         }
-
-        count += pop_records(queue, buf + count, seqno, records - count);
     } while (count < records);
 
     unlock_mutex(&queue->mutex);
@@ -571,11 +1602,91 @@ size_t queue_pop_records(
     return count;
 }
 
+size_t queue_pop_bytes(
+    struct queue *queue,
+    struct record_info **buf,
+    size_t buf_len,
+    size_t bytes,
+    const struct timespec *deadline,
+    hound_seqno *seqnos,
+    size_t *out_records,
+    hound_err *err)
+{
+    size_t count;
+    size_t records;
+    bool timed_out;
+
+    XASSERT_NOT_NULL(queue);
+    XASSERT_NOT_NULL(buf);
+    XASSERT_NOT_NULL(seqnos);
+    XASSERT_NOT_NULL(out_records);
+    XASSERT_NOT_NULL(err);
+
+    count = 0;
+    *out_records = 0;
+    *err = HOUND_OK;
+    timed_out = false;
+    lock_mutex(&queue->mutex);
+    while (count < bytes && *out_records < buf_len) {
+        /*
+         * Wait until enough bytes are queued to finish the read. As with
+         * queue_pop_records, take what we have if the queue fills up first.
+         */
+        while (queue->payload < bytes - count &&
+               !queue->interrupt &&
+               !is_full(queue) &&
+               !timed_out) {
+            if (deadline == NULL) {
+                cond_wait(&queue->ready_cond, &queue->mutex);
+            }
+            else {
+                timed_out = !cond_timedwait(
+                    &queue->ready_cond,
+                    &queue->mutex,
+                    deadline);
+            }
+        }
+        if (queue->interrupt) {
+            queue->interrupt = false;
+            *err = HOUND_CTX_STOPPED;
+            break;
+        }
+
+        count += pop_bytes(
+            queue,
+            buf + *out_records,
+            buf_len - *out_records,
+            bytes - count,
+            seqnos + *out_records,
+            &records);
+        *out_records += records;
+
+        if (queue->len > 0 && *out_records < buf_len) {
+            /* The next record doesn't fit, so we're done. */
+            break;
+        }
+        if (records == 0 && is_full(queue)) {
+            /* As in queue_pop_records, don't spin on a full queue. */
+            break;
+        }
+        if (timed_out) {
+            if (count < bytes) {
+                *err = HOUND_TIMEOUT;
+            }
+            break;
+        }
+    }
+    unlock_mutex(&queue->mutex);
+
+    return count;
+}
+
 size_t queue_pop_bytes_nowait(
     struct queue *queue,
     struct record_info **buf,
+    size_t buf_len,
     size_t bytes,
-    hound_seqno *first_seqno,
+    hound_seqno *seqnos,
     size_t *records)
 {
     size_t count;
@@ -585,7 +1696,7 @@ size_t queue_pop_bytes_nowait(
     XASSERT_NOT_NULL(records);
 
     lock_mutex(&queue->mutex);
-    count = pop_bytes(queue, buf, bytes, first_seqno, records);
+    count = pop_bytes(queue, buf, buf_len, bytes, seqnos, records);
     unlock_mutex(&queue->mutex);
 
     return count;
@@ -594,7 +1705,7 @@ size_t queue_pop_bytes_nowait(
 size_t queue_pop_records_nowait(
     struct queue *queue,
     struct record_info **buf,
-    hound_seqno *first_seqno,
+    hound_seqno *seqnos,
     size_t records)
 {
     size_t count;
@@ -603,7 +1714,7 @@ size_t queue_pop_records_nowait(
     XASSERT_NOT_NULL(buf);
 
     lock_mutex(&queue->mutex);
-    count = pop_records(queue, buf, first_seqno, records);
+    count = pop_records(queue, buf, seqnos, records);
     unlock_mutex(&queue->mutex);
 
     return count;
@@ -632,14 +1743,87 @@ size_t queue_len(struct queue *queue)
 }
 
 size_t queue_max_len(struct queue *queue)
+{
+    size_t i;
+    size_t len;
+
+    XASSERT_NOT_NULL(queue);
+
+    lock_mutex(&queue->mutex);
+    len = queue->shared.max_len;
+    if (queue->policy != NULL) {
+        for (i = 0; i < queue->policy->lane_count; ++i) {
+            len += queue->policy->lanes[i].max_len;
+        }
+    }
+    unlock_mutex(&queue->mutex);
+
+    return len;
+}
+
+size_t queue_shared_max_len(struct queue *queue)
 {
     size_t len;
 
     XASSERT_NOT_NULL(queue);
 
     lock_mutex(&queue->mutex);
-    len = queue->max_len;
+    len = queue->shared.max_len;
     unlock_mutex(&queue->mutex);
 
     return len;
 }
+
+size_t queue_bytes(struct queue *queue)
+{
+    size_t bytes;
+
+    XASSERT_NOT_NULL(queue);
+
+    lock_mutex(&queue->mutex);
+    bytes = queue->bytes;
+    unlock_mutex(&queue->mutex);
+
+    return bytes;
+}
+
+size_t queue_max_bytes(struct queue *queue)
+{
+    size_t bytes;
+
+    XASSERT_NOT_NULL(queue);
+
+    lock_mutex(&queue->mutex);
+    bytes = queue->max_bytes;
+    unlock_mutex(&queue->mutex);
+
+    return bytes;
+}
+
+hound_err queue_get_fd(struct queue *queue, size_t watermark, int *fd)
+{
+    hound_err err;
+
+    XASSERT_NOT_NULL(queue);
+    XASSERT_GT(watermark, 0);
+    XASSERT_NOT_NULL(fd);
+
+    lock_mutex(&queue->mutex);
+    if (queue->event_fd == -1) {
+        queue->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (queue->event_fd == -1) {
+            hound_log_err_nofmt(errno, "failed to create queue eventfd");
+            err = HOUND_IO_ERROR;
+            goto out;
+        }
+        queue->event_ready = false;
+    }
+    queue->watermark = watermark;
+    update_event(queue);
+    *fd = queue->event_fd;
+    err = HOUND_OK;
+
+out:
+    unlock_mutex(&queue->mutex);
+    return err;
+}
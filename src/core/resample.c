@@ -0,0 +1,410 @@
+/**
+ * @file      resample.c
+ * @brief     Fixed-timeline resampling stage. The resampling stage turns the
+ *            samples of a set of data IDs into records at every multiple of a
+ *            fixed period, either holding the last sample or interpolating the
+ *            numeric fields of the samples on either side of each tick. Each
+ *            data ID is resampled on its own. It is owned by a queue and always
+ *            runs with the queue lock held.
+ * @author    Martin Kelly <mkelly@xevo.com>
+ * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
+ */
+
+#include <hound-private/decode.h>
+#include <hound-private/driver.h>
+#include <hound-private/error.h>
+#include <hound-private/log.h>
+#include <hound-private/queue.h>
+#include <hound-private/resample.h>
+#include <hound-private/util.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct resample_member {
+    hound_data_id id;
+
+    /* NULL unless the policy interpolates. */
+    struct hound_decoder *decoder;
+
+    /* The last sample, or NULL if there isn't one yet. */
+    struct record_info *prev;
+    hound_data_period prev_ts;
+    bool prev_decoded;
+    double *prev_values;
+
+    /* Space to decode the current sample and interpolate into. */
+    double *values;
+    double *out;
+
+    /* The first tick that hasn't been emitted or skipped yet. */
+    hound_data_period next_tick;
+};
+
+struct resample {
+    hound_data_period period;
+    hound_resample_policy policy;
+    hound_data_period max_gap;
+    size_t member_count;
+    struct resample_member *members;
+    struct hound_resample_stats stats;
+};
+
+static
+hound_data_period get_ts(const struct record_info *rec)
+{
+    return NSEC_PER_SEC*rec->record.timestamp.tv_sec +
+        rec->record.timestamp.tv_nsec;
+}
+
+static
+void free_member(struct resample_member *member)
+{
+    free(member->out);
+    free(member->values);
+    free(member->prev_values);
+    if (member->decoder != NULL) {
+        decoder_free(member->decoder);
+    }
+}
+
+static
+hound_err init_member(
+    struct resample_member *member,
+    hound_data_id id,
+    hound_resample_policy policy)
+{
+    hound_err err;
+    size_t field_count;
+
+    member->id = id;
+    member->decoder = NULL;
+    member->prev = NULL;
+    member->prev_ts = 0;
+    member->prev_decoded = false;
+    member->prev_values = NULL;
+    member->values = NULL;
+    member->out = NULL;
+    member->next_tick = 0;
+
+    if (policy != HOUND_RESAMPLE_LINEAR) {
+        return HOUND_OK;
+    }
+
+    /*
+     * The stage gets its own decoder rather than borrowing the driver's, since
+     * the driver may be destroyed while the stage still exists.
+     */
+    err = driver_alloc_decoder(id, &member->decoder);
+    if (err != HOUND_OK) {
+        goto error;
+    }
+
+    field_count = decoder_field_count(member->decoder);
+    if (field_count == 0) {
+        return HOUND_OK;
+    }
+
+    /* Zeroed so that fields we never decode are never garbage. */
+    member->prev_values = calloc(field_count, sizeof(*member->prev_values));
+    member->values = calloc(field_count, sizeof(*member->values));
+    member->out = calloc(field_count, sizeof(*member->out));
+    if (member->prev_values == NULL ||
+        member->values == NULL ||
+        member->out == NULL) {
+        err = HOUND_OOM;
+        goto error;
+    }
+
+    return HOUND_OK;
+
+error:
+    free_member(member);
+    return err;
+}
+
+hound_err resample_alloc(
+    const struct hound_resample_rq *rq,
+    struct resample **out_resample)
+{
+    struct driver *drv;
+    hound_err err;
+    size_t i;
+    size_t j;
+    struct resample *resample;
+
+    NULL_CHECK(rq);
+    NULL_CHECK(out_resample);
+    NULL_CHECK(rq->ids);
+
+    if (rq->len == 0 ||
+        rq->period_ns == 0 ||
+        rq->max_gap_ns < rq->period_ns) {
+        return HOUND_INVALID_VAL;
+    }
+
+    if (rq->policy != HOUND_RESAMPLE_LINEAR &&
+        rq->policy != HOUND_RESAMPLE_HOLD) {
+        return HOUND_INVALID_VAL;
+    }
+
+    for (i = 0; i < rq->len; ++i) {
+        err = driver_get(rq->ids[i], &drv);
+        if (err != HOUND_OK) {
+            return err;
+        }
+
+        for (j = 0; j < i; ++j) {
+            if (rq->ids[i] == rq->ids[j]) {
+                return HOUND_DUPLICATE_DATA_REQUESTED;
+            }
+        }
+    }
+
+    resample = malloc(sizeof(*resample));
+    if (resample == NULL) {
+        err = HOUND_OOM;
+        goto error_alloc_resample;
+    }
+
+    resample->members = malloc(rq->len * sizeof(*resample->members));
+    if (resample->members == NULL) {
+        err = HOUND_OOM;
+        goto error_alloc_members;
+    }
+
+    for (i = 0; i < rq->len; ++i) {
+        err = init_member(&resample->members[i], rq->ids[i], rq->policy);
+        if (err != HOUND_OK) {
+            goto error_init_member;
+        }
+    }
+
+    resample->period = rq->period_ns;
+    resample->policy = rq->policy;
+    resample->max_gap = rq->max_gap_ns;
+    resample->member_count = rq->len;
+    memset(&resample->stats, 0, sizeof(resample->stats));
+
+    *out_resample = resample;
+
+    return HOUND_OK;
+
+error_init_member:
+    for (j = 0; j < i; ++j) {
+        free_member(&resample->members[j]);
+    }
+    free(resample->members);
+error_alloc_members:
+    free(resample);
+error_alloc_resample:
+    return err;
+}
+
+static
+void clear_member(struct resample_member *member)
+{
+    if (member->prev != NULL) {
+        record_ref_dec(member->prev);
+        member->prev = NULL;
+    }
+    member->prev_decoded = false;
+}
+
+void resample_reset(struct resample *resample)
+{
+    size_t i;
+
+    XASSERT_NOT_NULL(resample);
+
+    for (i = 0; i < resample->member_count; ++i) {
+        clear_member(&resample->members[i]);
+    }
+}
+
+void resample_destroy(struct resample *resample)
+{
+    size_t i;
+
+    XASSERT_NOT_NULL(resample);
+
+    resample_reset(resample);
+    for (i = 0; i < resample->member_count; ++i) {
+        free_member(&resample->members[i]);
+    }
+    free(resample->members);
+    free(resample);
+}
+
+static
+void emit_sample(
+    struct resample *resample,
+    struct record_info *rec,
+    resample_emit_cb emit,
+    void *data)
+{
+    /* Records are never modified once made, so a sample on a tick is reused. */
+    atomic_ref_inc(&rec->refcount);
+
+    ++resample->stats.emitted;
+    emit(rec, data);
+}
+
+static
+void emit_tick(
+    struct resample *resample,
+    struct resample_member *member,
+    hound_data_period tick,
+    hound_data_period ts,
+    bool decoded,
+    resample_emit_cb emit,
+    void *data)
+{
+    double frac;
+    size_t i;
+    size_t field_count;
+    const struct hound_record *prev;
+    struct record_info *rec;
+
+    prev = &member->prev->record;
+
+    rec = drv_alloc(sizeof(*rec));
+    if (rec == NULL) {
+        hound_log_err_limited_nofmt(
+            HOUND_OOM,
+            "Failed to allocate a resampled record");
+        return;
+    }
+
+    rec->record.data = drv_alloc(prev->size);
+    if (rec->record.data == NULL && prev->size > 0) {
+        hound_log_err_limited_nofmt(
+            HOUND_OOM,
+            "Failed to allocate resampled record data");
+        drv_free(rec);
+        return;
+    }
+
+    /* Start from the earlier sample, which is all a hold needs. */
+    if (prev->size > 0) {
+        memcpy(rec->record.data, prev->data, prev->size);
+    }
+    rec->record.data_id = prev->data_id;
+    rec->record.dev_id = prev->dev_id;
+    rec->record.timestamp.tv_sec = tick / NSEC_PER_SEC;
+    rec->record.timestamp.tv_nsec = tick % NSEC_PER_SEC;
+    rec->record.size = prev->size;
+    rec->chunk = NULL;
+    atomic_ref_init(&rec->refcount, 1);
+
+    /* If either sample can't be decoded, fall back to holding. */
+    if (member->decoder != NULL && member->prev_decoded && decoded) {
+        frac = (double) (tick - member->prev_ts) / (ts - member->prev_ts);
+        field_count = decoder_field_count(member->decoder);
+        for (i = 0; i < field_count; ++i) {
+            member->out[i] = member->prev_values[i] +
+                frac*(member->values[i] - member->prev_values[i]);
+        }
+        decoder_encode_record(member->decoder, member->out, &rec->record);
+    }
+
+    ++resample->stats.emitted;
+    emit(rec, data);
+}
+
+bool resample_push(
+    struct resample *resample,
+    struct record_info *rec,
+    resample_emit_cb emit,
+    void *data)
+{
+    hound_data_period count;
+    bool decoded;
+    size_t i;
+    struct resample_member *member;
+    hound_data_period period;
+    double *tmp;
+    hound_data_period ts;
+
+    XASSERT_NOT_NULL(resample);
+    XASSERT_NOT_NULL(rec);
+    XASSERT_NOT_NULL(emit);
+
+    for (i = 0; i < resample->member_count; ++i) {
+        if (resample->members[i].id == rec->record.data_id) {
+            break;
+        }
+    }
+    if (i == resample->member_count) {
+        return false;
+    }
+    member = &resample->members[i];
+    period = resample->period;
+    ts = get_ts(rec);
+
+    if (member->prev == NULL) {
+        /* There's nothing to interpolate from, so start at the next tick. */
+        member->next_tick = (ts + period - 1) / period * period;
+    }
+    else if (ts <= member->prev_ts) {
+        ++resample->stats.late_samples;
+        record_ref_dec(rec);
+        return true;
+    }
+    else if (ts - member->prev_ts > resample->max_gap) {
+        /* Skip the ticks inside the gap, but not one that lands on ts. */
+        if (member->next_tick < ts) {
+            count = (ts - member->next_tick - 1) / period + 1;
+            resample->stats.skipped_ticks += count;
+            member->next_tick += count*period;
+        }
+    }
+
+    decoded = false;
+    if (member->decoder != NULL) {
+        decoded = decoder_decode_record(
+            member->decoder,
+            &rec->record,
+            member->values);
+    }
+
+    for (; member->next_tick <= ts; member->next_tick += period) {
+        if (member->next_tick == ts) {
+            emit_sample(resample, rec, emit, data);
+        }
+        else {
+            emit_tick(
+                resample,
+                member,
+                member->next_tick,
+                ts,
+                decoded,
+                emit,
+                data);
+        }
+    }
+
+    /* The sample is the new baseline. */
+    if (member->prev != NULL) {
+        record_ref_dec(member->prev);
+    }
+    member->prev = rec;
+    member->prev_ts = ts;
+    if (decoded) {
+        tmp = member->prev_values;
+        member->prev_values = member->values;
+        member->values = tmp;
+    }
+    member->prev_decoded = decoded;
+
+    return true;
+}
+
+void resample_get_stats(
+    const struct resample *resample,
+    struct hound_resample_stats *stats)
+{
+    XASSERT_NOT_NULL(resample);
+    XASSERT_NOT_NULL(stats);
+
+    *stats = resample->stats;
+}
@@ -0,0 +1,271 @@
+/**
+ * @file      rt.c
+ * @brief     Real-time settings for hound's threads and memory. Threads that
+ *            should follow the settings register themselves here, and
+ *            rt_set applies the scheduling policy and CPU affinity to each of
+ *            them, locks memory, and fills the read pools.
+ * @author    Martin Kelly <mkelly@xevo.com>
+ * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
+ */
+
+#define _GNU_SOURCE
+#include <hound/hound.h>
+#include <hound-private/driver.h>
+#include <hound-private/error.h>
+#include <hound-private/log.h>
+#include <hound-private/rt.h>
+#include <hound-private/util.h>
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <sys/mman.h>
+
+/* glibc's defaults, documented in mallopt(3). */
+#define DEFAULT_TRIM_THRESHOLD (128*1024)
+#define DEFAULT_MMAP_MAX 65536
+
+static pthread_mutex_t s_rt_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* s_rt_mutex protects everything here except s_pool_chunks. */
+static struct rt_thread *s_threads;
+
+/* The SCHED_FIFO priority, or 0 for the default scheduler. */
+static int s_priority;
+
+/* The CPUs our threads run on, and the ones they ran on when we were loaded. */
+static cpu_set_t s_cpus;
+static cpu_set_t s_default_cpus;
+
+static bool s_memory_locked;
+
+/* Read by the driver core while holding driver locks, so it has no lock. */
+static atomic_size_t s_pool_chunks;
+
+static
+bool rt_enabled(void)
+{
+    return s_priority > 0 || !CPU_EQUAL(&s_cpus, &s_default_cpus);
+}
+
+static
+void apply_thread(pthread_t thread, bool *sched_ok, bool *affinity_ok)
+{
+    int err;
+    struct sched_param param;
+    int policy;
+
+    if (s_priority > 0) {
+        policy = SCHED_FIFO;
+    }
+    else {
+        policy = SCHED_OTHER;
+    }
+    param.sched_priority = s_priority;
+    err = pthread_setschedparam(thread, policy, &param);
+    if (err != 0) {
+        hound_log_err(
+            err,
+            "Failed to set thread scheduling (policy = %d, priority = %d)",
+            policy,
+            s_priority);
+        *sched_ok = false;
+    }
+
+    err = pthread_setaffinity_np(thread, sizeof(s_cpus), &s_cpus);
+    if (err != 0) {
+        hound_log_err_nofmt(err, "Failed to set thread CPU affinity");
+        *affinity_ok = false;
+    }
+}
+
+static
+bool set_memory_lock(bool lock)
+{
+    int ret;
+
+    if (lock == s_memory_locked) {
+        return true;
+    }
+
+    if (!lock) {
+        ret = munlockall();
+        XASSERT_EQ(ret, 0);
+
+        /*
+         * Undo the allocator tuning below. glibc stops adjusting the trim
+         * threshold dynamically once it has been set, so this gets the
+         * defaults back but not that behavior.
+         */
+        mallopt(M_TRIM_THRESHOLD, DEFAULT_TRIM_THRESHOLD);
+        mallopt(M_MMAP_MAX, DEFAULT_MMAP_MAX);
+        s_memory_locked = false;
+        return true;
+    }
+
+    /*
+     * Locking faults in everything mapped now, and MCL_FUTURE faults in new
+     * mappings as they're made, including the stacks of threads we create
+     * later.
+     */
+    ret = mlockall(MCL_CURRENT | MCL_FUTURE);
+    if (ret != 0) {
+        hound_log_err_nofmt(errno, "Failed to lock memory");
+        return false;
+    }
+
+    /*
+     * Keep freed memory in the heap rather than handing it back to the kernel,
+     * and serve big allocations from the heap too, so that memory we free and
+     * allocate again doesn't have to be faulted in again.
+     */
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+    s_memory_locked = true;
+
+    return true;
+}
+
+hound_err rt_set(const struct hound_rt_rq *rq, struct hound_rt_status *status)
+{
+    bool affinity_ok;
+    cpu_set_t cpus;
+    hound_err err;
+    size_t i;
+    bool memory_ok;
+    bool pools_ok;
+    bool sched_ok;
+    struct rt_thread *t;
+    bool was_enabled;
+
+    NULL_CHECK(rq);
+    if (rq->priority < 0 || rq->priority > sched_get_priority_max(SCHED_FIFO)) {
+        return HOUND_INVALID_VAL;
+    }
+    if (rq->cpu_count > 0) {
+        NULL_CHECK(rq->cpus);
+        CPU_ZERO(&cpus);
+        for (i = 0; i < rq->cpu_count; ++i) {
+            if (rq->cpus[i] < 0 || rq->cpus[i] >= CPU_SETSIZE) {
+                return HOUND_INVALID_VAL;
+            }
+            CPU_SET(rq->cpus[i], &cpus);
+        }
+    }
+    else {
+        cpus = s_default_cpus;
+    }
+
+    lock_mutex(&s_rt_mutex);
+    was_enabled = rt_enabled();
+    s_priority = rq->priority;
+    s_cpus = cpus;
+    sched_ok = true;
+    affinity_ok = true;
+
+    /*
+     * As in rt_add_thread, leave threads alone unless real-time mode is on or
+     * being turned off, so that a request that only locks memory or fills
+     * pools doesn't override scheduling the application set itself.
+     */
+    if (was_enabled || rt_enabled()) {
+        for (t = s_threads; t != NULL; t = t->next) {
+            apply_thread(t->thread, &sched_ok, &affinity_ok);
+        }
+    }
+    memory_ok = set_memory_lock(rq->lock_memory);
+    atomic_store(&s_pool_chunks, rq->pool_chunks);
+    unlock_mutex(&s_rt_mutex);
+
+    /* The driver core takes its own locks, so this must be done unlocked. */
+    err = driver_fill_pools(rq->pool_chunks);
+    if (err != HOUND_OK) {
+        hound_log_err_nofmt(err, "Failed to fill read pools");
+    }
+    pools_ok = err == HOUND_OK;
+
+    if (status != NULL) {
+        status->sched = sched_ok;
+        status->affinity = affinity_ok;
+        status->memory = memory_ok;
+        status->pools = pools_ok;
+    }
+
+    if (!sched_ok || !affinity_ok || !memory_ok || !pools_ok) {
+        return HOUND_RT_UNAVAILABLE;
+    }
+
+    return HOUND_OK;
+}
+
+void rt_add_thread(struct rt_thread *t, pthread_t thread)
+{
+    bool affinity_ok;
+    bool sched_ok;
+
+    XASSERT_NOT_NULL(t);
+
+    lock_mutex(&s_rt_mutex);
+    t->thread = thread;
+    t->next = s_threads;
+    s_threads = t;
+
+    /*
+     * Until real-time mode is turned on, leave the thread with whatever it
+     * inherited from its creator. The thread is already running, so failures
+     * are only logged.
+     */
+    if (rt_enabled()) {
+        apply_thread(thread, &sched_ok, &affinity_ok);
+    }
+    unlock_mutex(&s_rt_mutex);
+}
+
+void rt_remove_thread(struct rt_thread *t)
+{
+    struct rt_thread **p;
+
+    XASSERT_NOT_NULL(t);
+
+    lock_mutex(&s_rt_mutex);
+    for (p = &s_threads; *p != t; p = &(*p)->next) {
+        XASSERT_NOT_NULL(*p);
+    }
+    *p = t->next;
+    unlock_mutex(&s_rt_mutex);
+}
+
+size_t rt_pool_chunks(void)
+{
+    return atomic_load(&s_pool_chunks);
+}
+
+void rt_init(void)
+{
+    int cpu;
+    int ret;
+
+    s_threads = NULL;
+    s_priority = 0;
+    s_memory_locked = false;
+    atomic_init(&s_pool_chunks, 0);
+
+    ret = sched_getaffinity(0, sizeof(s_default_cpus), &s_default_cpus);
+    if (ret != 0) {
+        /* Allowing every CPU is the same as not setting affinity at all. */
+        CPU_ZERO(&s_default_cpus);
+        for (cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            CPU_SET(cpu, &s_default_cpus);
+        }
+    }
+    s_cpus = s_default_cpus;
+}
+
+void rt_destroy(void)
+{
+    lock_mutex(&s_rt_mutex);
+    set_memory_lock(false);
+    unlock_mutex(&s_rt_mutex);
+}
@@ -5,10 +5,16 @@
  * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <hound-private/log.h>
 #include <hound-private/util.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 
 size_t min(size_t a, size_t b)
 {
@@ -78,10 +84,23 @@ void destroy_mutex(pthread_mutex_t *mutex)
 
 void init_cond(pthread_cond_t *cond)
 {
+    pthread_condattr_t attr;
     int rc;
 
+    /*
+     * Time out against CLOCK_MONOTONIC so that setting the wall clock doesn't
+     * make waits end early or late. See get_deadline.
+     */
+    rc = pthread_condattr_init(&attr);
+    XASSERT_EQ(rc, 0);
+    rc = pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    XASSERT_EQ(rc, 0);
+
     /* This is documented never to fail. */
-    rc = pthread_cond_init(cond, NULL);
+    rc = pthread_cond_init(cond, &attr);
+    XASSERT_EQ(rc, 0);
+
+    rc = pthread_condattr_destroy(&attr);
     XASSERT_EQ(rc, 0);
 }
 
@@ -123,6 +142,69 @@ void cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex)
     XASSERT_EQ(rc, 0);
 }
 
+hound_data_period monotonic_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return NSEC_PER_SEC*ts.tv_sec + ts.tv_nsec;
+}
+
+void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || (defined(__arm__) && __ARM_ARCH >= 7)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+#define TIME_T_MAX \
+    ((time_t) ((UINTMAX_C(1) << (sizeof(time_t)*CHAR_BIT - 1)) - 1))
+
+void get_deadline(hound_data_period timeout_ns, struct timespec *deadline)
+{
+    hound_data_period ns;
+    hound_data_period sec;
+
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    sec = timeout_ns / NSEC_PER_SEC;
+    ns = deadline->tv_nsec + timeout_ns % NSEC_PER_SEC;
+    if (ns >= NSEC_PER_SEC) {
+        ns -= NSEC_PER_SEC;
+        ++sec;
+    }
+
+    /* A deadline too far out to represent is as good as none. */
+    if (sec > (hound_data_period) (TIME_T_MAX - deadline->tv_sec)) {
+        deadline->tv_sec = TIME_T_MAX;
+        deadline->tv_nsec = NSEC_PER_SEC - 1;
+        return;
+    }
+
+    deadline->tv_sec += sec;
+    deadline->tv_nsec = ns;
+}
+
+bool cond_timedwait(
+    pthread_cond_t *cond,
+    pthread_mutex_t *mutex,
+    const struct timespec *deadline)
+{
+    int rc;
+
+    /* This routine must be called with the associated mutex held. */
+
+    rc = pthread_cond_timedwait(cond, mutex, deadline);
+    if (rc == ETIMEDOUT) {
+        return false;
+    }
+    XASSERT_EQ(rc, 0);
+
+    return true;
+}
+
 void cond_signal(pthread_cond_t *cond)
 {
     int rc;
@@ -131,3 +213,12 @@ void cond_signal(pthread_cond_t *cond)
     rc = pthread_cond_signal(cond);
     XASSERT_EQ(rc, 0);
 }
+
+void cond_broadcast(pthread_cond_t *cond)
+{
+    int rc;
+
+    /* If the condition variable is valid, this should never fail. */
+    rc = pthread_cond_broadcast(cond);
+    XASSERT_EQ(rc, 0);
+}
@@ -27,6 +27,9 @@
 #define IIO_TOPDIR "/sys/bus/iio/devices"
 #define FD_INVALID (-1)
 
+/* About how many bytes to read at once, rounded down to whole scans. */
+#define READ_SIZE (100*1024)
+
 struct chan_desc {
     hound_data_id id;
     const char *scale_file;
@@ -1618,6 +1621,31 @@ hound_err iio_parse(unsigned char *buf, size_t bytes)
     return err;
 }
 
+static
+hound_err iio_read_info(size_t *size, bool *zero_copy)
+{
+    const struct iio_ctx *ctx;
+
+    ctx = drv_ctx();
+    XASSERT_NOT_NULL(ctx);
+
+    /* Read only whole scans, so a scan is never split across two reads. */
+    if (ctx->scan_size == 0) {
+        *size = READ_SIZE;
+    }
+    else if (ctx->scan_size >= READ_SIZE) {
+        *size = ctx->scan_size;
+    }
+    else {
+        *size = READ_SIZE - (READ_SIZE % ctx->scan_size);
+    }
+
+    /* We convert each scan into floats, so records can't point into buf. */
+    *zero_copy = false;
+
+    return HOUND_OK;
+}
+
 static
 hound_err iio_next(UNUSED hound_data_id id)
 {
@@ -1633,6 +1661,7 @@ static struct driver_ops iio_driver = {
     .setdata = iio_setdata,
     .poll = drv_default_push,
     .parse = iio_parse,
+    .read_info = iio_read_info,
     .start = iio_start,
     .next = iio_next,
     .stop = iio_stop
@@ -16,6 +16,7 @@
 #include <msgpack.h>
 #include <mosquitto.h>
 #include <poll.h>
+#include <pthread.h>
 #include <xlib/xassert.h>
 #include <xlib/xhash.h>
 #include <xlib/xvec.h>
@@ -33,6 +34,8 @@ XHASH_MAP_INIT_INT(ID_MAP, const struct schema_desc *)
 XHASH_MAP_INIT_STR(TOPIC_MAP, const struct schema_desc *)
 XHASH_SET_INIT_INT(ACTIVE_IDS)
 
+static pthread_mutex_t s_mosq_lib_lock = PTHREAD_MUTEX_INITIALIZER;
+
 typedef enum {
     /* Still waiting for the callback. */
     CB_PENDING,
@@ -166,7 +169,7 @@ void on_log(
         XASSERT_ERROR;
     }
 
-    hound_log_nofmt(syslog_level, msg);
+    hound_log_limited_nofmt(syslog_level, msg);
 }
 
 static
@@ -382,7 +385,7 @@ void make_record(
 
     success = parse_payload(msg->payload, msg->payloadlen, schema, &record);
     if (!success) {
-        hound_log(
+        hound_log_limited(
             LOG_WARNING,
             "failed to parse payload for data ID 0x%x",
             schema->data_id);
@@ -417,7 +420,7 @@ void on_message(
          * We don't know anything about this topic, so we shouldn't have
          * received this message!
          */
-        hound_log(
+        hound_log_limited(
             LOG_WARNING,
             "received topic we didn't subscribe to: %s",
             msg->topic);
@@ -440,7 +443,7 @@ hound_err do_write(struct mqtt_ctx *ctx)
 
     rc = mosquitto_loop_write(ctx->mosq, 1);
     if (rc != MOSQ_ERR_SUCCESS) {
-        hound_log(LOG_ERR, "MQTT failed to write: %d", rc);
+        hound_log_limited(LOG_ERR, "MQTT failed to write: %d", rc);
         err = HOUND_IO_ERROR;
     }
     else {
@@ -457,7 +460,7 @@ void do_misc(struct mqtt_ctx *ctx)
 
     rc = mosquitto_loop_misc(ctx->mosq);
     if (rc != MOSQ_ERR_SUCCESS) {
-        hound_log(LOG_ERR, "MQTT failed to do misc ops: %d", rc);
+        hound_log_limited(LOG_ERR, "MQTT failed to do misc ops: %d", rc);
     }
 }
 
@@ -479,7 +482,7 @@ hound_err do_read(struct mqtt_ctx *ctx)
 
     rc = mosquitto_loop_read(ctx->mosq, 1);
     if (rc != MOSQ_ERR_SUCCESS) {
-        hound_log(LOG_ERR, "MQTT failed to read: %d", rc);
+        hound_log_limited(LOG_ERR, "MQTT failed to read: %d", rc);
         err = HOUND_IO_ERROR;
     }
     else {
@@ -645,6 +648,40 @@ bool mosq_init_is_safe(void)
     return mosquitto_lib_version(NULL, NULL, NULL) >= 1006010;
 }
 
+static
+void mosq_lib_init(void)
+{
+    int rc;
+
+    if (!mosq_init_is_safe()) {
+        return;
+    }
+
+    /*
+     * mosquitto's init refcount isn't thread-safe, and drivers may initialize
+     * in parallel.
+     */
+    lock_mutex(&s_mosq_lib_lock);
+    rc = mosquitto_lib_init();
+    unlock_mutex(&s_mosq_lib_lock);
+    XASSERT_EQ(rc, MOSQ_ERR_SUCCESS);
+}
+
+static
+void mosq_lib_cleanup(void)
+{
+    int rc;
+
+    if (!mosq_init_is_safe()) {
+        return;
+    }
+
+    lock_mutex(&s_mosq_lib_lock);
+    rc = mosquitto_lib_cleanup();
+    unlock_mutex(&s_mosq_lib_lock);
+    XASSERT_EQ(rc, MOSQ_ERR_SUCCESS);
+}
+
 static
 hound_err mqtt_init(
     const char *location,
@@ -721,10 +758,7 @@ hound_err mqtt_init(
         goto error_alloc_active_ids;
     }
 
-    if (mosq_init_is_safe()) {
-        rc = mosquitto_lib_init();
-        XASSERT_EQ(rc, MOSQ_ERR_SUCCESS);
-    }
+    mosq_lib_init();
 
     errno = 0;
     mosq = mosquitto_new(NULL, true, ctx);
@@ -770,10 +804,7 @@ hound_err mqtt_init(
 error_mosq_set_threaded:
     mosquitto_destroy(mosq);
 error_mosq_new:
-    if (mosq_init_is_safe()) {
-        rc = mosquitto_lib_cleanup();
-        XASSERT_EQ(rc, MOSQ_ERR_SUCCESS);
-    }
+    mosq_lib_cleanup();
     xh_destroy(ACTIVE_IDS, active_ids);
 error_alloc_active_ids:
     xh_destroy(TOPIC_MAP, topic_map);
@@ -791,17 +822,13 @@ hound_err mqtt_destroy(void)
 {
     struct mqtt_ctx *ctx;
     xhiter_t iter;
-    int rc;
     const struct schema_desc *schema;
 
     ctx = drv_ctx();
 
     mosquitto_destroy(ctx->mosq);
 
-    if (mosq_init_is_safe()) {
-        rc = mosquitto_lib_cleanup();
-        XASSERT_EQ(rc, MOSQ_ERR_SUCCESS);
-    }
+    mosq_lib_cleanup();
 
     xh_destroy(ACTIVE_IDS, ctx->active_ids);
 
@@ -1169,7 +1196,7 @@ hound_err unsubscribe_old(
             continue;
         }
 
-        iter = xh_get(ID_MAP, ctx->id_map, rqs[i].id);
+        iter = xh_get(ID_MAP, ctx->id_map, id);
         XASSERT_NEQ(iter, xh_end(ctx->id_map));
         schema = xh_val(ctx->id_map, iter);
 
@@ -1216,6 +1243,84 @@ hound_err mqtt_setdata(const struct hound_data_rq *rqs, size_t rqs_len)
     return HOUND_OK;
 }
 
+static
+void get_topics(
+    const struct mqtt_ctx *ctx,
+    const struct hound_data_rq *rqs,
+    size_t rqs_len,
+    const char **topics)
+{
+    size_t i;
+    xhiter_t iter;
+
+    for (i = 0; i < rqs_len; ++i) {
+        iter = xh_get(ID_MAP, ctx->id_map, rqs[i].id);
+        XASSERT_NEQ(iter, xh_end(ctx->id_map));
+        topics[i] = xh_val(ctx->id_map, iter)->name;
+    }
+}
+
+static
+hound_err mqtt_modifydata(
+    const struct hound_data_rq *add,
+    size_t add_len,
+    const struct hound_data_rq *remove,
+    size_t remove_len)
+{
+    struct mqtt_ctx *ctx;
+    hound_err err;
+    size_t i;
+    xhiter_t iter;
+    int ret;
+    const char **topics;
+
+    ctx = drv_ctx();
+
+    /*
+     * All periods are 0, so each data ID appears at most once, and the core
+     * tells us exactly which topics to subscribe to and unsubscribe from.
+     */
+    topics = malloc(max(add_len, remove_len) * sizeof(*topics));
+    if (topics == NULL && max(add_len, remove_len) > 0) {
+        return HOUND_OOM;
+    }
+
+    if (ctx->active) {
+        get_topics(ctx, add, add_len, topics);
+        err = do_subscribe(ctx, add_len, topics);
+        if (err != HOUND_OK) {
+            goto out;
+        }
+
+        get_topics(ctx, remove, remove_len, topics);
+        err = do_unsubscribe(ctx, remove_len, topics);
+        if (err != HOUND_OK) {
+            goto out;
+        }
+    }
+
+    for (i = 0; i < add_len; ++i) {
+        xh_put(ACTIVE_IDS, ctx->active_ids, add[i].id, &ret);
+        XASSERT_NEQ(ret, 0);
+        if (ret == -1) {
+            err = HOUND_OOM;
+            goto out;
+        }
+    }
+
+    for (i = 0; i < remove_len; ++i) {
+        iter = xh_get(ACTIVE_IDS, ctx->active_ids, remove[i].id);
+        XASSERT_NEQ(iter, xh_end(ctx->active_ids));
+        xh_del(ACTIVE_IDS, ctx->active_ids, iter);
+    }
+
+    err = HOUND_OK;
+
+out:
+    free(topics);
+    return err;
+}
+
 static
 hound_err mqtt_poll(
     short events,
@@ -1365,6 +1470,7 @@ static struct driver_ops mqtt_driver = {
     .device_name = mqtt_device_name,
     .datadesc = mqtt_datadesc,
     .setdata = mqtt_setdata,
+    .modifydata = mqtt_modifydata,
     .poll = mqtt_poll,
     .start = mqtt_start,
     .next = NULL,
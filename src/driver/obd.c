@@ -5,7 +5,9 @@
  * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
  */
 
-#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
+/* With _GNU_SOURCE, net/if.h must come before linux/if.h to avoid conflicts. */
+#include <net/if.h>
 #include <asm/socket.h>
 #include <errno.h>
 #include <hound/hound.h>
@@ -18,9 +20,9 @@
 #include <linux/can/raw.h>
 #include <linux/socket.h>
 #include <linux/sockios.h>
-#include <net/if.h>
 #include <stdbool.h>
 #include <sys/ioctl.h>
+#include <sys/socket.h>
 #include <sys/time.h>
 #include <unistd.h>
 #include <xlib/xhash.h>
@@ -32,6 +34,9 @@
 
 #define FD_INVALID (-1)
 
+/* The max number of CAN frames we send in a single syscall. */
+#define MAX_BATCH_FRAMES (64)
+
 XHASH_MAP_INIT_INT(FRAME_MAP, struct can_frame)
 
 struct obd_ctx {
@@ -377,6 +382,18 @@ hound_err obd_parse(unsigned char *buf, size_t bytes)
     return HOUND_OK;
 }
 
+static
+hound_err obd_read_info(size_t *size, bool *zero_copy)
+{
+    /* CAN sockets return at most one frame per read. */
+    *size = sizeof(struct can_frame);
+
+    /* We decode each frame into a new record, so nothing points into buf. */
+    *zero_copy = false;
+
+    return HOUND_OK;
+}
+
 static
 hound_err obd_next(hound_data_id id)
 {
@@ -404,6 +421,52 @@ hound_err obd_next(hound_data_id id)
     return HOUND_OK;
 }
 
+static
+hound_err obd_next_batch(const hound_data_id *ids, size_t count, size_t n)
+{
+    const struct obd_ctx *ctx;
+    size_t done;
+    size_t frames;
+    size_t i;
+    struct iovec iovs[MAX_BATCH_FRAMES];
+    xhiter_t iter;
+    struct mmsghdr msgs[MAX_BATCH_FRAMES];
+    int sent;
+    size_t total;
+
+    ctx = drv_ctx();
+    XASSERT_NOT_NULL(ctx);
+
+    /*
+     * Send n requests for each ID, in the same order as calling next() n times
+     * per ID would, but with one sendmmsg per MAX_BATCH_FRAMES frames.
+     */
+    total = count * n;
+    for (done = 0; done < total; done += sent) {
+        frames = min(total - done, ARRAYLEN(msgs));
+        for (i = 0; i < frames; ++i) {
+            iter = xh_get(FRAME_MAP, ctx->frame_cache, ids[(done + i) / n]);
+            XASSERT_NEQ(iter, xh_end(ctx->frame_cache));
+            iovs[i].iov_base = &xh_val(ctx->frame_cache, iter);
+            iovs[i].iov_len = sizeof(struct can_frame);
+            memset(&msgs[i], 0, sizeof(msgs[i]));
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        sent = sendmmsg(ctx->tx_fd, msgs, frames, 0);
+        if (sent == -1) {
+            if (errno == EINTR) {
+                sent = 0;
+                continue;
+            }
+            return errno;
+        }
+    }
+
+    return HOUND_OK;
+}
+
 static
 hound_err obd_start(int *out_fd)
 {
@@ -529,8 +592,10 @@ static struct driver_ops obd_driver = {
     .setdata = obd_setdata,
     .poll = drv_default_pull,
     .parse = obd_parse,
+    .read_info = obd_read_info,
     .start = obd_start,
     .next = obd_next,
+    .next_batch = obd_next_batch,
     .stop = obd_stop
 };
 
@@ -0,0 +1,440 @@
+/**
+ * @file      bench.c
+ * @brief     Benchmark and stress test for the record pipeline. Drives the
+ *            counter driver in on-demand mode through the whole core (I/O
+ *            thread, queue push, queue pop and callbacks) across a matrix of
+ *            queue lengths, context counts, reader counts and spin budgets,
+ *            and checks that every record is delivered exactly once to every
+ *            context. Results are printed as one JSON object per scenario.
+ * @author    Martin Kelly <mkelly@xevo.com>
+ * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <hound/hound.h>
+#include <hound-private/util.h>
+#include <hound-test/assert.h>
+#include <hound-test/id.h>
+#include <inttypes.h>
+#include <linux/limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <valgrind.h>
+
+#define MAX_CONTEXTS 4
+#define MAX_READERS 4
+
+/* The most records a reader reads at once. */
+#define MAX_BATCH 64
+
+/* The most records the producer asks for at once. */
+#define MAX_NEXT 256
+
+/*
+ * The most records in flight at once. This keeps the counter driver's pipe from
+ * filling up, as the driver would block on a full pipe while holding its op
+ * lock, which the I/O thread needs in order to drain the pipe.
+ */
+#define MAX_WINDOW 4096
+
+/* The max number of latency samples we keep per context. */
+#define MAX_SAMPLES 65536
+
+#define DEFAULT_RECORDS 200000
+
+static const size_t s_queue_lens[] = { 64, 1024, 16384 };
+static const size_t s_ctx_counts[] = { 1, MAX_CONTEXTS };
+static const size_t s_reader_counts[] = { 1, MAX_READERS };
+
+/* Spin budgets for both readers and the I/O thread; 0 means never spin. */
+static const hound_data_period s_spin_ns[] = { 0, 50000 };
+
+/*
+ * Count allocations made by any thread, including hound's, by interposing on
+ * the glibc allocator.
+ */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static atomic_size_t s_allocs;
+
+PUBLIC_API
+void *malloc(size_t size)
+{
+    atomic_fetch_add_explicit(&s_allocs, 1, memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+PUBLIC_API
+void *calloc(size_t nmemb, size_t size)
+{
+    atomic_fetch_add_explicit(&s_allocs, 1, memory_order_relaxed);
+    return __libc_calloc(nmemb, size);
+}
+
+PUBLIC_API
+void *realloc(void *ptr, size_t size)
+{
+    atomic_fetch_add_explicit(&s_allocs, 1, memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+
+PUBLIC_API
+void free(void *ptr)
+{
+    __libc_free(ptr);
+}
+
+struct bench_ctx {
+    struct hound_ctx *ctx;
+    size_t records;
+    atomic_size_t consumed;
+    unsigned char *seen;
+    size_t stride;
+    hound_data_period *latencies;
+};
+
+struct reader {
+    pthread_t thread;
+    struct bench_ctx *bench_ctx;
+    size_t batch;
+};
+
+/* min and max from util.h are internal to libhound. */
+static
+size_t min_size(size_t a, size_t b)
+{
+    return a < b ? a : b;
+}
+
+static
+size_t max_size(size_t a, size_t b)
+{
+    return a > b ? a : b;
+}
+
+static
+hound_data_period timespec_ns(const struct timespec *ts)
+{
+    return ts->tv_sec * NSEC_PER_SEC + ts->tv_nsec;
+}
+
+static
+hound_data_period now_ns(clockid_t clock)
+{
+    struct timespec ts;
+    int ret;
+
+    ret = clock_gettime(clock, &ts);
+    XASSERT_EQ(ret, 0);
+
+    return timespec_ns(&ts);
+}
+
+static
+void bench_cb(const struct hound_record *rec, hound_seqno seqno, void *cb_ctx)
+{
+    struct bench_ctx *ctx;
+    hound_data_period latency;
+
+    XASSERT_NOT_NULL(rec);
+    XASSERT_NOT_NULL(cb_ctx);
+    ctx = cb_ctx;
+
+    XASSERT_EQ(rec->data_id, HOUND_DATA_COUNTER);
+    if (seqno < ctx->records) {
+        /* Every record must show up exactly once. */
+        XASSERT_EQ(ctx->seen[seqno], 0);
+        ctx->seen[seqno] = 1;
+
+        if (seqno % ctx->stride == 0) {
+            latency = now_ns(CLOCK_REALTIME) - timespec_ns(&rec->timestamp);
+            ctx->latencies[seqno / ctx->stride] = latency;
+        }
+    }
+
+    atomic_fetch_add(&ctx->consumed, 1);
+}
+
+static
+void *reader_thread(void *data)
+{
+    hound_err err;
+    struct reader *reader;
+    size_t records_read;
+
+    reader = data;
+    while (atomic_load(&reader->bench_ctx->consumed) <
+           reader->bench_ctx->records) {
+        err = hound_read(reader->bench_ctx->ctx, reader->batch, &records_read);
+        XASSERT_OK(err);
+        XASSERT_EQ(records_read, reader->batch);
+    }
+
+    return NULL;
+}
+
+static
+size_t min_consumed(struct bench_ctx *ctxs, size_t ctx_count)
+{
+    size_t consumed;
+    size_t i;
+    size_t min_val;
+
+    min_val = SIZE_MAX;
+    for (i = 0; i < ctx_count; ++i) {
+        consumed = atomic_load(&ctxs[i].consumed);
+        min_val = min_size(min_val, consumed);
+    }
+
+    return min_val;
+}
+
+static
+int compare_period(const void *a, const void *b)
+{
+    hound_data_period x;
+    hound_data_period y;
+
+    x = *((const hound_data_period *) a);
+    y = *((const hound_data_period *) b);
+    if (x < y) {
+        return -1;
+    }
+    else if (x > y) {
+        return 1;
+    }
+    return 0;
+}
+
+static
+void run_scenario(
+    size_t queue_len,
+    size_t ctx_count,
+    size_t reader_count,
+    hound_data_period spin_ns,
+    size_t records)
+{
+    size_t allocs;
+    size_t batch;
+    size_t consumed;
+    struct bench_ctx ctxs[MAX_CONTEXTS];
+    hound_data_period elapsed;
+    hound_err err;
+    size_t i;
+    size_t in_flight;
+    size_t j;
+    hound_data_period *latencies;
+    size_t n;
+    size_t produced;
+    struct reader readers[MAX_CONTEXTS*MAX_READERS];
+    struct hound_rq rq;
+    struct hound_data_rq rq_list[] = {
+        { .id = HOUND_DATA_COUNTER, .period_ns = 0 }
+    };
+    size_t sample_count;
+    size_t samples_per_ctx;
+    hound_data_period start;
+    size_t target;
+    size_t window;
+
+    XASSERT_LTE(ctx_count, MAX_CONTEXTS);
+    XASSERT_LTE(reader_count, MAX_READERS);
+
+    /*
+     * Keep the queue from overflowing, so that we measure the pipeline rather
+     * than drops. Leave room for every reader to have a batch outstanding.
+     */
+    window = min_size(queue_len / 2, MAX_WINDOW);
+    batch = max_size(1, min_size(MAX_BATCH, window / (2 * reader_count)));
+
+    memset(&rq, 0, sizeof(rq));
+    rq.queue_len = queue_len;
+    rq.cb = bench_cb;
+    rq.rq_list.len = ARRAYLEN(rq_list);
+    rq.rq_list.data = rq_list;
+
+    samples_per_ctx = min_size(records, MAX_SAMPLES);
+    for (i = 0; i < ctx_count; ++i) {
+        ctxs[i].records = records;
+        atomic_init(&ctxs[i].consumed, 0);
+        ctxs[i].seen = calloc(records, sizeof(*ctxs[i].seen));
+        XASSERT_NOT_NULL(ctxs[i].seen);
+        ctxs[i].stride = (records + samples_per_ctx - 1) / samples_per_ctx;
+        ctxs[i].latencies = calloc(
+            samples_per_ctx,
+            sizeof(*ctxs[i].latencies));
+        XASSERT_NOT_NULL(ctxs[i].latencies);
+
+        rq.cb_ctx = &ctxs[i];
+        err = hound_alloc_ctx(&rq, &ctxs[i].ctx);
+        XASSERT_OK(err);
+        err = hound_set_spin(ctxs[i].ctx, spin_ns, spin_ns);
+        XASSERT_OK(err);
+        err = hound_start(ctxs[i].ctx);
+        XASSERT_OK(err);
+    }
+
+    allocs = atomic_load(&s_allocs);
+    start = now_ns(CLOCK_MONOTONIC);
+
+    for (i = 0; i < ctx_count; ++i) {
+        for (j = 0; j < reader_count; ++j) {
+            readers[i*reader_count + j].bench_ctx = &ctxs[i];
+            readers[i*reader_count + j].batch = batch;
+            err = pthread_create(
+                &readers[i*reader_count + j].thread,
+                NULL,
+                reader_thread,
+                &readers[i*reader_count + j]);
+            XASSERT_EQ(err, 0);
+        }
+    }
+
+    /*
+     * Produce enough extra records that every reader can finish its last
+     * batch.
+     */
+    target = records + reader_count * batch;
+    produced = 0;
+    while (produced < target) {
+        consumed = min_consumed(ctxs, ctx_count);
+        in_flight = produced - min_size(produced, consumed);
+        if (in_flight >= window) {
+            sched_yield();
+            continue;
+        }
+
+        n = min_size(min_size(window - in_flight, target - produced), MAX_NEXT);
+        err = hound_next(ctxs[0].ctx, n);
+        XASSERT_OK(err);
+        produced += n;
+    }
+
+    for (i = 0; i < ctx_count * reader_count; ++i) {
+        err = pthread_join(readers[i].thread, NULL);
+        XASSERT_EQ(err, 0);
+    }
+
+    elapsed = now_ns(CLOCK_MONOTONIC) - start;
+    allocs = atomic_load(&s_allocs) - allocs;
+
+    /* Check for lost records and gather latencies. */
+    latencies = malloc(ctx_count * samples_per_ctx * sizeof(*latencies));
+    XASSERT_NOT_NULL(latencies);
+    sample_count = 0;
+    for (i = 0; i < ctx_count; ++i) {
+        for (j = 0; j < records; ++j) {
+            XASSERT_EQ(ctxs[i].seen[j], 1);
+        }
+        for (j = 0; j < records; j += ctxs[i].stride) {
+            latencies[sample_count] = ctxs[i].latencies[j / ctxs[i].stride];
+            ++sample_count;
+        }
+
+        err = hound_stop(ctxs[i].ctx);
+        XASSERT_OK(err);
+        err = hound_free_ctx(ctxs[i].ctx);
+        XASSERT_OK(err);
+        free(ctxs[i].latencies);
+        free(ctxs[i].seen);
+    }
+    qsort(latencies, sample_count, sizeof(*latencies), compare_period);
+
+    printf(
+        "{\"queue_len\": %zu, \"contexts\": %zu, \"readers\": %zu, "
+        "\"spin_ns\": %" PRIu64 ", \"records\": %zu, \"seconds\": %.6f, "
+        "\"records_per_sec\": %.0f, "
+        "\"p50_latency_ns\": %" PRIu64 ", \"p99_latency_ns\": %" PRIu64 ", "
+        "\"allocs_per_record\": %.2f}\n",
+        queue_len,
+        ctx_count,
+        reader_count,
+        spin_ns,
+        records,
+        (double) elapsed / NSEC_PER_SEC,
+        (double) (records * ctx_count) * NSEC_PER_SEC / elapsed,
+        latencies[sample_count / 2],
+        latencies[sample_count * 99 / 100],
+        (double) allocs / produced);
+    fflush(stdout);
+
+    free(latencies);
+}
+
+int main(int argc, const char **argv)
+{
+    const char *config_path;
+    hound_err err;
+    size_t i;
+    size_t j;
+    size_t k;
+    size_t l;
+    size_t records;
+    const char *schema_base;
+
+    if (argc != 3 && argc != 4) {
+        fprintf(
+            stderr,
+            "Usage: %s SCHEMA-BASE-PATH CONFIG-PATH [RECORDS]\n",
+            argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (strnlen(argv[1], PATH_MAX) == PATH_MAX) {
+        fprintf(stderr, "Schema base path is longer than PATH_MAX\n");
+        exit(EXIT_FAILURE);
+    }
+    schema_base = argv[1];
+    config_path = argv[2];
+
+    if (argc == 4) {
+        records = strtoul(argv[3], NULL, 10);
+        if (records == 0) {
+            fprintf(stderr, "RECORDS must be a positive number\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    else {
+        records = DEFAULT_RECORDS;
+    }
+
+    /*
+     * Valgrind substantially slows down runtime performance, so reduce the
+     * record count so that tests will still finish in a reasonable amount of
+     * time.
+     */
+    if (RUNNING_ON_VALGRIND) {
+        records = min_size(records, 100);
+    }
+
+    err = hound_init_config(config_path, schema_base);
+    XASSERT_OK(err);
+
+    for (i = 0; i < ARRAYLEN(s_queue_lens); ++i) {
+        for (j = 0; j < ARRAYLEN(s_ctx_counts); ++j) {
+            for (k = 0; k < ARRAYLEN(s_reader_counts); ++k) {
+                for (l = 0; l < ARRAYLEN(s_spin_ns); ++l) {
+                    run_scenario(
+                        s_queue_lens[i],
+                        s_ctx_counts[j],
+                        s_reader_counts[k],
+                        s_spin_ns[l],
+                        records);
+                }
+            }
+        }
+    }
+
+    err = hound_destroy_driver("/dev/counter");
+    XASSERT_OK(err);
+
+    return EXIT_SUCCESS;
+}
@@ -12,8 +12,17 @@
 #include <hound-private/util.h>
 #include <hound-test/assert.h>
 #include <hound-test/id.h>
+#include <dirent.h>
+#include <fcntl.h>
 #include <linux/limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <time.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <valgrind.h>
 
 struct cb_ctx {
@@ -60,6 +69,1471 @@ void data_cb(const struct hound_record *rec, hound_seqno seqno, void *cb_ctx)
     ++ctx->seqno;
 }
 
+struct query_ctx {
+    size_t count;
+    struct timespec last;
+};
+
+static
+void query_cb(
+    const struct hound_record *rec,
+    UNUSED hound_seqno seqno,
+    void *cb_ctx)
+{
+    struct query_ctx *ctx;
+
+    XASSERT_NOT_NULL(rec);
+    XASSERT_NOT_NULL(cb_ctx);
+    ctx = cb_ctx;
+
+    /* Records should come back in timestamp order. */
+    if (ctx->count > 0) {
+        XASSERT(
+            rec->timestamp.tv_sec > ctx->last.tv_sec ||
+            (rec->timestamp.tv_sec == ctx->last.tv_sec &&
+             rec->timestamp.tv_nsec >= ctx->last.tv_nsec));
+    }
+    ctx->last = rec->timestamp;
+    ++ctx->count;
+}
+
+static
+void test_query_range(struct cb_ctx *cb_ctx, size_t total_records)
+{
+    struct timespec end;
+    hound_err err;
+    size_t i;
+    struct query_ctx query_ctx;
+    size_t queue_len;
+    size_t records_read;
+    struct timespec start;
+
+    start.tv_sec = 0;
+    start.tv_nsec = 0;
+    end.tv_sec = INT32_MAX;
+    end.tv_nsec = 0;
+
+    err = hound_query_range(
+        cb_ctx->ctx,
+        &start,
+        &end,
+        query_cb,
+        &query_ctx,
+        &records_read);
+    XASSERT_EQ(err, HOUND_RETENTION_DISABLED);
+
+    err = hound_set_retention(cb_ctx->ctx, total_records, 0);
+    XASSERT_OK(err);
+
+    /*
+     * Records queued before retention was enabled aren't retained, so read
+     * past them to make sure enough new records have been produced.
+     */
+    err = hound_max_queue_length(cb_ctx->ctx, &queue_len);
+    XASSERT_OK(err);
+    for (i = 0; i < total_records + queue_len; ++i) {
+        err = hound_read(cb_ctx->ctx, 1, &records_read);
+        XASSERT_OK(err);
+        XASSERT_EQ(records_read, 1);
+    }
+
+    /* Reading doesn't consume retained records. */
+    query_ctx.count = 0;
+    err = hound_query_range(
+        cb_ctx->ctx,
+        &start,
+        &end,
+        query_cb,
+        &query_ctx,
+        &records_read);
+    XASSERT_OK(err);
+    XASSERT_EQ(records_read, total_records);
+    XASSERT_EQ(query_ctx.count, total_records);
+
+    /* Nothing is that old. */
+    query_ctx.count = 0;
+    err = hound_query_range(
+        cb_ctx->ctx,
+        &start,
+        &start,
+        query_cb,
+        &query_ctx,
+        &records_read);
+    XASSERT_OK(err);
+    XASSERT_EQ(records_read, 0);
+    XASSERT_EQ(query_ctx.count, 0);
+
+    err = hound_query_range(
+        cb_ctx->ctx,
+        &end,
+        &start,
+        query_cb,
+        &query_ctx,
+        &records_read);
+    XASSERT_EQ(err, HOUND_INVALID_VAL);
+
+    err = hound_set_retention(cb_ctx->ctx, 0, 0);
+    XASSERT_OK(err);
+    err = hound_query_range(
+        cb_ctx->ctx,
+        &start,
+        &end,
+        query_cb,
+        &query_ctx,
+        &records_read);
+    XASSERT_EQ(err, HOUND_RETENTION_DISABLED);
+}
+
+struct async_ctx {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    size_t count;
+    hound_seqno last_seqno;
+};
+
+static
+void async_cb(
+    const struct hound_record *rec,
+    hound_seqno seqno,
+    void *cb_ctx)
+{
+    struct async_ctx *ctx;
+
+    XASSERT_NOT_NULL(rec);
+    XASSERT_NOT_NULL(cb_ctx);
+    ctx = cb_ctx;
+
+    pthread_mutex_lock(&ctx->lock);
+    /* Records for the same data ID must arrive in order. */
+    if (ctx->count > 0) {
+        XASSERT_GT(seqno, ctx->last_seqno);
+    }
+    ctx->last_seqno = seqno;
+    ++ctx->count;
+    pthread_cond_signal(&ctx->cond);
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+static
+void test_async(
+    struct cb_ctx *cb_ctx,
+    struct hound_rq *rq,
+    size_t total_records)
+{
+    struct async_ctx async_ctx;
+    hound_err err;
+    size_t records_read;
+
+    pthread_mutex_init(&async_ctx.lock, NULL);
+    pthread_cond_init(&async_ctx.cond, NULL);
+    async_ctx.count = 0;
+    async_ctx.last_seqno = 0;
+
+    err = hound_stop(cb_ctx->ctx);
+    XASSERT_OK(err);
+
+    rq->cb = async_cb;
+    rq->cb_ctx = &async_ctx;
+    err = hound_modify_ctx(cb_ctx->ctx, rq, true);
+    XASSERT_OK(err);
+
+    err = hound_start_async(cb_ctx->ctx, 0, 16);
+    XASSERT_EQ(err, HOUND_INVALID_VAL);
+    err = hound_start_async(cb_ctx->ctx, 4, 0);
+    XASSERT_EQ(err, HOUND_INVALID_VAL);
+
+    err = hound_start_async(cb_ctx->ctx, 4, 16);
+    XASSERT_OK(err);
+    err = hound_start_async(cb_ctx->ctx, 4, 16);
+    XASSERT_EQ(err, HOUND_CTX_ACTIVE);
+
+    /* The dispatcher owns the queue, so reads aren't allowed. */
+    err = hound_read(cb_ctx->ctx, 1, &records_read);
+    XASSERT_EQ(err, HOUND_CTX_ASYNC);
+    err = hound_read_nowait(cb_ctx->ctx, 1, &records_read);
+    XASSERT_EQ(err, HOUND_CTX_ASYNC);
+
+    pthread_mutex_lock(&async_ctx.lock);
+    while (async_ctx.count < total_records) {
+        pthread_cond_wait(&async_ctx.cond, &async_ctx.lock);
+    }
+    pthread_mutex_unlock(&async_ctx.lock);
+
+    err = hound_stop(cb_ctx->ctx);
+    XASSERT_OK(err);
+    XASSERT_GTE(async_ctx.count, total_records);
+
+    /* Go back to sync reads. */
+    rq->cb = data_cb;
+    rq->cb_ctx = cb_ctx;
+    err = hound_modify_ctx(cb_ctx->ctx, rq, true);
+    XASSERT_OK(err);
+    err = hound_start(cb_ctx->ctx);
+    XASSERT_OK(err);
+
+    pthread_cond_destroy(&async_ctx.cond);
+    pthread_mutex_destroy(&async_ctx.lock);
+}
+
+struct async_stop_ctx {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct hound_ctx *ctx;
+    bool called;
+};
+
+static
+void async_stop_cb(
+    const struct hound_record *rec,
+    UNUSED hound_seqno seqno,
+    void *cb_ctx)
+{
+    struct async_stop_ctx *ctx;
+    hound_err err;
+    size_t len;
+    const struct timespec pause = { .tv_sec = 0, .tv_nsec = 10*NSEC_PER_MSEC };
+
+    XASSERT_NOT_NULL(rec);
+    XASSERT_NOT_NULL(cb_ctx);
+    ctx = cb_ctx;
+
+    pthread_mutex_lock(&ctx->lock);
+    ctx->called = true;
+    pthread_cond_signal(&ctx->cond);
+    pthread_mutex_unlock(&ctx->lock);
+
+    /* Give hound_stop time to start waiting on us, then take the ctx lock. */
+    nanosleep(&pause, NULL);
+    err = hound_queue_length(ctx->ctx, &len);
+    XASSERT_OK(err);
+}
+
+/*
+ * Stopping waits for in-flight callbacks, which may call back into the context,
+ * so it must not hold the context lock while it waits.
+ */
+static
+void test_async_stop(struct cb_ctx *cb_ctx, struct hound_rq *rq)
+{
+    struct async_stop_ctx async_ctx;
+    hound_err err;
+
+    pthread_mutex_init(&async_ctx.lock, NULL);
+    pthread_cond_init(&async_ctx.cond, NULL);
+    async_ctx.ctx = cb_ctx->ctx;
+    async_ctx.called = false;
+
+    err = hound_stop(cb_ctx->ctx);
+    XASSERT_OK(err);
+
+    rq->cb = async_stop_cb;
+    rq->cb_ctx = &async_ctx;
+    err = hound_modify_ctx(cb_ctx->ctx, rq, true);
+    XASSERT_OK(err);
+    err = hound_start_async(cb_ctx->ctx, 1, 4);
+    XASSERT_OK(err);
+
+    pthread_mutex_lock(&async_ctx.lock);
+    while (!async_ctx.called) {
+        pthread_cond_wait(&async_ctx.cond, &async_ctx.lock);
+    }
+    pthread_mutex_unlock(&async_ctx.lock);
+
+    err = hound_stop(cb_ctx->ctx);
+    XASSERT_OK(err);
+
+    /* The dispatcher is gone, so we can start again. */
+    rq->cb = data_cb;
+    rq->cb_ctx = cb_ctx;
+    err = hound_modify_ctx(cb_ctx->ctx, rq, true);
+    XASSERT_OK(err);
+    err = hound_start(cb_ctx->ctx);
+    XASSERT_OK(err);
+
+    pthread_cond_destroy(&async_ctx.cond);
+    pthread_mutex_destroy(&async_ctx.lock);
+}
+
+#define POLICY_RECORDS 20
+
+struct policy_ctx {
+    size_t count;
+    hound_seqno seqnos[POLICY_RECORDS];
+    size_t values[POLICY_RECORDS];
+};
+
+static
+void policy_cb(
+    const struct hound_record *rec,
+    hound_seqno seqno,
+    void *cb_ctx)
+{
+    struct policy_ctx *ctx;
+
+    XASSERT_NOT_NULL(rec);
+    XASSERT_NOT_NULL(cb_ctx);
+    ctx = cb_ctx;
+
+    XASSERT_LT(ctx->count, POLICY_RECORDS);
+    ctx->seqnos[ctx->count] = seqno;
+    ctx->values[ctx->count] = *((size_t *) rec->data);
+    ++ctx->count;
+}
+
+static
+void set_overflow(
+    struct hound_rq *rq,
+    hound_overflow_policy overflow,
+    hound_data_period timeout_ns,
+    size_t lane_len)
+{
+    size_t i;
+
+    for (i = 0; i < rq->rq_list.len; ++i) {
+        rq->rq_list.data[i].overflow = overflow;
+        rq->rq_list.data[i].block_timeout_ns = timeout_ns;
+        rq->rq_list.data[i].lane_len = lane_len;
+    }
+}
+
+static
+void wait_for_full_queue(struct hound_ctx *ctx)
+{
+    hound_err err;
+    size_t len;
+    size_t max_len;
+    struct timespec ts;
+
+    err = hound_max_queue_length(ctx, &max_len);
+    XASSERT_OK(err);
+
+    do {
+        err = hound_queue_length(ctx, &len);
+        XASSERT_OK(err);
+    } while (len < max_len);
+
+    /* Give the producer some time to overflow the queue. */
+    ts.tv_sec = 0;
+    ts.tv_nsec = 20*NSEC_PER_MSEC;
+    nanosleep(&ts, NULL);
+}
+
+static
+void check_contiguous(const struct policy_ctx *ctx, size_t start, size_t end)
+{
+    size_t i;
+
+    for (i = start + 1; i < end; ++i) {
+        XASSERT_EQ(ctx->seqnos[i], ctx->seqnos[i-1] + 1);
+        XASSERT_EQ(ctx->values[i], ctx->values[i-1] + 1);
+    }
+}
+
+static
+void test_overflow(struct cb_ctx *cb_ctx, struct hound_rq *rq)
+{
+    hound_err err;
+    size_t i;
+    size_t len;
+    struct policy_ctx policy_ctx;
+    size_t records_read;
+
+    rq->cb = policy_cb;
+    rq->cb_ctx = &policy_ctx;
+    rq->queue_len = POLICY_RECORDS / 2;
+
+    /* Requests for the same data must agree. */
+    set_overflow(rq, HOUND_OVERFLOW_DROP_NEWEST, 0, 0);
+    rq->rq_list.data[1].overflow = HOUND_OVERFLOW_DROP_OLDEST;
+    err = hound_modify_ctx(cb_ctx->ctx, rq, true);
+    XASSERT_EQ(err, HOUND_INVALID_VAL);
+
+    set_overflow(rq, 42, 0, 0);
+    err = hound_modify_ctx(cb_ctx->ctx, rq, true);
+    XASSERT_EQ(err, HOUND_INVALID_VAL);
+
+    /* Dropping the newest records keeps the oldest ones intact. */
+    set_overflow(rq, HOUND_OVERFLOW_DROP_NEWEST, 0, 0);
+    err = hound_modify_ctx(cb_ctx->ctx, rq, true);
+    XASSERT_OK(err);
+    wait_for_full_queue(cb_ctx->ctx);
+
+    policy_ctx.count = 0;
+    err = hound_read(cb_ctx->ctx, rq->queue_len, &records_read);
+    XASSERT_OK(err);
+    XASSERT_EQ(records_read, rq->queue_len);
+    check_contiguous(&policy_ctx, 0, rq->queue_len);
+    err = hound_read(cb_ctx->ctx, 1, &records_read);
+    XASSERT_OK(err);
+    XASSERT_EQ(records_read, 1);
+
+    /* The dropped records show up as a gap in sequence numbers. */
+    XASSERT_GT(
+        policy_ctx.seqnos[rq->queue_len],
+        policy_ctx.seqnos[rq->queue_len - 1] + 1);
+
+    /* Blocking stalls the I/O thread, so the timeout is capped. */
+    set_overflow(rq, HOUND_OVERFLOW_BLOCK, HOUND_MAX_BLOCK_TIMEOUT_NS + 1, 0);
+    err = hound_modify_ctx(cb_ctx->ctx, rq, true);
+    XASSERT_EQ(err, HOUND_INVALID_VAL);
+
+    /* Blocking the producer doesn't lose anything. */
+    set_overflow(rq, HOUND_OVERFLOW_BLOCK, HOUND_MAX_BLOCK_TIMEOUT_NS, 0);
+    err = hound_modify_ctx(cb_ctx->ctx, rq, true);
+    XASSERT_OK(err);
+    wait_for_full_queue(cb_ctx->ctx);
+
+    policy_ctx.count = 0;
+    for (i = 0; i < POLICY_RECORDS; ++i) {
+        err = hound_read(cb_ctx->ctx, 1, &records_read);
+        XASSERT_OK(err);
+        XASSERT_EQ(records_read, 1);
+    }
+    check_contiguous(&policy_ctx, 0, POLICY_RECORDS);
+
+    /* Lanes add to the queue length. */
+    set_overflow(rq, HOUND_OVERFLOW_DROP_OLDEST, 0, POLICY_RECORDS / 2);
+    rq->queue_len = 1;
+    err = hound_modify_ctx(cb_ctx->ctx, rq, true);
+    XASSERT_OK(err);
+    err = hound_max_queue_length(cb_ctx->ctx, &len);
+    XASSERT_OK(err);
+    XASSERT_EQ(len, POLICY_RECORDS / 2 + 1);
+
+    policy_ctx.count = 0;
+    err = hound_read(cb_ctx->ctx, POLICY_RECORDS, &records_read);
+    XASSERT_EQ(err, HOUND_QUEUE_TOO_SMALL);
+    err = hound_read(cb_ctx->ctx, POLICY_RECORDS / 2, &records_read);
+    XASSERT_OK(err);
+    for (i = 1; i < policy_ctx.count; ++i) {
+        XASSERT_GT(policy_ctx.seqnos[i], policy_ctx.seqnos[i-1]);
+    }
+
+    /*
+     * Stopping shouldn't wait for a blocked producer to time out. Note that we
+     * don't read after this, as the stop interrupts the next blocking read.
+     */
+    set_overflow(rq, HOUND_OVERFLOW_BLOCK, HOUND_MAX_BLOCK_TIMEOUT_NS, 0);
+    err = hound_modify_ctx(cb_ctx->ctx, rq, true);
+    XASSERT_OK(err);
+    wait_for_full_queue(cb_ctx->ctx);
+    err = hound_stop(cb_ctx->ctx);
+    XASSERT_OK(err);
+    err = hound_start(cb_ctx->ctx);
+    XASSERT_OK(err);
+
+    /* Go back to the defaults. */
+    set_overflow(rq, HOUND_OVERFLOW_DROP_OLDEST, 0, 0);
+    rq->cb = data_cb;
+    rq->cb_ctx = cb_ctx;
+    rq->queue_len = 10;
+    cb_ctx->allow_drops = true;
+    err = hound_modify_ctx(cb_ctx->ctx, rq, true);
+    XASSERT_OK(err);
+}
+
+struct blocked_read {
+    pthread_t thread;
+    struct hound_ctx *ctx;
+    bool bytes;
+    hound_err err;
+    size_t records_read;
+};
+
+static
+void never_cb(
+    UNUSED const struct hound_record *rec,
+    UNUSED hound_seqno seqno,
+    UNUSED void *cb_ctx)
+{
+    XASSERT_ERROR;
+}
+
+static
+void *blocked_read_thread(void *data)
+{
+    size_t bytes_read;
+    struct blocked_read *read;
+
+    read = data;
+    if (read->bytes) {
+        read->err = hound_read_bytes(
+            read->ctx,
+            sizeof(uint64_t),
+            &read->records_read,
+            &bytes_read);
+    }
+    else {
+        read->err = hound_read(read->ctx, 1, &read->records_read);
+    }
+
+    return NULL;
+}
+
+/*
+ * Starts a blocking read that can't be satisfied, then checks that a stop
+ * interrupts it. If the read spun with the queue lock held, the stop would hang
+ * instead.
+ */
+static
+void check_blocked_read(struct hound_ctx *ctx, bool bytes)
+{
+    hound_err err;
+    struct blocked_read read;
+    const struct timespec delay = { .tv_sec = 0, .tv_nsec = 20*NSEC_PER_MSEC };
+
+    read.ctx = ctx;
+    read.bytes = bytes;
+    err = pthread_create(&read.thread, NULL, blocked_read_thread, &read);
+    XASSERT_EQ(err, 0);
+    nanosleep(&delay, NULL);
+
+    err = hound_stop(ctx);
+    XASSERT_OK(err);
+    err = pthread_join(read.thread, NULL);
+    XASSERT_EQ(err, 0);
+    XASSERT_EQ(read.err, HOUND_CTX_STOPPED);
+    XASSERT_EQ(read.records_read, 0);
+
+    err = hound_start(ctx);
+    XASSERT_OK(err);
+}
+
+/*
+ * A record bigger than the whole byte limit is dropped, but must not make the
+ * empty queue look full, or blocking reads spin rather than wait.
+ */
+static
+void test_oversized_records(void)
+{
+    size_t bytes_read;
+    struct hound_ctx *ctx;
+    hound_err err;
+    size_t len;
+    size_t records_read;
+    struct hound_rq rq;
+    struct hound_data_rq rq_list[] = {
+        { .id = HOUND_DATA_COUNTER, .period_ns = NSEC_PER_SEC/10000 }
+    };
+    const struct timespec delay = { .tv_sec = 0, .tv_nsec = 20*NSEC_PER_MSEC };
+
+    memset(&rq, 0, sizeof(rq));
+    rq.queue_len = 10;
+    rq.queue_bytes = sizeof(struct hound_record) + sizeof(uint64_t) - 1;
+    rq.cb = never_cb;
+    rq.rq_list.len = ARRAYLEN(rq_list);
+    rq.rq_list.data = rq_list;
+
+    err = hound_alloc_ctx(&rq, &ctx);
+    XASSERT_OK(err);
+    err = hound_start(ctx);
+    XASSERT_OK(err);
+    nanosleep(&delay, NULL);
+    err = hound_queue_length(ctx, &len);
+    XASSERT_OK(err);
+    XASSERT_EQ(len, 0);
+
+    err = hound_read_bytes_timeout(
+        ctx,
+        sizeof(uint64_t),
+        NSEC_PER_MSEC,
+        &records_read,
+        &bytes_read);
+    XASSERT_EQ(err, HOUND_TIMEOUT);
+    XASSERT_EQ(bytes_read, 0);
+
+    check_blocked_read(ctx, false);
+    check_blocked_read(ctx, true);
+
+    err = hound_stop(ctx);
+    XASSERT_OK(err);
+    err = hound_free_ctx(ctx);
+    XASSERT_OK(err);
+}
+
+static
+void wait_for_full_bytes(struct hound_ctx *ctx, size_t record_bytes)
+{
+    size_t bytes;
+    hound_err err;
+    size_t max_bytes;
+    struct timespec ts;
+
+    err = hound_max_queue_bytes(ctx, &max_bytes);
+    XASSERT_OK(err);
+
+    do {
+        err = hound_queue_bytes(ctx, &bytes);
+        XASSERT_OK(err);
+    } while (bytes + record_bytes <= max_bytes);
+
+    /* Give the producer some time to overflow the queue. */
+    ts.tv_sec = 0;
+    ts.tv_nsec = 20*NSEC_PER_MSEC;
+    nanosleep(&ts, NULL);
+}
+
+static
+void test_queue_bytes(struct cb_ctx *cb_ctx, struct hound_rq *rq)
+{
+    size_t bytes;
+    hound_err err;
+    size_t len;
+    struct policy_ctx policy_ctx;
+    size_t record_bytes;
+    size_t records_read;
+    struct timespec ts;
+
+    rq->cb = policy_cb;
+    rq->cb_ctx = &policy_ctx;
+    rq->queue_len = POLICY_RECORDS;
+
+    /* The byte limit caps the queue well below its record limit. */
+    record_bytes = sizeof(struct hound_record) + sizeof(uint64_t);
+    rq->queue_bytes = 4 * record_bytes;
+    err = hound_modify_ctx(cb_ctx->ctx, rq, true);
+    XASSERT_OK(err);
+    err = hound_max_queue_bytes(cb_ctx->ctx, &bytes);
+    XASSERT_OK(err);
+    XASSERT_EQ(bytes, rq->queue_bytes);
+    err = hound_max_queue_length(cb_ctx->ctx, &len);
+    XASSERT_OK(err);
+    XASSERT_EQ(len, POLICY_RECORDS);
+    err = hound_read_bytes(
+        cb_ctx->ctx,
+        rq->queue_bytes + 1,
+        &records_read,
+        &bytes);
+    XASSERT_EQ(err, HOUND_QUEUE_TOO_SMALL);
+
+    wait_for_full_bytes(cb_ctx->ctx, record_bytes);
+    err = hound_queue_bytes(cb_ctx->ctx, &bytes);
+    XASSERT_OK(err);
+    XASSERT_EQ(bytes, rq->queue_bytes);
+    err = hound_queue_length(cb_ctx->ctx, &len);
+    XASSERT_OK(err);
+    XASSERT_EQ(len, 4);
+
+    /* The oldest records were evicted, so what's left is contiguous. */
+    policy_ctx.count = 0;
+    err = hound_read_nowait(cb_ctx->ctx, 4, &records_read);
+    XASSERT_OK(err);
+    XASSERT_EQ(records_read, 4);
+    check_contiguous(&policy_ctx, 0, 4);
+
+    /* Dropping the newest records applies to the byte limit too. */
+    set_overflow(rq, HOUND_OVERFLOW_DROP_NEWEST, 0, 0);
+    err = hound_modify_ctx(cb_ctx->ctx, rq, true);
+    XASSERT_OK(err);
+    wait_for_full_bytes(cb_ctx->ctx, record_bytes);
+
+    /*
+     * Note that we read without blocking, as the stop in test_overflow
+     * interrupts the next blocking read.
+     */
+    policy_ctx.count = 0;
+    while (policy_ctx.count < 5) {
+        err = hound_read_nowait(
+            cb_ctx->ctx,
+            5 - policy_ctx.count,
+            &records_read);
+        XASSERT_OK(err);
+    }
+    check_contiguous(&policy_ctx, 0, 4);
+    XASSERT_GT(policy_ctx.seqnos[4], policy_ctx.seqnos[3] + 1);
+
+    /* Records that could never fit are always dropped. */
+    set_overflow(rq, HOUND_OVERFLOW_BLOCK, HOUND_MAX_BLOCK_TIMEOUT_NS, 0);
+    rq->queue_bytes = record_bytes - 1;
+    err = hound_modify_ctx(cb_ctx->ctx, rq, true);
+    XASSERT_OK(err);
+    ts.tv_sec = 0;
+    ts.tv_nsec = 20*NSEC_PER_MSEC;
+    nanosleep(&ts, NULL);
+    err = hound_queue_length(cb_ctx->ctx, &len);
+    XASSERT_OK(err);
+    XASSERT_EQ(len, 0);
+
+    /* Go back to the defaults. */
+    set_overflow(rq, HOUND_OVERFLOW_DROP_OLDEST, 0, 0);
+    rq->cb = data_cb;
+    rq->cb_ctx = cb_ctx;
+    rq->queue_len = 10;
+    rq->queue_bytes = 0;
+    err = hound_modify_ctx(cb_ctx->ctx, rq, true);
+    XASSERT_OK(err);
+    err = hound_max_queue_bytes(cb_ctx->ctx, &bytes);
+    XASSERT_OK(err);
+    XASSERT_EQ(bytes, 0);
+}
+
+static
+void test_ctx_fd(struct cb_ctx *cb_ctx, struct hound_rq *rq)
+{
+    hound_err err;
+    int fd;
+    size_t len;
+    int other_fd;
+    struct pollfd pfd;
+    size_t records_read;
+    int ret;
+
+    rq->queue_len = 1000;
+    cb_ctx->allow_drops = true;
+    err = hound_modify_ctx(cb_ctx->ctx, rq, true);
+    XASSERT_OK(err);
+
+    err = hound_get_ctx_fd(cb_ctx->ctx, 0, &fd);
+    XASSERT_EQ(err, HOUND_INVALID_VAL);
+    err = hound_get_ctx_fd(cb_ctx->ctx, rq->queue_len + 1, &fd);
+    XASSERT_EQ(err, HOUND_QUEUE_TOO_SMALL);
+    err = hound_get_ctx_fd(cb_ctx->ctx, rq->queue_len / 2, &fd);
+    XASSERT_OK(err);
+    XASSERT_GTE(fd, 0);
+
+    /* The fd becomes readable once the queue reaches the watermark. */
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    ret = poll(&pfd, 1, 10*MSEC_PER_SEC);
+    XASSERT_EQ(ret, 1);
+    XASSERT(pfd.revents & POLLIN);
+    err = hound_queue_length(cb_ctx->ctx, &len);
+    XASSERT_OK(err);
+    XASSERT_GTE(len, rq->queue_len / 2);
+
+    /* Draining the queue clears it. */
+    err = hound_read_all_nowait(cb_ctx->ctx, &records_read);
+    XASSERT_OK(err);
+    XASSERT_GTE(records_read, rq->queue_len / 2);
+    ret = poll(&pfd, 1, 0);
+    XASSERT_EQ(ret, 0);
+
+    /* Changing the watermark keeps the same fd. */
+    err = hound_get_ctx_fd(cb_ctx->ctx, 1, &other_fd);
+    XASSERT_OK(err);
+    XASSERT_EQ(other_fd, fd);
+    ret = poll(&pfd, 1, 10*MSEC_PER_SEC);
+    XASSERT_EQ(ret, 1);
+
+    rq->queue_len = 10;
+    err = hound_modify_ctx(cb_ctx->ctx, rq, true);
+    XASSERT_OK(err);
+}
+
+#define SWAP_READERS 4
+#define SWAP_ROUNDS 50
+
+struct swap_ctx {
+    atomic_size_t count;
+};
+
+struct swap_reader {
+    pthread_t thread;
+    struct hound_ctx *ctx;
+    atomic_bool *stop;
+};
+
+static struct swap_ctx s_swap_ctxs[2];
+
+/*
+ * Each callback checks that it gets its own context, so a reader that sees a
+ * callback from one modify and a context from another fails.
+ */
+static
+void swap_cb0(
+    UNUSED const struct hound_record *rec,
+    UNUSED hound_seqno seqno,
+    void *cb_ctx)
+{
+    XASSERT_EQ(cb_ctx, &s_swap_ctxs[0]);
+    atomic_fetch_add(&s_swap_ctxs[0].count, 1);
+}
+
+static
+void swap_cb1(
+    UNUSED const struct hound_record *rec,
+    UNUSED hound_seqno seqno,
+    void *cb_ctx)
+{
+    XASSERT_EQ(cb_ctx, &s_swap_ctxs[1]);
+    atomic_fetch_add(&s_swap_ctxs[1].count, 1);
+}
+
+static
+void *swap_reader_thread(void *data)
+{
+    hound_err err;
+    struct swap_reader *reader;
+    size_t records_read;
+
+    reader = data;
+    while (!atomic_load(reader->stop)) {
+        err = hound_read_nowait(reader->ctx, 16, &records_read);
+        XASSERT_OK(err);
+    }
+
+    return NULL;
+}
+
+/*
+ * Readers don't take the context lock, so make sure several of them can read
+ * at once while the callback keeps changing underneath them.
+ */
+static
+void test_concurrent_readers(struct cb_ctx *cb_ctx, struct hound_rq *rq)
+{
+    hound_err err;
+    size_t i;
+    struct swap_reader readers[SWAP_READERS];
+    atomic_bool stop;
+    const struct timespec delay = { .tv_sec = 0, .tv_nsec = NSEC_PER_MSEC };
+
+    for (i = 0; i < ARRAYLEN(s_swap_ctxs); ++i) {
+        atomic_init(&s_swap_ctxs[i].count, 0);
+    }
+    atomic_init(&stop, false);
+
+    rq->queue_len = 1000;
+    for (i = 0; i < ARRAYLEN(readers); ++i) {
+        readers[i].ctx = cb_ctx->ctx;
+        readers[i].stop = &stop;
+        err = pthread_create(
+            &readers[i].thread,
+            NULL,
+            swap_reader_thread,
+            &readers[i]);
+        XASSERT_EQ(err, 0);
+    }
+
+    for (i = 0; i < SWAP_ROUNDS; ++i) {
+        rq->cb = (i % 2 == 0) ? swap_cb0 : swap_cb1;
+        rq->cb_ctx = &s_swap_ctxs[i % 2];
+        err = hound_modify_ctx(cb_ctx->ctx, rq, false);
+        XASSERT_OK(err);
+        nanosleep(&delay, NULL);
+    }
+
+    atomic_store(&stop, true);
+    for (i = 0; i < ARRAYLEN(readers); ++i) {
+        err = pthread_join(readers[i].thread, NULL);
+        XASSERT_EQ(err, 0);
+    }
+    XASSERT_GT(atomic_load(&s_swap_ctxs[0].count), 0);
+    XASSERT_GT(atomic_load(&s_swap_ctxs[1].count), 0);
+
+    rq->cb = data_cb;
+    rq->cb_ctx = cb_ctx;
+    rq->queue_len = 10;
+    err = hound_modify_ctx(cb_ctx->ctx, rq, true);
+    XASSERT_OK(err);
+}
+
+/*
+ * Spinning only changes how readers and the I/O thread wait, so records should
+ * flow the same with it on, and it should be possible to turn it on and off
+ * while the context runs. Use a fresh context so no interrupt from an earlier
+ * stop is pending.
+ */
+static
+void test_spin(struct hound_rq *rq)
+{
+    struct hound_ctx *ctx;
+    hound_err err;
+    size_t i;
+    size_t records_read;
+    struct hound_rq spin_rq;
+
+    err = hound_set_spin(NULL, 0, 0);
+    XASSERT_EQ(err, HOUND_NULL_VAL);
+
+    spin_rq = *rq;
+    spin_rq.cb = swap_cb0;
+    spin_rq.cb_ctx = &s_swap_ctxs[0];
+    atomic_store(&s_swap_ctxs[0].count, 0);
+    err = hound_alloc_ctx(&spin_rq, &ctx);
+    XASSERT_OK(err);
+
+    err = hound_set_spin(ctx, NSEC_PER_SEC + 1, 0);
+    XASSERT_EQ(err, HOUND_INVALID_VAL);
+    err = hound_set_spin(ctx, 0, NSEC_PER_SEC + 1);
+    XASSERT_EQ(err, HOUND_INVALID_VAL);
+
+    /* Set before starting, then change while running. */
+    err = hound_set_spin(ctx, 100*NSEC_PER_USEC, 100*NSEC_PER_USEC);
+    XASSERT_OK(err);
+    err = hound_start(ctx);
+    XASSERT_OK(err);
+    for (i = 0; i < 5; ++i) {
+        err = hound_read(ctx, 2, &records_read);
+        XASSERT_OK(err);
+        XASSERT_EQ(records_read, 2);
+    }
+
+    err = hound_set_spin(ctx, NSEC_PER_USEC, 0);
+    XASSERT_OK(err);
+    err = hound_read(ctx, 2, &records_read);
+    XASSERT_OK(err);
+    XASSERT_EQ(records_read, 2);
+
+    err = hound_set_spin(ctx, 0, 100*NSEC_PER_USEC);
+    XASSERT_OK(err);
+    err = hound_read(ctx, 2, &records_read);
+    XASSERT_OK(err);
+    XASSERT_EQ(records_read, 2);
+    XASSERT_EQ(atomic_load(&s_swap_ctxs[0].count), 14);
+
+    err = hound_stop(ctx);
+    XASSERT_OK(err);
+    err = hound_free_ctx(ctx);
+    XASSERT_OK(err);
+}
+
+struct filter_ctx {
+    bool have_last;
+    uint64_t last;
+    hound_data_period last_ns;
+    uint64_t min_step;
+    hound_data_period min_gap_ns;
+};
+
+static
+void filter_cb(
+    const struct hound_record *rec,
+    UNUSED hound_seqno seqno,
+    void *cb_ctx)
+{
+    uint64_t count;
+    struct filter_ctx *ctx;
+    hound_data_period ts;
+
+    ctx = cb_ctx;
+    memcpy(&count, rec->data, sizeof(count));
+    ts = NSEC_PER_SEC*rec->timestamp.tv_sec + rec->timestamp.tv_nsec;
+    if (ctx->have_last) {
+        XASSERT_GTE(count - ctx->last, ctx->min_step);
+        XASSERT_GTE(ts - ctx->last_ns, ctx->min_gap_ns);
+    }
+    ctx->have_last = true;
+    ctx->last = count;
+    ctx->last_ns = ts;
+}
+
+/*
+ * The counter goes up by one per record, so a deadband lets through every so
+ * many records, and the counts it skips show up in the stats.
+ */
+static
+void test_filter(void)
+{
+    struct hound_ctx *ctx;
+    hound_err err;
+    struct filter_ctx filter_ctx;
+    size_t i;
+    size_t records_read;
+    struct hound_rq rq;
+    struct hound_data_rq rq_list[] = {
+        {
+            .id = HOUND_DATA_COUNTER,
+            .period_ns = NSEC_PER_SEC/10000,
+            .deadband_abs = 4
+        }
+    };
+    struct hound_filter_stats stats;
+
+    memset(&filter_ctx, 0, sizeof(filter_ctx));
+    filter_ctx.min_step = 5;
+
+    memset(&rq, 0, sizeof(rq));
+    rq.queue_len = 100;
+    rq.cb = filter_cb;
+    rq.cb_ctx = &filter_ctx;
+    rq.rq_list.len = ARRAYLEN(rq_list);
+    rq.rq_list.data = rq_list;
+
+    rq_list[0].deadband_abs = -1;
+    err = hound_alloc_ctx(&rq, &ctx);
+    XASSERT_EQ(err, HOUND_INVALID_VAL);
+    rq_list[0].deadband_abs = 4;
+
+    err = hound_alloc_ctx(&rq, &ctx);
+    XASSERT_OK(err);
+    err = hound_get_filter_stats(ctx, NULL);
+    XASSERT_EQ(err, HOUND_NULL_VAL);
+
+    err = hound_start(ctx);
+    XASSERT_OK(err);
+    for (i = 0; i < 10; ++i) {
+        err = hound_read(ctx, 2, &records_read);
+        XASSERT_OK(err);
+        XASSERT_EQ(records_read, 2);
+    }
+
+    /* Changing only the filter takes effect without touching the driver. */
+    rq_list[0].deadband_abs = 0;
+    rq_list[0].min_interval_ns = NSEC_PER_MSEC;
+    filter_ctx.have_last = false;
+    filter_ctx.min_step = 1;
+    filter_ctx.min_gap_ns = NSEC_PER_MSEC;
+    err = hound_modify_ctx(ctx, &rq, true);
+    XASSERT_OK(err);
+    for (i = 0; i < 5; ++i) {
+        err = hound_read(ctx, 1, &records_read);
+        XASSERT_OK(err);
+        XASSERT_EQ(records_read, 1);
+    }
+
+    err = hound_stop(ctx);
+    XASSERT_OK(err);
+    err = hound_get_filter_stats(ctx, &stats);
+    XASSERT_OK(err);
+    XASSERT_GTE(stats.passed, 25);
+    XASSERT_GTE(stats.suppressed, 4*19);
+
+    err = hound_free_ctx(ctx);
+    XASSERT_OK(err);
+}
+
+struct resample_ctx {
+    bool have_last;
+    uint64_t last;
+    hound_data_period last_ns;
+    hound_data_period period_ns;
+    size_t count;
+};
+
+static
+void resample_cb(
+    const struct hound_record *rec,
+    UNUSED hound_seqno seqno,
+    void *cb_ctx)
+{
+    uint64_t count;
+    struct resample_ctx *ctx;
+    hound_data_period ts;
+
+    ctx = cb_ctx;
+    memcpy(&count, rec->data, sizeof(count));
+    ts = NSEC_PER_SEC*rec->timestamp.tv_sec + rec->timestamp.tv_nsec;
+    XASSERT_EQ(rec->data_id, HOUND_DATA_COUNTER);
+    XASSERT_EQ(ts % ctx->period_ns, 0);
+    if (ctx->have_last) {
+        /* A full queue may drop ticks, but never moves them off the grid. */
+        XASSERT_GT(ts, ctx->last_ns);
+        XASSERT_GTE(count, ctx->last);
+    }
+    ctx->have_last = true;
+    ctx->last = count;
+    ctx->last_ns = ts;
+    ++ctx->count;
+}
+
+/*
+ * The counter goes up with time, so every resampled count, whether held or
+ * interpolated, should be on the grid and no smaller than the one before it.
+ */
+static
+void test_resample(void)
+{
+    struct hound_ctx *ctx;
+    hound_err err;
+    size_t i;
+    hound_data_id ids[] = { HOUND_DATA_COUNTER };
+    size_t records_read;
+    struct resample_ctx resample_ctx;
+    struct hound_rq rq;
+    struct hound_data_rq rq_list[] = {
+        { .id = HOUND_DATA_COUNTER, .period_ns = NSEC_PER_SEC/10000 }
+    };
+    struct hound_resample_rq resample_rq = {
+        .period_ns = NSEC_PER_MSEC,
+        .policy = HOUND_RESAMPLE_LINEAR,
+        .max_gap_ns = NSEC_PER_MSEC/2,
+        .len = ARRAYLEN(ids),
+        .ids = ids
+    };
+    struct hound_resample_stats stats;
+
+    memset(&resample_ctx, 0, sizeof(resample_ctx));
+    resample_ctx.period_ns = resample_rq.period_ns;
+
+    memset(&rq, 0, sizeof(rq));
+    rq.queue_len = 100;
+    rq.cb = resample_cb;
+    rq.cb_ctx = &resample_ctx;
+    rq.rq_list.len = ARRAYLEN(rq_list);
+    rq.rq_list.data = rq_list;
+
+    err = hound_alloc_ctx(&rq, &ctx);
+    XASSERT_OK(err);
+
+    /* The max gap must cover at least one period. */
+    err = hound_set_resample(ctx, &resample_rq);
+    XASSERT_ERRCODE(err, HOUND_INVALID_VAL);
+    resample_rq.max_gap_ns = NSEC_PER_SEC;
+
+    err = hound_set_resample(ctx, &resample_rq);
+    XASSERT_OK(err);
+
+    err = hound_start(ctx);
+    XASSERT_OK(err);
+    for (i = 0; i < 10; ++i) {
+        err = hound_read(ctx, 2, &records_read);
+        XASSERT_OK(err);
+        XASSERT_EQ(records_read, 2);
+    }
+
+    err = hound_get_resample_stats(ctx, &stats);
+    XASSERT_OK(err);
+    XASSERT_GTE(stats.emitted, 20);
+
+    /* Switching to a hold keeps records on the same grid. */
+    resample_rq.policy = HOUND_RESAMPLE_HOLD;
+    err = hound_set_resample(ctx, &resample_rq);
+    XASSERT_OK(err);
+    for (i = 0; i < 10; ++i) {
+        err = hound_read(ctx, 2, &records_read);
+        XASSERT_OK(err);
+        XASSERT_EQ(records_read, 2);
+    }
+    XASSERT_EQ(resample_ctx.count, 40);
+
+    err = hound_stop(ctx);
+    XASSERT_OK(err);
+    err = hound_get_resample_stats(ctx, &stats);
+    XASSERT_OK(err);
+    XASSERT_GT(stats.emitted, 0);
+
+    err = hound_set_resample(ctx, NULL);
+    XASSERT_OK(err);
+    err = hound_get_resample_stats(ctx, &stats);
+    XASSERT_OK(err);
+    XASSERT_EQ(stats.emitted, 0);
+
+    err = hound_free_ctx(ctx);
+    XASSERT_OK(err);
+}
+
+/*
+ * Real-time settings usually need privileges we may not have, so accept either
+ * outcome, as long as the status agrees with the error code. Turning real-time
+ * mode back off needs no privileges, so that must always work.
+ */
+static
+void test_rt(struct cb_ctx *cb_ctx)
+{
+    int cpus[1];
+    hound_err err;
+    struct hound_rt_rq rt;
+    struct hound_rt_status status;
+
+    memset(&rt, 0, sizeof(rt));
+    rt.priority = -1;
+    err = hound_set_rt(&rt, &status);
+    XASSERT_EQ(err, HOUND_INVALID_VAL);
+    rt.priority = 0;
+    rt.cpu_count = 1;
+    rt.cpus = NULL;
+    err = hound_set_rt(&rt, &status);
+    XASSERT_EQ(err, HOUND_NULL_VAL);
+    cpus[0] = -1;
+    rt.cpus = cpus;
+    err = hound_set_rt(&rt, &status);
+    XASSERT_EQ(err, HOUND_INVALID_VAL);
+
+    /* Filling pools needs nothing special, so only that must succeed. */
+    cpus[0] = 0;
+    rt.priority = 1;
+    rt.lock_memory = true;
+    rt.pool_chunks = 32;
+    err = hound_set_rt(&rt, &status);
+    XASSERT(status.pools);
+    if (status.sched && status.affinity && status.memory) {
+        XASSERT_OK(err);
+    }
+    else {
+        XASSERT_EQ(err, HOUND_RT_UNAVAILABLE);
+    }
+
+    /* Dispatch threads started now pick up the settings too. */
+    err = hound_stop(cb_ctx->ctx);
+    XASSERT_OK(err);
+    err = hound_start_async(cb_ctx->ctx, 1, 8);
+    XASSERT_OK(err);
+    err = hound_stop(cb_ctx->ctx);
+    XASSERT_OK(err);
+    err = hound_start(cb_ctx->ctx);
+    XASSERT_OK(err);
+
+    memset(&rt, 0, sizeof(rt));
+    err = hound_set_rt(&rt, NULL);
+    XASSERT_OK(err);
+    err = hound_set_rt(NULL, NULL);
+    XASSERT_EQ(err, HOUND_NULL_VAL);
+}
+
+static
+void check_counter_desc(void)
+{
+    struct hound_datadesc *desc;
+    hound_err err;
+    size_t size;
+
+    err = hound_get_datadescs(&desc, &size);
+    XASSERT_OK(err);
+    XASSERT_EQ(size, 1);
+    XASSERT_STREQ(desc->name, "counter");
+    XASSERT_EQ(desc->fmt_count, 1);
+    XASSERT_STREQ(desc->fmts->name, "counter");
+    XASSERT_EQ(desc->fmts->size, sizeof(uint64_t));
+    hound_free_datadescs(desc);
+}
+
+static
+void test_decode(const struct hound_datadesc *desc)
+{
+    double column[16];
+    double *columns[1];
+    uint64_t count;
+    unsigned char data[ARRAYLEN(column) * (sizeof(count) + 1)];
+    hound_err err;
+    size_t i;
+    unsigned char *pos;
+    struct hound_record records[ARRAYLEN(column)];
+
+    /* Leave each record's data unaligned, which the decoder must handle. */
+    pos = data + 1;
+    for (i = 0; i < ARRAYLEN(records); ++i) {
+        count = 1000 * i;
+        memcpy(pos, &count, sizeof(count));
+        records[i].data_id = desc->data_id;
+        records[i].dev_id = desc->dev_id;
+        records[i].size = sizeof(count);
+        records[i].data = pos;
+        pos += sizeof(count) + 1;
+    }
+
+    err = hound_decode_batch(NULL, records, ARRAYLEN(records), columns);
+    XASSERT_EQ(err, HOUND_NULL_VAL);
+    err = hound_decode_batch(desc, NULL, ARRAYLEN(records), columns);
+    XASSERT_EQ(err, HOUND_NULL_VAL);
+    err = hound_decode_batch(desc, records, ARRAYLEN(records), NULL);
+    XASSERT_EQ(err, HOUND_NULL_VAL);
+
+    columns[0] = column;
+    err = hound_decode_batch(desc, records, ARRAYLEN(records), columns);
+    XASSERT_OK(err);
+    for (i = 0; i < ARRAYLEN(column); ++i) {
+        XASSERT_EQ(column[i], 1000 * i);
+    }
+
+    /* A NULL column is skipped. */
+    columns[0] = NULL;
+    err = hound_decode_batch(desc, records, ARRAYLEN(records), columns);
+    XASSERT_OK(err);
+
+    /* Records must match the descriptor. */
+    columns[0] = column;
+    records[3].data_id = desc->data_id + 1;
+    err = hound_decode_batch(desc, records, ARRAYLEN(records), columns);
+    XASSERT_EQ(err, HOUND_INVALID_VAL);
+    records[3].data_id = desc->data_id;
+
+    records[5].size = sizeof(count) - 1;
+    err = hound_decode_batch(desc, records, ARRAYLEN(records), columns);
+    XASSERT_EQ(err, HOUND_INVALID_VAL);
+}
+
+/**
+ * Finds the single cache file in the cache directory.
+ */
+static
+void get_cache_file(const char *dir, size_t len, char *path)
+{
+    struct dirent *entry;
+    size_t count;
+    DIR *d;
+    int ret;
+
+    d = opendir(dir);
+    XASSERT_NOT_NULL(d);
+    count = 0;
+    while ((entry = readdir(d)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        ret = snprintf(path, len, "%s/%s", dir, entry->d_name);
+        XASSERT_LT((size_t) ret, len);
+        ++count;
+    }
+    closedir(d);
+    XASSERT_EQ(count, 1);
+}
+
+static
+void read_file(const char *path, size_t len, char *data, size_t *size)
+{
+    FILE *f;
+    int ret;
+
+    f = fopen(path, "r");
+    XASSERT_NOT_NULL(f);
+    *size = fread(data, 1, len, f);
+    XASSERT_LT(*size, len);
+    ret = fclose(f);
+    XASSERT_EQ(ret, 0);
+}
+
+/*
+ * Overwrites a file in place, keeping its inode, size and timestamps, so that
+ * the cache can't tell it changed.
+ */
+static
+void overwrite_file(const char *path, const char *data, size_t size)
+{
+    FILE *f;
+    int ret;
+    struct stat st;
+    struct timespec times[2];
+
+    ret = stat(path, &st);
+    XASSERT_EQ(ret, 0);
+    XASSERT_EQ((size_t) st.st_size, size);
+
+    f = fopen(path, "r+");
+    XASSERT_NOT_NULL(f);
+    XASSERT_EQ(fwrite(data, 1, size, f), size);
+    ret = fclose(f);
+    XASSERT_EQ(ret, 0);
+
+    times[0] = st.st_atim;
+    times[1] = st.st_mtim;
+    ret = utimensat(AT_FDCWD, path, times, 0);
+    XASSERT_EQ(ret, 0);
+}
+
+/*
+ * Init from a private copy of the counter config. Once the cache is written,
+ * we break the copy without the cache noticing, so init can only work if it
+ * loads the cache.
+ */
+static
+void test_config_cache(const char *config_path, const char *schema_base)
+{
+    char cache_dir[] = "/tmp/hound-cache-XXXXXX";
+    char cache_file[PATH_MAX];
+    char config_dir[] = "/tmp/hound-config-XXXXXX";
+    char config_copy[PATH_MAX];
+    hound_err err;
+    char changed[4096];
+    FILE *f;
+    char *name;
+    char *old_env;
+    char original[ARRAYLEN(changed)];
+    int ret;
+    size_t size;
+
+    old_env = getenv("HOUND_CACHE_DIR");
+    if (old_env != NULL) {
+        old_env = strdup(old_env);
+        XASSERT_NOT_NULL(old_env);
+    }
+
+    XASSERT_NOT_NULL(mkdtemp(cache_dir));
+    ret = setenv("HOUND_CACHE_DIR", cache_dir, 1);
+    XASSERT_EQ(ret, 0);
+
+    XASSERT_NOT_NULL(mkdtemp(config_dir));
+    ret = snprintf(
+        config_copy,
+        ARRAYLEN(config_copy),
+        "%s/counter.yaml",
+        config_dir);
+    XASSERT_LT((size_t) ret, ARRAYLEN(config_copy));
+    read_file(config_path, ARRAYLEN(original), original, &size);
+    f = fopen(config_copy, "w");
+    XASSERT_NOT_NULL(f);
+    XASSERT_EQ(fwrite(original, 1, size, f), size);
+    ret = fclose(f);
+    XASSERT_EQ(ret, 0);
+
+    /* The same config, but naming a driver that doesn't exist. */
+    original[size] = '\0';
+    memcpy(changed, original, size + 1);
+    name = strstr(changed, "name: counter");
+    XASSERT_NOT_NULL(name);
+    name[strlen("name: counter") - 1] = 'X';
+
+    /* The first init parses YAML and writes the cache. */
+    err = hound_init_config(config_copy, schema_base);
+    XASSERT_OK(err);
+    check_counter_desc();
+    err = hound_destroy_driver("/dev/counter");
+    XASSERT_OK(err);
+    get_cache_file(cache_dir, ARRAYLEN(cache_file), cache_file);
+
+    /* The second init loads the cache, since the YAML would now fail. */
+    overwrite_file(config_copy, changed, size);
+    err = hound_init_config(config_copy, schema_base);
+    XASSERT_OK(err);
+    check_counter_desc();
+    err = hound_destroy_driver("/dev/counter");
+    XASSERT_OK(err);
+
+    /* A cache that others could have written should be ignored. */
+    ret = chmod(cache_file, 0666);
+    XASSERT_EQ(ret, 0);
+    err = hound_init_config(config_copy, schema_base);
+    XASSERT_NEQ(err, HOUND_OK);
+    ret = chmod(cache_file, 0600);
+    XASSERT_EQ(ret, 0);
+
+    ret = chmod(cache_dir, 0777);
+    XASSERT_EQ(ret, 0);
+    err = hound_init_config(config_copy, schema_base);
+    XASSERT_NEQ(err, HOUND_OK);
+    ret = chmod(cache_dir, 0700);
+    XASSERT_EQ(ret, 0);
+
+    /* A corrupt cache should be ignored. */
+    f = fopen(cache_file, "r+");
+    XASSERT_NOT_NULL(f);
+    ret = fseek(f, -1, SEEK_END);
+    XASSERT_EQ(ret, 0);
+    ret = fputc('!', f);
+    XASSERT_EQ(ret, '!');
+    ret = fclose(f);
+    XASSERT_EQ(ret, 0);
+
+    err = hound_init_config(config_copy, schema_base);
+    XASSERT_NEQ(err, HOUND_OK);
+
+    /* With the YAML back, init works again and rewrites the cache. */
+    overwrite_file(config_copy, original, size);
+    err = hound_init_config(config_copy, schema_base);
+    XASSERT_OK(err);
+    check_counter_desc();
+    err = hound_destroy_driver("/dev/counter");
+    XASSERT_OK(err);
+
+    ret = unlink(config_copy);
+    XASSERT_EQ(ret, 0);
+    ret = rmdir(config_dir);
+    XASSERT_EQ(ret, 0);
+    ret = unlink(cache_file);
+    XASSERT_EQ(ret, 0);
+    ret = rmdir(cache_dir);
+    XASSERT_EQ(ret, 0);
+
+    if (old_env != NULL) {
+        ret = setenv("HOUND_CACHE_DIR", old_env, 1);
+        free(old_env);
+    }
+    else {
+        ret = unsetenv("HOUND_CACHE_DIR");
+    }
+    XASSERT_EQ(ret, 0);
+}
+
 int main(int argc, const char **argv)
 {
     size_t bytes_read;
@@ -107,6 +1581,8 @@ int main(int argc, const char **argv)
     }
     total_bytes = total_records * sizeof(size_t);
 
+    test_config_cache(config_path, schema_base);
+
     err = hound_init_config(config_path, schema_base);
     XASSERT_OK(err);
 
@@ -115,6 +1591,7 @@ int main(int argc, const char **argv)
     cb_ctx.ctx = NULL;
     cb_ctx.allow_drops = false;
     rq.queue_len = 100 * total_records;
+    rq.queue_bytes = 0;
     rq.cb = data_cb;
     rq.cb_ctx = &cb_ctx;
     rq.rq_list.len = ARRAYLEN(rq_list);
@@ -141,6 +1618,8 @@ int main(int argc, const char **argv)
 
     cb_ctx.dev_id = desc->dev_id;
 
+    test_decode(desc);
+
     hound_free_datadescs(desc);
 
     /* Do individual, sync reads. */
@@ -205,6 +1684,37 @@ int main(int argc, const char **argv)
     XASSERT_EQ(count_bytes, total_bytes)
     XASSERT_GTE(count_records, total_records);
 
+    /* Do blocking byte reads. */
+    err = hound_read_bytes(
+        cb_ctx.ctx,
+        total_bytes,
+        &records_read,
+        &bytes_read);
+    XASSERT_OK(err);
+    XASSERT_EQ(bytes_read, total_bytes);
+    XASSERT_EQ(records_read, total_records);
+
+    /* Time out waiting for more bytes than can arrive in time. */
+    err = hound_read_bytes_timeout(
+        cb_ctx.ctx,
+        rq.queue_len * sizeof(uint64_t),
+        NSEC_PER_MSEC,
+        &records_read,
+        &bytes_read);
+    XASSERT_EQ(err, HOUND_TIMEOUT);
+    XASSERT_LT(bytes_read, rq.queue_len * sizeof(uint64_t));
+    XASSERT_EQ(bytes_read, records_read * sizeof(uint64_t));
+
+    /* A huge timeout must not wrap around into the past. */
+    err = hound_read_bytes_timeout(
+        cb_ctx.ctx,
+        total_bytes,
+        UINT_FAST64_MAX,
+        &records_read,
+        &bytes_read);
+    XASSERT_OK(err);
+    XASSERT_EQ(bytes_read, total_bytes);
+
     /* Expand the queue length and verify we don't lose data. */
     rq.queue_len *= 5;
     cb_ctx.allow_drops = false;
@@ -239,6 +1749,19 @@ int main(int argc, const char **argv)
     }
     XASSERT_EQ(count_records, total_records);
 
+    test_query_range(&cb_ctx, total_records);
+    test_async(&cb_ctx, &rq, total_records);
+    test_async_stop(&cb_ctx, &rq);
+    test_overflow(&cb_ctx, &rq);
+    test_queue_bytes(&cb_ctx, &rq);
+    test_oversized_records();
+    test_ctx_fd(&cb_ctx, &rq);
+    test_concurrent_readers(&cb_ctx, &rq);
+    test_spin(&rq);
+    test_filter();
+    test_resample();
+    test_rt(&cb_ctx);
+
     /* Change the data frequency. */
     rq_list[0].period_ns /= 2;
     rq_list[1].period_ns *= 2;
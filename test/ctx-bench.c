@@ -0,0 +1,361 @@
+/**
+ * @file      ctx-bench.c
+ * @brief     Benchmark for the context lifecycle with many data IDs. Generates
+ *            a schema with one data descriptor per ID, backs it with a
+ *            pull-mode load generator, and times allocating, starting,
+ *            modifying, stopping and freeing a context that requests every ID.
+ *            Modifying is timed both for swapping every request and for
+ *            changing just one. Results are printed as a JSON object, with the
+ *            mean time of each operation.
+ * @author    Martin Kelly <mkelly@xevo.com>
+ * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
+ */
+
+#define _GNU_SOURCE
+
+#include <hound/hound.h>
+#include <hound-private/util.h>
+#include <hound-test/assert.h>
+#include <hound-test/id.h>
+#include <linux/limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DRIVER_PATH "/dev/loadgen-ctx-bench"
+#define SCHEMA_NAME "ctx-bench.yaml"
+
+#define DEFAULT_ITERATIONS 100
+
+/*
+ * Data is pulled this slowly when the context runs at its periodic rate, so the
+ * benchmark measures the context operations rather than moving records.
+ */
+#define PULL_PERIOD_NS NSEC_PER_SEC
+
+enum op {
+    OP_ALLOC,
+    OP_START,
+    OP_MODIFY,
+    OP_MODIFY_ONE,
+    OP_STOP,
+    OP_FREE,
+    OP_COUNT
+};
+
+static const char *s_op_names[OP_COUNT] = {
+    [OP_ALLOC] = "alloc",
+    [OP_START] = "start",
+    [OP_MODIFY] = "modify",
+    [OP_MODIFY_ONE] = "modify_one",
+    [OP_STOP] = "stop",
+    [OP_FREE] = "free"
+};
+
+static
+void data_cb(
+    UNUSED const struct hound_record *rec,
+    UNUSED hound_seqno seqno,
+    UNUSED void *data)
+{
+}
+
+static
+hound_data_period get_time_ns(void)
+{
+    int ret;
+    struct timespec ts;
+
+    ret = clock_gettime(CLOCK_MONOTONIC, &ts);
+    XASSERT_EQ(ret, 0);
+
+    return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static
+void write_schema(const char *dir, size_t count)
+{
+    FILE *f;
+    size_t i;
+    char path[PATH_MAX];
+    int ret;
+
+    ret = snprintf(path, sizeof(path), "%s/%s", dir, SCHEMA_NAME);
+    XASSERT_GT(ret, 0);
+    XASSERT_LT((size_t) ret, sizeof(path));
+
+    f = fopen(path, "w");
+    XASSERT_NOT_NULL(f);
+    for (i = 0; i < count; ++i) {
+        fprintf(
+            f,
+            "---\n"
+            "id: 0x%08x\n"
+            "name: ctx-bench%zu\n"
+            "fmt:\n"
+            "    - name: payload\n"
+            "      unit: none\n"
+            "      type: bytes\n"
+            "      size: 0\n",
+            HOUND_DATA_CTX_BENCH_BASE + (hound_data_id) i,
+            i);
+    }
+    ret = fclose(f);
+    XASSERT_EQ(ret, 0);
+}
+
+static
+void remove_schema(const char *dir)
+{
+    char path[PATH_MAX];
+    int ret;
+
+    ret = snprintf(path, sizeof(path), "%s/%s", dir, SCHEMA_NAME);
+    XASSERT_GT(ret, 0);
+    XASSERT_LT((size_t) ret, sizeof(path));
+
+    ret = unlink(path);
+    XASSERT_EQ(ret, 0);
+    ret = rmdir(dir);
+    XASSERT_EQ(ret, 0);
+}
+
+static
+void init_driver(const char *schema_base, size_t count)
+{
+    struct hound_init_arg *arg;
+    struct hound_init_arg *args;
+    hound_err err;
+    size_t i;
+
+    args = malloc(4 * count * sizeof(*args));
+    XASSERT_NOT_NULL(args);
+    for (i = 0; i < count; ++i) {
+        arg = &args[4*i];
+        arg[0].type = HOUND_TYPE_UINT32;
+        arg[0].data.as_uint32 = HOUND_DATA_CTX_BENCH_BASE + i;
+        arg[1].type = HOUND_TYPE_UINT64;
+        arg[1].data.as_uint64 = PULL_PERIOD_NS;
+        arg[2].type = HOUND_TYPE_UINT32;
+        arg[2].data.as_uint32 = sizeof(uint64_t);
+        arg[3].type = HOUND_TYPE_UINT32;
+        arg[3].data.as_uint32 = 1;
+    }
+
+    err = hound_init_driver(
+        "loadgen-pull",
+        DRIVER_PATH,
+        schema_base,
+        SCHEMA_NAME,
+        4 * count,
+        args);
+    XASSERT_OK(err);
+
+    free(args);
+}
+
+static
+void make_rqs(struct hound_data_rq *rqs, size_t count, hound_data_period period)
+{
+    size_t i;
+
+    memset(rqs, 0, count * sizeof(*rqs));
+    for (i = 0; i < count; ++i) {
+        rqs[i].id = HOUND_DATA_CTX_BENCH_BASE + i;
+        rqs[i].period_ns = period;
+    }
+}
+
+/*
+ * Validation indexes requests by data ID, so check that it still catches the
+ * conflicts it used to find by comparing every pair of requests.
+ */
+static
+void test_validate(size_t count)
+{
+    struct hound_ctx *ctx;
+    struct hound_data_rq *data_rqs;
+    hound_err err;
+    size_t half;
+    struct hound_rq rq = {
+        .queue_len = 1024,
+        .queue_bytes = 0,
+        .cb = data_cb,
+        .cb_ctx = NULL
+    };
+
+    /* Each ID twice, once on-demand and once periodic, is fine. */
+    half = count;
+    if (half > HOUND_MAX_DATA_REQ / 2) {
+        half = HOUND_MAX_DATA_REQ / 2;
+    }
+    data_rqs = malloc(2 * half * sizeof(*data_rqs));
+    XASSERT_NOT_NULL(data_rqs);
+    make_rqs(data_rqs, half, 0);
+    make_rqs(data_rqs + half, half, PULL_PERIOD_NS);
+    rq.rq_list.len = 2 * half;
+    rq.rq_list.data = data_rqs;
+    err = hound_alloc_ctx(&rq, &ctx);
+    XASSERT_OK(err);
+    err = hound_free_ctx(ctx);
+    XASSERT_OK(err);
+
+    /* The same ID and period twice is a duplicate, wherever it appears. */
+    data_rqs[2*half - 1].period_ns = 0;
+    err = hound_alloc_ctx(&rq, &ctx);
+    XASSERT_EQ(err, HOUND_DUPLICATE_DATA_REQUESTED);
+    data_rqs[2*half - 1].period_ns = PULL_PERIOD_NS;
+
+    /* Requests for the same ID must agree on how the queue treats it. */
+    data_rqs[2*half - 1].overflow = HOUND_OVERFLOW_DROP_NEWEST;
+    err = hound_alloc_ctx(&rq, &ctx);
+    XASSERT_EQ(err, HOUND_INVALID_VAL);
+
+    free(data_rqs);
+}
+
+static
+void bench(size_t count, size_t iterations)
+{
+    struct hound_ctx *ctx;
+    struct hound_data_rq *data_rqs;
+    hound_err err;
+    size_t i;
+    size_t op;
+    struct hound_data_rq *mixed_data_rqs;
+    struct hound_rq mixed_rq;
+    struct hound_rq on_demand_rq;
+    struct hound_data_rq *periodic_data_rqs;
+    struct hound_rq periodic_rq;
+    hound_data_period start;
+    hound_data_period totals[OP_COUNT];
+
+    data_rqs = malloc(count * sizeof(*data_rqs));
+    XASSERT_NOT_NULL(data_rqs);
+    make_rqs(data_rqs, count, 0);
+    periodic_data_rqs = malloc(count * sizeof(*periodic_data_rqs));
+    XASSERT_NOT_NULL(periodic_data_rqs);
+    make_rqs(periodic_data_rqs, count, PULL_PERIOD_NS);
+    /* The same as the on-demand requests, except the last is periodic. */
+    mixed_data_rqs = malloc(count * sizeof(*mixed_data_rqs));
+    XASSERT_NOT_NULL(mixed_data_rqs);
+    make_rqs(mixed_data_rqs, count, 0);
+    mixed_data_rqs[count-1].period_ns = PULL_PERIOD_NS;
+
+    on_demand_rq.queue_len = 1024;
+    on_demand_rq.queue_bytes = 0;
+    on_demand_rq.cb = data_cb;
+    on_demand_rq.cb_ctx = NULL;
+    on_demand_rq.rq_list.len = count;
+    on_demand_rq.rq_list.data = data_rqs;
+    periodic_rq = on_demand_rq;
+    periodic_rq.rq_list.data = periodic_data_rqs;
+    mixed_rq = on_demand_rq;
+    mixed_rq.rq_list.data = mixed_data_rqs;
+
+    memset(totals, 0, sizeof(totals));
+    for (i = 0; i < iterations; ++i) {
+        start = get_time_ns();
+        err = hound_alloc_ctx(&on_demand_rq, &ctx);
+        XASSERT_OK(err);
+        totals[OP_ALLOC] += get_time_ns() - start;
+
+        start = get_time_ns();
+        err = hound_start(ctx);
+        XASSERT_OK(err);
+        totals[OP_START] += get_time_ns() - start;
+
+        /* Swap every request for another one, and back again. */
+        start = get_time_ns();
+        err = hound_modify_ctx(ctx, &periodic_rq, false);
+        XASSERT_OK(err);
+        err = hound_modify_ctx(ctx, &on_demand_rq, false);
+        XASSERT_OK(err);
+        totals[OP_MODIFY] += get_time_ns() - start;
+
+        /* Change a single request, and back again. */
+        start = get_time_ns();
+        err = hound_modify_ctx(ctx, &mixed_rq, false);
+        XASSERT_OK(err);
+        err = hound_modify_ctx(ctx, &on_demand_rq, false);
+        XASSERT_OK(err);
+        totals[OP_MODIFY_ONE] += get_time_ns() - start;
+
+        start = get_time_ns();
+        err = hound_stop(ctx);
+        XASSERT_OK(err);
+        totals[OP_STOP] += get_time_ns() - start;
+
+        start = get_time_ns();
+        err = hound_free_ctx(ctx);
+        XASSERT_OK(err);
+        totals[OP_FREE] += get_time_ns() - start;
+    }
+    /* Each iteration modifies twice. */
+    totals[OP_MODIFY] /= 2;
+    totals[OP_MODIFY_ONE] /= 2;
+
+    printf("{\"ids\": %zu, \"iterations\": %zu", count, iterations);
+    for (op = 0; op < OP_COUNT; ++op) {
+        printf(
+            ", \"%s_us\": %.1f",
+            s_op_names[op],
+            (double) totals[op] / iterations / NSEC_PER_USEC);
+    }
+    printf("}\n");
+
+    free(mixed_data_rqs);
+    free(periodic_data_rqs);
+    free(data_rqs);
+}
+
+int main(int argc, const char **argv)
+{
+    size_t count;
+    char dir[] = "/tmp/hound-ctx-bench-XXXXXX";
+    hound_err err;
+    size_t iterations;
+    char *p;
+
+    if (argc > 3) {
+        fprintf(stderr, "Usage: %s [ID-COUNT [ITERATIONS]]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    count = HOUND_MAX_DATA_REQ;
+    if (argc > 1) {
+        count = strtoul(argv[1], NULL, 10);
+        if (count == 0 || count > HOUND_MAX_DATA_REQ) {
+            fprintf(
+                stderr,
+                "ID-COUNT must be between 1 and %d\n",
+                HOUND_MAX_DATA_REQ);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    iterations = DEFAULT_ITERATIONS;
+    if (argc > 2) {
+        iterations = strtoul(argv[2], NULL, 10);
+        if (iterations == 0) {
+            fprintf(stderr, "ITERATIONS must be a positive number\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    p = mkdtemp(dir);
+    XASSERT_NOT_NULL(p);
+    write_schema(dir, count);
+    init_driver(dir, count);
+
+    test_validate(count);
+    bench(count, iterations);
+
+    err = hound_destroy_driver(DRIVER_PATH);
+    XASSERT_OK(err);
+    remove_schema(dir);
+
+    return EXIT_SUCCESS;
+}
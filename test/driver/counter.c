@@ -21,6 +21,9 @@
 #define READ_END (0)
 #define WRITE_END (1)
 
+/* The max number of counts we write to the pipe at once. */
+#define BATCH_SIZE (512)
+
 struct counter_ctx {
     int pipe[2];
     uint64_t count;
@@ -100,7 +103,7 @@ hound_err counter_parse(unsigned char *buf, size_t bytes)
     hound_err err;
     size_t i;
     struct hound_record record;
-    const unsigned char *pos;
+    unsigned char *pos;
 
     XASSERT_NOT_NULL(buf);
     XASSERT_GT(bytes, 0);
@@ -116,17 +119,12 @@ hound_err counter_parse(unsigned char *buf, size_t bytes)
     count = bytes / sizeof(ctx->count);
     pos = buf;
     for (i = 0; i < count; ++i) {
-        record.data = drv_alloc(sizeof(ctx->count));
-        if (record.data == NULL) {
-            return HOUND_OOM;
-        }
-
-        /* We have at least a full record. */
+        /* We read zero-copy, so the record can point right into the buffer. */
         err = clock_gettime(CLOCK_REALTIME, &record.timestamp);
         XASSERT_EQ(err, 0);
         record.data_id = HOUND_DATA_COUNTER;
         record.size = sizeof(ctx->count);
-        memcpy(record.data, pos, sizeof(ctx->count));
+        record.data = pos;
 
         drv_push_records(&record, 1);
 
@@ -136,6 +134,20 @@ hound_err counter_parse(unsigned char *buf, size_t bytes)
     return HOUND_OK;
 }
 
+static
+hound_err counter_read_info(size_t *size, bool *zero_copy)
+{
+    struct counter_ctx *ctx;
+
+    ctx = drv_ctx();
+    XASSERT_NOT_NULL(ctx);
+
+    *size = BATCH_SIZE * sizeof(ctx->count);
+    *zero_copy = true;
+
+    return HOUND_OK;
+}
+
 static
 hound_err counter_start(int *fd)
 {
@@ -199,6 +211,36 @@ hound_err counter_next(hound_data_id id)
 	return HOUND_OK;
 }
 
+static
+hound_err counter_next_batch(const hound_data_id *ids, size_t count, size_t n)
+{
+    uint64_t buf[BATCH_SIZE];
+    size_t chunk;
+    struct counter_ctx *ctx;
+    size_t i;
+    size_t remaining;
+    ssize_t written;
+
+    ctx = drv_ctx();
+    XASSERT_NOT_NULL(ctx);
+
+    XASSERT_EQ(count, 1);
+    XASSERT_EQ(ids[0], HOUND_DATA_COUNTER);
+
+    /* Write the counts in as few syscalls as we can. */
+    for (remaining = n; remaining > 0; remaining -= chunk) {
+        chunk = remaining < ARRAYLEN(buf) ? remaining : ARRAYLEN(buf);
+        for (i = 0; i < chunk; ++i) {
+            buf[i] = ctx->count;
+            ++ctx->count;
+        }
+        written = write(ctx->pipe[WRITE_END], buf, chunk * sizeof(*buf));
+        XASSERT_EQ(written, chunk * sizeof(*buf));
+    }
+
+    return HOUND_OK;
+}
+
 static struct driver_ops counter_driver = {
     .init = counter_init,
     .destroy = counter_destroy,
@@ -207,8 +249,10 @@ static struct driver_ops counter_driver = {
     .setdata = counter_setdata,
     .poll = drv_default_pull,
     .parse = counter_parse,
+    .read_info = counter_read_info,
     .start = counter_start,
     .next = counter_next,
+    .next_batch = counter_next_batch,
     .stop = counter_stop
 };
 
@@ -127,12 +127,8 @@ hound_err file_parse(unsigned char *buf, size_t bytes)
     XASSERT_NOT_NULL(buf);
     XASSERT_GT(bytes, 0);
 
-    record.data = drv_alloc(bytes * sizeof(*buf));
-    if (record.data == NULL) {
-        return HOUND_OOM;
-    }
-
-    memcpy(record.data, buf, bytes);
+    /* We read zero-copy, so the record can point right into the buffer. */
+    record.data = buf;
     record.data_id = s_datadesc.data_id;
     record.timestamp = timestamp;
     record.size = bytes;
@@ -142,6 +138,21 @@ hound_err file_parse(unsigned char *buf, size_t bytes)
     return HOUND_OK;
 }
 
+static
+hound_err file_read_info(size_t *size, bool *zero_copy)
+{
+    struct file_ctx *ctx;
+
+    ctx = drv_ctx();
+    XASSERT_NOT_NULL(ctx);
+
+    /* Read as much as file_next writes at once. */
+    *size = ARRAYLEN(ctx->buf);
+    *zero_copy = true;
+
+    return HOUND_OK;
+}
+
 static
 hound_err file_next(hound_data_id id)
 {
@@ -232,6 +243,7 @@ static struct driver_ops file_driver = {
     .setdata = file_setdata,
     .poll = drv_default_push,
     .parse = file_parse,
+    .read_info = file_read_info,
     .start = file_start,
     .next = file_next,
     .stop = file_stop
@@ -0,0 +1,666 @@
+/**
+ * @file      loadgen.c
+ * @brief     Synthetic load generator driver, used for benchmarking and soak
+ *            testing the core without hardware. It produces a configurable set
+ *            of data IDs, each with its own rate, payload size, and burst size.
+ *
+ *            The driver registers under two names:
+ *            - "loadgen" runs in push mode. A timerfd wakes the I/O core, and
+ *              each stream emits a burst of records every (period * burst)
+ *              nanoseconds, so the average rate is one record per period.
+ *            - "loadgen-pull" runs in pull mode. Each pull (scheduled by the
+ *              core, or triggered by hound_next) emits one burst.
+ *
+ *            The init args are a list of streams, each given by four args:
+ *            - uint32: the data ID, which must be in the driver's schema
+ *            - uint64: the period in nanoseconds
+ *            - uint32: the payload size in bytes (at least 8)
+ *            - uint32: the number of records per burst (at least 1)
+ *
+ *            The first 8 bytes of each payload hold a per-stream sequence
+ *            number, starting at 0, so consumers can detect loss.
+ * @author    Martin Kelly <mkelly@xevo.com>
+ * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
+ */
+
+#define _GNU_SOURCE
+#include <hound/hound.h>
+#include <hound-private/driver.h>
+#include <hound-private/util.h>
+#include <hound-test/assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FD_INVALID (-1)
+
+#define READ_END (0)
+#define WRITE_END (1)
+
+#define ARGS_PER_STREAM (4)
+
+/*
+ * If we fall more than this many bursts behind on a stream, we skip ahead
+ * rather than trying to catch up all at once, so an overloaded core can't
+ * stall the poll loop indefinitely.
+ */
+#define MAX_CATCHUP_BURSTS (16)
+
+struct stream {
+    hound_data_id id;
+    hound_data_period period_ns;
+    size_t size;
+    uint32_t burst;
+
+    /* The number of active requests, as a stream can be requested per period. */
+    size_t active_rqs;
+    uint64_t seqno;
+    hound_data_period next_due;
+};
+
+struct loadgen_ctx {
+    bool push;
+    int fd;
+    int pipe[2];
+    size_t stream_count;
+    struct stream *streams;
+};
+
+static
+hound_data_period get_monotonic_ns(void)
+{
+    int ret;
+    struct timespec ts;
+
+    ret = clock_gettime(CLOCK_MONOTONIC, &ts);
+    XASSERT_EQ(ret, 0);
+
+    return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static
+int compare_streams(const void *a, const void *b)
+{
+    const struct stream *x;
+    const struct stream *y;
+
+    x = a;
+    y = b;
+    if (x->id < y->id) {
+        return -1;
+    }
+    if (x->id > y->id) {
+        return 1;
+    }
+    return 0;
+}
+
+/* Streams are sorted by data ID, so this stays cheap with many streams. */
+static
+struct stream *find_stream(struct loadgen_ctx *ctx, hound_data_id id)
+{
+    struct stream key;
+
+    key.id = id;
+    return bsearch(
+        &key,
+        ctx->streams,
+        ctx->stream_count,
+        sizeof(*ctx->streams),
+        compare_streams);
+}
+
+static
+hound_err loadgen_init_common(
+    bool push,
+    size_t arg_count,
+    const struct hound_init_arg *args)
+{
+    const struct hound_init_arg *arg;
+    struct loadgen_ctx *ctx;
+    hound_err err;
+    size_t i;
+    struct stream *stream;
+
+    if (args == NULL) {
+        return HOUND_NULL_VAL;
+    }
+    if (arg_count == 0 || arg_count % ARGS_PER_STREAM != 0) {
+        return HOUND_INVALID_VAL;
+    }
+
+    ctx = malloc(sizeof(*ctx));
+    if (ctx == NULL) {
+        err = HOUND_OOM;
+        goto error_alloc_ctx;
+    }
+    ctx->push = push;
+    ctx->fd = FD_INVALID;
+    ctx->pipe[READ_END] = FD_INVALID;
+    ctx->pipe[WRITE_END] = FD_INVALID;
+    ctx->stream_count = arg_count / ARGS_PER_STREAM;
+
+    ctx->streams = malloc(ctx->stream_count * sizeof(*ctx->streams));
+    if (ctx->streams == NULL) {
+        err = HOUND_OOM;
+        goto error_alloc_streams;
+    }
+
+    for (i = 0; i < ctx->stream_count; ++i) {
+        arg = &args[i * ARGS_PER_STREAM];
+        if (arg[0].type != HOUND_TYPE_UINT32 ||
+            arg[1].type != HOUND_TYPE_UINT64 ||
+            arg[2].type != HOUND_TYPE_UINT32 ||
+            arg[3].type != HOUND_TYPE_UINT32) {
+            err = HOUND_INVALID_VAL;
+            goto error_parse;
+        }
+
+        stream = &ctx->streams[i];
+        stream->id = arg[0].data.as_uint32;
+        stream->period_ns = arg[1].data.as_uint64;
+        stream->size = arg[2].data.as_uint32;
+        stream->burst = arg[3].data.as_uint32;
+        stream->active_rqs = 0;
+        stream->seqno = 0;
+        stream->next_due = 0;
+
+        /* Push mode has no way to honor on-demand (0) periods. */
+        if ((push && stream->period_ns == 0) ||
+            stream->size < sizeof(stream->seqno) ||
+            stream->burst == 0) {
+            err = HOUND_INVALID_VAL;
+            goto error_parse;
+        }
+    }
+
+    /* Each data ID may have only one stream. */
+    qsort(
+        ctx->streams,
+        ctx->stream_count,
+        sizeof(*ctx->streams),
+        compare_streams);
+    for (i = 1; i < ctx->stream_count; ++i) {
+        if (ctx->streams[i].id == ctx->streams[i-1].id) {
+            err = HOUND_INVALID_VAL;
+            goto error_parse;
+        }
+    }
+
+    drv_set_ctx(ctx);
+
+    return HOUND_OK;
+
+error_parse:
+    free(ctx->streams);
+error_alloc_streams:
+    free(ctx);
+error_alloc_ctx:
+    return err;
+}
+
+static
+hound_err loadgen_push_init(
+    UNUSED const char *path,
+    size_t arg_count,
+    const struct hound_init_arg *args)
+{
+    return loadgen_init_common(true, arg_count, args);
+}
+
+static
+hound_err loadgen_pull_init(
+    UNUSED const char *path,
+    size_t arg_count,
+    const struct hound_init_arg *args)
+{
+    return loadgen_init_common(false, arg_count, args);
+}
+
+static
+hound_err loadgen_destroy(void)
+{
+    struct loadgen_ctx *ctx;
+
+    ctx = drv_ctx();
+    free(ctx->streams);
+    free(ctx);
+
+    return HOUND_OK;
+}
+
+static
+hound_err loadgen_device_name(char *device_name)
+{
+    strcpy(device_name, "loadgen");
+
+    return HOUND_OK;
+}
+
+static
+hound_err loadgen_datadesc(size_t desc_count, struct drv_datadesc *descs)
+{
+    struct loadgen_ctx *ctx;
+    struct drv_datadesc *desc;
+    size_t found;
+    size_t i;
+    struct stream *stream;
+
+    ctx = drv_ctx();
+    XASSERT_NOT_NULL(ctx);
+
+    found = 0;
+    for (i = 0; i < desc_count; ++i) {
+        desc = &descs[i];
+        stream = find_stream(ctx, desc->schema_desc->data_id);
+        if (stream == NULL) {
+            desc->enabled = false;
+            continue;
+        }
+        ++found;
+
+        /* Push mode runs at the configured rate; pull mode also on demand. */
+        desc->enabled = true;
+        desc->period_count = ctx->push ? 1 : 2;
+        desc->avail_periods = drv_alloc(
+            desc->period_count * sizeof(*desc->avail_periods));
+        if (desc->avail_periods == NULL) {
+            /* The core frees any periods we already allocated. */
+            return HOUND_OOM;
+        }
+        desc->avail_periods[0] = stream->period_ns;
+        if (!ctx->push) {
+            desc->avail_periods[1] = 0;
+        }
+    }
+
+    /*
+     * Every configured stream must be in the schema. Data IDs are unique in
+     * both, so it's enough to count the matches.
+     */
+    if (found != ctx->stream_count) {
+        return HOUND_INVALID_VAL;
+    }
+
+    return HOUND_OK;
+}
+
+static
+hound_err arm_timer(struct loadgen_ctx *ctx)
+{
+    struct itimerspec its;
+    hound_data_period next_due;
+    size_t i;
+    int ret;
+    const struct stream *stream;
+
+    next_due = 0;
+    for (i = 0; i < ctx->stream_count; ++i) {
+        stream = &ctx->streams[i];
+        if (stream->active_rqs > 0 &&
+            (next_due == 0 || stream->next_due < next_due)) {
+            next_due = stream->next_due;
+        }
+    }
+
+    /* A zero it_value disarms the timer, which we want if nothing is active. */
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = next_due / NSEC_PER_SEC;
+    its.it_value.tv_nsec = next_due % NSEC_PER_SEC;
+    ret = timerfd_settime(ctx->fd, TFD_TIMER_ABSTIME, &its, NULL);
+    if (ret != 0) {
+        return errno;
+    }
+
+    return HOUND_OK;
+}
+
+static
+hound_err loadgen_setdata(const struct hound_data_rq *rqs, size_t rqs_len)
+{
+    struct loadgen_ctx *ctx;
+    size_t i;
+    hound_data_period now;
+    struct stream *stream;
+
+    ctx = drv_ctx();
+    XASSERT_NOT_NULL(ctx);
+
+    now = get_monotonic_ns();
+    for (i = 0; i < ctx->stream_count; ++i) {
+        stream = &ctx->streams[i];
+        stream->active_rqs = 0;
+    }
+    for (i = 0; i < rqs_len; ++i) {
+        stream = find_stream(ctx, rqs[i].id);
+        XASSERT_NOT_NULL(stream);
+        if (stream->active_rqs == 0) {
+            stream->next_due = now;
+        }
+        ++stream->active_rqs;
+    }
+
+    /* If we're already running, pick up the new schedule right away. */
+    if (ctx->push && ctx->fd != FD_INVALID) {
+        return arm_timer(ctx);
+    }
+
+    return HOUND_OK;
+}
+
+static
+hound_err loadgen_modifydata(
+    const struct hound_data_rq *add,
+    size_t add_len,
+    const struct hound_data_rq *remove,
+    size_t remove_len)
+{
+    struct loadgen_ctx *ctx;
+    size_t i;
+    hound_data_period now;
+    struct stream *stream;
+
+    ctx = drv_ctx();
+    XASSERT_NOT_NULL(ctx);
+
+    /* Streams that stay active keep their schedule and sequence numbers. */
+    now = get_monotonic_ns();
+    for (i = 0; i < add_len; ++i) {
+        stream = find_stream(ctx, add[i].id);
+        XASSERT_NOT_NULL(stream);
+        if (stream->active_rqs == 0) {
+            stream->next_due = now;
+        }
+        ++stream->active_rqs;
+    }
+    for (i = 0; i < remove_len; ++i) {
+        stream = find_stream(ctx, remove[i].id);
+        XASSERT_NOT_NULL(stream);
+        XASSERT_GT(stream->active_rqs, 0);
+        --stream->active_rqs;
+    }
+
+    if (ctx->push && ctx->fd != FD_INVALID) {
+        return arm_timer(ctx);
+    }
+
+    return HOUND_OK;
+}
+
+static
+hound_err emit_burst(struct stream *stream)
+{
+    hound_err err;
+    uint32_t i;
+    struct hound_record record;
+    struct timespec timestamp;
+
+    err = clock_gettime(CLOCK_REALTIME, &timestamp);
+    XASSERT_EQ(err, 0);
+
+    record.data_id = stream->id;
+    record.timestamp = timestamp;
+    record.size = stream->size;
+    for (i = 0; i < stream->burst; ++i) {
+        record.data = drv_alloc(stream->size);
+        if (record.data == NULL) {
+            return HOUND_OOM;
+        }
+        memcpy(record.data, &stream->seqno, sizeof(stream->seqno));
+        memset(
+            record.data + sizeof(stream->seqno),
+            (unsigned char) stream->seqno,
+            stream->size - sizeof(stream->seqno));
+        ++stream->seqno;
+
+        drv_push_records(&record, 1);
+    }
+
+    return HOUND_OK;
+}
+
+static
+hound_err loadgen_push_parse(
+    UNUSED unsigned char *buf,
+    UNUSED size_t bytes)
+{
+    size_t bursts;
+    struct loadgen_ctx *ctx;
+    hound_err err;
+    size_t i;
+    hound_data_period interval;
+    hound_data_period now;
+    struct stream *stream;
+
+    ctx = drv_ctx();
+    XASSERT_NOT_NULL(ctx);
+
+    /*
+     * The buffer holds the timerfd expiration count, which we don't need, as
+     * we track each stream's schedule ourselves.
+     */
+    now = get_monotonic_ns();
+    for (i = 0; i < ctx->stream_count; ++i) {
+        stream = &ctx->streams[i];
+        if (stream->active_rqs == 0) {
+            continue;
+        }
+
+        interval = stream->period_ns * stream->burst;
+        for (bursts = 0; stream->next_due <= now; ++bursts) {
+            if (bursts == MAX_CATCHUP_BURSTS) {
+                stream->next_due = now + interval;
+                break;
+            }
+            err = emit_burst(stream);
+            if (err != HOUND_OK) {
+                return err;
+            }
+            stream->next_due += interval;
+        }
+    }
+
+    return arm_timer(ctx);
+}
+
+static
+hound_err loadgen_pull_parse(unsigned char *buf, size_t bytes)
+{
+    struct loadgen_ctx *ctx;
+    hound_err err;
+    size_t i;
+    size_t index;
+
+    XASSERT_NOT_NULL(buf);
+    XASSERT_GT(bytes, 0);
+
+    ctx = drv_ctx();
+    XASSERT_NOT_NULL(ctx);
+
+    /* We write full stream indices, so we should not get partial reads. */
+    if (bytes % sizeof(index) != 0) {
+        return HOUND_DRIVER_FAIL;
+    }
+
+    for (i = 0; i < bytes / sizeof(index); ++i) {
+        memcpy(&index, buf + i * sizeof(index), sizeof(index));
+        XASSERT_LT(index, ctx->stream_count);
+        err = emit_burst(&ctx->streams[index]);
+        if (err != HOUND_OK) {
+            return err;
+        }
+    }
+
+    return HOUND_OK;
+}
+
+static
+hound_err loadgen_push_start(int *fd)
+{
+    struct loadgen_ctx *ctx;
+    hound_err err;
+
+    ctx = drv_ctx();
+    XASSERT_NOT_NULL(ctx);
+    XASSERT_EQ(ctx->fd, FD_INVALID);
+
+    ctx->fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (ctx->fd == FD_INVALID) {
+        return errno;
+    }
+
+    err = arm_timer(ctx);
+    if (err != HOUND_OK) {
+        close(ctx->fd);
+        ctx->fd = FD_INVALID;
+        return err;
+    }
+    *fd = ctx->fd;
+
+    return HOUND_OK;
+}
+
+static
+hound_err loadgen_pull_start(int *fd)
+{
+    struct loadgen_ctx *ctx;
+    int ret;
+
+    ctx = drv_ctx();
+    XASSERT_NOT_NULL(ctx);
+    XASSERT_EQ(ctx->fd, FD_INVALID);
+
+    ret = pipe2(ctx->pipe, O_CLOEXEC);
+    if (ret != 0) {
+        return errno;
+    }
+    ctx->fd = ctx->pipe[READ_END];
+    *fd = ctx->fd;
+
+    return HOUND_OK;
+}
+
+static
+hound_err loadgen_stop(void)
+{
+    struct loadgen_ctx *ctx;
+    int ret;
+
+    ctx = drv_ctx();
+    XASSERT_NOT_NULL(ctx);
+    XASSERT_NEQ(ctx->fd, FD_INVALID);
+
+    ret = close(ctx->fd);
+    XASSERT_EQ(ret, 0);
+    if (!ctx->push) {
+        ret = close(ctx->pipe[WRITE_END]);
+        XASSERT_EQ(ret, 0);
+        ctx->pipe[READ_END] = FD_INVALID;
+        ctx->pipe[WRITE_END] = FD_INVALID;
+    }
+    ctx->fd = FD_INVALID;
+
+    return HOUND_OK;
+}
+
+static
+hound_err loadgen_next(hound_data_id id)
+{
+    struct loadgen_ctx *ctx;
+    size_t index;
+    struct stream *stream;
+    ssize_t written;
+
+    ctx = drv_ctx();
+    XASSERT_NOT_NULL(ctx);
+
+    stream = find_stream(ctx, id);
+    XASSERT_NOT_NULL(stream);
+    index = stream - ctx->streams;
+
+    written = write(ctx->pipe[WRITE_END], &index, sizeof(index));
+    XASSERT_EQ(written, sizeof(index));
+
+    return HOUND_OK;
+}
+
+static
+hound_err loadgen_next_batch(
+    const hound_data_id *ids,
+    size_t count,
+    size_t n)
+{
+    struct loadgen_ctx *ctx;
+    size_t i;
+    size_t *indices;
+    size_t j;
+    struct stream *stream;
+    ssize_t written;
+
+    ctx = drv_ctx();
+    XASSERT_NOT_NULL(ctx);
+
+    indices = malloc(count * n * sizeof(*indices));
+    if (indices == NULL) {
+        return HOUND_OOM;
+    }
+
+    for (i = 0; i < count; ++i) {
+        stream = find_stream(ctx, ids[i]);
+        XASSERT_NOT_NULL(stream);
+        for (j = 0; j < n; ++j) {
+            indices[i*n + j] = stream - ctx->streams;
+        }
+    }
+
+    /* Request every burst with a single write. */
+    written = write(
+        ctx->pipe[WRITE_END],
+        indices,
+        count * n * sizeof(*indices));
+    XASSERT_EQ(written, count * n * sizeof(*indices));
+    free(indices);
+
+    return HOUND_OK;
+}
+
+static struct driver_ops loadgen_push_driver = {
+    .init = loadgen_push_init,
+    .destroy = loadgen_destroy,
+    .device_name = loadgen_device_name,
+    .datadesc = loadgen_datadesc,
+    .setdata = loadgen_setdata,
+    .modifydata = loadgen_modifydata,
+    .poll = drv_default_push,
+    .parse = loadgen_push_parse,
+    .start = loadgen_push_start,
+    .next = NULL,
+    .next_batch = NULL,
+    .stop = loadgen_stop
+};
+
+static struct driver_ops loadgen_pull_driver = {
+    .init = loadgen_pull_init,
+    .destroy = loadgen_destroy,
+    .device_name = loadgen_device_name,
+    .datadesc = loadgen_datadesc,
+    .setdata = loadgen_setdata,
+    .modifydata = loadgen_modifydata,
+    .poll = drv_default_pull,
+    .parse = loadgen_pull_parse,
+    .start = loadgen_pull_start,
+    .next = loadgen_next,
+    .next_batch = loadgen_next_batch,
+    .stop = loadgen_stop
+};
+
+HOUND_DRIVER_REGISTER_FUNC
+static void register_loadgen_driver(void)
+{
+    driver_register("loadgen", &loadgen_push_driver);
+    driver_register("loadgen-pull", &loadgen_pull_driver);
+}
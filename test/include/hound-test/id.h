@@ -18,5 +18,15 @@
 #define HOUND_DATA_FILE ((hound_data_id) 0xffffff01)
 #define HOUND_DATA_NOP1 ((hound_data_id) 0xffffff02)
 #define HOUND_DATA_NOP2 ((hound_data_id) 0xffffff03)
+#define HOUND_DATA_LOADGEN0 ((hound_data_id) 0xffffff04)
+#define HOUND_DATA_LOADGEN1 ((hound_data_id) 0xffffff05)
+#define HOUND_DATA_LOADGEN2 ((hound_data_id) 0xffffff06)
+#define HOUND_DATA_LOADGEN3 ((hound_data_id) 0xffffff07)
+
+/* No driver provides this, so tests use it for combined join records. */
+#define HOUND_DATA_JOINED ((hound_data_id) 0xffffff08)
+
+/* The context benchmark generates a schema with IDs counting up from here. */
+#define HOUND_DATA_CTX_BENCH_BASE ((hound_data_id) 0xfffe0000)
 
 #endif /* HOUND_TEST_ID_H_ */
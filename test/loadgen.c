@@ -0,0 +1,915 @@
+/**
+ * @file      loadgen.c
+ * @brief     Unit test and soak test for the load generator driver. In push
+ *            mode, the test runs for a given duration and prints the achieved
+ *            throughput as a JSON object, so it doubles as a benchmark.
+ * @author    Martin Kelly <mkelly@xevo.com>
+ * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <hound/hound.h>
+#include <hound-private/util.h>
+#include <hound-test/assert.h>
+#include <hound-test/id.h>
+#include <inttypes.h>
+#include <linux/limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define PUSH_PATH "/dev/loadgen"
+#define PULL_PATH "/dev/loadgen-pull"
+
+#define DEFAULT_DURATION_MS 200
+
+#define MAX_JOIN_SAMPLES 256
+
+struct stream_spec {
+    hound_data_id id;
+    hound_data_period period_ns;
+    uint32_t size;
+    uint32_t burst;
+};
+
+struct stream_stats {
+    const struct stream_spec *spec;
+    uint64_t records;
+    uint64_t bytes;
+};
+
+struct cb_ctx {
+    size_t stream_count;
+    struct stream_stats *stats;
+};
+
+/*
+ * A small, steady stream next to a large, bursty one. These must match
+ * config/loadgen.yaml.
+ */
+static const struct stream_spec s_push_specs[] = {
+    {
+        .id = HOUND_DATA_LOADGEN0,
+        .period_ns = NSEC_PER_MSEC,
+        .size = 64,
+        .burst = 1
+    },
+    {
+        .id = HOUND_DATA_LOADGEN1,
+        .period_ns = 250 * NSEC_PER_USEC,
+        .size = 4096,
+        .burst = 8
+    }
+};
+
+static const struct stream_spec s_pull_specs[] = {
+    {
+        .id = HOUND_DATA_LOADGEN2,
+        .period_ns = NSEC_PER_MSEC,
+        .size = 8,
+        .burst = 1
+    },
+    {
+        .id = HOUND_DATA_LOADGEN3,
+        .period_ns = NSEC_PER_MSEC,
+        .size = 1500,
+        .burst = 4
+    }
+};
+
+static
+void data_cb(
+    const struct hound_record *rec,
+    UNUSED hound_seqno seqno,
+    void *data)
+{
+    struct cb_ctx *ctx;
+    size_t i;
+    uint64_t stream_seqno;
+    struct stream_stats *stats;
+
+    XASSERT_NOT_NULL(rec);
+    XASSERT_NOT_NULL(data);
+    ctx = data;
+
+    stats = NULL;
+    for (i = 0; i < ctx->stream_count; ++i) {
+        if (ctx->stats[i].spec->id == rec->data_id) {
+            stats = &ctx->stats[i];
+            break;
+        }
+    }
+    XASSERT_NOT_NULL(stats);
+
+    /* Every record should arrive, in order, with the configured size. */
+    XASSERT_EQ(rec->size, stats->spec->size);
+    memcpy(&stream_seqno, rec->data, sizeof(stream_seqno));
+    XASSERT_EQ(stream_seqno, stats->records);
+    if (rec->size > sizeof(stream_seqno)) {
+        XASSERT_EQ(rec->data[rec->size-1], (uint8_t) stream_seqno);
+    }
+
+    ++stats->records;
+    stats->bytes += rec->size;
+}
+
+static
+void init_driver(
+    const char *name,
+    const char *path,
+    const char *schema_base,
+    const struct stream_spec *specs,
+    size_t spec_count)
+{
+    struct hound_init_arg *arg;
+    struct hound_init_arg *args;
+    hound_err err;
+    size_t i;
+
+    args = malloc(4 * spec_count * sizeof(*args));
+    XASSERT_NOT_NULL(args);
+    for (i = 0; i < spec_count; ++i) {
+        arg = &args[4*i];
+        arg[0].type = HOUND_TYPE_UINT32;
+        arg[0].data.as_uint32 = specs[i].id;
+        arg[1].type = HOUND_TYPE_UINT64;
+        arg[1].data.as_uint64 = specs[i].period_ns;
+        arg[2].type = HOUND_TYPE_UINT32;
+        arg[2].data.as_uint32 = specs[i].size;
+        arg[3].type = HOUND_TYPE_UINT32;
+        arg[3].data.as_uint32 = specs[i].burst;
+    }
+
+    err = hound_init_driver(
+        name,
+        path,
+        schema_base,
+        "loadgen.yaml",
+        4 * spec_count,
+        args);
+    XASSERT_OK(err);
+
+    free(args);
+}
+
+static
+void test_bad_args(const char *schema_base)
+{
+    struct hound_init_arg args[4];
+    hound_err err;
+
+    /* Push mode can't generate on-demand data. */
+    args[0].type = HOUND_TYPE_UINT32;
+    args[0].data.as_uint32 = HOUND_DATA_LOADGEN0;
+    args[1].type = HOUND_TYPE_UINT64;
+    args[1].data.as_uint64 = 0;
+    args[2].type = HOUND_TYPE_UINT32;
+    args[2].data.as_uint32 = 64;
+    args[3].type = HOUND_TYPE_UINT32;
+    args[3].data.as_uint32 = 1;
+    err = hound_init_driver(
+        "loadgen",
+        PUSH_PATH,
+        schema_base,
+        "loadgen.yaml",
+        ARRAYLEN(args),
+        args);
+    XASSERT_EQ(err, HOUND_INVALID_VAL);
+
+    /* Payloads must have room for the sequence number. */
+    args[1].data.as_uint64 = NSEC_PER_MSEC;
+    args[2].data.as_uint32 = 4;
+    err = hound_init_driver(
+        "loadgen",
+        PUSH_PATH,
+        schema_base,
+        "loadgen.yaml",
+        ARRAYLEN(args),
+        args);
+    XASSERT_EQ(err, HOUND_INVALID_VAL);
+
+    /* The data ID must be in the schema. */
+    args[0].data.as_uint32 = HOUND_DATA_COUNTER;
+    args[2].data.as_uint32 = 64;
+    err = hound_init_driver(
+        "loadgen",
+        PUSH_PATH,
+        schema_base,
+        "loadgen.yaml",
+        ARRAYLEN(args),
+        args);
+    XASSERT_EQ(err, HOUND_INVALID_VAL);
+
+    /* Streams come in groups of four args. */
+    err = hound_init_driver(
+        "loadgen",
+        PUSH_PATH,
+        schema_base,
+        "loadgen.yaml",
+        ARRAYLEN(args) - 1,
+        args);
+    XASSERT_EQ(err, HOUND_INVALID_VAL);
+}
+
+static
+void test_push(uint64_t duration_ms)
+{
+    size_t bytes_read;
+    struct hound_ctx *ctx;
+    struct cb_ctx cb_ctx;
+    struct hound_data_rq data_rqs[ARRAYLEN(s_push_specs)];
+    hound_data_period elapsed_ns;
+    hound_err err;
+    uint64_t expected;
+    size_t i;
+    size_t records_read;
+    int ret;
+    struct timespec start;
+    struct stream_stats stats[ARRAYLEN(s_push_specs)];
+    struct timespec stop;
+    uint64_t total_bytes;
+    uint64_t total_records;
+    struct hound_rq rq = {
+        .queue_len = 4096,
+        .queue_bytes = 0,
+        .cb = data_cb,
+        .cb_ctx = &cb_ctx,
+        .rq_list.len = ARRAYLEN(data_rqs),
+        .rq_list.data = data_rqs
+    };
+
+    for (i = 0; i < ARRAYLEN(s_push_specs); ++i) {
+        stats[i].spec = &s_push_specs[i];
+        stats[i].records = 0;
+        stats[i].bytes = 0;
+        memset(&data_rqs[i], 0, sizeof(data_rqs[i]));
+        data_rqs[i].id = s_push_specs[i].id;
+        data_rqs[i].period_ns = s_push_specs[i].period_ns;
+    }
+    cb_ctx.stream_count = ARRAYLEN(stats);
+    cb_ctx.stats = stats;
+
+    err = hound_alloc_ctx(&rq, &ctx);
+    XASSERT_OK(err);
+
+    ret = clock_gettime(CLOCK_MONOTONIC, &start);
+    XASSERT_EQ(ret, 0);
+
+    err = hound_start(ctx);
+    XASSERT_OK(err);
+
+    do {
+        err = hound_read_bytes_timeout(
+            ctx,
+            16*4096,
+            10*NSEC_PER_MSEC,
+            &records_read,
+            &bytes_read);
+        if (err != HOUND_TIMEOUT) {
+            XASSERT_OK(err);
+        }
+
+        ret = clock_gettime(CLOCK_MONOTONIC, &stop);
+        XASSERT_EQ(ret, 0);
+        elapsed_ns = (stop.tv_sec - start.tv_sec) * NSEC_PER_SEC +
+                     stop.tv_nsec - start.tv_nsec;
+    } while (elapsed_ns < duration_ms * NSEC_PER_MSEC);
+
+    err = hound_stop(ctx);
+    XASSERT_OK(err);
+    err = hound_read_all_nowait(ctx, &records_read);
+    XASSERT_OK(err);
+
+    ret = clock_gettime(CLOCK_MONOTONIC, &stop);
+    XASSERT_EQ(ret, 0);
+    elapsed_ns = (stop.tv_sec - start.tv_sec) * NSEC_PER_SEC +
+                 stop.tv_nsec - start.tv_nsec;
+
+    /*
+     * Timing under load (or valgrind) is unpredictable, so just make sure we
+     * got some data and didn't exceed the configured rate.
+     */
+    total_records = 0;
+    total_bytes = 0;
+    for (i = 0; i < ARRAYLEN(stats); ++i) {
+        expected = elapsed_ns / stats[i].spec->period_ns;
+        XASSERT_GT(stats[i].records, 0);
+        XASSERT_LTE(stats[i].records, expected + stats[i].spec->burst);
+        total_records += stats[i].records;
+        total_bytes += stats[i].bytes;
+    }
+
+    printf(
+        "{\"mode\": \"push\", \"seconds\": %f, \"records\": %" PRIu64 ", "
+        "\"records_per_sec\": %.0f, \"bytes_per_sec\": %.0f}\n",
+        (double) elapsed_ns / NSEC_PER_SEC,
+        total_records,
+        (double) total_records * NSEC_PER_SEC / elapsed_ns,
+        (double) total_bytes * NSEC_PER_SEC / elapsed_ns);
+
+    err = hound_free_ctx(ctx);
+    XASSERT_OK(err);
+}
+
+static
+void test_pull(void)
+{
+    struct hound_ctx *ctx;
+    struct cb_ctx cb_ctx;
+    struct hound_data_rq data_rqs[ARRAYLEN(s_pull_specs)];
+    hound_err err;
+    size_t i;
+    size_t n;
+    size_t records;
+    struct stream_stats stats[ARRAYLEN(s_pull_specs)];
+    struct hound_rq rq = {
+        .queue_len = 1024,
+        .queue_bytes = 0,
+        .cb = data_cb,
+        .cb_ctx = &cb_ctx,
+        .rq_list.len = ARRAYLEN(data_rqs),
+        .rq_list.data = data_rqs
+    };
+
+    records = 0;
+    for (i = 0; i < ARRAYLEN(s_pull_specs); ++i) {
+        stats[i].spec = &s_pull_specs[i];
+        stats[i].records = 0;
+        stats[i].bytes = 0;
+        memset(&data_rqs[i], 0, sizeof(data_rqs[i]));
+        data_rqs[i].id = s_pull_specs[i].id;
+        data_rqs[i].period_ns = 0;
+        records += s_pull_specs[i].burst;
+    }
+    cb_ctx.stream_count = ARRAYLEN(stats);
+    cb_ctx.stats = stats;
+
+    err = hound_alloc_ctx(&rq, &ctx);
+    XASSERT_OK(err);
+
+    err = hound_start(ctx);
+    XASSERT_OK(err);
+
+    /* Each pull yields one burst per stream. */
+    n = 10;
+    err = hound_next(ctx, n);
+    XASSERT_OK(err);
+    err = hound_read(ctx, n * records, NULL);
+    XASSERT_OK(err);
+    for (i = 0; i < ARRAYLEN(stats); ++i) {
+        XASSERT_EQ(stats[i].records, n * stats[i].spec->burst);
+    }
+
+    err = hound_stop(ctx);
+    XASSERT_OK(err);
+
+    err = hound_free_ctx(ctx);
+    XASSERT_OK(err);
+}
+
+/*
+ * Modifying a context changes only the data that differs, so streams that stay
+ * requested keep flowing without gaps in their sequence numbers.
+ */
+static
+void test_modify(void)
+{
+    struct hound_ctx *ctx;
+    struct cb_ctx cb_ctx;
+    struct hound_data_rq data_rqs[ARRAYLEN(s_pull_specs)];
+    hound_err err;
+    size_t i;
+    size_t n;
+    struct stream_stats stats[ARRAYLEN(s_pull_specs)];
+    struct hound_rq rq = {
+        .queue_len = 1024,
+        .queue_bytes = 0,
+        .cb = data_cb,
+        .cb_ctx = &cb_ctx,
+        .rq_list.len = 1,
+        .rq_list.data = data_rqs
+    };
+
+    XASSERT_EQ(ARRAYLEN(s_pull_specs), 2);
+    for (i = 0; i < ARRAYLEN(s_pull_specs); ++i) {
+        stats[i].spec = &s_pull_specs[i];
+        stats[i].records = 0;
+        stats[i].bytes = 0;
+        memset(&data_rqs[i], 0, sizeof(data_rqs[i]));
+        data_rqs[i].id = s_pull_specs[i].id;
+        data_rqs[i].period_ns = 0;
+    }
+    cb_ctx.stream_count = ARRAYLEN(stats);
+    cb_ctx.stats = stats;
+
+    /* Start with just the first stream. */
+    err = hound_alloc_ctx(&rq, &ctx);
+    XASSERT_OK(err);
+
+    err = hound_start(ctx);
+    XASSERT_OK(err);
+
+    n = 10;
+    err = hound_next(ctx, n);
+    XASSERT_OK(err);
+    err = hound_read(ctx, n * stats[0].spec->burst, NULL);
+    XASSERT_OK(err);
+    XASSERT_EQ(stats[0].records, n * stats[0].spec->burst);
+    XASSERT_EQ(stats[1].records, 0);
+
+    /* Add the second stream, keeping the first. */
+    rq.rq_list.len = 2;
+    err = hound_modify_ctx(ctx, &rq, false);
+    XASSERT_OK(err);
+
+    err = hound_next(ctx, n);
+    XASSERT_OK(err);
+    err = hound_read(
+        ctx,
+        n * (stats[0].spec->burst + stats[1].spec->burst),
+        NULL);
+    XASSERT_OK(err);
+    XASSERT_EQ(stats[0].records, 2 * n * stats[0].spec->burst);
+    XASSERT_EQ(stats[1].records, n * stats[1].spec->burst);
+
+    /* Drop the first stream, keeping the second. */
+    rq.rq_list.len = 1;
+    rq.rq_list.data = &data_rqs[1];
+    err = hound_modify_ctx(ctx, &rq, false);
+    XASSERT_OK(err);
+
+    err = hound_next(ctx, n);
+    XASSERT_OK(err);
+    err = hound_read(ctx, n * stats[1].spec->burst, NULL);
+    XASSERT_OK(err);
+    XASSERT_EQ(stats[0].records, 2 * n * stats[0].spec->burst);
+    XASSERT_EQ(stats[1].records, 2 * n * stats[1].spec->burst);
+
+    err = hound_stop(ctx);
+    XASSERT_OK(err);
+
+    err = hound_free_ctx(ctx);
+    XASSERT_OK(err);
+}
+
+struct sample_log {
+    size_t len;
+    hound_data_period ts[MAX_JOIN_SAMPLES];
+};
+
+struct joined_log {
+    size_t len;
+    hound_data_period anchor_ts[MAX_JOIN_SAMPLES];
+    hound_data_period member_ts[MAX_JOIN_SAMPLES];
+};
+
+static
+hound_data_period get_ts(const struct timespec *ts)
+{
+    return NSEC_PER_SEC*ts->tv_sec + ts->tv_nsec;
+}
+
+static
+void sample_cb(
+    const struct hound_record *rec,
+    UNUSED hound_seqno seqno,
+    void *data)
+{
+    struct sample_log *log;
+
+    log = data;
+    XASSERT_LT(log->len, ARRAYLEN(log->ts));
+    log->ts[log->len] = get_ts(&rec->timestamp);
+    ++log->len;
+}
+
+static
+void joined_cb(
+    const struct hound_record *rec,
+    UNUSED hound_seqno seqno,
+    void *data)
+{
+    const struct hound_record *anchor;
+    struct joined_log *log;
+    const struct hound_record *member;
+    uint64_t stream_seqno;
+
+    log = data;
+    XASSERT_LT(log->len, ARRAYLEN(log->anchor_ts));
+
+    /* An array of the member records, then their payloads, in order. */
+    XASSERT_EQ(rec->data_id, HOUND_DATA_JOINED);
+    XASSERT_EQ(
+        rec->size,
+        2*sizeof(struct hound_record) +
+        s_pull_specs[0].size + s_pull_specs[1].size);
+    anchor = (const struct hound_record *) rec->data;
+    member = anchor + 1;
+    XASSERT_EQ(anchor->data_id, s_pull_specs[0].id);
+    XASSERT_EQ(member->data_id, s_pull_specs[1].id);
+    XASSERT_EQ(anchor->size, s_pull_specs[0].size);
+    XASSERT_EQ(member->size, s_pull_specs[1].size);
+    XASSERT_EQ(anchor->data, rec->data + 2*sizeof(struct hound_record));
+    XASSERT_EQ(member->data, anchor->data + anchor->size);
+    memcpy(&stream_seqno, member->data, sizeof(stream_seqno));
+    XASSERT_EQ(member->data[member->size-1], (uint8_t) stream_seqno);
+
+    XASSERT_EQ(get_ts(&rec->timestamp), get_ts(&anchor->timestamp));
+    log->anchor_ts[log->len] = get_ts(&anchor->timestamp);
+    log->member_ts[log->len] = get_ts(&member->timestamp);
+    ++log->len;
+}
+
+/*
+ * Works out which member sample the join stage should pick for an anchor, or
+ * returns false if there is none within tolerance.
+ */
+static
+bool find_expected_match(
+    const struct sample_log *members,
+    hound_data_period anchor_ts,
+    const struct hound_join_rq *rq,
+    hound_data_period *member_ts)
+{
+    bool have_next;
+    bool have_prev;
+    size_t i;
+    hound_data_period next;
+    hound_data_period prev;
+
+    have_prev = false;
+    have_next = false;
+    prev = 0;
+    next = 0;
+    for (i = 0; i < members->len; ++i) {
+        if (members->ts[i] <= anchor_ts) {
+            have_prev = true;
+            prev = members->ts[i];
+        }
+        else {
+            have_next = true;
+            next = members->ts[i];
+            break;
+        }
+    }
+
+    have_prev = have_prev && anchor_ts - prev <= rq->tolerance_ns;
+    have_next = have_next && next - anchor_ts <= rq->tolerance_ns;
+    if (rq->policy == HOUND_JOIN_LAST_VALUE) {
+        have_next = false;
+    }
+
+    if (have_prev && (!have_next || anchor_ts - prev <= next - anchor_ts)) {
+        *member_ts = prev;
+        return true;
+    }
+    if (have_next) {
+        *member_ts = next;
+        return true;
+    }
+    return false;
+}
+
+/*
+ * Joins the pull streams, pulling each stream on its own through a separate
+ * context as the steps say: 'a' pulls an anchor, 'm' pulls a member burst, '-'
+ * waits a little and '=' waits longer than the tolerance. The separate
+ * contexts see every sample, so we can work out what the join should have
+ * produced.
+ *
+ * Once min_emitted combined records are out, the statistics must not change
+ * any more, except for unmatched_samples. If the steps end in a member pull,
+ * every sample before that pull is accounted for.
+ */
+static
+void run_join(
+    const struct hound_join_rq *join_rq,
+    const char *steps,
+    size_t min_emitted,
+    struct sample_log *anchors,
+    struct sample_log *members,
+    struct joined_log *joined,
+    struct hound_join_stats *stats)
+{
+    struct hound_ctx *anchor_ctx;
+    size_t anchor_pulls;
+    struct hound_data_rq data_rqs[ARRAYLEN(s_pull_specs)];
+    hound_err err;
+    size_t i;
+    struct hound_ctx *join_ctx;
+    struct hound_ctx *member_ctx;
+    size_t member_pulls;
+    size_t read;
+    struct hound_rq rq = {
+        .queue_len = 1024,
+        .queue_bytes = 0,
+        .rq_list.len = 1
+    };
+    struct timespec wait;
+
+    XASSERT_EQ(ARRAYLEN(s_pull_specs), 2);
+    for (i = 0; i < ARRAYLEN(s_pull_specs); ++i) {
+        memset(&data_rqs[i], 0, sizeof(data_rqs[i]));
+        data_rqs[i].id = s_pull_specs[i].id;
+        data_rqs[i].period_ns = 0;
+    }
+
+    anchors->len = 0;
+    members->len = 0;
+    joined->len = 0;
+
+    rq.cb = sample_cb;
+    rq.cb_ctx = anchors;
+    rq.rq_list.data = &data_rqs[0];
+    err = hound_alloc_ctx(&rq, &anchor_ctx);
+    XASSERT_OK(err);
+
+    rq.cb_ctx = members;
+    rq.rq_list.data = &data_rqs[1];
+    err = hound_alloc_ctx(&rq, &member_ctx);
+    XASSERT_OK(err);
+
+    rq.cb = joined_cb;
+    rq.cb_ctx = joined;
+    rq.rq_list.len = ARRAYLEN(data_rqs);
+    rq.rq_list.data = data_rqs;
+    err = hound_alloc_ctx(&rq, &join_ctx);
+    XASSERT_OK(err);
+    err = hound_set_join(join_ctx, join_rq);
+    XASSERT_OK(err);
+
+    err = hound_start(join_ctx);
+    XASSERT_OK(err);
+    err = hound_start(anchor_ctx);
+    XASSERT_OK(err);
+    err = hound_start(member_ctx);
+    XASSERT_OK(err);
+
+    anchor_pulls = 0;
+    member_pulls = 0;
+    for (; *steps != '\0'; ++steps) {
+        wait.tv_sec = 0;
+        wait.tv_nsec = 0;
+        switch (*steps) {
+            case 'a':
+                err = hound_next(anchor_ctx, 1);
+                XASSERT_OK(err);
+                ++anchor_pulls;
+                break;
+            case 'm':
+                err = hound_next(member_ctx, 1);
+                XASSERT_OK(err);
+                ++member_pulls;
+                break;
+            case '-':
+                wait.tv_nsec = NSEC_PER_MSEC/2;
+                break;
+            case '=':
+                wait.tv_nsec = 2*join_rq->tolerance_ns;
+                break;
+            default:
+                XASSERT_ERROR;
+        }
+        if (wait.tv_nsec != 0) {
+            nanosleep(&wait, NULL);
+        }
+    }
+
+    /*
+     * All of our pulls go through the same driver, and the I/O core hands each
+     * record to every queue before moving on to the next one. So once the
+     * last sample reaches its own context, every earlier sample has been
+     * through the join stage.
+     */
+    err = hound_read(anchor_ctx, anchor_pulls * s_pull_specs[0].burst, NULL);
+    XASSERT_OK(err);
+    err = hound_read(member_ctx, member_pulls * s_pull_specs[1].burst, NULL);
+    XASSERT_OK(err);
+    if (min_emitted > 0) {
+        err = hound_read(join_ctx, min_emitted, NULL);
+        XASSERT_OK(err);
+    }
+
+    /* Anything the stats count as emitted is already queued. */
+    err = hound_get_join_stats(join_ctx, stats);
+    XASSERT_OK(err);
+    err = hound_read_nowait(join_ctx, stats->emitted - joined->len, &read);
+    XASSERT_OK(err);
+    XASSERT_EQ(joined->len, stats->emitted);
+
+    err = hound_stop(member_ctx);
+    XASSERT_OK(err);
+    err = hound_stop(anchor_ctx);
+    XASSERT_OK(err);
+    err = hound_stop(join_ctx);
+    XASSERT_OK(err);
+    err = hound_free_ctx(member_ctx);
+    XASSERT_OK(err);
+    err = hound_free_ctx(anchor_ctx);
+    XASSERT_OK(err);
+    err = hound_free_ctx(join_ctx);
+    XASSERT_OK(err);
+}
+
+/* Checks the combined records and stats against what we worked out. */
+static
+void check_join(
+    const struct hound_join_rq *rq,
+    const struct sample_log *anchors,
+    const struct sample_log *members,
+    const struct joined_log *joined,
+    const struct hound_join_stats *stats)
+{
+    size_t i;
+    size_t matched;
+    hound_data_period member_ts;
+    size_t unmatched;
+
+    matched = 0;
+    unmatched = 0;
+    for (i = 0; i < anchors->len; ++i) {
+        if (!find_expected_match(members, anchors->ts[i], rq, &member_ts)) {
+            ++unmatched;
+            continue;
+        }
+        XASSERT_LT(matched, joined->len);
+        XASSERT_EQ(joined->anchor_ts[matched], anchors->ts[i]);
+        XASSERT_EQ(joined->member_ts[matched], member_ts);
+        ++matched;
+    }
+
+    XASSERT_EQ(joined->len, matched);
+    XASSERT_EQ(stats->emitted, matched);
+    XASSERT_EQ(stats->unmatched_ticks, unmatched);
+}
+
+static
+void test_join(void)
+{
+    struct sample_log anchors;
+    struct hound_ctx *ctx;
+    hound_err err;
+    hound_data_id ids[ARRAYLEN(s_pull_specs)];
+    size_t i;
+    struct joined_log joined;
+    struct sample_log members;
+    struct hound_data_rq data_rq = {
+        .id = HOUND_DATA_LOADGEN0,
+        .period_ns = NSEC_PER_MSEC
+    };
+    struct hound_rq rq = {
+        .queue_len = 1,
+        .queue_bytes = 0,
+        .cb = sample_cb,
+        .cb_ctx = &anchors,
+        .rq_list.len = 1,
+        .rq_list.data = &data_rq
+    };
+    struct hound_join_rq join_rq = {
+        .out_id = HOUND_DATA_LOADGEN0,
+        .policy = HOUND_JOIN_NEAREST,
+        .tolerance_ns = 2*NSEC_PER_MSEC,
+        .buffer_len = 64,
+        .len = ARRAYLEN(ids),
+        .ids = ids
+    };
+    const hound_join_policy policies[] = {
+        HOUND_JOIN_NEAREST,
+        HOUND_JOIN_LAST_VALUE
+    };
+    struct hound_join_stats stats;
+
+    for (i = 0; i < ARRAYLEN(ids); ++i) {
+        ids[i] = s_pull_specs[i].id;
+    }
+
+    /* Combined records can't take the ID of data a driver provides. */
+    err = hound_alloc_ctx(&rq, &ctx);
+    XASSERT_OK(err);
+    err = hound_set_join(ctx, &join_rq);
+    XASSERT_ERRCODE(err, HOUND_INVALID_VAL);
+    err = hound_free_ctx(ctx);
+    XASSERT_OK(err);
+    join_rq.out_id = HOUND_DATA_JOINED;
+
+    /*
+     * Mix matches on either side, anchors too far from any member, and member
+     * bursts that never get used. The last member pull settles every anchor,
+     * and the one before it is what settles them for NEAREST.
+     */
+    for (i = 0; i < ARRAYLEN(policies); ++i) {
+        join_rq.policy = policies[i];
+        run_join(
+            &join_rq,
+            "m-a--m-a=m=a=m-a-a-m-m-a--a=a-m-a-mm",
+            0,
+            &anchors,
+            &members,
+            &joined,
+            &stats);
+        check_join(&join_rq, &anchors, &members, &joined, &stats);
+
+        /* The anchor between two long waits can't have matched. */
+        XASSERT_GT(stats.unmatched_ticks, 0);
+
+        /* Only one sample of each member burst is ever the closest. */
+        XASSERT_GT(stats.unmatched_samples, 0);
+    }
+
+    /*
+     * With NEAREST, an anchor waits for a later member sample. When too many
+     * anchors are waiting, the oldest gets decided with what we have.
+     */
+    join_rq.policy = HOUND_JOIN_NEAREST;
+    join_rq.tolerance_ns = NSEC_PER_SEC;
+    join_rq.buffer_len = 2;
+    run_join(&join_rq, "m-a-a-a-a", 2, &anchors, &members, &joined, &stats);
+    XASSERT_EQ(stats.emitted, 2);
+    XASSERT_EQ(stats.unmatched_ticks, 0);
+    for (i = 0; i < joined.len; ++i) {
+        XASSERT_EQ(joined.anchor_ts[i], anchors.ts[i]);
+        XASSERT_EQ(joined.member_ts[i], members.ts[members.len-1]);
+    }
+
+    /*
+     * Member samples beyond the buffer length get dropped. Without anchors,
+     * nothing else drops them, so all but the last two of the first two bursts
+     * must be gone by now.
+     */
+    run_join(&join_rq, "m-m-m", 0, &anchors, &members, &joined, &stats);
+    XASSERT_EQ(stats.emitted, 0);
+    XASSERT_GTE(stats.unmatched_samples, 2*s_pull_specs[1].burst - 2);
+    XASSERT_LTE(stats.unmatched_samples, members.len - 2);
+}
+
+int main(int argc, const char **argv)
+{
+    uint64_t duration_ms;
+    hound_err err;
+    const char *config_path;
+    const char *schema_base;
+
+    if (argc != 3 && argc != 4) {
+        fprintf(
+            stderr,
+            "Usage: loadgen SCHEMA-BASE-PATH CONFIG-PATH [DURATION-MS]\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (strnlen(argv[1], PATH_MAX) == PATH_MAX) {
+        fprintf(stderr, "Schema base path is longer than PATH_MAX\n");
+        exit(EXIT_FAILURE);
+    }
+    schema_base = argv[1];
+
+    if (strnlen(argv[2], PATH_MAX) == PATH_MAX) {
+        fprintf(stderr, "Config path is longer than PATH_MAX\n");
+        exit(EXIT_FAILURE);
+    }
+    config_path = argv[2];
+
+    duration_ms = DEFAULT_DURATION_MS;
+    if (argc == 4) {
+        duration_ms = strtoull(argv[3], NULL, 10);
+        if (duration_ms == 0) {
+            fprintf(stderr, "Duration must be a positive integer\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    test_bad_args(schema_base);
+
+    /* The push driver is configured via YAML, and the pull driver directly. */
+    err = hound_init_config(config_path, schema_base);
+    XASSERT_OK(err);
+    init_driver(
+        "loadgen-pull",
+        PULL_PATH,
+        schema_base,
+        s_pull_specs,
+        ARRAYLEN(s_pull_specs));
+
+    test_push(duration_ms);
+    test_pull();
+
+    /* Start over, so the sequence numbers start from 0 again. */
+    err = hound_destroy_driver(PULL_PATH);
+    XASSERT_OK(err);
+    init_driver(
+        "loadgen-pull",
+        PULL_PATH,
+        schema_base,
+        s_pull_specs,
+        ARRAYLEN(s_pull_specs));
+    test_modify();
+    test_join();
+
+    err = hound_destroy_driver(PUSH_PATH);
+    XASSERT_OK(err);
+    err = hound_destroy_driver(PULL_PATH);
+    XASSERT_OK(err);
+
+    return 0;
+}
@@ -0,0 +1,199 @@
+/**
+ * @file      log.c
+ * @brief     Unit test for the rate-limited, asynchronous log path.
+ * @author    Martin Kelly <mkelly@xevo.com>
+ * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <hound/hound.h>
+#include <hound-private/log.h>
+#include <hound-private/util.h>
+#include <hound-test/assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Matches the log ring size and per-site burst in src/core/log.c. */
+#define RING_SIZE 256
+#define BURST 10
+
+#define MAX_MSGS 512
+#define MSG_LEN 128
+
+struct sink_state {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    size_t count;
+    char msgs[MAX_MSGS][MSG_LEN];
+
+    /* While closed, the sink holds up the drain thread. */
+    bool gate_open;
+    bool entered;
+};
+
+static struct sink_state s_sink = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+    .gate_open = true
+};
+
+static
+void sink(UNUSED int pri, const char *msg)
+{
+    pthread_mutex_lock(&s_sink.lock);
+    s_sink.entered = true;
+    pthread_cond_broadcast(&s_sink.cond);
+    while (!s_sink.gate_open) {
+        pthread_cond_wait(&s_sink.cond, &s_sink.lock);
+    }
+
+    XASSERT_LT(s_sink.count, MAX_MSGS);
+    snprintf(s_sink.msgs[s_sink.count], MSG_LEN, "%s", msg);
+    ++s_sink.count;
+    pthread_cond_broadcast(&s_sink.cond);
+    pthread_mutex_unlock(&s_sink.lock);
+}
+
+static
+void reset_sink(void)
+{
+    pthread_mutex_lock(&s_sink.lock);
+    s_sink.count = 0;
+    s_sink.entered = false;
+    pthread_mutex_unlock(&s_sink.lock);
+}
+
+static
+void wait_for_msgs(size_t count)
+{
+    pthread_mutex_lock(&s_sink.lock);
+    while (s_sink.count < count) {
+        pthread_cond_wait(&s_sink.cond, &s_sink.lock);
+    }
+    pthread_mutex_unlock(&s_sink.lock);
+}
+
+/*
+ * Gives the drain thread a chance to deliver anything it shouldn't, then
+ * returns how many messages it delivered.
+ */
+static
+size_t settle(void)
+{
+    size_t count;
+    const struct timespec delay = { .tv_sec = 0, .tv_nsec = 50*NSEC_PER_MSEC };
+
+    nanosleep(&delay, NULL);
+
+    pthread_mutex_lock(&s_sink.lock);
+    count = s_sink.count;
+    pthread_mutex_unlock(&s_sink.lock);
+
+    return count;
+}
+
+static
+void test_burst(void)
+{
+    char expected[MSG_LEN];
+    size_t i;
+    static struct log_site site;
+    const struct timespec interval = {
+        .tv_sec = 1,
+        .tv_nsec = 100*NSEC_PER_MSEC
+    };
+
+    /* Only the first few messages in an interval get through, in order. */
+    reset_sink();
+    for (i = 0; i < BURST + 15; ++i) {
+        log_ratelimited(&site, XLOG_INFO, "burst %zu", i);
+    }
+    wait_for_msgs(BURST);
+    XASSERT_EQ(settle(), BURST);
+    for (i = 0; i < BURST; ++i) {
+        snprintf(expected, sizeof(expected), "burst %zu", i);
+        XASSERT_EQ(strcmp(s_sink.msgs[i], expected), 0);
+    }
+
+    /* The first message of the next interval reports what was suppressed. */
+    nanosleep(&interval, NULL);
+    reset_sink();
+    log_ratelimited(&site, XLOG_INFO, "burst %d", 42);
+    wait_for_msgs(1);
+    XASSERT_EQ(
+        strcmp(s_sink.msgs[0], "burst 42 (suppressed 15 similar messages)"),
+        0);
+
+    /* Nothing was suppressed since, so the next message is plain. */
+    reset_sink();
+    log_ratelimited(&site, XLOG_INFO, "burst %d", 43);
+    wait_for_msgs(1);
+    XASSERT_EQ(strcmp(s_sink.msgs[0], "burst 43"), 0);
+}
+
+static
+void test_ring_full(void)
+{
+    char expected[MSG_LEN];
+    static struct log_site first_site;
+    size_t i;
+    static struct log_site sites[(2*RING_SIZE) / BURST];
+    size_t total;
+
+    /* Hold up the drain thread in the sink. */
+    reset_sink();
+    pthread_mutex_lock(&s_sink.lock);
+    s_sink.gate_open = false;
+    pthread_mutex_unlock(&s_sink.lock);
+    log_ratelimited(&first_site, XLOG_INFO, "%s", "first");
+    pthread_mutex_lock(&s_sink.lock);
+    while (!s_sink.entered) {
+        pthread_cond_wait(&s_sink.cond, &s_sink.lock);
+    }
+    pthread_mutex_unlock(&s_sink.lock);
+
+    /*
+     * The message being delivered still holds its slot, so only RING_SIZE - 1
+     * more fit. The rest are dropped rather than waiting.
+     */
+    total = ARRAYLEN(sites) * BURST;
+    for (i = 0; i < total; ++i) {
+        log_ratelimited(&sites[i / BURST], XLOG_INFO, "ring %zu", i);
+    }
+
+    pthread_mutex_lock(&s_sink.lock);
+    s_sink.gate_open = true;
+    pthread_cond_broadcast(&s_sink.cond);
+    pthread_mutex_unlock(&s_sink.lock);
+
+    /* Everything that fit arrives in order, followed by the drop count. */
+    wait_for_msgs(RING_SIZE + 1);
+    XASSERT_EQ(settle(), RING_SIZE + 1);
+    XASSERT_EQ(strcmp(s_sink.msgs[0], "first"), 0);
+    for (i = 0; i < RING_SIZE - 1; ++i) {
+        snprintf(expected, sizeof(expected), "ring %zu", i);
+        XASSERT_EQ(strcmp(s_sink.msgs[i + 1], expected), 0);
+    }
+    snprintf(
+        expected,
+        sizeof(expected),
+        "log ring full; dropped %zu messages",
+        total - (RING_SIZE - 1));
+    XASSERT_EQ(strcmp(s_sink.msgs[RING_SIZE], expected), 0);
+}
+
+int main(void)
+{
+    log_set_sink(sink);
+
+    test_burst();
+    test_ring_full();
+
+    log_set_sink(NULL);
+
+    return EXIT_SUCCESS;
+}
@@ -451,6 +451,7 @@ int main(int argc, const char **argv)
     }
     mosq_conf = argv[3];
 
+    memset(data_rqs, 0, sizeof(data_rqs));
     for (i = 0; i < test_ctx.count; ++i) {
         data_rq = &data_rqs[i];
         data_rq->id = test_ctx.info[i].data_id;
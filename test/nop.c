@@ -13,8 +13,11 @@
 #include <hound-test/id.h>
 #include <limits.h>
 #include <linux/limits.h>
+#include <pthread.h>
 #include <string.h>
 
+#define INIT_THREADS 8
+
 void data_cb(
     const struct hound_record *rec,
     UNUSED hound_seqno seqno,
@@ -33,11 +36,67 @@ void test_strerror(void)
     XASSERT_NULL(hound_strerror(INT_MIN));
 }
 
+static
+void *init_nop(void *data)
+{
+    const char *schema_base;
+    hound_err *err;
+
+    schema_base = *((const char **) data);
+    err = malloc(sizeof(*err));
+    XASSERT_NOT_NULL(err);
+    *err = hound_init_driver(
+        "nop",
+        "/dev/nop",
+        schema_base,
+        "nop.yaml",
+        0,
+        NULL);
+
+    return err;
+}
+
+static
+void test_parallel_driver_init(const char *schema_base)
+{
+    hound_err err;
+    hound_err *errp;
+    size_t i;
+    size_t ok_count;
+    int ret;
+    pthread_t threads[INIT_THREADS];
+
+    /* Racing to init the same device should let exactly one driver win. */
+    for (i = 0; i < ARRAYLEN(threads); ++i) {
+        ret = pthread_create(&threads[i], NULL, init_nop, &schema_base);
+        XASSERT_EQ(ret, 0);
+    }
+
+    ok_count = 0;
+    for (i = 0; i < ARRAYLEN(threads); ++i) {
+        ret = pthread_join(threads[i], (void **) &errp);
+        XASSERT_EQ(ret, 0);
+        if (*errp == HOUND_OK) {
+            ++ok_count;
+        }
+        else {
+            XASSERT_EQ(*errp, HOUND_DRIVER_ALREADY_PRESENT);
+        }
+        free(errp);
+    }
+    XASSERT_EQ(ok_count, 1);
+
+    err = hound_destroy_driver("/dev/nop");
+    XASSERT_OK(err);
+}
+
 static
 void test_driver_init(const char *config_path, const char *schema_base)
 {
     hound_err err;
 
+    test_parallel_driver_init(schema_base);
+
     err = hound_init_driver(
         "nop",
         "/dev/nop",
@@ -111,6 +170,7 @@ void ctx_test(
     struct hound_rq rq;
 
     rq.queue_len = queue_len;
+    rq.queue_bytes = 0;
     rq.cb = cb;
     rq.cb_ctx = NULL;
     rq.rq_list.len = rq_len;
@@ -161,6 +221,132 @@ void test_alloc_ctx(struct hound_ctx **ctx)
     ctx_test(ctx, 5, data_cb, ARRAYLEN(data_rq), data_rq, HOUND_OK);
 }
 
+static
+void test_join(struct hound_ctx *ctx)
+{
+    hound_err err;
+    hound_data_id ids[] = { HOUND_DATA_NOP1, HOUND_DATA_NOP2 };
+    struct hound_join_rq rq = {
+        .out_id = HOUND_DATA_JOINED,
+        .policy = HOUND_JOIN_NEAREST,
+        .tolerance_ns = NSEC_PER_SEC/100,
+        .buffer_len = 10,
+        .len = ARRAYLEN(ids),
+        .ids = ids
+    };
+    struct hound_join_stats stats;
+
+    err = hound_set_join(NULL, &rq);
+    XASSERT_ERRCODE(err, HOUND_NULL_VAL);
+
+    rq.len = 1;
+    err = hound_set_join(ctx, &rq);
+    XASSERT_ERRCODE(err, HOUND_INVALID_VAL);
+    rq.len = ARRAYLEN(ids);
+
+    rq.buffer_len = 0;
+    err = hound_set_join(ctx, &rq);
+    XASSERT_ERRCODE(err, HOUND_INVALID_VAL);
+    rq.buffer_len = 10;
+
+    /* Combined records can't take the ID of real data, such as a member's. */
+    rq.out_id = HOUND_DATA_NOP1;
+    err = hound_set_join(ctx, &rq);
+    XASSERT_ERRCODE(err, HOUND_INVALID_VAL);
+    rq.out_id = HOUND_DATA_JOINED;
+
+    ids[1] = HOUND_DATA_GPS;
+    err = hound_set_join(ctx, &rq);
+    XASSERT_ERRCODE(err, HOUND_DATA_ID_DOES_NOT_EXIST);
+
+    ids[1] = HOUND_DATA_NOP1;
+    err = hound_set_join(ctx, &rq);
+    XASSERT_ERRCODE(err, HOUND_DUPLICATE_DATA_REQUESTED);
+    ids[1] = HOUND_DATA_NOP2;
+
+    err = hound_set_join(ctx, &rq);
+    XASSERT_OK(err);
+
+    err = hound_get_join_stats(ctx, NULL);
+    XASSERT_ERRCODE(err, HOUND_NULL_VAL);
+
+    err = hound_get_join_stats(ctx, &stats);
+    XASSERT_OK(err);
+    XASSERT_EQ(stats.emitted, 0);
+    XASSERT_EQ(stats.unmatched_ticks, 0);
+    XASSERT_EQ(stats.unmatched_samples, 0);
+
+    /* Replacing and removing the join stage should both work. */
+    rq.policy = HOUND_JOIN_LAST_VALUE;
+    err = hound_set_join(ctx, &rq);
+    XASSERT_OK(err);
+
+    err = hound_set_join(ctx, NULL);
+    XASSERT_OK(err);
+}
+
+static
+void test_resample(struct hound_ctx *ctx)
+{
+    hound_err err;
+    hound_data_id ids[] = { HOUND_DATA_NOP1, HOUND_DATA_NOP2 };
+    struct hound_resample_rq rq = {
+        .period_ns = NSEC_PER_SEC/100,
+        .policy = HOUND_RESAMPLE_LINEAR,
+        .max_gap_ns = NSEC_PER_SEC/10,
+        .len = ARRAYLEN(ids),
+        .ids = ids
+    };
+    struct hound_resample_stats stats;
+
+    err = hound_set_resample(NULL, &rq);
+    XASSERT_ERRCODE(err, HOUND_NULL_VAL);
+
+    rq.len = 0;
+    err = hound_set_resample(ctx, &rq);
+    XASSERT_ERRCODE(err, HOUND_INVALID_VAL);
+    rq.len = ARRAYLEN(ids);
+
+    rq.period_ns = 0;
+    err = hound_set_resample(ctx, &rq);
+    XASSERT_ERRCODE(err, HOUND_INVALID_VAL);
+    rq.period_ns = NSEC_PER_SEC/100;
+
+    rq.max_gap_ns = rq.period_ns - 1;
+    err = hound_set_resample(ctx, &rq);
+    XASSERT_ERRCODE(err, HOUND_INVALID_VAL);
+    rq.max_gap_ns = NSEC_PER_SEC/10;
+
+    ids[1] = HOUND_DATA_GPS;
+    err = hound_set_resample(ctx, &rq);
+    XASSERT_ERRCODE(err, HOUND_DATA_ID_DOES_NOT_EXIST);
+
+    ids[1] = HOUND_DATA_NOP1;
+    err = hound_set_resample(ctx, &rq);
+    XASSERT_ERRCODE(err, HOUND_DUPLICATE_DATA_REQUESTED);
+    ids[1] = HOUND_DATA_NOP2;
+
+    err = hound_set_resample(ctx, &rq);
+    XASSERT_OK(err);
+
+    err = hound_get_resample_stats(ctx, NULL);
+    XASSERT_ERRCODE(err, HOUND_NULL_VAL);
+
+    err = hound_get_resample_stats(ctx, &stats);
+    XASSERT_OK(err);
+    XASSERT_EQ(stats.emitted, 0);
+    XASSERT_EQ(stats.skipped_ticks, 0);
+    XASSERT_EQ(stats.late_samples, 0);
+
+    /* Replacing and removing the resampling stage should both work. */
+    rq.policy = HOUND_RESAMPLE_HOLD;
+    err = hound_set_resample(ctx, &rq);
+    XASSERT_OK(err);
+
+    err = hound_set_resample(ctx, NULL);
+    XASSERT_OK(err);
+}
+
 static
 void test_start_ctx(struct hound_ctx *ctx)
 {
@@ -228,6 +414,8 @@ int main(int argc, const char **argv)
     test_driver_init(config_path, schema_base);
     test_datadescs();
     test_alloc_ctx(&ctx);
+    test_join(ctx);
+    test_resample(ctx);
     test_start_ctx(ctx);
     test_stop_ctx(ctx);
     test_free_ctx(ctx);
@@ -0,0 +1,119 @@
+/**
+ * @file      schema-header.c
+ * @brief     Unit test for the headers generated from driver schemas, checking
+ *            that they agree with the layout the driver core computes.
+ * @author    Martin Kelly <mkelly@xevo.com>
+ * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <hound/hound.h>
+#include <hound-private/util.h>
+#include <hound-test/assert.h>
+#include <hound-test/id.h>
+#include <linux/limits.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "counter-schema.h"
+#include "loadgen-schema.h"
+#include "nop-schema.h"
+
+static
+void test_layout(void)
+{
+    struct hound_datadesc *desc;
+    hound_err err;
+    size_t size;
+
+    err = hound_get_datadescs(&desc, &size);
+    XASSERT_OK(err);
+    XASSERT_EQ(size, 1);
+
+    XASSERT_EQ(desc->data_id, HOUND_SCHEMA_COUNTER_ID);
+    XASSERT_EQ(desc->fmt_count, 1);
+    XASSERT_EQ(
+        desc->fmts[0].offset,
+        offsetof(struct hound_schema_counter, counter));
+    XASSERT_EQ(desc->fmts[0].size, sizeof(struct hound_schema_counter));
+
+    hound_free_datadescs(desc);
+}
+
+static
+void test_accessors(void)
+{
+    unsigned char data[1 + sizeof(uint64_t)];
+    struct hound_schema_counter decoded;
+    size_t len;
+    bool ok;
+    struct hound_record rec;
+    uint64_t val;
+
+    /* Record data need not be aligned. */
+    val = 12345;
+    memcpy(data + 1, &val, sizeof(val));
+    rec.data_id = HOUND_SCHEMA_COUNTER_ID;
+    rec.size = sizeof(val);
+    rec.data = data + 1;
+
+    XASSERT_EQ(hound_schema_counter_counter(&rec), val);
+
+    ok = hound_schema_counter_decode(&rec, &decoded);
+    XASSERT(ok);
+    XASSERT_EQ(decoded.counter, val);
+
+    /* Decoding checks the data ID and size. */
+    rec.data_id = HOUND_SCHEMA_LOADGEN0_ID;
+    ok = hound_schema_counter_decode(&rec, &decoded);
+    XASSERT(!ok);
+    rec.data_id = HOUND_SCHEMA_COUNTER_ID;
+    rec.size = sizeof(val) - 1;
+    ok = hound_schema_counter_decode(&rec, &decoded);
+    XASSERT(!ok);
+
+    /* Variable-length data has a pointer-and-length accessor. */
+    rec.data_id = HOUND_SCHEMA_LOADGEN0_ID;
+    rec.size = sizeof(data);
+    rec.data = data;
+    XASSERT_EQ(hound_schema_loadgen0_payload(&rec, &len), data);
+    XASSERT_EQ(len, sizeof(data));
+
+    /* A variable-length field after fixed ones may be empty or missing. */
+    rec.data_id = HOUND_SCHEMA_NOP_ID;
+    rec.size = 1;
+    XASSERT_EQ(hound_schema_nop_b(&rec, &len), data + 1);
+    XASSERT_EQ(len, 0);
+    rec.size = 0;
+    XASSERT_NULL(hound_schema_nop_b(&rec, &len));
+    XASSERT_EQ(len, 0);
+}
+
+int main(int argc, const char **argv)
+{
+    const char *config_path;
+    hound_err err;
+    const char *schema_base;
+
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s SCHEMA-BASE-PATH CONFIG-PATH\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (strnlen(argv[1], PATH_MAX) == PATH_MAX) {
+        fprintf(stderr, "Schema base path is longer than PATH_MAX\n");
+        exit(EXIT_FAILURE);
+    }
+    schema_base = argv[1];
+    config_path = argv[2];
+
+    err = hound_init_config(config_path, schema_base);
+    XASSERT_OK(err);
+
+    test_layout();
+    test_accessors();
+
+    err = hound_destroy_all_drivers();
+    XASSERT_OK(err);
+
+    return EXIT_SUCCESS;
+}